@@ -69,7 +69,8 @@ static struct etna_bo *lookup_bo(void *tbl, uint32_t handle)
 		bo = etna_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		if (!LIST_IS_EMPTY(&bo->list))
+			etna_bo_cache_remove(&bo->dev->bo_cache, bo);
 	}
 
 	return bo;
@@ -30,13 +30,20 @@
 drm_private void bo_del(struct etna_bo *bo);
 drm_private extern pthread_mutex_t table_lock;
 
+/* max # of bo's to check for being idle before giving up: */
+#define ETNA_BO_CACHE_SCAN 8
+
+/* default for etna_bo_cache::max_size: */
+#define ETNA_BO_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
 static void add_bucket(struct etna_bo_cache *cache, int size)
 {
-	unsigned i = cache->num_buckets;
+	unsigned i = cache->num_buckets, j;
 
 	assert(i < ARRAY_SIZE(cache->cache_bucket));
 
-	list_inithead(&cache->cache_bucket[i].list);
+	for (j = 0; j < ETNA_BO_CACHE_LISTS; j++)
+		list_inithead(&cache->cache_bucket[i].list[j]);
 	cache->cache_bucket[i].size = size;
 	cache->num_buckets++;
 }
@@ -45,6 +52,9 @@ drm_private void etna_bo_cache_init(struct etna_bo_cache *cache)
 {
 	unsigned long size, cache_max_size = 64 * 1024 * 1024;
 
+	list_inithead(&cache->lru);
+	cache->max_size = ETNA_BO_CACHE_MAX_SIZE;
+
 	/* OK, so power of two buckets was too wasteful of memory.
 	 * Give 3 other sizes between each power of two, to hopefully
 	 * cover things accurately enough.  (The alternative is
@@ -66,28 +76,43 @@ drm_private void etna_bo_cache_init(struct etna_bo_cache *cache)
 	}
 }
 
+/* unlink a bo from its bucket and the lru, call w/ table_lock held: */
+static void cache_unlink(struct etna_bo_cache *cache, struct etna_bo *bo)
+{
+	list_delinit(&bo->list);
+	list_del(&bo->lru);
+	cache->size -= bo->size;
+}
+
+/* Frees the least recently freed bo's until under the size limit.
+ * Called under table_lock
+ */
+static void cache_evict(struct etna_bo_cache *cache)
+{
+	while (cache->size > cache->max_size) {
+		struct etna_bo *bo = LIST_FIRST_ENTRY(&cache->lru, struct etna_bo, lru);
+
+		cache_unlink(cache, bo);
+		bo_del(bo);
+	}
+}
+
 /* Frees older cached buffers.  Called under table_lock */
 drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time)
 {
-	unsigned i;
-
 	if (cache->time == time)
 		return;
 
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct etna_bo_bucket *bucket = &cache->cache_bucket[i];
-		struct etna_bo *bo;
+	/* the lru is in free_time order, so stop at the first one to keep: */
+	while (!LIST_IS_EMPTY(&cache->lru)) {
+		struct etna_bo *bo = LIST_FIRST_ENTRY(&cache->lru, struct etna_bo, lru);
 
-		while (!LIST_IS_EMPTY(&bucket->list)) {
-			bo = LIST_ENTRY(struct etna_bo, bucket->list.next, list);
+		/* keep things in cache for at least 1 second: */
+		if (time && ((time - bo->free_time) <= 1))
+			break;
 
-			/* keep things in cache for at least 1 second: */
-			if (time && ((time - bo->free_time) <= 1))
-				break;
-
-			list_del(&bo->list);
-			bo_del(bo);
-		}
+		cache_unlink(cache, bo);
+		bo_del(bo);
 	}
 
 	cache->time = time;
@@ -95,19 +120,71 @@ drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time)
 
 static struct etna_bo_bucket *get_bucket(struct etna_bo_cache *cache, uint32_t size)
 {
-	unsigned i;
+	struct etna_bo_bucket *bucket;
+	unsigned idx;
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
+	/* The buckets set up by etna_bo_cache_init() are 4k, 8k, 12k, and
+	 * then every power of two from 16k, each followed by three steps of
+	 * a quarter towards the next power of two.  So the smallest bucket
+	 * that fits can be calculated directly:
 	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct etna_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
+	if (size <= 4096) {
+		idx = 0;
+	} else if (size <= 8192) {
+		idx = 1;
+	} else if (size <= 3 * 4096) {
+		idx = 2;
+	} else {
+		/* 2^e < size <= 2^(e+1), with e >= 13: */
+		unsigned e = 31 - __builtin_clz(size - 1);
+
+		if (e == 13) {
+			idx = 3;
+		} else {
+			/* which quarter step of 2^e it falls in, 1..4: */
+			unsigned q = (size - (1u << e) + (1u << (e - 2)) - 1) >> (e - 2);
+			idx = (e - 13) * 4 + q - 1;
 		}
 	}
 
-	return NULL;
+	if (idx >= cache->num_buckets)
+		return NULL;
+
+	bucket = &cache->cache_bucket[idx];
+	assert(bucket->size >= size);
+
+	return bucket;
+}
+
+/* Which of a bucket's lists holds bo's with @flags, or -1 for flags we
+ * don't cache.  Bo's only get reused with identical flags, so keeping
+ * them apart means a search never has to step over incompatible ones:
+ */
+static int bucket_list(uint32_t flags)
+{
+	int idx;
+
+	if (flags & ~(DRM_ETNA_GEM_CACHE_MASK | DRM_ETNA_GEM_FORCE_MMU))
+		return -1;
+
+	switch (flags & DRM_ETNA_GEM_CACHE_MASK) {
+	case DRM_ETNA_GEM_CACHE_CACHED:
+		idx = 0;
+		break;
+	case DRM_ETNA_GEM_CACHE_WC:
+		idx = 1;
+		break;
+	case DRM_ETNA_GEM_CACHE_UNCACHED:
+		idx = 2;
+		break;
+	default:
+		return -1;
+	}
+
+	if (flags & DRM_ETNA_GEM_FORCE_MMU)
+		idx += 3;
+
+	return idx;
 }
 
 static int is_idle(struct etna_bo *bo)
@@ -118,37 +195,31 @@ static int is_idle(struct etna_bo *bo)
 			DRM_ETNA_PREP_NOSYNC) == 0;
 }
 
-static struct etna_bo *find_in_bucket(struct etna_bo_bucket *bucket, uint32_t flags)
+static struct etna_bo *find_in_bucket(struct etna_bo_cache *cache,
+		struct list_head *list)
 {
-	struct etna_bo *bo = NULL, *tmp;
+	struct etna_bo *bo;
+	unsigned n = 0;
 
 	pthread_mutex_lock(&table_lock);
 
-	if (LIST_IS_EMPTY(&bucket->list))
-		goto out_unlock;
-
-	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &bucket->list, list) {
-		/* skip BOs with different flags */
-		if (bo->flags != flags)
-			continue;
+	/* The oldest bo's are the most likely to be idle, but one still
+	 * busy doesn't mean they all are, so look at a few:
+	 */
+	LIST_FOR_EACH_ENTRY(bo, list, list) {
+		if (n++ == ETNA_BO_CACHE_SCAN)
+			break;
 
-		/* check if the first BO with matching flags is idle */
 		if (is_idle(bo)) {
-			list_delinit(&bo->list);
-			goto out_unlock;
+			cache_unlink(cache, bo);
+			pthread_mutex_unlock(&table_lock);
+			return bo;
 		}
-
-		/* If the oldest BO is still busy, don't try younger ones */
-		break;
 	}
 
-	/* There was no matching buffer found */
-	bo = NULL;
-
-out_unlock:
 	pthread_mutex_unlock(&table_lock);
 
-	return bo;
+	return NULL;
 }
 
 /* allocate a new (un-tiled) buffer object
@@ -160,6 +231,7 @@ drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache, uin
 {
 	struct etna_bo *bo;
 	struct etna_bo_bucket *bucket;
+	int idx = bucket_list(flags);
 
 	*size = ALIGN(*size, 4096);
 	bucket = get_bucket(cache, *size);
@@ -167,7 +239,10 @@ drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache, uin
 	/* see if we can be green and recycle: */
 	if (bucket) {
 		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
+		if (idx < 0)
+			return NULL;
+
+		bo = find_in_bucket(cache, &bucket->list[idx]);
 		if (bo) {
 			atomic_set(&bo->refcnt, 1);
 			etna_device_ref(bo->dev);
@@ -181,16 +256,20 @@ drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache, uin
 drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *bo)
 {
 	struct etna_bo_bucket *bucket = get_bucket(cache, bo->size);
+	int idx = bucket_list(bo->flags);
 
 	/* see if we can be green and recycle: */
-	if (bucket) {
+	if (bucket && (idx >= 0) && (bo->size <= cache->max_size)) {
 		struct timespec time;
 
 		clock_gettime(CLOCK_MONOTONIC, &time);
 
 		bo->free_time = time.tv_sec;
-		list_addtail(&bo->list, &bucket->list);
+		list_addtail(&bo->list, &bucket->list[idx]);
+		list_addtail(&bo->lru, &cache->lru);
+		cache->size += bo->size;
 		etna_bo_cache_cleanup(cache, time.tv_sec);
+		cache_evict(cache);
 
 		/* bo's in the bucket cache don't have a ref and
 		 * don't hold a ref to the dev:
@@ -202,3 +281,20 @@ drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *
 
 	return -1;
 }
+
+/* take a bo back out of the cache, for when lookup_bo() finds a cached
+ * one.  Call w/ table_lock held:
+ */
+drm_private void etna_bo_cache_remove(struct etna_bo_cache *cache, struct etna_bo *bo)
+{
+	cache_unlink(cache, bo);
+}
+
+drm_private void etna_bo_cache_set_max_size(struct etna_bo_cache *cache,
+		uint64_t max_size)
+{
+	pthread_mutex_lock(&table_lock);
+	cache->max_size = max_size;
+	cache_evict(cache);
+	pthread_mutex_unlock(&table_lock);
+}
@@ -29,8 +29,6 @@
 #include "etnaviv_drmif.h"
 #include "etnaviv_priv.h"
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
-
 static void *grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
 {
 	if ((nr + 1) > *max) {
@@ -55,6 +53,8 @@ etna_cmd_stream_priv(struct etna_cmd_stream *stream)
     return (struct etna_cmd_stream_priv *)stream;
 }
 
+static void drain(struct etna_cmd_stream_priv *priv);
+
 drm_public struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe,
         uint32_t size,
 		void (*reset_notify)(struct etna_cmd_stream *stream, void *priv),
@@ -84,6 +84,7 @@ drm_public struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe,
 
 	stream->base.size = size;
 	stream->pipe = pipe;
+	stream->seqno = atomic_inc_return(&pipe->gpu->dev->stream_cnt);
 	stream->reset_notify = reset_notify;
 	stream->reset_notify_priv = priv;
 
@@ -96,13 +97,118 @@ fail:
 	return NULL;
 }
 
+static void *submit_thread_main(void *arg);
+
+/* like etna_cmd_stream_new(), but flushes hand the recorded command buffer
+ * to a submit thread, and recording continues in the next of nr_buffers
+ * buffers without waiting for the kernel:
+ */
+drm_public struct etna_cmd_stream *
+etna_cmd_stream_new_async(struct etna_pipe *pipe, uint32_t size,
+		unsigned nr_buffers,
+		void (*reset_notify)(struct etna_cmd_stream *stream, void *priv),
+		void *priv)
+{
+	struct etna_cmd_stream *stream;
+	struct etna_cmd_stream_priv *stream_priv;
+	unsigned i;
+
+	stream = etna_cmd_stream_new(pipe, size, reset_notify, priv);
+	if (!stream || nr_buffers < 2)
+		return stream;
+
+	stream_priv = etna_cmd_stream_priv(stream);
+
+	/* the stream's own buffer is one of them: */
+	stream_priv->cmd_buffers = calloc(nr_buffers - 1,
+			sizeof(stream_priv->cmd_buffers[0]));
+	if (!stream_priv->cmd_buffers)
+		goto fail;
+
+	list_inithead(&stream_priv->free_list);
+	list_inithead(&stream_priv->submit_queue);
+	list_inithead(&stream_priv->done_list);
+
+	for (i = 0; i < nr_buffers - 1; i++) {
+		struct etna_cmd_buffer *cmdbuf = &stream_priv->cmd_buffers[i];
+
+		cmdbuf->buffer = malloc(stream->size * sizeof(uint32_t));
+		if (!cmdbuf->buffer)
+			goto fail;
+
+		list_addtail(&cmdbuf->node, &stream_priv->free_list);
+	}
+
+	pthread_mutex_init(&stream_priv->submit_lock, NULL);
+	pthread_cond_init(&stream_priv->submit_cond, NULL);
+
+	if (pthread_create(&stream_priv->submit_thread, NULL,
+			submit_thread_main, stream_priv)) {
+		pthread_mutex_destroy(&stream_priv->submit_lock);
+		pthread_cond_destroy(&stream_priv->submit_cond);
+		goto fail;
+	}
+
+	stream_priv->nr_cmd_buffers = nr_buffers - 1;
+
+	return stream;
+
+fail:
+	ERROR_MSG("allocation failed");
+	if (stream_priv->cmd_buffers) {
+		for (i = 0; i < nr_buffers - 1; i++)
+			free(stream_priv->cmd_buffers[i].buffer);
+		free(stream_priv->cmd_buffers);
+		stream_priv->cmd_buffers = NULL;
+	}
+	etna_cmd_stream_del(stream);
+
+	return NULL;
+}
+
 drm_public void etna_cmd_stream_del(struct etna_cmd_stream *stream)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
 
+	if (priv->nr_cmd_buffers) {
+		drain(priv);
+
+		/* nobody is going to ask for these anymore: */
+		for (uint32_t i = 0; i < priv->nr_fences; i++) {
+			if (priv->fences[i].fence_fd != -1)
+				close(priv->fences[i].fence_fd);
+		}
+		free(priv->fences);
+
+		pthread_mutex_lock(&priv->submit_lock);
+		priv->submit_thread_exit = 1;
+		pthread_cond_broadcast(&priv->submit_cond);
+		pthread_mutex_unlock(&priv->submit_lock);
+
+		pthread_join(priv->submit_thread, NULL);
+
+		pthread_mutex_destroy(&priv->submit_lock);
+		pthread_cond_destroy(&priv->submit_cond);
+
+		for (unsigned i = 0; i < priv->nr_cmd_buffers; i++) {
+			struct etna_cmd_buffer *cmdbuf = &priv->cmd_buffers[i];
+
+			free(cmdbuf->buffer);
+			free(cmdbuf->submit.bos);
+			free(cmdbuf->submit.relocs);
+			free(cmdbuf->submit.pmrs);
+			free(cmdbuf->bos);
+			util_bo_table_fini(&cmdbuf->bo_table);
+		}
+		free(priv->cmd_buffers);
+	}
+
 	free(stream->buffer);
+	free(priv->submit.bos);
 	free(priv->submit.relocs);
 	free(priv->submit.pmrs);
+	free(priv->bos);
+	util_bo_table_fini(&priv->bo_table);
 	free(priv);
 }
 
@@ -114,15 +220,27 @@ static void reset_buffer(struct etna_cmd_stream *stream)
 	priv->submit.nr_bos = 0;
 	priv->submit.nr_relocs = 0;
 	priv->submit.nr_pmrs = 0;
+	priv->submit.perf_session = NULL;
 	priv->nr_bos = 0;
 
+	/* no need to clear the bos' stream_hint, with nr_bos reset it
+	 * won't match anymore:
+	 */
+	util_bo_table_clear(&priv->bo_table);
+
 	if (priv->reset_notify)
 		priv->reset_notify(stream, priv->reset_notify_priv);
 }
 
 drm_public uint32_t etna_cmd_stream_timestamp(struct etna_cmd_stream *stream)
 {
-	return etna_cmd_stream_priv(stream)->last_timestamp;
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	/* the fences of async flushes are only known once they are in: */
+	if (priv->nr_cmd_buffers)
+		drain(priv);
+
+	return priv->last_timestamp;
 }
 
 static uint32_t append_bo(struct etna_cmd_stream *stream, struct etna_bo *bo)
@@ -141,30 +259,30 @@ static uint32_t append_bo(struct etna_cmd_stream *stream, struct etna_bo *bo)
 	return idx;
 }
 
+static uint32_t lookup_bo(struct etna_cmd_stream *stream, struct etna_bo *bo)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	uint32_t idx;
+
+	idx = util_bo_table_lookup(&priv->bo_table, priv->submit.bos,
+			priv->submit.nr_bos, bo->handle);
+	if (idx == priv->submit.nr_bos)
+		idx = append_bo(stream, bo);
+
+	return idx;
+}
+
 /* add (if needed) bo, return idx: */
 static uint32_t bo2idx(struct etna_cmd_stream *stream, struct etna_bo *bo,
 		uint32_t flags)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
-	uint32_t idx;
-
-	pthread_mutex_lock(&idx_lock);
+	uint32_t idx = util_bo_hint_get(&bo->stream_hint, priv->seqno);
 
-	if (bo->current_stream == stream) {
-		idx = bo->idx;
-	} else {
-		/* slow-path: */
-		for (idx = 0; idx < priv->nr_bos; idx++)
-			if (priv->bos[idx] == bo)
-				break;
-		if (idx == priv->nr_bos) {
-			/* not found */
-			idx = append_bo(stream, bo);
-		}
-		bo->current_stream = stream;
-		bo->idx = idx;
+	if (idx >= priv->nr_bos || priv->bos[idx] != bo) {
+		idx = lookup_bo(stream, bo);
+		util_bo_hint_set(&bo->stream_hint, priv->seqno, idx);
 	}
-	pthread_mutex_unlock(&idx_lock);
 
 	if (flags & ETNA_RELOC_READ)
 		priv->submit.bos[idx].flags |= ETNA_SUBMIT_BO_READ;
@@ -174,24 +292,24 @@ static uint32_t bo2idx(struct etna_cmd_stream *stream, struct etna_bo *bo,
 	return idx;
 }
 
-static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
-		  int *out_fence_fd)
+static int submit(struct etna_pipe *pipe, uint32_t *buffer, uint32_t offset,
+		struct etna_cmd_stream_submit *submit, int in_fence_fd,
+		int out_fence, uint32_t *fence, int *fence_fd)
 {
-	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
-	int ret, id = priv->pipe->id;
-	struct etna_gpu *gpu = priv->pipe->gpu;
+	struct etna_gpu *gpu = pipe->gpu;
+	int ret;
 
 	struct drm_etnaviv_gem_submit req = {
 		.pipe = gpu->core,
-		.exec_state = id,
-		.bos = VOID2U64(priv->submit.bos),
-		.nr_bos = priv->submit.nr_bos,
-		.relocs = VOID2U64(priv->submit.relocs),
-		.nr_relocs = priv->submit.nr_relocs,
-		.pmrs = VOID2U64(priv->submit.pmrs),
-		.nr_pmrs = priv->submit.nr_pmrs,
-		.stream = VOID2U64(stream->buffer),
-		.stream_size = stream->offset * 4, /* in bytes */
+		.exec_state = pipe->id,
+		.bos = VOID2U64(submit->bos),
+		.nr_bos = submit->nr_bos,
+		.relocs = VOID2U64(submit->relocs),
+		.nr_relocs = submit->nr_relocs,
+		.pmrs = VOID2U64(submit->pmrs),
+		.nr_pmrs = submit->nr_pmrs,
+		.stream = VOID2U64(buffer),
+		.stream_size = offset * 4, /* in bytes */
 	};
 
 	if (in_fence_fd != -1) {
@@ -199,39 +317,270 @@ static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
 		req.fence_fd = in_fence_fd;
 	}
 
-	if (out_fence_fd)
+	if (out_fence)
 		req.flags |= ETNA_SUBMIT_FENCE_FD_OUT;
 
 	ret = drmCommandWriteRead(gpu->dev->fd, DRM_ETNAVIV_GEM_SUBMIT,
 			&req, sizeof(req));
+	if (ret) {
+		/* the kernel never filled in the sample, don't count it: */
+		if (submit->perf_session)
+			etna_perfmon_session_fail(submit->perf_session,
+					submit->perf_seqno);
+		return ret;
+	}
+
+	*fence = req.fence;
+	*fence_fd = req.fence_fd;
+
+	return 0;
+}
+
+static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
+		  int *out_fence_fd)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	uint32_t fence;
+	int ret, fence_fd = -1;
 
+	ret = submit(priv->pipe, stream->buffer, stream->offset, &priv->submit,
+			in_fence_fd, !!out_fence_fd, &fence, &fence_fd);
 	if (ret)
-		ERROR_MSG("submit failed: %d (%s)", ret, strerror(errno));
+		ERROR_MSG("submit failed: %d (%s)", ret, strerror(-ret));
 	else
-		priv->last_timestamp = req.fence;
+		priv->last_timestamp = fence;
 
 	for (uint32_t i = 0; i < priv->nr_bos; i++) {
-		struct etna_bo *bo = priv->bos[i];
+		etna_bo_del(priv->bos[i]);
+	}
+
+	if (out_fence_fd)
+		*out_fence_fd = fence_fd;
+}
+
+static void *submit_thread_main(void *arg)
+{
+	struct etna_cmd_stream_priv *priv = arg;
+
+	pthread_mutex_lock(&priv->submit_lock);
+	for (;;) {
+		struct etna_cmd_buffer *cmdbuf;
+
+		while (LIST_IS_EMPTY(&priv->submit_queue) && !priv->submit_thread_exit)
+			pthread_cond_wait(&priv->submit_cond, &priv->submit_lock);
+
+		if (LIST_IS_EMPTY(&priv->submit_queue))
+			break;
+
+		/* leave it on the queue until submitted, see flush_wait: */
+		cmdbuf = LIST_FIRST_ENTRY(&priv->submit_queue,
+				struct etna_cmd_buffer, node);
+		pthread_mutex_unlock(&priv->submit_lock);
+
+		cmdbuf->fence_fd = -1;
+		cmdbuf->ret = submit(priv->pipe, cmdbuf->buffer, cmdbuf->offset,
+				&cmdbuf->submit, cmdbuf->in_fence_fd, !!cmdbuf->out_fence_fd,
+				&cmdbuf->fence, &cmdbuf->fence_fd);
+
+		pthread_mutex_lock(&priv->submit_lock);
+		list_del(&cmdbuf->node);
+		list_addtail(&cmdbuf->node, &priv->done_list);
+		pthread_cond_broadcast(&priv->submit_cond);
+	}
+	pthread_mutex_unlock(&priv->submit_lock);
+
+	return NULL;
+}
+
+/* hand the results of submitted buffers back to the stream, and make the
+ * buffers available for recording again.  The first submit error and the
+ * out-fences are kept for flush_wait:
+ */
+static void retire(struct etna_cmd_stream_priv *priv)
+{
+	struct etna_cmd_buffer *cmdbuf, *tmp;
+	struct list_head done;
 
-		bo->current_stream = NULL;
-		etna_bo_del(bo);
+	pthread_mutex_lock(&priv->submit_lock);
+	if (LIST_IS_EMPTY(&priv->done_list)) {
+		pthread_mutex_unlock(&priv->submit_lock);
+		return;
 	}
+	list_replace(&priv->done_list, &done);
+	list_inithead(&priv->done_list);
+	pthread_mutex_unlock(&priv->submit_lock);
+
+	LIST_FOR_EACH_ENTRY_SAFE(cmdbuf, tmp, &done, node) {
+		if (cmdbuf->ret) {
+			ERROR_MSG("submit failed: %d (%s)", cmdbuf->ret,
+					strerror(-cmdbuf->ret));
+			if (!priv->submit_error)
+				priv->submit_error = cmdbuf->ret;
+		} else {
+			priv->last_timestamp = cmdbuf->fence;
+		}
 
+		if (cmdbuf->out_fence_fd) {
+			uint32_t idx = APPEND(priv, fences);
+
+			priv->fences[idx].out_fence_fd = cmdbuf->out_fence_fd;
+			priv->fences[idx].fence_fd = cmdbuf->fence_fd;
+		}
+		if (cmdbuf->in_fence_fd != -1)
+			close(cmdbuf->in_fence_fd);
+
+		for (uint32_t i = 0; i < cmdbuf->nr_bos; i++)
+			etna_bo_del(cmdbuf->bos[i]);
+
+		cmdbuf->offset = 0;
+		cmdbuf->submit.nr_bos = 0;
+		cmdbuf->submit.nr_relocs = 0;
+		cmdbuf->submit.nr_pmrs = 0;
+		cmdbuf->submit.perf_session = NULL;
+		cmdbuf->nr_bos = 0;
+		util_bo_table_clear(&cmdbuf->bo_table);
+
+		list_del(&cmdbuf->node);
+		list_addtail(&cmdbuf->node, &priv->free_list);
+	}
+}
+
+/* wait for all queued buffers to have been submitted, and retire them: */
+static void drain(struct etna_cmd_stream_priv *priv)
+{
+	pthread_mutex_lock(&priv->submit_lock);
+	while (!LIST_IS_EMPTY(&priv->submit_queue))
+		pthread_cond_wait(&priv->submit_cond, &priv->submit_lock);
+	pthread_mutex_unlock(&priv->submit_lock);
+
+	retire(priv);
+}
+
+#define SWAP(a, b) do { __typeof__(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+
+static void flush_async(struct etna_cmd_stream *stream, int in_fence_fd,
+		int *out_fence_fd)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	struct etna_cmd_buffer *cmdbuf;
+	int fd = -1;
+
+	/* the caller may close in_fence_fd as soon as we return: */
+	if (in_fence_fd != -1) {
+		fd = dup(in_fence_fd);
+		if (fd == -1) {
+			drain(priv);
+			flush(stream, in_fence_fd, out_fence_fd);
+			return;
+		}
+	}
+
+	retire(priv);
+
+	/* all buffers in flight, wait for the oldest: */
+	if (LIST_IS_EMPTY(&priv->free_list)) {
+		pthread_mutex_lock(&priv->submit_lock);
+		while (LIST_IS_EMPTY(&priv->done_list))
+			pthread_cond_wait(&priv->submit_cond, &priv->submit_lock);
+		pthread_mutex_unlock(&priv->submit_lock);
+
+		retire(priv);
+	}
+
+	cmdbuf = LIST_FIRST_ENTRY(&priv->free_list, struct etna_cmd_buffer, node);
+	list_del(&cmdbuf->node);
+
+	/* the recorded batch goes to cmdbuf, and the stream carries on
+	 * recording into cmdbuf's (empty) buffer and tables:
+	 */
+	SWAP(stream->buffer, cmdbuf->buffer);
+	SWAP(stream->offset, cmdbuf->offset);
+	SWAP(priv->submit, cmdbuf->submit);
+	SWAP(priv->bos, cmdbuf->bos);
+	SWAP(priv->nr_bos, cmdbuf->nr_bos);
+	SWAP(priv->max_bos, cmdbuf->max_bos);
+	SWAP(priv->bo_table, cmdbuf->bo_table);
+
+	cmdbuf->in_fence_fd = fd;
+	cmdbuf->out_fence_fd = out_fence_fd;
 	if (out_fence_fd)
-		*out_fence_fd = req.fence_fd;
+		*out_fence_fd = -1;
+
+	pthread_mutex_lock(&priv->submit_lock);
+	list_addtail(&cmdbuf->node, &priv->submit_queue);
+	pthread_cond_broadcast(&priv->submit_cond);
+	pthread_mutex_unlock(&priv->submit_lock);
+}
+
+/* wait for all flushes of an async stream to have been submitted, and
+ * write their out-fence fds.  Returns the first submit error since the
+ * last call:
+ */
+drm_public int etna_cmd_stream_flush_wait(struct etna_cmd_stream *stream)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	int ret;
+
+	if (!priv->nr_cmd_buffers)
+		return 0;
+
+	drain(priv);
+
+	for (uint32_t i = 0; i < priv->nr_fences; i++)
+		*priv->fences[i].out_fence_fd = priv->fences[i].fence_fd;
+	priv->nr_fences = 0;
+
+	ret = priv->submit_error;
+	priv->submit_error = 0;
+
+	return ret;
 }
 
 drm_public void etna_cmd_stream_flush(struct etna_cmd_stream *stream)
 {
-	flush(stream, -1, NULL);
-	reset_buffer(stream);
+	etna_cmd_stream_flush2(stream, -1, NULL);
+}
+
+/* sample the session's signals around the submit about to be flushed: */
+static void emit_perf_session(struct etna_cmd_stream *stream)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	struct etna_perfmon_session *session = priv->perf_session;
+	uint32_t seqno, offset, bo_idx;
+
+	if (etna_perfmon_session_sample(session, &seqno, &offset))
+		return;
+
+	bo_idx = bo2idx(stream, session->bo, ETNA_RELOC_READ | ETNA_RELOC_WRITE);
+	priv->submit.perf_session = session;
+	priv->submit.perf_seqno = seqno;
+
+	for (unsigned i = 0; i < session->nr_signals; i++) {
+		for (unsigned j = 0; j < 2; j++) {
+			uint32_t idx = APPEND(&priv->submit, pmrs);
+			struct drm_etnaviv_gem_submit_pmr *pmr = &priv->submit.pmrs[idx];
+
+			pmr->flags = j ? ETNA_PM_PROCESS_POST : ETNA_PM_PROCESS_PRE;
+			pmr->sequence = seqno;
+			pmr->read_offset = offset + 2 * i + j;
+			pmr->read_idx = bo_idx;
+			pmr->domain = session->domains[i];
+			pmr->signal = session->signals[i];
+		}
+	}
 }
 
 drm_public void etna_cmd_stream_flush2(struct etna_cmd_stream *stream,
 									   int in_fence_fd,
 									   int *out_fence_fd)
 {
-	flush(stream, in_fence_fd, out_fence_fd);
+	if (etna_cmd_stream_priv(stream)->perf_session)
+		emit_perf_session(stream);
+
+	if (etna_cmd_stream_priv(stream)->nr_cmd_buffers)
+		flush_async(stream, in_fence_fd, out_fence_fd);
+	else
+		flush(stream, in_fence_fd, out_fence_fd);
 	reset_buffer(stream);
 }
 
@@ -239,7 +588,15 @@ drm_public void etna_cmd_stream_finish(struct etna_cmd_stream *stream)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
 
-	flush(stream, -1, NULL);
+	if (priv->perf_session)
+		emit_perf_session(stream);
+
+	if (priv->nr_cmd_buffers) {
+		flush_async(stream, -1, NULL);
+		drain(priv);
+	} else {
+		flush(stream, -1, NULL);
+	}
 	etna_pipe_wait(priv->pipe, priv->last_timestamp, 5000);
 	reset_buffer(stream);
 }
@@ -277,3 +634,10 @@ drm_public void etna_cmd_stream_perf(struct etna_cmd_stream *stream, const struc
 	pmr->domain = p->signal->domain->id;
 	pmr->signal = p->signal->signal;
 }
+
+/* attach a perf sampling session, or detach with NULL: */
+drm_public void etna_cmd_stream_perf_session(struct etna_cmd_stream *stream,
+		struct etna_perfmon_session *session)
+{
+	etna_cmd_stream_priv(stream)->perf_session = session;
+}
@@ -113,3 +113,12 @@ drm_public int etna_device_fd(struct etna_device *dev)
 {
    return dev->fd;
 }
+
+/* limit the memory held by freed bo's kept around for reuse, evicting
+ * the least recently freed ones once over @size bytes:
+ */
+drm_public void etna_device_set_bo_cache_size(struct etna_device *dev,
+		uint64_t size)
+{
+	etna_bo_cache_set_max_size(&dev->bo_cache, size);
+}
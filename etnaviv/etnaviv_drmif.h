@@ -38,6 +38,7 @@ struct etna_cmd_stream;
 struct etna_perfmon;
 struct etna_perfmon_domain;
 struct etna_perfmon_signal;
+struct etna_perfmon_session;
 
 enum etna_pipe_id {
 	ETNA_PIPE_3D = 0,
@@ -91,6 +92,7 @@ struct etna_device *etna_device_new_dup(int fd);
 struct etna_device *etna_device_ref(struct etna_device *dev);
 void etna_device_del(struct etna_device *dev);
 int etna_device_fd(struct etna_device *dev);
+void etna_device_set_bo_cache_size(struct etna_device *dev, uint64_t size);
 
 /* gpu functions:
  */
@@ -140,12 +142,21 @@ struct etna_cmd_stream {
 struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe, uint32_t size,
 		void (*reset_notify)(struct etna_cmd_stream *stream, void *priv),
 		void *priv);
+struct etna_cmd_stream *etna_cmd_stream_new_async(struct etna_pipe *pipe,
+		uint32_t size, unsigned nr_buffers,
+		void (*reset_notify)(struct etna_cmd_stream *stream, void *priv),
+		void *priv);
 void etna_cmd_stream_del(struct etna_cmd_stream *stream);
 uint32_t etna_cmd_stream_timestamp(struct etna_cmd_stream *stream);
 void etna_cmd_stream_flush(struct etna_cmd_stream *stream);
 void etna_cmd_stream_flush2(struct etna_cmd_stream *stream, int in_fence_fd,
 			    int *out_fence_fd);
 void etna_cmd_stream_finish(struct etna_cmd_stream *stream);
+/* for async streams, out-fence fds are only written by this, so must stay
+ * valid until it is called.  Returns the first submit error since the
+ * last call:
+ */
+int etna_cmd_stream_flush_wait(struct etna_cmd_stream *stream);
 
 static inline uint32_t etna_cmd_stream_avail(struct etna_cmd_stream *stream)
 {
@@ -211,4 +222,21 @@ struct etna_perf {
 
 void etna_cmd_stream_perf(struct etna_cmd_stream *stream, const struct etna_perf *p);
 
+/* perf sampling sessions: the signals are sampled before and after every
+ * submit of the stream the session is attached to, into a ring of
+ * nr_samples slots in a single bo.  Per-signal deltas are only summed up
+ * when read, and if the GPU falls nr_samples submits behind, submits go
+ * unsampled rather than stall.  A session should only be attached to a
+ * single stream at a time.
+ */
+struct etna_perfmon_session *etna_perfmon_session_new(struct etna_perfmon *pm,
+		struct etna_perfmon_signal **signals, unsigned nr_signals,
+		unsigned nr_samples);
+void etna_perfmon_session_del(struct etna_perfmon_session *session);
+/* returns the # of samples summed into values[nr_signals] so far: */
+int etna_perfmon_session_read(struct etna_perfmon_session *session,
+		uint64_t *values);
+void etna_cmd_stream_perf_session(struct etna_cmd_stream *stream,
+		struct etna_perfmon_session *session);
+
 #endif /* ETNAVIV_DRMIF_H_ */
@@ -27,7 +27,8 @@
 #include "etnaviv_priv.h"
 #include "etnaviv_drmif.h"
 
-static uint64_t get_param(struct etna_device *dev, uint32_t core, uint32_t param)
+static int get_param(struct etna_device *dev, uint32_t core, uint32_t param,
+		uint64_t *value)
 {
 	struct drm_etnaviv_param req = {
 		.pipe = core,
@@ -36,17 +37,43 @@ static uint64_t get_param(struct etna_device *dev, uint32_t core, uint32_t param
 	int ret;
 
 	ret = drmCommandWriteRead(dev->fd, DRM_ETNAVIV_GET_PARAM, &req, sizeof(req));
-	if (ret) {
-		ERROR_MSG("get-param (%x) failed! %d (%s)", param, ret, strerror(errno));
-		return 0;
-	}
+	if (ret)
+		return ret;
+
+	*value = req.value;
 
-	return req.value;
+	return 0;
 }
 
+/* params that etna_gpu_get_param() knows about: */
+static const uint32_t gpu_params[] = {
+	ETNAVIV_PARAM_GPU_MODEL,
+	ETNAVIV_PARAM_GPU_REVISION,
+	ETNAVIV_PARAM_GPU_FEATURES_0,
+	ETNAVIV_PARAM_GPU_FEATURES_1,
+	ETNAVIV_PARAM_GPU_FEATURES_2,
+	ETNAVIV_PARAM_GPU_FEATURES_3,
+	ETNAVIV_PARAM_GPU_FEATURES_4,
+	ETNAVIV_PARAM_GPU_FEATURES_5,
+	ETNAVIV_PARAM_GPU_FEATURES_6,
+	ETNAVIV_PARAM_GPU_STREAM_COUNT,
+	ETNAVIV_PARAM_GPU_REGISTER_MAX,
+	ETNAVIV_PARAM_GPU_THREAD_COUNT,
+	ETNAVIV_PARAM_GPU_VERTEX_CACHE_SIZE,
+	ETNAVIV_PARAM_GPU_SHADER_CORE_COUNT,
+	ETNAVIV_PARAM_GPU_PIXEL_PIPES,
+	ETNAVIV_PARAM_GPU_VERTEX_OUTPUT_BUFFER_SIZE,
+	ETNAVIV_PARAM_GPU_BUFFER_SIZE,
+	ETNAVIV_PARAM_GPU_INSTRUCTION_COUNT,
+	ETNAVIV_PARAM_GPU_NUM_CONSTANTS,
+	ETNAVIV_PARAM_GPU_NUM_VARYINGS,
+};
+
 drm_public struct etna_gpu *etna_gpu_new(struct etna_device *dev, unsigned int core)
 {
 	struct etna_gpu *gpu;
+	unsigned i;
+	int ret;
 
 	gpu = calloc(1, sizeof(*gpu));
 	if (!gpu) {
@@ -57,13 +84,29 @@ drm_public struct etna_gpu *etna_gpu_new(struct etna_device *dev, unsigned int c
 	gpu->dev = dev;
 	gpu->core = core;
 
-	gpu->model    	= get_param(dev, core, ETNAVIV_PARAM_GPU_MODEL);
-	gpu->revision 	= get_param(dev, core, ETNAVIV_PARAM_GPU_REVISION);
-
-	if (!gpu->model)
+	ret = get_param(dev, core, ETNAVIV_PARAM_GPU_MODEL,
+			&gpu->params[ETNA_GPU_MODEL]);
+	if (ret) {
+		ERROR_MSG("get-param (%x) failed! %d (%s)", ETNAVIV_PARAM_GPU_MODEL,
+				ret, strerror(errno));
+		goto fail;
+	}
+	if (!gpu->params[ETNA_GPU_MODEL])
 		goto fail;
 
-	INFO_MSG(" GPU model:          0x%x (rev %x)", gpu->model, gpu->revision);
+	/* the params are constant for the lifetime of the gpu, so rather than
+	 * an ioctl per etna_gpu_get_param() call, read them all up front.
+	 * Older kernels don't know about all of them, those read as 0 just
+	 * like they always did:
+	 */
+	for (i = 1; i < ARRAY_SIZE(gpu_params); i++) {
+		if (get_param(dev, core, gpu_params[i], &gpu->params[gpu_params[i]]))
+			gpu->params[gpu_params[i]] = 0;
+	}
+
+	INFO_MSG(" GPU model:          0x%x (rev %x)",
+			(uint32_t)gpu->params[ETNA_GPU_MODEL],
+			(uint32_t)gpu->params[ETNA_GPU_REVISION]);
 
 	return gpu;
 fail:
@@ -81,69 +124,28 @@ drm_public void etna_gpu_del(struct etna_gpu *gpu)
 drm_public int etna_gpu_get_param(struct etna_gpu *gpu, enum etna_param_id param,
 		uint64_t *value)
 {
-	struct etna_device *dev = gpu->dev;
-	unsigned int core = gpu->core;
-
 	switch(param) {
 	case ETNA_GPU_MODEL:
-		*value = gpu->model;
-		return 0;
 	case ETNA_GPU_REVISION:
-		*value = gpu->revision;
-		return 0;
 	case ETNA_GPU_FEATURES_0:
-		*value = get_param(dev, core, ETNAVIV_PARAM_GPU_FEATURES_0);
-		return 0;
 	case ETNA_GPU_FEATURES_1:
-		*value = get_param(dev, core, ETNAVIV_PARAM_GPU_FEATURES_1);
-		return 0;
 	case ETNA_GPU_FEATURES_2:
-		*value = get_param(dev, core, ETNAVIV_PARAM_GPU_FEATURES_2);
-		return 0;
 	case ETNA_GPU_FEATURES_3:
-		*value = get_param(dev, core, ETNAVIV_PARAM_GPU_FEATURES_3);
-		return 0;
 	case ETNA_GPU_FEATURES_4:
-		*value = get_param(dev, core, ETNAVIV_PARAM_GPU_FEATURES_4);
-		return 0;
 	case ETNA_GPU_FEATURES_5:
-		*value = get_param(dev, core, ETNAVIV_PARAM_GPU_FEATURES_5);
-		return 0;
 	case ETNA_GPU_FEATURES_6:
-		*value = get_param(dev, core, ETNAVIV_PARAM_GPU_FEATURES_6);
-		return 0;
 	case ETNA_GPU_STREAM_COUNT:
-		*value = get_param(dev, core, ETNA_GPU_STREAM_COUNT);
-		return 0;
 	case ETNA_GPU_REGISTER_MAX:
-		*value = get_param(dev, core, ETNA_GPU_REGISTER_MAX);
-		return 0;
 	case ETNA_GPU_THREAD_COUNT:
-		*value = get_param(dev, core, ETNA_GPU_THREAD_COUNT);
-		return 0;
 	case ETNA_GPU_VERTEX_CACHE_SIZE:
-		*value = get_param(dev, core, ETNA_GPU_VERTEX_CACHE_SIZE);
-		return 0;
 	case ETNA_GPU_SHADER_CORE_COUNT:
-		*value = get_param(dev, core, ETNA_GPU_SHADER_CORE_COUNT);
-		return 0;
 	case ETNA_GPU_PIXEL_PIPES:
-		*value = get_param(dev, core, ETNA_GPU_PIXEL_PIPES);
-		return 0;
 	case ETNA_GPU_VERTEX_OUTPUT_BUFFER_SIZE:
-		*value = get_param(dev, core, ETNA_GPU_VERTEX_OUTPUT_BUFFER_SIZE);
-		return 0;
 	case ETNA_GPU_BUFFER_SIZE:
-		*value = get_param(dev, core, ETNA_GPU_BUFFER_SIZE);
-		return 0;
 	case ETNA_GPU_INSTRUCTION_COUNT:
-		*value = get_param(dev, core, ETNA_GPU_INSTRUCTION_COUNT);
-		return 0;
 	case ETNA_GPU_NUM_CONSTANTS:
-		*value = get_param(dev, core, ETNA_GPU_NUM_CONSTANTS);
-		return 0;
 	case ETNA_GPU_NUM_VARYINGS:
-		*value = get_param(dev, core, ETNA_GPU_NUM_VARYINGS);
+		*value = gpu->params[param];
 		return 0;
 
 	default:
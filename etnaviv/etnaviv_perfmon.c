@@ -183,3 +183,167 @@ drm_public struct etna_perfmon_signal *etna_perfmon_get_sig_by_name(struct etna_
 
 	return NULL;
 }
+
+drm_public struct etna_perfmon_session *etna_perfmon_session_new(struct etna_perfmon *pm,
+		struct etna_perfmon_signal **signals, unsigned nr_signals,
+		unsigned nr_samples)
+{
+	struct etna_perfmon_session *session;
+	uint32_t size;
+	unsigned i;
+
+	if (!pm || !nr_signals || !nr_samples)
+		return NULL;
+
+	session = calloc(1, sizeof(*session));
+	if (!session) {
+		ERROR_MSG("allocation failed");
+		return NULL;
+	}
+
+	session->nr_signals = nr_signals;
+	session->nr_samples = nr_samples;
+	session->domains = calloc(nr_signals, sizeof(session->domains[0]));
+	session->signals = calloc(nr_signals, sizeof(session->signals[0]));
+	session->totals = calloc(nr_signals, sizeof(session->totals[0]));
+	session->failed = calloc(nr_samples, sizeof(session->failed[0]));
+	if (!session->domains || !session->signals || !session->totals ||
+			!session->failed) {
+		ERROR_MSG("allocation failed");
+		goto fail;
+	}
+
+	for (i = 0; i < nr_signals; i++) {
+		session->domains[i] = signals[i]->domain->id;
+		session->signals[i] = signals[i]->signal;
+	}
+
+	size = (1 + nr_samples * nr_signals * 2) * sizeof(uint32_t);
+	session->bo = etna_bo_new(pm->pipe->gpu->dev, size, DRM_ETNA_GEM_CACHE_UNCACHED);
+	if (!session->bo)
+		goto fail;
+
+	session->map = etna_bo_map(session->bo);
+	if (!session->map)
+		goto fail;
+
+	/* the bo may have come from the cache: */
+	memset((void *)session->map, 0, size);
+
+	pthread_mutex_init(&session->lock, NULL);
+
+	return session;
+
+fail:
+	if (session->bo)
+		etna_bo_del(session->bo);
+	free(session->domains);
+	free(session->signals);
+	free(session->totals);
+	free(session->failed);
+	free(session);
+
+	return NULL;
+}
+
+drm_public void etna_perfmon_session_del(struct etna_perfmon_session *session)
+{
+	if (!session)
+		return;
+
+	pthread_mutex_destroy(&session->lock);
+	etna_bo_del(session->bo);
+	free(session->domains);
+	free(session->signals);
+	free(session->totals);
+	free(session->failed);
+	free(session);
+}
+
+/* offset of the slot for sample @seqno, in dwords: */
+static uint32_t slot_offset(struct etna_perfmon_session *session, uint32_t seqno)
+{
+	return 1 + ((seqno - 1) % session->nr_samples) * session->nr_signals * 2;
+}
+
+/* sum up the samples the kernel has completed, call w/ session->lock held: */
+static void session_collect(struct etna_perfmon_session *session)
+{
+	uint32_t done = session->map[0];
+
+	/* the values are written before the sequence: */
+	__sync_synchronize();
+
+	while (session->read_seqno != session->seqno) {
+		uint32_t next = session->read_seqno + 1;
+		volatile uint32_t *slot;
+		unsigned i;
+
+		/* samples of failed submits are never written, skip them even
+		 * if nothing after them has completed yet:
+		 */
+		if (session->failed[(next - 1) % session->nr_samples] == next) {
+			session->read_seqno = next;
+			continue;
+		}
+
+		if ((int32_t)(done - next) < 0)
+			break;
+
+		session->read_seqno = next;
+		slot = &session->map[slot_offset(session, next)];
+
+		for (i = 0; i < session->nr_signals; i++)
+			session->totals[i] += (uint32_t)(slot[2 * i + 1] - slot[2 * i]);
+
+		session->nr_read++;
+	}
+}
+
+/* hand out the slot for the next sample.  Returns -1 if all slots are
+ * still waiting for the GPU, in which case the submit isn't sampled:
+ */
+drm_private int etna_perfmon_session_sample(struct etna_perfmon_session *session,
+		uint32_t *seqno, uint32_t *offset)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&session->lock);
+
+	if (session->seqno - session->read_seqno >= session->nr_samples)
+		session_collect(session);
+
+	if (session->seqno - session->read_seqno >= session->nr_samples) {
+		ret = -1;
+	} else {
+		*seqno = ++session->seqno;
+		*offset = slot_offset(session, *seqno);
+	}
+
+	pthread_mutex_unlock(&session->lock);
+
+	return ret;
+}
+
+/* the submit carrying sample @seqno failed, so its slot is never written: */
+drm_private void etna_perfmon_session_fail(struct etna_perfmon_session *session,
+		uint32_t seqno)
+{
+	pthread_mutex_lock(&session->lock);
+	session->failed[(seqno - 1) % session->nr_samples] = seqno;
+	pthread_mutex_unlock(&session->lock);
+}
+
+drm_public int etna_perfmon_session_read(struct etna_perfmon_session *session,
+		uint64_t *values)
+{
+	int ret;
+
+	pthread_mutex_lock(&session->lock);
+	session_collect(session);
+	memcpy(values, session->totals, session->nr_signals * sizeof(values[0]));
+	ret = session->nr_read;
+	pthread_mutex_unlock(&session->lock);
+
+	return ret;
+}
@@ -43,19 +43,28 @@
 #include "xf86atomic.h"
 
 #include "util_double_list.h"
+#include "util_bo_table.h"
 
 #include "etnaviv_drmif.h"
 #include "etnaviv_drm.h"
 
+/* one list per cache mode, with and without FORCE_MMU: */
+#define ETNA_BO_CACHE_LISTS 6
+
 struct etna_bo_bucket {
 	uint32_t size;
-	struct list_head list;
+	struct list_head list[ETNA_BO_CACHE_LISTS];
 };
 
 struct etna_bo_cache {
 	struct etna_bo_bucket cache_bucket[14 * 4];
 	unsigned num_buckets;
 	time_t time;
+
+	/* all cached bo's, least recently freed first: */
+	struct list_head lru;
+	uint64_t size;          /* total size of cached bo's, in bytes */
+	uint64_t max_size;
 };
 
 struct etna_device {
@@ -75,6 +84,8 @@ struct etna_device {
 
 	struct etna_bo_cache bo_cache;
 
+	atomic_t stream_cnt;   /* for etna_cmd_stream_priv::seqno */
+
 	int closefd;        /* call close(fd) upon destruction */
 };
 
@@ -83,6 +94,9 @@ drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time)
 drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache,
 		uint32_t *size, uint32_t flags);
 drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *bo);
+drm_private void etna_bo_cache_remove(struct etna_bo_cache *cache, struct etna_bo *bo);
+drm_private void etna_bo_cache_set_max_size(struct etna_bo_cache *cache,
+		uint64_t max_size);
 
 /* for where @table_lock is already held: */
 drm_private void etna_device_del_locked(struct etna_device *dev);
@@ -99,25 +113,29 @@ struct etna_bo {
 	atomic_t        refcnt;
 
 	/* in the common case, a bo won't be referenced by more than a single
-	 * command stream.  So to avoid looping over all the bo's in the
-	 * reloc table to find the idx of a bo that might already be in the
-	 * table, we cache the idx in the bo.  But in order to detect the
-	 * slow-path where bo is ref'd in multiple streams, we also must track
-	 * the current_stream for which the idx is valid.  See bo2idx().
+	 * command stream.  So to avoid hashtable lookups, cache the stream
+	 * this bo was last emitted on: the stream's seqno in the upper 32
+	 * bits, and the bo's idx in that stream in the lower.  Streams being
+	 * built on other threads may overwrite it at any time, so it is only
+	 * accessed atomically, and checked against the stream before use.
+	 * See bo2idx().
 	 */
-	struct etna_cmd_stream *current_stream;
-	uint32_t idx;
+	uint64_t stream_hint;
 
 	int reuse;
 	struct list_head list;   /* bucket-list entry */
+	struct list_head lru;    /* etna_bo_cache::lru entry */
 	time_t free_time;        /* time when added to bucket-list */
 };
 
 struct etna_gpu {
 	struct etna_device *dev;
 	uint32_t core;
-	uint32_t model;
-	uint32_t revision;
+
+	/* all of the etna_param_id's, fetched once in etna_gpu_new(), and
+	 * indexed by param id (which matches the kernel's ETNAVIV_PARAM_x):
+	 */
+	uint64_t params[ETNA_GPU_NUM_VARYINGS + 1];
 };
 
 struct etna_pipe {
@@ -125,31 +143,97 @@ struct etna_pipe {
 	struct etna_gpu *gpu;
 };
 
+/* submit ioctl related tables: */
+struct etna_cmd_stream_submit {
+	/* bo's table: */
+	struct drm_etnaviv_gem_submit_bo *bos;
+	uint32_t nr_bos, max_bos;
+
+	/* reloc's table: */
+	struct drm_etnaviv_gem_submit_reloc *relocs;
+	uint32_t nr_relocs, max_relocs;
+
+	/* perf's table: */
+	struct drm_etnaviv_gem_submit_pmr *pmrs;
+	uint32_t nr_pmrs, max_pmrs;
+
+	/* the session sample the pmrs are for, if any: */
+	struct etna_perfmon_session *perf_session;
+	uint32_t perf_seqno;
+};
+
+/* A command buffer that an async stream has handed to its submit thread,
+ * or that is waiting to be recorded into again.  Holds everything a
+ * submit needs, which is swapped with the stream's own when the stream
+ * moves on to the next buffer:
+ */
+struct etna_cmd_buffer {
+	struct list_head node;
+
+	uint32_t *buffer;
+	uint32_t offset;
+	struct etna_cmd_stream_submit submit;
+	struct etna_bo **bos;
+	uint32_t nr_bos, max_bos;
+	struct util_bo_table bo_table;
+
+	int in_fence_fd;     /* our own dup(), or -1 */
+	int *out_fence_fd;
+
+	/* results, filled in by the submit thread: */
+	int ret;
+	uint32_t fence;
+	int fence_fd;
+};
+
+/* An out-fence of a retired async flush, until flush_wait hands it out: */
+struct etna_cmd_fence {
+	int *out_fence_fd;
+	int fence_fd;
+};
+
 struct etna_cmd_stream_priv {
 	struct etna_cmd_stream base;
 	struct etna_pipe *pipe;
 
 	uint32_t last_timestamp;
 
-	/* submit ioctl related tables: */
-	struct {
-		/* bo's table: */
-		struct drm_etnaviv_gem_submit_bo *bos;
-		uint32_t nr_bos, max_bos;
-
-		/* reloc's table: */
-		struct drm_etnaviv_gem_submit_reloc *relocs;
-		uint32_t nr_relocs, max_relocs;
-
-		/* perf's table: */
-		struct drm_etnaviv_gem_submit_pmr *pmrs;
-		uint32_t nr_pmrs, max_pmrs;
-	} submit;
+	struct etna_cmd_stream_submit submit;
 
 	/* should have matching entries in submit.bos: */
 	struct etna_bo **bos;
 	uint32_t nr_bos, max_bos;
 
+	uint32_t seqno;
+
+	/* maps bo handle to idx in submit.bos: */
+	struct util_bo_table bo_table;
+
+	/* For async streams, the spare command buffers.  They move from
+	 * free_list (ready to record into) to submit_queue (waiting for, or
+	 * in, the submit ioctl) to done_list (submitted, to be retired on
+	 * the stream's own thread) and back:
+	 */
+	struct etna_cmd_buffer *cmd_buffers;
+	unsigned nr_cmd_buffers;
+	struct list_head free_list;
+	struct list_head submit_queue;
+	struct list_head done_list;
+	pthread_mutex_t submit_lock;
+	pthread_cond_t submit_cond;
+	pthread_t submit_thread;
+	int submit_thread_exit;
+
+	/* kept by retire until flush_wait, which reports the first error
+	 * and writes the out-fences:
+	 */
+	int submit_error;
+	struct etna_cmd_fence *fences;
+	uint32_t nr_fences, max_fences;
+
+	/* sampled around every flush, if set: */
+	struct etna_perfmon_session *perf_session;
+
 	/* notify callback if buffer reset happened */
 	void (*reset_notify)(struct etna_cmd_stream *stream, void *priv);
 	void *reset_notify_priv;
@@ -176,6 +260,35 @@ struct etna_perfmon_signal
 	char name[64];
 };
 
+/* The bo of a session starts with the sequence # of the last sample the
+ * kernel has completed (it writes the pmr's sequence to the first word of
+ * the bo after processing the POST requests), followed by nr_samples slots
+ * of a pre and a post value per signal:
+ */
+struct etna_perfmon_session {
+	struct etna_bo *bo;
+	volatile uint32_t *map;
+
+	/* pre-resolved, so a flush doesn't have to look anything up: */
+	unsigned nr_signals;
+	uint8_t *domains;
+	uint16_t *signals;
+
+	unsigned nr_samples;
+
+	pthread_mutex_t lock;       /* protects everything below */
+	uint32_t seqno;             /* last sample handed out */
+	uint32_t read_seqno;        /* last sample summed into totals */
+	uint32_t nr_read;
+	uint64_t *totals;
+	uint32_t *failed;           /* per slot, seqno of a sample never run */
+};
+
+drm_private int etna_perfmon_session_sample(struct etna_perfmon_session *session,
+		uint32_t *seqno, uint32_t *offset);
+drm_private void etna_perfmon_session_fail(struct etna_perfmon_session *session,
+		uint32_t seqno);
+
 #define ALIGN(v,a) (((v) + (a) - 1) & ~((a) - 1))
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
@@ -29,10 +29,7 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-drm_private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-drm_private void bo_del(struct fd_bo *bo);
-
-/* set buffer name, and add to table, call w/ table_lock held: */
+/* set buffer name, and add to table, call w/ dev->table_lock held: */
 static void set_name(struct fd_bo *bo, uint32_t name)
 {
 	bo->name = name;
@@ -40,7 +37,7 @@ static void set_name(struct fd_bo *bo, uint32_t name)
 	drmHashInsert(bo->dev->name_table, name, bo);
 }
 
-/* lookup a buffer, call w/ table_lock held: */
+/* lookup a buffer, call w/ dev->table_lock held: */
 static struct fd_bo * lookup_bo(void *tbl, uint32_t key)
 {
 	struct fd_bo *bo = NULL;
@@ -49,12 +46,15 @@ static struct fd_bo * lookup_bo(void *tbl, uint32_t key)
 		bo = fd_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		if (bo->bo_reuse == BO_CACHE)
+			fd_bo_cache_remove(&bo->dev->bo_cache, bo);
+		else if (bo->bo_reuse == RING_CACHE)
+			fd_bo_cache_remove(&bo->dev->ring_cache, bo);
 	}
 	return bo;
 }
 
-/* allocate a new buffer object, call w/ table_lock held */
+/* allocate a new buffer object, call w/ dev->table_lock held */
 static struct fd_bo * bo_from_handle(struct fd_device *dev,
 		uint32_t size, uint32_t handle)
 {
@@ -90,13 +90,19 @@ bo_new(struct fd_device *dev, uint32_t size, uint32_t flags,
 	if (bo)
 		return bo;
 
+	/* usage hints are for the cache only, don't pass them to the kernel: */
+	flags &= ~DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER;
+
 	ret = dev->funcs->bo_new_handle(dev, size, flags, &handle);
 	if (ret)
 		return NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 	bo = bo_from_handle(dev, size, handle);
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	if (bo)
+		bo->flags = flags;
 
 	VG_BO_ALLOC(bo);
 
@@ -131,7 +137,7 @@ fd_bo_from_handle(struct fd_device *dev, uint32_t handle, uint32_t size)
 {
 	struct fd_bo *bo = NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 
 	bo = lookup_bo(dev->handle_table, handle);
 	if (bo)
@@ -142,7 +148,7 @@ fd_bo_from_handle(struct fd_device *dev, uint32_t handle, uint32_t size)
 	VG_BO_ALLOC(bo);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -154,10 +160,10 @@ fd_bo_from_dmabuf(struct fd_device *dev, int fd)
 	uint32_t handle;
 	struct fd_bo *bo;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 	ret = drmPrimeFDToHandle(dev->fd, fd, &handle);
 	if (ret) {
-		pthread_mutex_unlock(&table_lock);
+		pthread_mutex_unlock(&dev->table_lock);
 		return NULL;
 	}
 
@@ -174,7 +180,7 @@ fd_bo_from_dmabuf(struct fd_device *dev, int fd)
 	VG_BO_ALLOC(bo);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -186,7 +192,7 @@ drm_public struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 	};
 	struct fd_bo *bo;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 
 	/* check name table first, to see if bo is already open: */
 	bo = lookup_bo(dev->name_table, name);
@@ -209,7 +215,7 @@ drm_public struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 	}
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -237,44 +243,60 @@ drm_public void fd_bo_del(struct fd_bo *bo)
 	if (!atomic_dec_and_test(&bo->refcnt))
 		return;
 
-	pthread_mutex_lock(&table_lock);
-
 	if ((bo->bo_reuse == BO_CACHE) && (fd_bo_cache_free(&dev->bo_cache, bo) == 0))
-		goto out;
+		return;
 	if ((bo->bo_reuse == RING_CACHE) && (fd_bo_cache_free(&dev->ring_cache, bo) == 0))
-		goto out;
+		return;
 
 	bo_del(bo);
-	fd_device_del_locked(dev);
-out:
-	pthread_mutex_unlock(&table_lock);
+	fd_device_del(dev);
 }
 
-/* Called under table_lock */
-drm_private void bo_del(struct fd_bo *bo)
+/* remove from the handle and name tables, call w/ dev->table_lock held.
+ * Once unlinked the bo can no longer be found by lookup_bo(), so the
+ * (potentially slow) teardown in bo_free() can happen without the lock:
+ */
+drm_private void bo_unlink_locked(struct fd_bo *bo)
+{
+	if (bo->handle) {
+		drmHashDelete(bo->dev->handle_table, bo->handle);
+		if (bo->name)
+			drmHashDelete(bo->dev->name_table, bo->name);
+	}
+}
+
+drm_private void bo_free(struct fd_bo *bo)
 {
 	VG_BO_FREE(bo);
 
 	if (bo->map)
 		drm_munmap(bo->map, bo->size);
 
-	/* TODO probably bo's in bucket list get removed from
-	 * handle table??
+	/* the handle must be unlinked before it is closed, otherwise the
+	 * kernel could hand the same handle to a new bo which then gets
+	 * clobbered in the handle table:
 	 */
-
 	if (bo->handle) {
 		struct drm_gem_close req = {
 				.handle = bo->handle,
 		};
-		drmHashDelete(bo->dev->handle_table, bo->handle);
-		if (bo->name)
-			drmHashDelete(bo->dev->name_table, bo->name);
 		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 	}
 
 	bo->funcs->destroy(bo);
 }
 
+drm_private void bo_del(struct fd_bo *bo)
+{
+	struct fd_device *dev = bo->dev;
+
+	pthread_mutex_lock(&dev->table_lock);
+	bo_unlink_locked(bo);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	bo_free(bo);
+}
+
 drm_public int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 {
 	if (!bo->name) {
@@ -288,9 +310,9 @@ drm_public int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 			return ret;
 		}
 
-		pthread_mutex_lock(&table_lock);
+		pthread_mutex_lock(&bo->dev->table_lock);
 		set_name(bo, req.name);
-		pthread_mutex_unlock(&table_lock);
+		pthread_mutex_unlock(&bo->dev->table_lock);
 		bo->bo_reuse = NO_CACHE;
 	}
 
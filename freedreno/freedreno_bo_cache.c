@@ -29,8 +29,8 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-drm_private void bo_del(struct fd_bo *bo);
-drm_private extern pthread_mutex_t table_lock;
+/* max # of cached bo's looked at per allocation before giving up: */
+#define FD_BO_CACHE_SCAN 8
 
 static void
 add_bucket(struct fd_bo_cache *cache, int size)
@@ -40,6 +40,7 @@ add_bucket(struct fd_bo_cache *cache, int size)
 	assert(i < ARRAY_SIZE(cache->cache_bucket));
 
 	list_inithead(&cache->cache_bucket[i].list);
+	pthread_mutex_init(&cache->cache_bucket[i].lock, NULL);
 	cache->cache_bucket[i].size = size;
 	cache->num_buckets++;
 }
@@ -53,6 +54,9 @@ fd_bo_cache_init(struct fd_bo_cache *cache, int coarse)
 {
 	unsigned long size, cache_max_size = 64 * 1024 * 1024;
 
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->coarse = coarse;
+
 	/* OK, so power of two buckets was too wasteful of memory.
 	 * Give 3 other sizes between each power of two, to hopefully
 	 * cover things accurately enough.  (The alternative is
@@ -77,19 +81,34 @@ fd_bo_cache_init(struct fd_bo_cache *cache, int coarse)
 	}
 }
 
-/* Frees older cached buffers.  Called under table_lock */
+/* Frees older cached buffers.  Expired bo's are pulled out of their
+ * buckets and the handle table together, under dev->table_lock, so that
+ * lookup_bo() cannot revive them, and are then freed without any lock
+ * held.  If another thread is already cleaning up, leave it to them.
+ */
 drm_private void
-fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
+fd_bo_cache_cleanup(struct fd_device *dev, struct fd_bo_cache *cache,
+		time_t time)
 {
+	struct list_head expired;
 	int i;
 
-	if (cache->time == time)
+	if (pthread_mutex_trylock(&cache->lock))
+		return;
+
+	if (cache->time == time) {
+		pthread_mutex_unlock(&cache->lock);
 		return;
+	}
+
+	list_inithead(&expired);
 
+	pthread_mutex_lock(&dev->table_lock);
 	for (i = 0; i < cache->num_buckets; i++) {
 		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
 		struct fd_bo *bo;
 
+		pthread_mutex_lock(&bucket->lock);
 		while (!LIST_IS_EMPTY(&bucket->list)) {
 			bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
 
@@ -97,30 +116,65 @@ fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
 			if (time && ((time - bo->free_time) <= 1))
 				break;
 
-			VG_BO_OBTAIN(bo);
 			list_del(&bo->list);
-			bo_del(bo);
+			list_addtail(&bo->list, &expired);
+			bo_unlink_locked(bo);
+			bucket->stats.expired++;
 		}
+		pthread_mutex_unlock(&bucket->lock);
 	}
+	pthread_mutex_unlock(&dev->table_lock);
 
 	cache->time = time;
+	pthread_mutex_unlock(&cache->lock);
+
+	while (!LIST_IS_EMPTY(&expired)) {
+		struct fd_bo *bo = LIST_ENTRY(struct fd_bo, expired.next, list);
+
+		VG_BO_OBTAIN(bo);
+		list_del(&bo->list);
+		bo_free(bo);
+	}
 }
 
 static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
 {
-	int i;
+	struct fd_bo_bucket *bucket;
+	unsigned idx;
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
+	/* The buckets set up by fd_bo_cache_init() are 4k, 8k, (12k,) and
+	 * then every power of two from 16k, each (unless coarse) followed
+	 * by three steps of a quarter towards the next power of two.  So
+	 * the smallest bucket that fits can be calculated directly:
 	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
+	if (size <= 4096) {
+		idx = 0;
+	} else if (size <= 8192) {
+		idx = 1;
+	} else if (!cache->coarse && (size <= 3 * 4096)) {
+		idx = 2;
+	} else {
+		/* 2^e < size <= 2^(e+1), with e >= 13: */
+		unsigned e = 31 - __builtin_clz(size - 1);
+
+		if (cache->coarse) {
+			idx = e - 11;
+		} else if (e == 13) {
+			idx = 3;
+		} else {
+			/* which quarter step of 2^e it falls in, 1..4: */
+			unsigned q = (size - (1u << e) + (1u << (e - 2)) - 1) >> (e - 2);
+			idx = (e - 13) * 4 + q - 1;
 		}
 	}
 
-	return NULL;
+	if (idx >= (unsigned)cache->num_buckets)
+		return NULL;
+
+	bucket = &cache->cache_bucket[idx];
+	assert(bucket->size >= size);
+
+	return bucket;
 }
 
 static int is_idle(struct fd_bo *bo)
@@ -133,26 +187,60 @@ static int is_idle(struct fd_bo *bo)
 
 static struct fd_bo *find_in_bucket(struct fd_bo_bucket *bucket, uint32_t flags)
 {
-	struct fd_bo *bo = NULL;
+	struct fd_bo *bo = NULL, *entry;
+	int for_render = !!(flags & DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER);
+	int n = 0;
 
-	/* TODO .. if we had an ALLOC_FOR_RENDER flag like intel, we could
-	 * skip the busy check.. if it is only going to be a render target
-	 * then we probably don't need to stall..
-	 *
-	 * NOTE that intel takes ALLOC_FOR_RENDER bo's from the list tail
-	 * (MRU, since likely to be in GPU cache), rather than head (LRU)..
-	 */
-	pthread_mutex_lock(&table_lock);
-	if (!LIST_IS_EMPTY(&bucket->list)) {
-		bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
-		/* TODO check for compatible flags? */
-		if (is_idle(bo)) {
-			list_del(&bo->list);
-		} else {
-			bo = NULL;
+	flags &= ~DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER;
+
+	pthread_mutex_lock(&bucket->lock);
+
+	if (for_render) {
+		/* Like intel, take render targets from the list tail (MRU, since
+		 * likely to be in GPU cache).  They are only accessed by the GPU,
+		 * which orders against the previous user itself, so there is no
+		 * need to skip busy bo's:
+		 */
+		LIST_FOR_EACH_ENTRY_FROM_REV(entry, bucket->list.prev,
+				&bucket->list, list) {
+			if (n++ == FD_BO_CACHE_SCAN)
+				break;
+			if (entry->flags != flags) {
+				bucket->stats.incompatible++;
+				continue;
+			}
+			bo = entry;
+			break;
+		}
+	} else {
+		/* otherwise the oldest (LRU) bo that is already idle, so the
+		 * caller does not stall on its first cpu access:
+		 */
+		LIST_FOR_EACH_ENTRY(entry, &bucket->list, list) {
+			if (n++ == FD_BO_CACHE_SCAN)
+				break;
+			if (entry->flags != flags) {
+				bucket->stats.incompatible++;
+				continue;
+			}
+			if (!is_idle(entry)) {
+				bucket->stats.busy++;
+				continue;
+			}
+			bo = entry;
+			break;
 		}
 	}
-	pthread_mutex_unlock(&table_lock);
+
+	if (bo) {
+		/* leave the node self-linked for fd_bo_cache_remove(): */
+		list_delinit(&bo->list);
+		bucket->stats.hits++;
+	} else {
+		bucket->stats.misses++;
+	}
+
+	pthread_mutex_unlock(&bucket->lock);
 
 	return bo;
 }
@@ -176,9 +264,10 @@ retry:
 			VG_BO_OBTAIN(bo);
 			if (bo->funcs->madvise(bo, TRUE) <= 0) {
 				/* we've lost the backing pages, delete and try again: */
-				pthread_mutex_lock(&table_lock);
+				pthread_mutex_lock(&bucket->lock);
+				bucket->stats.purged++;
+				pthread_mutex_unlock(&bucket->lock);
 				bo_del(bo);
-				pthread_mutex_unlock(&table_lock);
 				goto retry;
 			}
 			atomic_set(&bo->refcnt, 1);
@@ -197,6 +286,7 @@ fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
 
 	/* see if we can be green and recycle: */
 	if (bucket) {
+		struct fd_device *dev = bo->dev;
 		struct timespec time;
 
 		bo->funcs->madvise(bo, FALSE);
@@ -205,16 +295,62 @@ fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
 
 		bo->free_time = time.tv_sec;
 		VG_BO_RELEASE(bo);
+
+		/* once it is in the bucket another thread may take (or free)
+		 * the bo, so don't touch it after dropping the lock:
+		 */
+		pthread_mutex_lock(&bucket->lock);
 		list_addtail(&bo->list, &bucket->list);
-		fd_bo_cache_cleanup(cache, time.tv_sec);
+		bucket->stats.freed++;
+		pthread_mutex_unlock(&bucket->lock);
+
+		fd_bo_cache_cleanup(dev, cache, time.tv_sec);
 
 		/* bo's in the bucket cache don't have a ref and
 		 * don't hold a ref to the dev:
 		 */
-		fd_device_del_locked(bo->dev);
+		fd_device_del(dev);
 
 		return 0;
 	}
 
 	return -1;
 }
+
+/* take a bo back out of its bucket (if it is in one), for when
+ * lookup_bo() finds a cached bo.  Call w/ dev->table_lock held:
+ */
+drm_private void
+fd_bo_cache_remove(struct fd_bo_cache *cache, struct fd_bo *bo)
+{
+	struct fd_bo_bucket *bucket = get_bucket(cache, bo->size);
+
+	if (!bucket)
+		return;
+
+	pthread_mutex_lock(&bucket->lock);
+	list_delinit(&bo->list);
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+drm_private void
+fd_bo_cache_get_stats(struct fd_bo_cache *cache, struct fd_bo_cache_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < cache->num_buckets; i++) {
+		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
+
+		pthread_mutex_lock(&bucket->lock);
+		stats->hits += bucket->stats.hits;
+		stats->misses += bucket->stats.misses;
+		stats->busy += bucket->stats.busy;
+		stats->incompatible += bucket->stats.incompatible;
+		stats->purged += bucket->stats.purged;
+		stats->freed += bucket->stats.freed;
+		stats->expired += bucket->stats.expired;
+		pthread_mutex_unlock(&bucket->lock);
+	}
+}
@@ -33,8 +33,6 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-
 struct fd_device * kgsl_device_new(int fd);
 struct fd_device * msm_device_new(int fd);
 
@@ -81,6 +79,7 @@ out:
 	dev->fd = fd;
 	dev->handle_table = drmHashCreate();
 	dev->name_table = drmHashCreate();
+	pthread_mutex_init(&dev->table_lock, NULL);
 	fd_bo_cache_init(&dev->bo_cache, FALSE);
 	fd_bo_cache_init(&dev->ring_cache, TRUE);
 
@@ -110,28 +109,20 @@ drm_public struct fd_device * fd_device_ref(struct fd_device *dev)
 static void fd_device_del_impl(struct fd_device *dev)
 {
 	int close_fd = dev->closefd ? dev->fd : -1;
-	fd_bo_cache_cleanup(&dev->bo_cache, 0);
+	fd_bo_cache_cleanup(dev, &dev->bo_cache, 0);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
+	pthread_mutex_destroy(&dev->table_lock);
 	dev->funcs->destroy(dev);
 	if (close_fd >= 0)
 		close(close_fd);
 }
 
-drm_private void fd_device_del_locked(struct fd_device *dev)
-{
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-	fd_device_del_impl(dev);
-}
-
 drm_public void fd_device_del(struct fd_device *dev)
 {
 	if (!atomic_dec_and_test(&dev->refcnt))
 		return;
-	pthread_mutex_lock(&table_lock);
 	fd_device_del_impl(dev);
-	pthread_mutex_unlock(&table_lock);
 }
 
 drm_public int fd_device_fd(struct fd_device *dev)
@@ -139,6 +130,16 @@ drm_public int fd_device_fd(struct fd_device *dev)
 	return dev->fd;
 }
 
+drm_public void fd_device_get_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *bo_stats,
+		struct fd_bo_cache_stats *ring_stats)
+{
+	if (bo_stats)
+		fd_bo_cache_get_stats(&dev->bo_cache, bo_stats);
+	if (ring_stats)
+		fd_bo_cache_get_stats(&dev->ring_cache, ring_stats);
+}
+
 drm_public enum fd_version fd_device_version(struct fd_device *dev)
 {
 	return dev->version;
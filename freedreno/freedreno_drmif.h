@@ -75,6 +75,10 @@ enum fd_param_id {
 #define DRM_FREEDRENO_GEM_CACHE_WBACKWA   0x00800000
 #define DRM_FREEDRENO_GEM_CACHE_MASK      0x00f00000
 #define DRM_FREEDRENO_GEM_GPUREADONLY     0x01000000
+/* hint that the bo is only going to be accessed by the GPU (ie. a render
+ * target), so a recently freed but still busy bo may be recycled for it:
+ */
+#define DRM_FREEDRENO_GEM_ALLOC_FOR_RENDER 0x02000000
 
 /* bo access flags: (keep aligned to MSM_PREP_x) */
 #define DRM_FREEDRENO_PREP_READ           0x01
@@ -99,6 +103,22 @@ enum fd_version {
 };
 enum fd_version fd_device_version(struct fd_device *dev);
 
+/* bo cache counters.  Allocations too large for any cache bucket bypass
+ * the cache and are not counted:
+ */
+struct fd_bo_cache_stats {
+	uint64_t hits;           /* allocations served from the cache */
+	uint64_t misses;         /* allocations that needed a new bo */
+	uint64_t busy;           /* candidates skipped because still busy */
+	uint64_t incompatible;   /* candidates skipped because of their flags */
+	uint64_t purged;         /* hits whose pages had been reclaimed */
+	uint64_t freed;          /* bo's returned to the cache */
+	uint64_t expired;        /* bo's dropped from the cache by age */
+};
+void fd_device_get_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *bo_stats,
+		struct fd_bo_cache_stats *ring_stats);
+
 /* pipe functions:
  */
 
@@ -112,6 +132,11 @@ int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp);
 /* timeout in nanosec */
 int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout);
+/* wait until all fd_ringbuffer_flush_deferred()'s on the pipe have been
+ * submitted and write their out-fences, returns the first submit error
+ * since the last call:
+ */
+int fd_pipe_flush_wait(struct fd_pipe *pipe);
 
 
 /* buffer-object functions:
@@ -95,6 +95,13 @@ drm_public int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
 	return fd_pipe_wait_timeout(pipe, timestamp, ~0);
 }
 
+drm_public int fd_pipe_flush_wait(struct fd_pipe *pipe)
+{
+	if (!pipe->funcs->flush_wait)
+		return 0;
+	return pipe->funcs->flush_wait(pipe);
+}
+
 drm_public int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout)
 {
@@ -70,12 +70,16 @@ struct fd_device_funcs {
 
 struct fd_bo_bucket {
 	uint32_t size;
+	pthread_mutex_t lock;   /* protects list and stats */
 	struct list_head list;
+	struct fd_bo_cache_stats stats;
 };
 
 struct fd_bo_cache {
 	struct fd_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
+	int coarse;
+	pthread_mutex_t lock;   /* serializes cleanup, protects time */
 	time_t time;
 };
 
@@ -95,6 +99,11 @@ struct fd_device {
 	 */
 	void *handle_table, *name_table;
 
+	/* protects handle_table and name_table.  Lock order is
+	 * cache->lock -> table_lock -> bucket->lock:
+	 */
+	pthread_mutex_t table_lock;
+
 	const struct fd_device_funcs *funcs;
 
 	struct fd_bo_cache bo_cache;
@@ -107,19 +116,26 @@ struct fd_device {
 };
 
 drm_private void fd_bo_cache_init(struct fd_bo_cache *cache, int coarse);
-drm_private void fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time);
+drm_private void fd_bo_cache_cleanup(struct fd_device *dev,
+		struct fd_bo_cache *cache, time_t time);
 drm_private struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache,
 		uint32_t *size, uint32_t flags);
 drm_private int fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo);
+drm_private void fd_bo_cache_get_stats(struct fd_bo_cache *cache,
+		struct fd_bo_cache_stats *stats);
+drm_private void fd_bo_cache_remove(struct fd_bo_cache *cache, struct fd_bo *bo);
 
-/* for where @table_lock is already held: */
-drm_private void fd_device_del_locked(struct fd_device *dev);
+/* for where dev->table_lock is already held: */
+drm_private void bo_unlink_locked(struct fd_bo *bo);
+drm_private void bo_free(struct fd_bo *bo);
+drm_private void bo_del(struct fd_bo *bo);
 
 struct fd_pipe_funcs {
 	struct fd_ringbuffer * (*ringbuffer_new)(struct fd_pipe *pipe, uint32_t size,
 			enum fd_ringbuffer_flags flags);
 	int (*get_param)(struct fd_pipe *pipe, enum fd_param_id param, uint64_t *value);
 	int (*wait)(struct fd_pipe *pipe, uint32_t timestamp, uint64_t timeout);
+	int (*flush_wait)(struct fd_pipe *pipe);   /* optional */
 	void (*destroy)(struct fd_pipe *pipe);
 };
 
@@ -135,8 +151,13 @@ struct fd_ringbuffer_funcs {
 	void * (*hostptr)(struct fd_ringbuffer *ring);
 	int (*flush)(struct fd_ringbuffer *ring, uint32_t *last_start,
 			int in_fence_fd, int *out_fence_fd);
+	/* optional, falls back to flush: */
+	int (*flush_deferred)(struct fd_ringbuffer *ring, uint32_t *last_start,
+			int in_fence_fd, int *out_fence_fd);
 	void (*grow)(struct fd_ringbuffer *ring, uint32_t size);
 	void (*reset)(struct fd_ringbuffer *ring);
+	/* optional, for backends where last_timestamp may lag behind: */
+	uint32_t (*timestamp)(struct fd_ringbuffer *ring);
 	void (*emit_reloc)(struct fd_ringbuffer *ring,
 			const struct fd_reloc *reloc);
 	uint32_t (*emit_reloc_ring)(struct fd_ringbuffer *ring,
@@ -159,6 +180,7 @@ struct fd_bo {
 	uint32_t size;
 	uint32_t handle;
 	uint32_t name;
+	uint32_t flags;          /* allocation flags, for cache reuse */
 	void *map;
 	atomic_t refcnt;
 	const struct fd_bo_funcs *funcs;
@@ -121,6 +121,15 @@ drm_public int fd_ringbuffer_flush2(struct fd_ringbuffer *ring, int in_fence_fd,
 	return ring->funcs->flush(ring, ring->last_start, in_fence_fd, out_fence_fd);
 }
 
+drm_public int fd_ringbuffer_flush_deferred(struct fd_ringbuffer *ring,
+		int in_fence_fd, int *out_fence_fd)
+{
+	if (!ring->funcs->flush_deferred)
+		return ring->funcs->flush(ring, ring->last_start, in_fence_fd, out_fence_fd);
+	return ring->funcs->flush_deferred(ring, ring->last_start, in_fence_fd,
+			out_fence_fd);
+}
+
 drm_public void fd_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t ndwords)
 {
 	assert(ring->funcs->grow);     /* unsupported on kgsl */
@@ -139,6 +148,8 @@ drm_public void fd_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t ndwords)
 
 drm_public uint32_t fd_ringbuffer_timestamp(struct fd_ringbuffer *ring)
 {
+	if (ring->funcs->timestamp)
+		return ring->funcs->timestamp(ring);
 	return ring->last_timestamp;
 }
 
@@ -110,6 +110,16 @@ int fd_ringbuffer_flush(struct fd_ringbuffer *ring);
  */
 int fd_ringbuffer_flush2(struct fd_ringbuffer *ring, int in_fence_fd,
 		int *out_fence_fd);
+/* like fd_ringbuffer_flush2(), but the submit is handed to a per-pipe
+ * submit thread rather than waiting for the kernel.  Submits reach the
+ * kernel in the order they were flushed on the pipe.  The in_fence_fd is
+ * dup()'d, so the caller may close it straight away.  *out_fence_fd is
+ * set to -1, and only written with the fence by fd_pipe_flush_wait(), so
+ * it must stay valid until then.  fd_ringbuffer_timestamp() waits for
+ * the rb's deferred submits to reach the kernel.
+ */
+int fd_ringbuffer_flush_deferred(struct fd_ringbuffer *ring, int in_fence_fd,
+		int *out_fence_fd);
 void fd_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t ndwords);
 uint32_t fd_ringbuffer_timestamp(struct fd_ringbuffer *ring);
 
@@ -134,9 +134,389 @@ static void close_submitqueue(struct fd_pipe *pipe, uint32_t queue_id)
 			&queue_id, sizeof(queue_id));
 }
 
+/* has fence already been seen to pass?  (fences are seqno's, so compare
+ * allowing for wraparound)
+ */
+static int fence_passed(struct msm_pipe *msm_pipe, uint32_t fence)
+{
+	return (int32_t)(fence - msm_pipe->retired_fence) <= 0;
+}
+
+/* like msm_pipe_wait() with a zero timeout, but without complaining
+ * about fences which are still pending:
+ */
+static int fence_retired(struct fd_pipe *pipe, uint32_t fence)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct drm_msm_wait_fence req = {
+			.fence = fence,
+			.queueid = msm_pipe->queue_id,
+	};
+
+	if (fence_passed(msm_pipe, fence))
+		return TRUE;
+
+	get_abs_timeout(&req.timeout, 0);
+
+	if (drmCommandWrite(pipe->dev->fd, DRM_MSM_WAIT_FENCE, &req, sizeof(req)))
+		return FALSE;
+
+	msm_pipe->retired_fence = fence;
+
+	return TRUE;
+}
+
+/* slot sizes are powers of two from MSM_SLAB_MIN_SLOT (ie. 1 << 6): */
+static unsigned slab_class(uint32_t size)
+{
+	if (size <= MSM_SLAB_MIN_SLOT)
+		return 0;
+	return 32 - __builtin_clz(size - 1) - 6;
+}
+
+static struct msm_slab * slab_new(struct fd_pipe *pipe, uint32_t slot_size)
+{
+	uint32_t nr_slots = MSM_SLAB_SIZE / slot_size;
+	struct msm_slab *slab;
+	uint32_t i;
+
+	slab = calloc(1, sizeof(*slab) + nr_slots * sizeof(slab->fence[0]));
+	if (!slab)
+		return NULL;
+
+	slab->bo = fd_bo_new_ring(pipe->dev, MSM_SLAB_SIZE, 0);
+	if (!slab->bo) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->slot_size = slot_size;
+	slab->nr_slots = nr_slots;
+	slab->nr_free = nr_slots;
+
+	for (i = 0; i < nr_slots; i++)
+		slab->free_mask[i / 32] |= 1u << (i % 32);
+
+	return slab;
+}
+
+/* make freed slots available again once the gpu is done with them.  Try
+ * the newest pending fence first, since if that has passed so have all
+ * of them, otherwise see if at least the oldest has:
+ */
+static void slab_reclaim(struct fd_pipe *pipe, struct msm_slab *slab)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	uint32_t oldest = 0, newest = 0;
+	int pending = FALSE;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_SIZE(slab->busy_mask); i++) {
+		uint32_t bits = slab->busy_mask[i];
+
+		while (bits) {
+			uint32_t fence = slab->fence[i * 32 + ffs(bits) - 1];
+
+			if (!pending || (int32_t)(fence - oldest) < 0)
+				oldest = fence;
+			if (!pending || (int32_t)(fence - newest) > 0)
+				newest = fence;
+			pending = TRUE;
+
+			bits &= bits - 1;
+		}
+	}
+
+	if (!pending)
+		return;
+
+	if (!fence_retired(pipe, newest) && !fence_retired(pipe, oldest))
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(slab->busy_mask); i++) {
+		uint32_t bits = slab->busy_mask[i];
+
+		while (bits) {
+			unsigned bit = ffs(bits) - 1;
+
+			if (fence_passed(msm_pipe, slab->fence[i * 32 + bit])) {
+				slab->busy_mask[i] &= ~(1u << bit);
+				slab->free_mask[i] |= 1u << bit;
+				slab->nr_free++;
+			}
+
+			bits &= bits - 1;
+		}
+	}
+}
+
+/* allocate a slot for a stateobj rb of the given size, returning the slab
+ * (whose bo backs the rb) and the slot's offset in it.  Returns NULL if
+ * the rb is too large for a slot, or on allocation failure:
+ */
+drm_private struct msm_slab * msm_pipe_slab_alloc(struct fd_pipe *pipe,
+		uint32_t size, uint32_t *offset)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct list_head *slabs;
+	struct msm_slab *slab;
+	unsigned class, i, bit;
+
+	if (size > MSM_SLAB_MAX_SLOT)
+		return NULL;
+
+	class = slab_class(size);
+	slabs = &msm_pipe->slabs[class];
+
+	LIST_FOR_EACH_ENTRY(slab, slabs, node) {
+		if (slab->nr_free)
+			goto found;
+	}
+
+	LIST_FOR_EACH_ENTRY(slab, slabs, node) {
+		slab_reclaim(pipe, slab);
+		if (slab->nr_free)
+			goto found;
+	}
+
+	slab = slab_new(pipe, MSM_SLAB_MIN_SLOT << class);
+	if (!slab)
+		return NULL;
+
+	list_add(&slab->node, slabs);
+
+found:
+	for (i = 0; !slab->free_mask[i]; i++)
+		;
+
+	bit = ffs(slab->free_mask[i]) - 1;
+	slab->free_mask[i] &= ~(1u << bit);
+	slab->nr_free--;
+
+	*offset = (i * 32 + bit) * slab->slot_size;
+
+	return slab;
+}
+
+/* release a slot, which may still be read by the gpu until fence passes
+ * (or zero if the rb was never submitted):
+ */
+drm_private void msm_pipe_slab_free(struct fd_pipe *pipe,
+		struct msm_slab *slab, uint32_t offset, uint32_t fence)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	unsigned n = offset / slab->slot_size;
+
+	if (fence_passed(msm_pipe, fence)) {
+		slab->free_mask[n / 32] |= 1u << (n % 32);
+		slab->nr_free++;
+	} else {
+		slab->busy_mask[n / 32] |= 1u << (n % 32);
+		slab->fence[n] = fence;
+	}
+
+	/* keep slabs with room at the front, where the next alloc looks: */
+	list_del(&slab->node);
+	list_add(&slab->node, &msm_pipe->slabs[slab_class(slab->slot_size)]);
+}
+
+/* max # of deferred flushes in flight before the caller is throttled: */
+#define MSM_SUBMIT_QUEUE_DEPTH 16
+
+static void * submit_thread_main(void *arg)
+{
+	struct fd_pipe *pipe = arg;
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+
+	pthread_mutex_lock(&msm_pipe->submit_lock);
+	for (;;) {
+		struct msm_submit_job *job;
+
+		while (LIST_IS_EMPTY(&msm_pipe->submit_queue) &&
+				!msm_pipe->submit_thread_exit)
+			pthread_cond_wait(&msm_pipe->submit_cond, &msm_pipe->submit_lock);
+
+		if (LIST_IS_EMPTY(&msm_pipe->submit_queue))
+			break;
+
+		job = LIST_FIRST_ENTRY(&msm_pipe->submit_queue,
+				struct msm_submit_job, node);
+		pthread_mutex_unlock(&msm_pipe->submit_lock);
+
+		job->ret = drmCommandWriteRead(pipe->dev->fd, DRM_MSM_GEM_SUBMIT,
+				&job->req, sizeof(job->req));
+
+		pthread_mutex_lock(&msm_pipe->submit_lock);
+		list_del(&job->node);
+		list_addtail(&job->node, &msm_pipe->submit_done);
+		msm_pipe->submit_queued--;
+		pthread_cond_broadcast(&msm_pipe->submit_cond);
+	}
+	pthread_mutex_unlock(&msm_pipe->submit_lock);
+
+	return NULL;
+}
+
+/* drop everything the job holds on to, but its out-fence: */
+static void job_release(struct msm_submit_job *job)
+{
+	unsigned i;
+
+	for (i = 0; i < job->nr_rings; i++)
+		fd_ringbuffer_del(job->rings[i]);
+	for (i = 0; i < job->nr_bos; i++)
+		fd_bo_del(job->bos[i]);
+	if (job->in_fence_fd != -1)
+		close(job->in_fence_fd);
+
+	free(job->submit_bos);
+	free(job->submit_cmds);
+	free(job->relocs);
+	free(job->bos);
+	free(job->rings);
+}
+
+/* hand the results of completed jobs back to their rb's, and drop the
+ * job's references.  The first submit error is kept for flush_wait, and
+ * jobs with an out-fence move to submit_fenced:
+ */
+static void retire_jobs(struct fd_pipe *pipe)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct msm_submit_job *job, *tmp;
+	struct list_head done;
+
+	pthread_mutex_lock(&msm_pipe->submit_lock);
+	if (LIST_IS_EMPTY(&msm_pipe->submit_done)) {
+		pthread_mutex_unlock(&msm_pipe->submit_lock);
+		return;
+	}
+	list_replace(&msm_pipe->submit_done, &done);
+	list_inithead(&msm_pipe->submit_done);
+	pthread_mutex_unlock(&msm_pipe->submit_lock);
+
+	LIST_FOR_EACH_ENTRY_SAFE(job, tmp, &done, node) {
+		unsigned i;
+
+		if (job->ret) {
+			ERROR_MSG("submit failed: %d (%s)", job->ret, strerror(-job->ret));
+			if (!msm_pipe->submit_error)
+				msm_pipe->submit_error = job->ret;
+		} else if (job->out_fence_fd) {
+			job->fence_fd = job->req.fence_fd;
+		}
+
+		for (i = 0; i < job->nr_rings; i++)
+			msm_ringbuffer_retire(job->rings[i], !job->ret, job->req.fence);
+
+		list_del(&job->node);
+		job_release(job);
+
+		if (job->out_fence_fd)
+			list_addtail(&job->node, &msm_pipe->submit_fenced);
+		else
+			free(job);
+	}
+}
+
+/* hand out the fences of retired jobs, or close them if @publish is
+ * false since nobody is waiting for them anymore:
+ */
+static void release_fences(struct fd_pipe *pipe, int publish)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct msm_submit_job *job, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(job, tmp, &msm_pipe->submit_fenced, node) {
+		if (publish)
+			*job->out_fence_fd = job->fence_fd;
+		else if (job->fence_fd != -1)
+			close(job->fence_fd);
+		list_del(&job->node);
+		free(job);
+	}
+}
+
+drm_private void msm_pipe_submit_queue(struct fd_pipe *pipe,
+		struct msm_submit_job *job)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+
+	retire_jobs(pipe);
+
+	pthread_mutex_lock(&msm_pipe->submit_lock);
+
+	if (!msm_pipe->submit_thread_running) {
+		if (pthread_create(&msm_pipe->submit_thread, NULL,
+				submit_thread_main, pipe)) {
+			/* no thread, so just submit it here: */
+			job->ret = drmCommandWriteRead(pipe->dev->fd, DRM_MSM_GEM_SUBMIT,
+					&job->req, sizeof(job->req));
+			list_addtail(&job->node, &msm_pipe->submit_done);
+			pthread_mutex_unlock(&msm_pipe->submit_lock);
+			return;
+		}
+		msm_pipe->submit_thread_running = TRUE;
+	}
+
+	while (msm_pipe->submit_queued >= MSM_SUBMIT_QUEUE_DEPTH)
+		pthread_cond_wait(&msm_pipe->submit_cond, &msm_pipe->submit_lock);
+
+	list_addtail(&job->node, &msm_pipe->submit_queue);
+	msm_pipe->submit_queued++;
+	pthread_cond_broadcast(&msm_pipe->submit_cond);
+
+	pthread_mutex_unlock(&msm_pipe->submit_lock);
+}
+
+/* wait for the queued jobs to reach the kernel, and retire them: */
+drm_private void msm_pipe_submit_drain(struct fd_pipe *pipe)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+
+	pthread_mutex_lock(&msm_pipe->submit_lock);
+	while (msm_pipe->submit_queued)
+		pthread_cond_wait(&msm_pipe->submit_cond, &msm_pipe->submit_lock);
+	pthread_mutex_unlock(&msm_pipe->submit_lock);
+
+	retire_jobs(pipe);
+}
+
+drm_private int msm_pipe_flush_wait(struct fd_pipe *pipe)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	int ret;
+
+	msm_pipe_submit_drain(pipe);
+	release_fences(pipe, TRUE);
+
+	ret = msm_pipe->submit_error;
+	msm_pipe->submit_error = 0;
+
+	return ret;
+}
+
 static void msm_pipe_destroy(struct fd_pipe *pipe)
 {
 	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	unsigned i;
+
+	if (msm_pipe->submit_thread_running) {
+		msm_pipe_submit_drain(pipe);
+
+		pthread_mutex_lock(&msm_pipe->submit_lock);
+		msm_pipe->submit_thread_exit = TRUE;
+		pthread_cond_broadcast(&msm_pipe->submit_cond);
+		pthread_mutex_unlock(&msm_pipe->submit_lock);
+
+		pthread_join(msm_pipe->submit_thread, NULL);
+	}
+	retire_jobs(pipe);
+	release_fences(pipe, FALSE);
+
+	pthread_mutex_destroy(&msm_pipe->submit_lock);
+	pthread_cond_destroy(&msm_pipe->submit_cond);
+
 	close_submitqueue(pipe, msm_pipe->queue_id);
 
 	if (msm_pipe->suballoc_ring) {
@@ -144,6 +524,15 @@ static void msm_pipe_destroy(struct fd_pipe *pipe)
 		msm_pipe->suballoc_ring = NULL;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(msm_pipe->slabs); i++) {
+		struct msm_slab *slab, *tmp;
+
+		LIST_FOR_EACH_ENTRY_SAFE(slab, tmp, &msm_pipe->slabs[i], node) {
+			fd_bo_del(slab->bo);
+			free(slab);
+		}
+	}
+
 	free(msm_pipe);
 }
 
@@ -151,6 +540,7 @@ static const struct fd_pipe_funcs funcs = {
 		.ringbuffer_new = msm_ringbuffer_new,
 		.get_param = msm_pipe_get_param,
 		.wait = msm_pipe_wait,
+		.flush_wait = msm_pipe_flush_wait,
 		.destroy = msm_pipe_destroy,
 };
 
@@ -174,6 +564,7 @@ drm_private struct fd_pipe * msm_pipe_new(struct fd_device *dev,
 	};
 	struct msm_pipe *msm_pipe = NULL;
 	struct fd_pipe *pipe = NULL;
+	unsigned i;
 
 	msm_pipe = calloc(1, sizeof(*msm_pipe));
 	if (!msm_pipe) {
@@ -181,6 +572,15 @@ drm_private struct fd_pipe * msm_pipe_new(struct fd_device *dev,
 		goto fail;
 	}
 
+	for (i = 0; i < ARRAY_SIZE(msm_pipe->slabs); i++)
+		list_inithead(&msm_pipe->slabs[i]);
+
+	pthread_mutex_init(&msm_pipe->submit_lock, NULL);
+	pthread_cond_init(&msm_pipe->submit_cond, NULL);
+	list_inithead(&msm_pipe->submit_queue);
+	list_inithead(&msm_pipe->submit_done);
+	list_inithead(&msm_pipe->submit_fenced);
+
 	pipe = &msm_pipe->base;
 	pipe->funcs = &funcs;
 
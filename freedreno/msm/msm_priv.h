@@ -50,6 +50,11 @@ static inline struct msm_device * to_msm_device(struct fd_device *x)
 
 drm_private struct fd_device * msm_device_new(int fd);
 
+#define MSM_SLAB_SIZE      0x8000
+#define MSM_SLAB_MIN_SLOT  0x40
+#define MSM_SLAB_MAX_SLOT  0x1000
+#define MSM_SLAB_CLASSES   7      /* MSM_SLAB_MIN_SLOT .. MSM_SLAB_MAX_SLOT */
+
 struct msm_pipe {
 	struct fd_pipe base;
 	uint32_t pipe;
@@ -68,6 +73,75 @@ struct msm_pipe {
 	 * so we can reclaim extra space at it's end.
 	 */
 	struct fd_ringbuffer *suballoc_ring;
+
+	/* Longer lived (non-streaming) stateobj rb's that are small enough
+	 * get a fixed size slot in a shared slab bo, rather than a bo of
+	 * their own.  One list of slabs per power-of-two slot size.  Freed
+	 * slots are only handed out again once the last submit that used
+	 * them has retired, which is checked against retired_fence (the
+	 * newest fence known to have passed) before asking the kernel.
+	 */
+	struct list_head slabs[MSM_SLAB_CLASSES];
+	uint32_t retired_fence;
+
+	/* Deferred flushes are queued as msm_submit_job's for a submit
+	 * thread, started on first use.  Jobs stay on submit_queue until
+	 * the ioctl has returned, then move to submit_done, from where
+	 * they are retired on the pipe's own thread (in flush and
+	 * flush_wait), since retiring drops rb refs.  Jobs with an
+	 * out-fence then wait on submit_fenced, holding on to just the
+	 * fence, until flush_wait hands it to the caller.  The first
+	 * submit error is kept in submit_error until flush_wait reports
+	 * it:
+	 */
+	pthread_mutex_t submit_lock;
+	pthread_cond_t submit_cond;
+	struct list_head submit_queue;
+	struct list_head submit_done;
+	struct list_head submit_fenced;
+	unsigned submit_queued;
+	int submit_error;
+	int submit_thread_running;
+	int submit_thread_exit;
+	pthread_t submit_thread;
+};
+
+/* a frozen submit, which owns the tables the submit ioctl points at as
+ * well as references to the bo's and rb's involved:
+ */
+struct msm_submit_job {
+	struct list_head node;
+	struct drm_msm_gem_submit req;
+
+	struct drm_msm_gem_submit_bo *submit_bos;
+	struct drm_msm_gem_submit_cmd *submit_cmds;
+	struct drm_msm_gem_submit_reloc *relocs;
+
+	struct fd_bo **bos;
+	unsigned nr_bos;
+
+	/* rb's to update last_timestamp on: */
+	struct fd_ringbuffer **rings;
+	unsigned nr_rings;
+
+	int in_fence_fd;     /* our own dup(), or -1 */
+	int *out_fence_fd;   /* written by flush_wait */
+	int fence_fd;        /* the out-fence once retired, or -1 */
+	int ret;
+};
+
+struct msm_slab {
+	struct list_head node;
+	struct fd_bo *bo;
+	uint32_t slot_size;
+	uint32_t nr_slots;
+	uint32_t nr_free;
+
+	/* slot is available: */
+	uint32_t free_mask[MSM_SLAB_SIZE / MSM_SLAB_MIN_SLOT / 32];
+	/* slot was freed but may still be in use by the gpu until fence[n]: */
+	uint32_t busy_mask[MSM_SLAB_SIZE / MSM_SLAB_MIN_SLOT / 32];
+	uint32_t fence[];
 };
 
 static inline struct msm_pipe * to_msm_pipe(struct fd_pipe *x)
@@ -78,8 +152,20 @@ static inline struct msm_pipe * to_msm_pipe(struct fd_pipe *x)
 drm_private struct fd_pipe * msm_pipe_new(struct fd_device *dev,
 		enum fd_pipe_id id, uint32_t prio);
 
+drm_private struct msm_slab * msm_pipe_slab_alloc(struct fd_pipe *pipe,
+		uint32_t size, uint32_t *offset);
+drm_private void msm_pipe_slab_free(struct fd_pipe *pipe,
+		struct msm_slab *slab, uint32_t offset, uint32_t fence);
+
+drm_private void msm_pipe_submit_queue(struct fd_pipe *pipe,
+		struct msm_submit_job *job);
+drm_private void msm_pipe_submit_drain(struct fd_pipe *pipe);
+drm_private int msm_pipe_flush_wait(struct fd_pipe *pipe);
+
 drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 		uint32_t size, enum fd_ringbuffer_flags flags);
+drm_private void msm_ringbuffer_retire(struct fd_ringbuffer *ring,
+		int submitted, uint32_t fence);
 
 struct msm_bo {
 	struct fd_bo base;
@@ -87,10 +173,12 @@ struct msm_bo {
 	uint64_t presumed;
 	/* to avoid excess hashtable lookups, cache the ring this bo was
 	 * last emitted on (since that will probably also be the next ring
-	 * it is emitted on)
+	 * it is emitted on): the ring's seqno in the upper 32 bits, and the
+	 * bo's idx in that ring in the lower.  Rings being built on other
+	 * threads may overwrite it at any time, so it is only accessed
+	 * atomically, and checked against the ring before use.
 	 */
-	unsigned current_ring_seqno;
-	uint32_t idx;
+	uint64_t ring_hint;
 };
 
 static inline struct msm_bo * to_msm_bo(struct fd_bo *x)
@@ -30,6 +30,7 @@
 #include <inttypes.h>
 
 #include "xf86atomic.h"
+#include "util_bo_table.h"
 #include "freedreno_ringbuffer.h"
 #include "msm_priv.h"
 
@@ -89,11 +90,15 @@ struct msm_ringbuffer {
 	unsigned cmd_count;
 
 	unsigned offset;    /* for sub-allocated stateobj rb's */
+	struct msm_slab *slab;  /* for slab allocated stateobj rb's */
+
+	/* # of deferred submits using this rb which are not retired yet: */
+	unsigned deferred;
 
 	unsigned seqno;
 
-	/* maps fd_bo to idx: */
-	void *bo_table;
+	/* maps bo handle to idx in submit.bos: */
+	struct util_bo_table bo_table;
 
 	/* maps msm_cmd to drm_msm_gem_submit_cmd in parent rb.  Each rb has a
 	 * list of msm_cmd's which correspond to each chunk of cmdstream in
@@ -115,8 +120,6 @@ static inline struct msm_ringbuffer * to_msm_ringbuffer(struct fd_ringbuffer *x)
 
 #define INIT_SIZE 0x1000
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
-
 static struct msm_cmd *current_cmd(struct fd_ringbuffer *ring)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
@@ -144,8 +147,8 @@ static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 
 	cmd->ring = ring;
 
-	/* TODO separate suballoc buffer for small non-streaming state, using
-	 * smaller page-sized backing bo's.
+	/* small non-streaming state goes in a slot of a shared slab bo
+	 * (see msm_pipe_slab_alloc()), falling back to a bo of its own:
 	 */
 	if (flags & FD_RINGBUFFER_STREAMING) {
 		struct msm_pipe *msm_pipe = to_msm_pipe(ring->pipe);
@@ -183,7 +186,15 @@ static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 
 		msm_pipe->suballoc_ring = fd_ringbuffer_ref(ring);
 	} else {
-		cmd->ring_bo = fd_bo_new_ring(ring->pipe->dev, size, 0);
+		if (flags & FD_RINGBUFFER_OBJECT) {
+			msm_ring->slab = msm_pipe_slab_alloc(ring->pipe, size,
+					&msm_ring->offset);
+		}
+
+		if (msm_ring->slab)
+			cmd->ring_bo = fd_bo_ref(msm_ring->slab->bo);
+		else
+			cmd->ring_bo = fd_bo_new_ring(ring->pipe->dev, size, 0);
 	}
 	if (!cmd->ring_bo)
 		goto fail;
@@ -215,33 +226,31 @@ static uint32_t append_bo(struct fd_ringbuffer *ring, struct fd_bo *bo)
 	return idx;
 }
 
+static uint32_t lookup_bo(struct fd_ringbuffer *ring, struct fd_bo *bo)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	uint32_t idx;
+
+	idx = util_bo_table_lookup(&msm_ring->bo_table, msm_ring->submit.bos,
+			msm_ring->submit.nr_bos, bo->handle);
+	if (idx == msm_ring->submit.nr_bos)
+		idx = append_bo(ring, bo);
+
+	return idx;
+}
+
 /* add (if needed) bo, return idx: */
 static uint32_t bo2idx(struct fd_ringbuffer *ring, struct fd_bo *bo, uint32_t flags)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	struct msm_bo *msm_bo = to_msm_bo(bo);
-	uint32_t idx;
-	pthread_mutex_lock(&idx_lock);
-	if (msm_bo->current_ring_seqno == msm_ring->seqno) {
-		idx = msm_bo->idx;
-	} else {
-		void *val;
+	uint32_t idx = util_bo_hint_get(&msm_bo->ring_hint, msm_ring->seqno);
 
-		if (!msm_ring->bo_table)
-			msm_ring->bo_table = drmHashCreate();
-
-		if (!drmHashLookup(msm_ring->bo_table, bo->handle, &val)) {
-			/* found */
-			idx = (uint32_t)(uintptr_t)val;
-		} else {
-			idx = append_bo(ring, bo);
-			val = (void *)(uintptr_t)idx;
-			drmHashInsert(msm_ring->bo_table, bo->handle, val);
-		}
-		msm_bo->current_ring_seqno = msm_ring->seqno;
-		msm_bo->idx = idx;
+	if (idx >= msm_ring->nr_bos || msm_ring->bos[idx] != bo) {
+		idx = lookup_bo(ring, bo);
+		util_bo_hint_set(&msm_bo->ring_hint, msm_ring->seqno, idx);
 	}
-	pthread_mutex_unlock(&idx_lock);
+
 	if (flags & FD_RELOC_READ)
 		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_READ;
 	if (flags & FD_RELOC_WRITE)
@@ -332,12 +341,12 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	unsigned i;
 
+	/* no need to clear the bos' ring_hint, with nr_bos reset below it
+	 * won't match anymore:
+	 */
 	for (i = 0; i < msm_ring->nr_bos; i++) {
-		struct msm_bo *msm_bo = to_msm_bo(msm_ring->bos[i]);
-		if (!msm_bo)
-			continue;
-		msm_bo->current_ring_seqno = 0;
-		fd_bo_del(&msm_bo->base);
+		if (msm_ring->bos[i])
+			fd_bo_del(msm_ring->bos[i]);
 	}
 
 	for (i = 0; i < msm_ring->nr_cmds; i++) {
@@ -355,10 +364,7 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	msm_ring->nr_cmds = 0;
 	msm_ring->nr_bos = 0;
 
-	if (msm_ring->bo_table) {
-		drmHashDestroy(msm_ring->bo_table);
-		msm_ring->bo_table = NULL;
-	}
+	util_bo_table_clear(&msm_ring->bo_table);
 
 	if (msm_ring->cmd_table) {
 		drmHashDestroy(msm_ring->cmd_table);
@@ -420,20 +426,30 @@ handle_stateobj_relocs(struct fd_ringbuffer *parent, struct fd_ringbuffer *state
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(stateobj);
 	struct drm_msm_gem_submit_reloc *relocs = malloc(nr_relocs * sizeof(*relocs));
+	unsigned last_idx = ~0, parent_idx = 0;
 	unsigned i;
 
 	for (i = 0; i < nr_relocs; i++) {
 		unsigned idx = orig_relocs[i].reloc_idx;
-		struct fd_bo *bo = msm_ring->bos[idx];
-		unsigned flags = 0;
 
-		if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_READ)
-			flags |= FD_RELOC_READ;
-		if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_WRITE)
-			flags |= FD_RELOC_WRITE;
+		/* relocs come in runs against the same bo (at least the lo/hi
+		 * pairs on a5xx+), so only translate once per run:
+		 */
+		if (idx != last_idx) {
+			struct fd_bo *bo = msm_ring->bos[idx];
+			unsigned flags = 0;
+
+			if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_READ)
+				flags |= FD_RELOC_READ;
+			if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_WRITE)
+				flags |= FD_RELOC_WRITE;
+
+			parent_idx = bo2idx(parent, bo, flags);
+			last_idx = idx;
+		}
 
 		relocs[i] = orig_relocs[i];
-		relocs[i].reloc_idx = bo2idx(parent, bo, flags);
+		relocs[i].reloc_idx = parent_idx;
 	}
 
 	/* stateobj rb's could have reloc's to other stateobj rb's which didn't
@@ -457,32 +473,14 @@ handle_stateobj_relocs(struct fd_ringbuffer *parent, struct fd_ringbuffer *state
 	return relocs;
 }
 
-static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start,
-		int in_fence_fd, int *out_fence_fd)
+/* finalize the submit tables, for each of the cmd's fix up their reloc's: */
+static void prepare_submit(struct fd_ringbuffer *ring, uint32_t *last_start)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
-	struct msm_pipe *msm_pipe = to_msm_pipe(ring->pipe);
-	struct drm_msm_gem_submit req = {
-			.flags = msm_pipe->pipe,
-			.queueid = msm_pipe->queue_id,
-	};
 	uint32_t i;
-	int ret;
-
-	assert(!ring->parent);
-
-	if (in_fence_fd != -1) {
-		req.flags |= MSM_SUBMIT_FENCE_FD_IN | MSM_SUBMIT_NO_IMPLICIT;
-		req.fence_fd = in_fence_fd;
-	}
-
-	if (out_fence_fd) {
-		req.flags |= MSM_SUBMIT_FENCE_FD_OUT;
-	}
 
 	finalize_current_cmd(ring, last_start);
 
-	/* for each of the cmd's fix up their reloc's: */
 	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
 		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
 		struct drm_msm_gem_submit_reloc *relocs = msm_cmd->relocs;
@@ -504,6 +502,41 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 		cmd->relocs = VOID2U64(relocs);
 		cmd->nr_relocs = nr_relocs;
 	}
+}
+
+static void init_submit_req(struct fd_ringbuffer *ring,
+		struct drm_msm_gem_submit *req, int in_fence_fd, int *out_fence_fd)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(ring->pipe);
+
+	req->flags = msm_pipe->pipe;
+	req->queueid = msm_pipe->queue_id;
+
+	if (in_fence_fd != -1) {
+		req->flags |= MSM_SUBMIT_FENCE_FD_IN | MSM_SUBMIT_NO_IMPLICIT;
+		req->fence_fd = in_fence_fd;
+	}
+
+	if (out_fence_fd) {
+		req->flags |= MSM_SUBMIT_FENCE_FD_OUT;
+	}
+}
+
+/* submit the prepared tables right away: */
+static int submit_prepared(struct fd_ringbuffer *ring, int in_fence_fd,
+		int *out_fence_fd)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct msm_pipe *msm_pipe = to_msm_pipe(ring->pipe);
+	struct drm_msm_gem_submit req = {0};
+	uint32_t i;
+	int ret;
+
+	/* don't overtake earlier deferred flushes: */
+	if (msm_pipe->submit_thread_running)
+		msm_pipe_submit_drain(ring->pipe);
+
+	init_submit_req(ring, &req, in_fence_fd, out_fence_fd);
 
 	/* needs to be after get_cmd() as that could create bos/cmds table: */
 	req.bos = VOID2U64(msm_ring->submit.bos),
@@ -544,6 +577,151 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 	return ret;
 }
 
+static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start,
+		int in_fence_fd, int *out_fence_fd)
+{
+	assert(!ring->parent);
+
+	prepare_submit(ring, last_start);
+
+	return submit_prepared(ring, in_fence_fd, out_fence_fd);
+}
+
+/* Take the (prepared) submit tables, and references to everything they
+ * point at, out of the rb so that it can be reset and reused while the
+ * submit is still waiting for the submit thread.  Returns NULL, leaving
+ * the rb as it was, on allocation failure:
+ */
+static struct msm_submit_job * freeze_submit(struct fd_ringbuffer *ring,
+		int in_fence_fd, int *out_fence_fd)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct drm_msm_gem_submit_reloc *relocs;
+	struct msm_submit_job *job;
+	uint32_t i, nr_relocs = 0;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return NULL;
+
+	for (i = 0; i < msm_ring->submit.nr_cmds; i++)
+		nr_relocs += msm_ring->submit.cmds[i].nr_relocs;
+
+	if (nr_relocs)
+		job->relocs = malloc(nr_relocs * sizeof(job->relocs[0]));
+	job->rings = malloc(msm_ring->submit.nr_cmds * sizeof(job->rings[0]));
+	job->in_fence_fd = (in_fence_fd != -1) ? dup(in_fence_fd) : -1;
+
+	if ((nr_relocs && !job->relocs) || !job->rings ||
+			((in_fence_fd != -1) && (job->in_fence_fd == -1))) {
+		if (job->in_fence_fd != -1)
+			close(job->in_fence_fd);
+		free(job->relocs);
+		free(job->rings);
+		free(job);
+		return NULL;
+	}
+
+	/* the relocs tables belong to the cmds, which may be reused (or
+	 * freed) as soon as we return, so they need to be copied:
+	 */
+	relocs = job->relocs;
+	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
+		struct drm_msm_gem_submit_cmd *cmd = &msm_ring->submit.cmds[i];
+		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
+		struct drm_msm_gem_submit_reloc *orig = U642VOID(cmd->relocs);
+
+		if (cmd->nr_relocs)
+			memcpy(relocs, orig, cmd->nr_relocs * sizeof(*relocs));
+		if (msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT)
+			free(orig);
+		cmd->relocs = VOID2U64(relocs);
+		relocs += cmd->nr_relocs;
+
+		if (!job->nr_rings || (job->rings[job->nr_rings - 1] != msm_cmd->ring)) {
+			job->rings[job->nr_rings++] = fd_ringbuffer_ref(msm_cmd->ring);
+			to_msm_ringbuffer(msm_cmd->ring)->deferred++;
+		}
+	}
+
+	init_submit_req(ring, &job->req, job->in_fence_fd, out_fence_fd);
+
+	/* and the bos/cmds tables (and the bo references in the bos table)
+	 * move to the job entirely:
+	 */
+	job->submit_bos = msm_ring->submit.bos;
+	job->submit_cmds = msm_ring->submit.cmds;
+	job->bos = msm_ring->bos;
+	job->nr_bos = msm_ring->nr_bos;
+
+	job->req.bos = VOID2U64(job->submit_bos);
+	job->req.nr_bos = msm_ring->submit.nr_bos;
+	job->req.cmds = VOID2U64(job->submit_cmds);
+	job->req.nr_cmds = msm_ring->submit.nr_cmds;
+
+	msm_ring->submit.bos = NULL;
+	msm_ring->submit.nr_bos = msm_ring->submit.max_bos = 0;
+	msm_ring->submit.cmds = NULL;
+	msm_ring->submit.nr_cmds = msm_ring->submit.max_cmds = 0;
+	msm_ring->bos = NULL;
+	msm_ring->nr_bos = msm_ring->max_bos = 0;
+
+	job->fence_fd = -1;
+	if (out_fence_fd) {
+		job->out_fence_fd = out_fence_fd;
+		*out_fence_fd = -1;
+	}
+
+	return job;
+}
+
+static int msm_ringbuffer_flush_deferred(struct fd_ringbuffer *ring,
+		uint32_t *last_start, int in_fence_fd, int *out_fence_fd)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+	struct msm_submit_job *job;
+
+	assert(!ring->parent);
+
+	/* a non-growable rb keeps writing to the same cmdstream bo after
+	 * the flush, so it can't be left for the submit thread:
+	 */
+	if (!msm_ring->is_growable)
+		return msm_ringbuffer_flush(ring, last_start, in_fence_fd, out_fence_fd);
+
+	prepare_submit(ring, last_start);
+
+	job = freeze_submit(ring, in_fence_fd, out_fence_fd);
+	if (!job)
+		return submit_prepared(ring, in_fence_fd, out_fence_fd);
+
+	flush_reset(ring);
+
+	msm_pipe_submit_queue(ring->pipe, job);
+
+	return 0;
+}
+
+/* called as a deferred submit using the rb retires: */
+drm_private void msm_ringbuffer_retire(struct fd_ringbuffer *ring,
+		int submitted, uint32_t fence)
+{
+	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
+
+	assert(msm_ring->deferred > 0);
+	msm_ring->deferred--;
+	if (submitted)
+		ring->last_timestamp = fence;
+}
+
+static uint32_t msm_ringbuffer_timestamp(struct fd_ringbuffer *ring)
+{
+	/* the fence of a deferred submit is only known once it is in: */
+	if (to_msm_ringbuffer(ring)->deferred)
+		msm_pipe_submit_drain(ring->pipe);
+	return ring->last_timestamp;
+}
+
 static void msm_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t size)
 {
 	assert(to_msm_ringbuffer(ring)->is_growable);
@@ -671,8 +849,14 @@ static void msm_ringbuffer_destroy(struct fd_ringbuffer *ring)
 	flush_reset(ring);
 	delete_cmds(msm_ring);
 
+	if (msm_ring->slab) {
+		msm_pipe_slab_free(ring->pipe, msm_ring->slab, msm_ring->offset,
+				ring->last_timestamp);
+	}
+
 	free(msm_ring->submit.cmds);
 	free(msm_ring->submit.bos);
+	util_bo_table_fini(&msm_ring->bo_table);
 	free(msm_ring->bos);
 	free(msm_ring->cmds);
 	free(msm_ring);
@@ -681,8 +865,10 @@ static void msm_ringbuffer_destroy(struct fd_ringbuffer *ring)
 static const struct fd_ringbuffer_funcs funcs = {
 		.hostptr = msm_ringbuffer_hostptr,
 		.flush = msm_ringbuffer_flush,
+		.flush_deferred = msm_ringbuffer_flush_deferred,
 		.grow = msm_ringbuffer_grow,
 		.reset = msm_ringbuffer_reset,
+		.timestamp = msm_ringbuffer_timestamp,
 		.emit_reloc = msm_ringbuffer_emit_reloc,
 		.emit_reloc_ring = msm_ringbuffer_emit_reloc_ring,
 		.cmd_count = msm_ringbuffer_cmd_count,
@@ -302,10 +302,8 @@ drm_intel_bo_madvise(drm_intel_bo *bo, int madv)
 drm_public int
 drm_intel_bo_use_48b_address_range(drm_intel_bo *bo, uint32_t enable)
 {
-	if (bo->bufmgr->bo_use_48b_address_range) {
-		bo->bufmgr->bo_use_48b_address_range(bo, enable);
-		return 0;
-	}
+	if (bo->bufmgr->bo_use_48b_address_range)
+		return bo->bufmgr->bo_use_48b_address_range(bo, enable);
 
 	return -ENODEV;
 }
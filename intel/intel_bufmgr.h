@@ -178,8 +178,61 @@ drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						unsigned int handle);
 void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
+int drm_intel_bufmgr_gem_enable_softpin(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+
+enum drm_intel_vma_view {
+	DRM_INTEL_VMA_CPU,
+	DRM_INTEL_VMA_WC,
+	DRM_INTEL_VMA_GTT,
+	DRM_INTEL_VMA_VIEWS
+};
+
+struct drm_intel_bufmgr_gem_vma_stats {
+	/** Number and size of the mappings kept for unmapped buffers */
+	uint32_t cached[DRM_INTEL_VMA_VIEWS];
+	uint64_t cached_bytes[DRM_INTEL_VMA_VIEWS];
+	/** Number of buffers currently mapped */
+	uint32_t open;
+	/** Maps that reused an existing mapping/had to create one */
+	uint64_t hits;
+	uint64_t misses;
+	/** Cached mappings released to stay within the limits */
+	uint64_t unmaps;
+	uint64_t unmapped_bytes;
+};
+
+void drm_intel_bufmgr_gem_set_vma_cache_budget(drm_intel_bufmgr *bufmgr,
+					       uint64_t bytes, int small_count);
+void drm_intel_bufmgr_gem_set_vma_view_budget(drm_intel_bufmgr *bufmgr,
+					      enum drm_intel_vma_view view,
+					      uint64_t bytes);
+int drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr,
+					     struct drm_intel_bufmgr_gem_vma_stats *stats);
+
+struct drm_intel_bufmgr_gem_cache_stats {
+	/** Size and number of the buffers held in the reuse cache */
+	uint64_t cached_bytes;
+	uint32_t cached_bos;
+	/** Number of times memory pressure dropped the cache */
+	uint32_t pressure_events;
+	/** Size of the buffers held in per-thread caches */
+	uint64_t thread_cached_bytes;
+	/** Allocations of cacheable sizes that were/weren't reused */
+	uint64_t hits;
+	uint64_t misses;
+	/** Bytes released for exceeding the budget or under pressure */
+	uint64_t trimmed_bytes;
+	/** Bytes released for staying unused in the cache */
+	uint64_t expired_bytes;
+};
+
+void drm_intel_bufmgr_gem_set_cache_size(drm_intel_bufmgr *bufmgr,
+					 uint64_t high, uint64_t low);
+int drm_intel_bufmgr_gem_enable_pressure_trim(drm_intel_bufmgr *bufmgr);
+int drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+					 struct drm_intel_bufmgr_gem_cache_stats *stats);
 int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
@@ -193,6 +246,9 @@ void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo);
 void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo);
 void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo);
 
+void drm_intel_memcpy_from_wc(void *dst, const void *src, size_t n);
+void drm_intel_memcpy_to_wc(void *dst, const void *src, size_t n);
+
 int drm_intel_gem_bo_get_reloc_count(drm_intel_bo *bo);
 void drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start);
 void drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable);
@@ -266,6 +322,80 @@ void drm_intel_bo_fake_disable_backing_store(drm_intel_bo *bo,
 void drm_intel_bufmgr_fake_contended_lock_take(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr);
 
+struct drm_intel_bufmgr_fake_stats {
+	/** Buffers kicked out of the aperture to make room */
+	uint64_t evictions;
+	/** Waits on a fence, whether to free space or for idle */
+	uint64_t fence_waits;
+	uint64_t aperture_size;
+	/** Free space in the aperture, and the largest hole in it */
+	uint64_t free_bytes;
+	uint64_t largest_free;
+	uint32_t free_blocks;
+};
+
+int drm_intel_bufmgr_fake_get_stats(drm_intel_bufmgr *bufmgr,
+				    struct drm_intel_bufmgr_fake_stats *stats);
+
+/* intel_bufmgr_trace.c */
+int drm_intel_bufmgr_start_trace(drm_intel_bufmgr *bufmgr, FILE *file);
+void drm_intel_bufmgr_stop_trace(drm_intel_bufmgr *bufmgr);
+
+enum drm_intel_decode_field_type {
+	DRM_INTEL_DECODE_FIELD_INT,
+	/** Also used for flags, which are 0 or 1. */
+	DRM_INTEL_DECODE_FIELD_UINT,
+	DRM_INTEL_DECODE_FIELD_FLOAT,
+	/** Symbolic value, e.g. a compare function or surface format. */
+	DRM_INTEL_DECODE_FIELD_STRING,
+};
+
+/** A decoded field of a packet, as reported by the decode packet callback. */
+struct drm_intel_decode_field {
+	/** Index of the DWORD within the packet the field was decoded from. */
+	uint32_t index;
+	/**
+	 * Field name, e.g. "pitch" or "depth_write_enable".  Names repeat
+	 * for repeated structures, e.g. per vertex element; tell them apart
+	 * by index.
+	 */
+	const char *name;
+	enum drm_intel_decode_field_type type;
+	union {
+		int64_t i;
+		uint64_t u;
+		double f;
+		const char *s;
+	} value;
+};
+
+/** A decoded packet, as reported by the decode packet callback. */
+struct drm_intel_decode_packet {
+	/** GPU address of the packet. */
+	uint32_t offset;
+	/** First DWORD of the packet. */
+	uint32_t header;
+	/** Opcode bits of the header for its command type. */
+	uint32_t opcode;
+	/** Command name, e.g. "3DSTATE_VS", or "UNKNOWN". */
+	const char *name;
+	/** Packet contents. */
+	const uint32_t *data;
+	/** Number of DWORDs the packet was decoded as. */
+	uint32_t count;
+	/** Fields decoded from the packet, in DWORD order. */
+	const struct drm_intel_decode_field *fields;
+	unsigned int num_fields;
+};
+
+/**
+ * Called for each packet by drm_intel_decode().  The packet and
+ * everything it points to are only valid for the duration of the call.
+ */
+typedef void (*drm_intel_decode_packet_func)(void *closure,
+					     const struct drm_intel_decode_packet *packet);
+
+/* Returns NULL for a devid that isn't a known Intel GPU. */
 struct drm_intel_decode *drm_intel_decode_context_alloc(uint32_t devid);
 void drm_intel_decode_context_free(struct drm_intel_decode *ctx);
 void drm_intel_decode_set_batch_pointer(struct drm_intel_decode *ctx,
@@ -276,6 +406,9 @@ void drm_intel_decode_set_dump_past_end(struct drm_intel_decode *ctx,
 void drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 				    uint32_t head, uint32_t tail);
 void drm_intel_decode_set_output_file(struct drm_intel_decode *ctx, FILE *out);
+void drm_intel_decode_set_packet_callback(struct drm_intel_decode *ctx,
+					  drm_intel_decode_packet_func func,
+					  void *closure);
 void drm_intel_decode(struct drm_intel_decode *ctx);
 
 int drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
@@ -177,6 +177,10 @@ typedef struct _bufmgr_fake {
 	int debug;
 
 	int performed_rendering;
+
+	/** Counters for drm_intel_bufmgr_fake_get_stats() */
+	uint64_t evictions;
+	uint64_t fence_waits;
 } drm_intel_bufmgr_fake;
 
 typedef struct _drm_intel_bo_fake {
@@ -286,6 +290,8 @@ _fence_wait_internal(drm_intel_bufmgr_fake *bufmgr_fake, int seq)
 	int ret;
 	int kernel_lied;
 
+	bufmgr_fake->fence_waits++;
+
 	if (bufmgr_fake->fence_wait != NULL) {
 		bufmgr_fake->fence_wait(seq, bufmgr_fake->fence_priv);
 		clear_fenced(bufmgr_fake, seq);
@@ -553,6 +559,7 @@ evict_lru(drm_intel_bufmgr_fake *bufmgr_fake, unsigned int max_fence)
 		bo_fake->block = NULL;
 
 		free_block(bufmgr_fake, block, 0);
+		bufmgr_fake->evictions++;
 		return 1;
 	}
 
@@ -576,6 +583,7 @@ evict_mru(drm_intel_bufmgr_fake *bufmgr_fake)
 		bo_fake->block = NULL;
 
 		free_block(bufmgr_fake, block, 0);
+		bufmgr_fake->evictions++;
 		return 1;
 	}
 
@@ -1241,6 +1249,8 @@ drm_intel_fake_destroy(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_fake *bufmgr_fake = (drm_intel_bufmgr_fake *) bufmgr;
 
+	drm_intel_bufmgr_stop_trace(bufmgr);
+
 	pthread_mutex_destroy(&bufmgr_fake->lock);
 	mmDestroy(bufmgr_fake->heap);
 	free(bufmgr);
@@ -1567,6 +1577,32 @@ drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr)
 	pthread_mutex_unlock(&bufmgr_fake->lock);
 }
 
+/**
+ * Reports eviction and fence counts, and how fragmented the free space
+ * of the aperture is.
+ */
+drm_public int
+drm_intel_bufmgr_fake_get_stats(drm_intel_bufmgr *bufmgr,
+				struct drm_intel_bufmgr_fake_stats *stats)
+{
+	drm_intel_bufmgr_fake *bufmgr_fake = (drm_intel_bufmgr_fake *) bufmgr;
+	int free_bytes, largest_free, free_blocks;
+
+	pthread_mutex_lock(&bufmgr_fake->lock);
+	stats->evictions = bufmgr_fake->evictions;
+	stats->fence_waits = bufmgr_fake->fence_waits;
+	mmFreeInfo(bufmgr_fake->heap, &free_bytes, &largest_free,
+		   &free_blocks);
+	pthread_mutex_unlock(&bufmgr_fake->lock);
+
+	stats->aperture_size = bufmgr_fake->size;
+	stats->free_bytes = free_bytes;
+	stats->largest_free = largest_free;
+	stats->free_blocks = free_blocks;
+
+	return 0;
+}
+
 drm_public void
 drm_intel_bufmgr_fake_set_last_dispatch(drm_intel_bufmgr *bufmgr,
 					volatile unsigned int
@@ -1622,5 +1658,7 @@ drm_intel_bufmgr_fake_init(int fd, unsigned long low_offset,
 	bufmgr_fake->fd = fd;
 	bufmgr_fake->last_dispatch = (volatile int *)last_dispatch;
 
+	drm_intel_bufmgr_trace_from_env(&bufmgr_fake->bufmgr);
+
 	return &bufmgr_fake->bufmgr;
 }
@@ -37,12 +37,14 @@
 #include <xf86drm.h>
 #include <xf86atomic.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <pthread.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -57,6 +59,7 @@
 #include "intel_bufmgr.h"
 #include "intel_bufmgr_priv.h"
 #include "intel_chipset.h"
+#include "mm.h"
 #include "string.h"
 
 #include "i915_drm.h"
@@ -79,6 +82,7 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 #define MAX2(A, B) ((A) > (B) ? (A) : (B))
+#define MIN2(A, B) ((A) < (B) ? (A) : (B))
 
 /**
  * upper_32_bits - return bits 32-63 of a number
@@ -103,6 +107,69 @@ struct drm_intel_gem_bo_bucket {
 	unsigned long size;
 };
 
+/* Number of cache buckets, see init_cache_buckets() */
+#define CACHE_BUCKETS (14 * 4)
+
+/* Granularity of the softpin address heaps, which count in pages */
+#define GTT_PAGE_SHIFT 12
+
+/* Bytes of new BOs after which the cache is expired regardless of time */
+#define CACHE_EXPIRE_ALLOC_BYTES (64 * 1024 * 1024)
+
+/* Idle BOs a thread may hold per bucket before spilling to the bufmgr */
+#define MAGAZINE_SIZE 8
+#define MAGAZINE_BATCH (MAGAZINE_SIZE / 2)
+/* Largest BO, and total size of BOs, held in a single thread's magazine */
+#define MAGAZINE_MAX_BO_SIZE (1024 * 1024)
+#define MAGAZINE_MAX_BYTES (8 * 1024 * 1024)
+
+/**
+ * Per-thread stacks of recently freed BOs, one per cache bucket.
+ *
+ * A magazine is only ever touched by its owning thread, so BOs can be
+ * freed into it and allocated out of it without taking bufmgr_gem->lock.
+ * It refills from and spills to the shared cache buckets MAGAZINE_BATCH
+ * BOs at a time. BOs in a magazine are left I915_MADV_WILLNEED, which is
+ * why the total size held by a magazine is capped, and counted against
+ * the cache budget.
+ *
+ * The owner uses its magazine with either mag->lock or bufmgr_gem->lock
+ * held, and anyone else only with both, so that the pressure thread can
+ * empty the magazines of idle threads. mag->lock is uncontended
+ * otherwise.
+ */
+struct drm_intel_gem_bo_magazine {
+	struct _drm_intel_bufmgr_gem *bufmgr_gem;
+	drmMMListHead link;
+	pthread_mutex_t lock;
+	/** Value of bufmgr_gem->magazine_flush the magazine was emptied at */
+	int flush_seen;
+	unsigned long bytes;
+	unsigned long hits;
+	struct {
+		drm_intel_bo_gem *bo[MAGAZINE_SIZE];
+		int count;
+	} slot[CACHE_BUCKETS];
+};
+
+/* Buffers up to this size have their unused mmaps cached in a tier of
+ * their own, limited by count rather than by size.
+ */
+#define VMA_SMALL_SIZE (64 * 1024)
+
+enum {
+	VMA_TIER_LARGE,
+	VMA_TIER_SMALL,
+	VMA_TIERS
+};
+
+/** Unused mmaps of one view and tier, least recently used first */
+struct drm_intel_gem_vma_lru {
+	drmMMListHead head;
+	uint64_t bytes;
+	int count;
+};
+
 typedef struct _drm_intel_bufmgr_gem {
 	drm_intel_bufmgr bufmgr;
 
@@ -119,19 +186,105 @@ typedef struct _drm_intel_bufmgr_gem {
 	drm_intel_bo **exec_bos;
 	int exec_size;
 	int exec_count;
+	/**
+	 * execbuffer2 keeps its validation list from one batch to the next.
+	 * A BO is on the list being built while its exec_serial equals this
+	 * one, and entries that hold the same BO as in the previous batch,
+	 * the first exec_prev_count of them, are only patched up.
+	 */
+	uint32_t exec_serial;
+	int exec_prev_count;
+	bool exec_has_relocs;
 
 	/** Array of lists of cached gem objects of power-of-two sizes */
-	struct drm_intel_gem_bo_bucket cache_bucket[14 * 4];
+	struct drm_intel_gem_bo_bucket cache_bucket[CACHE_BUCKETS];
 	int num_buckets;
 	time_t time;
 
+	/** Per-thread BO magazines, see struct drm_intel_gem_bo_magazine */
+	pthread_key_t magazine_key;
+	drmMMListHead magazines;
+	/** Total size of the BOs in all magazines, in KiB */
+	atomic_t magazine_kbytes;
+	/**
+	 * Bumped to have every magazine emptied into the shared cache; the
+	 * owners of magazines that couldn't be emptied there and then check
+	 * it on their next use.
+	 */
+	atomic_t magazine_flush;
+
+	/** Size and number of the BOs held in cache_bucket */
+	uint64_t cache_bytes;
+	uint32_t cache_count;
+	/**
+	 * Byte budget of the cache: once above cache_high it is trimmed
+	 * down to cache_low, and age-based expiry leaves cache_low alone.
+	 * Zero means unlimited.
+	 */
+	uint64_t cache_high, cache_low;
+	/** Bytes of new BOs created since the cache was last expired */
+	uint64_t cache_alloc_bytes;
+	uint64_t cache_hits, cache_misses;
+	uint64_t cache_trimmed_bytes, cache_expired_bytes;
+	uint32_t cache_pressure_events;
+
+	/**
+	 * Softpin mode address heaps, in pages: below 4GiB for BOs without
+	 * EXEC_OBJECT_SUPPORTS_48B_ADDRESS, and above for the rest, if the
+	 * VM reaches that far. They coalesce freed ranges, so any free
+	 * range can serve any size.
+	 */
+	struct mem_block *gtt_heap[2];
+
+	/**
+	 * Memoised reachability for drm_intel_gem_bo_references(): the BOs
+	 * reachable from refs_root are stamped with refs_generation.
+	 * refs_serial only counts relocations added to stamped BOs, so
+	 * relocations elsewhere leave the memo alone; it stays valid while
+	 * refs_serial still reads refs_seen and refs_root has only gained
+	 * relocations since. Clearing the relocations of refs_root or of a
+	 * stamped BO drops it.
+	 */
+	atomic_t refs_generation;
+	atomic_t refs_serial;
+	drm_intel_bo *refs_root;
+	unsigned int refs_seen;
+	int refs_reloc_count, refs_softpin_count;
+
+	/** Source of the aperture accounting generations, never 0 */
+	atomic_t aperture_generation;
+
+	/**
+	 * Counts changes to the aperture size or fence of BOs that trees
+	 * may already have accounted, which leave those trees stale.
+	 */
+	atomic_t aperture_changes;
+
+	/** Optional thread draining the cache under memory pressure */
+	pthread_t pressure_thread;
+	int pressure_fd;
+	int pressure_wake[2];
+	bool has_pressure_thread;
+
 	drmMMListHead managers;
 
 	drm_intel_bo_gem *name_table;
 	drm_intel_bo_gem *handle_table;
 
-	drmMMListHead vma_cache;
+	/**
+	 * Mappings of unmapped BOs, kept for reuse, per view and tier.
+	 * vma_count is the number of them, vma_open the number of BOs
+	 * currently mapped.
+	 */
+	struct drm_intel_gem_vma_lru vma_cache[DRM_INTEL_VMA_VIEWS][VMA_TIERS];
 	int vma_count, vma_open, vma_max;
+	/** Limits on the large tier, per view and across views, in bytes */
+	uint64_t vma_view_budget[DRM_INTEL_VMA_VIEWS];
+	uint64_t vma_budget;
+	/** Limit on the number of mappings in the small tier, -1 for none */
+	int vma_small_max;
+	unsigned int vma_stamp;
+	uint64_t vma_hits, vma_misses, vma_unmaps, vma_unmapped_bytes;
 
 	uint64_t gtt_size;
 	int available_fences;
@@ -146,7 +299,9 @@ typedef struct _drm_intel_bufmgr_gem {
 	unsigned int no_exec : 1;
 	unsigned int has_vebox : 1;
 	unsigned int has_exec_async : 1;
+	unsigned int has_magazines : 1;
 	bool fenced_relocs;
+	bool softpin;
 
 	struct {
 		void *ptr;
@@ -156,6 +311,7 @@ typedef struct _drm_intel_bufmgr_gem {
 } drm_intel_bufmgr_gem;
 
 #define DRM_INTEL_RELOC_FENCE (1<<0)
+#define DRM_INTEL_RELOC_WRITE (1<<1)
 
 typedef struct _drm_intel_reloc_target_info {
 	drm_intel_bo *bo;
@@ -184,6 +340,8 @@ struct _drm_intel_bo_gem {
 	 * batchbuffer execution.
 	 */
 	int validate_index;
+	/** bufmgr_gem->exec_serial when last put on the execbuffer2 list */
+	uint32_t exec_serial;
 
 	/**
 	 * Current tiling mode
@@ -204,8 +362,11 @@ struct _drm_intel_bo_gem {
 	drm_intel_reloc_target *reloc_target_info;
 	/** Number of entries in relocs */
 	int reloc_count;
-	/** Array of BOs that are referenced by this buffer and will be softpinned */
-	drm_intel_bo **softpin_target;
+	/**
+	 * Array of BOs that are referenced by this buffer and will be
+	 * softpinned, with DRM_INTEL_RELOC_WRITE if the GPU writes to them.
+	 */
+	drm_intel_reloc_target *softpin_target;
 	/** Number softpinned BOs that are referenced by this buffer */
 	int softpin_target_count;
 	/** Maximum amount of softpinned BOs that are referenced by this buffer */
@@ -223,17 +384,14 @@ struct _drm_intel_bo_gem {
 	 */
 	void *user_virtual;
 	int map_count;
-	drmMMListHead vma_list;
+	/** Link in the bufmgr's VMA cache, per view, while map_count is 0 */
+	drmMMListHead vma_list[DRM_INTEL_VMA_VIEWS];
+	/** bufmgr_gem->vma_stamp at the last unmap, to order across views */
+	unsigned int vma_stamp;
 
 	/** BO cache list */
 	drmMMListHead head;
 
-	/**
-	 * Boolean of whether this BO and its children have been included in
-	 * the current drm_intel_bufmgr_check_aperture_space() total.
-	 */
-	bool included_in_check_aperture;
-
 	/**
 	 * Boolean of whether this buffer has been used as a relocation
 	 * target and had its size accounted for, and thus can't have any
@@ -265,13 +423,18 @@ struct _drm_intel_bo_gem {
 	 */
 	bool is_userptr;
 
+	/** Aperture space needed by this buffer alone, including alignment */
+	unsigned int aperture_size;
+
 	/**
-	 * Size in bytes of this buffer and its relocation descendents.
+	 * Size in bytes of this buffer and its relocation descendents,
+	 * each counted once.
 	 *
-	 * Used to avoid costly tree walking in
-	 * drm_intel_bufmgr_check_aperture in the common case.
+	 * Kept up to date as relocations and softpin targets are added, so
+	 * that drm_intel_bufmgr_check_aperture_space() doesn't have to walk
+	 * the tree.
 	 */
-	int reloc_tree_size;
+	uint64_t reloc_tree_size;
 
 	/**
 	 * Number of potential fence registers required by this buffer and its
@@ -279,15 +442,57 @@ struct _drm_intel_bo_gem {
 	 */
 	int reloc_tree_fences;
 
+	/**
+	 * Set of the BOs accounted in reloc_tree_size, as an open-addressed
+	 * table of pointers with the low bit set for those also counted in
+	 * reloc_tree_fences. Empty while this buffer has no relocations.
+	 *
+	 * Like the relocation lists, it belongs to the thread emitting
+	 * them, which keeps bufmgr_gem->lock out of the emit path.
+	 */
+	uintptr_t *tree_set;
+	unsigned int tree_set_size;
+	unsigned int tree_set_count;
+
+	/** Whether tree_set couldn't grow, leaving the totals unusable */
+	bool tree_overflow;
+
+	/** bufmgr_gem->aperture_changes when the tree was last recounted */
+	int tree_changes;
+
+	/**
+	 * Generations of the last aperture check that counted this, and
+	 * that counted its fence. Protected by bufmgr_gem->lock.
+	 */
+	uint32_t aperture_generation;
+	uint32_t fence_generation;
+
 	/** Flags that we may need to do the SW_FINISH ioctl on unmap. */
 	bool mapped_cpu_write;
+
+	/**
+	 * Range of the bufmgr's gtt_heap holding the softpin address of
+	 * this buffer, if the address comes from there
+	 */
+	struct mem_block *gtt_block;
+
+	/**
+	 * Boolean of whether the address of this buffer may have been
+	 * written into a batch since it was allocated, after which it can't
+	 * move anymore.
+	 */
+	bool gtt_emitted;
+
+	/** Equal to bufmgr_gem->refs_generation if reachable from refs_root */
+	uint32_t refs_generation;
 };
 
-static unsigned int
-drm_intel_gem_estimate_batch_space(drm_intel_bo ** bo_array, int count);
+static void
+drm_intel_gem_bo_reset_tree(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo_gem *bo_gem);
 
-static unsigned int
-drm_intel_gem_compute_batch_space(drm_intel_bo ** bo_array, int count);
+static uint64_t
+drm_intel_gem_exec_aperture_space(drm_intel_bufmgr_gem *bufmgr_gem);
 
 static int
 drm_intel_gem_bo_get_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
@@ -305,11 +510,66 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo);
 
 static void drm_intel_gem_bo_free(drm_intel_bo *bo);
 
+static void
+drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time);
+
 static inline drm_intel_bo_gem *to_bo_gem(drm_intel_bo *bo)
 {
         return (drm_intel_bo_gem *)bo;
 }
 
+/** Whether @bo_gem is in the memoised drm_intel_gem_bo_references() set */
+static inline bool
+drm_intel_gem_bo_is_stamped(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo_gem *bo_gem)
+{
+	return bo_gem->refs_generation ==
+		(uint32_t)atomic_read(&bufmgr_gem->refs_generation);
+}
+
+static void **
+drm_intel_gem_bo_vma_ptr(drm_intel_bo_gem *bo_gem, int view)
+{
+	if (view == DRM_INTEL_VMA_CPU)
+		return &bo_gem->mem_virtual;
+	if (view == DRM_INTEL_VMA_WC)
+		return &bo_gem->wc_virtual;
+	return &bo_gem->gtt_virtual;
+}
+
+static struct drm_intel_gem_vma_lru *
+drm_intel_gem_bo_vma_lru(drm_intel_bufmgr_gem *bufmgr_gem,
+			 drm_intel_bo_gem *bo_gem, int view)
+{
+	int tier = bo_gem->bo.size <= VMA_SMALL_SIZE ?
+		VMA_TIER_SMALL : VMA_TIER_LARGE;
+
+	return &bufmgr_gem->vma_cache[view][tier];
+}
+
+static void
+drm_intel_gem_bo_vma_init(drm_intel_bo_gem *bo_gem)
+{
+	int view;
+
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++)
+		DRMINITLISTHEAD(&bo_gem->vma_list[view]);
+}
+
+/** Takes a mapping out of the VMA cache, leaving it mapped */
+static void
+drm_intel_gem_bo_vma_del(drm_intel_bufmgr_gem *bufmgr_gem,
+			 drm_intel_bo_gem *bo_gem, int view)
+{
+	struct drm_intel_gem_vma_lru *lru =
+		drm_intel_gem_bo_vma_lru(bufmgr_gem, bo_gem, view);
+
+	DRMLISTDELINIT(&bo_gem->vma_list[view]);
+	lru->bytes -= bo_gem->bo.size;
+	lru->count--;
+	bufmgr_gem->vma_count--;
+}
+
 static unsigned long
 drm_intel_gem_bo_tile_size(drm_intel_bufmgr_gem *bufmgr_gem, unsigned long size,
 			   uint32_t *tiling_mode)
@@ -396,17 +656,91 @@ static struct drm_intel_gem_bo_bucket *
 drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
 				 unsigned long size)
 {
-	int i;
+	unsigned long base;
+	int i, order;
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
+	/* The buckets are laid out by init_cache_buckets(): one page
+	 * steps up to 16KiB, then four buckets per power of two in
+	 * quarter steps. Compute the index rather than searching for it.
+	 */
+	if (size <= 4 * 4096) {
+		i = size ? (size - 1) / 4096 : 0;
+	} else {
+		order = sizeof(unsigned long) * 8 - 1 -
+			__builtin_clzl(size - 1);
+		base = 1UL << order;
+		i = 4 * (order - 14) + 4 + (size - 1 - base) / (base / 4);
 	}
 
-	return NULL;
+	if (i >= bufmgr_gem->num_buckets)
+		return NULL;
+
+	return &bufmgr_gem->cache_bucket[i];
+}
+
+/* Must be called with bufmgr_gem->lock held. Returns NULL when exhausted. */
+static struct mem_block *
+drm_intel_gem_gtt_alloc(struct mem_block *heap, uint64_t size,
+			uint64_t alignment)
+{
+	uint64_t pages = (size + (1 << GTT_PAGE_SHIFT) - 1) >> GTT_PAGE_SHIFT;
+	int align2 = 64 - __builtin_clzll(alignment - 1) - GTT_PAGE_SHIFT;
+
+	if (heap == NULL || pages > INT_MAX)
+		return NULL;
+
+	return mmAllocMem(heap, pages, MAX2(align2, 0), 0);
+}
+
+/**
+ * Gives a BO a fixed address from the softpin heaps, preferring the 48-bit
+ * heap unless @low is set. Must be called with bufmgr_gem->lock held.
+ */
+static int
+drm_intel_gem_bo_assign_gtt(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo_gem *bo_gem, bool low)
+{
+	uint64_t alignment = MAX2(bo_gem->bo.align, 4096);
+	struct mem_block *block = NULL;
+	uint64_t offset;
+
+	if (!low)
+		block = drm_intel_gem_gtt_alloc(bufmgr_gem->gtt_heap[1],
+						bo_gem->bo.size, alignment);
+	if (block) {
+		bo_gem->kflags |= EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+	} else {
+		block = drm_intel_gem_gtt_alloc(bufmgr_gem->gtt_heap[0],
+						bo_gem->bo.size, alignment);
+		if (!block)
+			return -ENOSPC;
+	}
+	offset = (uint64_t)block->ofs << GTT_PAGE_SHIFT;
+
+	DBG("bo %d (%s) softpinned at 0x%08x %08x\n",
+	    bo_gem->gem_handle, bo_gem->name,
+	    upper_32_bits(offset), lower_32_bits(offset));
+
+	bo_gem->bo.offset64 = offset;
+	bo_gem->bo.offset = offset;
+	bo_gem->kflags |= EXEC_OBJECT_PINNED;
+	bo_gem->gtt_block = block;
+
+	return 0;
+}
+
+/* Must be called with bufmgr_gem->lock held */
+static void
+drm_intel_gem_bo_release_gtt(drm_intel_bufmgr_gem *bufmgr_gem,
+			     drm_intel_bo_gem *bo_gem)
+{
+	if (!bo_gem->gtt_block)
+		return;
+
+	mmFreeMem(bo_gem->gtt_block);
+	bo_gem->kflags &= ~(EXEC_OBJECT_PINNED |
+			    EXEC_OBJECT_SUPPORTS_48B_ADDRESS);
+	bo_gem->gtt_block = NULL;
 }
 
 static void
@@ -446,7 +780,7 @@ drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem)
 		}
 
 		for (j = 0; j < bo_gem->softpin_target_count; j++) {
-			drm_intel_bo *target_bo = bo_gem->softpin_target[j];
+			drm_intel_bo *target_bo = bo_gem->softpin_target[j].bo;
 			drm_intel_bo_gem *target_gem =
 			    (drm_intel_bo_gem *) target_bo;
 			DBG("%2d: %d %s(%s) -> "
@@ -517,8 +851,8 @@ drm_intel_add_validate_buffer(drm_intel_bo *bo)
 	bufmgr_gem->exec_count++;
 }
 
-static void
-drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
+static int
+drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence, int write)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
@@ -528,10 +862,49 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 	flags = 0;
 	if (need_fence)
 		flags |= EXEC_OBJECT_NEEDS_FENCE;
+	if (write)
+		flags |= EXEC_OBJECT_WRITE;
 
-	if (bo_gem->validate_index != -1) {
+	if (bo_gem->exec_serial == bufmgr_gem->exec_serial) {
 		bufmgr_gem->exec2_objects[bo_gem->validate_index].flags |= flags;
-		return;
+		return 0;
+	}
+
+	/* Buffers from before softpin mode was enabled, or that couldn't
+	 * get an address on import, get one now. Their relocations for
+	 * this batch are real ones, so the kernel still patches them.
+	 */
+	if (bufmgr_gem->softpin && !(bo_gem->kflags & EXEC_OBJECT_PINNED)) {
+		int ret = drm_intel_gem_bo_assign_gtt(bufmgr_gem, bo_gem,
+						      false);
+		if (ret)
+			return ret;
+	}
+
+	index = bufmgr_gem->exec_count;
+	if (bo_gem->reloc_count)
+		bufmgr_gem->exec_has_relocs = true;
+	bo_gem->idle = false;
+	bo_gem->gtt_emitted = true;
+
+	/* Same buffer in the same slot as last time: the handle is still
+	 * in place, everything else may have changed since.  The pointer
+	 * alone may match a since-freed BO whose memory got reused, so the
+	 * handle has to match too.
+	 */
+	if (index < bufmgr_gem->exec_prev_count &&
+	    bufmgr_gem->exec_bos[index] == bo &&
+	    bufmgr_gem->exec2_objects[index].handle == bo_gem->gem_handle &&
+	    bo_gem->exec_serial == bufmgr_gem->exec_serial - 1) {
+		struct drm_i915_gem_exec_object2 *entry =
+			&bufmgr_gem->exec2_objects[index];
+
+		entry->relocation_count = bo_gem->reloc_count;
+		entry->relocs_ptr = (uintptr_t)bo_gem->relocs;
+		entry->alignment = bo->align;
+		entry->offset = bo->offset64;
+		entry->flags = bo_gem->kflags | flags;
+		goto out;
 	}
 
 	/* Extend the array of validation entries as necessary. */
@@ -550,8 +923,6 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 		bufmgr_gem->exec_size = new_size;
 	}
 
-	index = bufmgr_gem->exec_count;
-	bo_gem->validate_index = index;
 	/* Fill in array entry */
 	bufmgr_gem->exec2_objects[index].handle = bo_gem->gem_handle;
 	bufmgr_gem->exec2_objects[index].relocation_count = bo_gem->reloc_count;
@@ -562,7 +933,11 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 	bufmgr_gem->exec2_objects[index].rsvd1 = 0;
 	bufmgr_gem->exec2_objects[index].rsvd2 = 0;
 	bufmgr_gem->exec_bos[index] = bo;
+out:
+	bo_gem->validate_index = index;
+	bo_gem->exec_serial = bufmgr_gem->exec_serial;
 	bufmgr_gem->exec_count++;
+	return 0;
 }
 
 #define RELOC_BUF_SIZE(x) ((I915_RELOC_HEADER + x * I915_RELOC0_STRIDE) * \
@@ -602,7 +977,11 @@ drm_intel_bo_gem_set_in_aperture_size(drm_intel_bufmgr_gem *bufmgr_gem,
 		alignment = MAX2(alignment, min_size);
 	}
 
-	bo_gem->reloc_tree_size = size + alignment;
+	bo_gem->aperture_size = size + alignment;
+	if (bo_gem->tree_set_count)
+		drm_intel_gem_bo_reset_tree(bufmgr_gem, bo_gem);
+	else
+		bo_gem->reloc_tree_size = bo_gem->aperture_size;
 }
 
 static int
@@ -681,6 +1060,84 @@ drm_intel_gem_bo_madvise(drm_intel_bo *bo, int madv)
 		 madv);
 }
 
+/* Frees the least recently cached BOs until at most @target bytes remain.
+ * Must be called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_cache_shrink(drm_intel_bufmgr_gem *bufmgr_gem,
+			      uint64_t target)
+{
+	while (bufmgr_gem->cache_bytes > target) {
+		drm_intel_bo_gem *bo_gem, *oldest = NULL;
+		int i;
+
+		/* Each bucket is in free order, so compare their heads.
+		 * Prefer larger buckets among equally old BOs.
+		 */
+		for (i = 0; i < bufmgr_gem->num_buckets; i++) {
+			struct drm_intel_gem_bo_bucket *bucket =
+			    &bufmgr_gem->cache_bucket[i];
+
+			if (DRMLISTEMPTY(&bucket->head))
+				continue;
+
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      bucket->head.next, head);
+			if (oldest == NULL ||
+			    bo_gem->free_time <= oldest->free_time)
+				oldest = bo_gem;
+		}
+		if (oldest == NULL)
+			break;
+
+		DRMLISTDEL(&oldest->head);
+		bufmgr_gem->cache_bytes -= oldest->bo.size;
+		bufmgr_gem->cache_count--;
+		bufmgr_gem->cache_trimmed_bytes += oldest->bo.size;
+		drm_intel_gem_bo_free(&oldest->bo);
+	}
+}
+
+static uint64_t
+drm_intel_gem_bo_magazine_bytes(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	return (uint64_t)atomic_read(&bufmgr_gem->magazine_kbytes) * 1024;
+}
+
+/* Must be called with bufmgr_gem->lock held */
+static void
+drm_intel_gem_bo_cache_add(drm_intel_bufmgr_gem *bufmgr_gem,
+			   struct drm_intel_gem_bo_bucket *bucket,
+			   drm_intel_bo_gem *bo_gem, time_t time)
+{
+	uint64_t held;
+
+	bo_gem->free_time = time;
+	DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
+	bufmgr_gem->cache_bytes += bo_gem->bo.size;
+	bufmgr_gem->cache_count++;
+
+	if (!bufmgr_gem->cache_high)
+		return;
+
+	/* The magazines count against the budget too */
+	held = drm_intel_gem_bo_magazine_bytes(bufmgr_gem);
+	if (bufmgr_gem->cache_bytes + held > bufmgr_gem->cache_high)
+		drm_intel_gem_bo_cache_shrink(bufmgr_gem,
+					      bufmgr_gem->cache_low > held ?
+					      bufmgr_gem->cache_low - held : 0);
+}
+
+/* Must be called with bufmgr_gem->lock held */
+static void
+drm_intel_gem_bo_cache_del(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo_gem *bo_gem)
+{
+	DRMLISTDEL(&bo_gem->head);
+	bufmgr_gem->cache_bytes -= bo_gem->bo.size;
+	bufmgr_gem->cache_count--;
+}
+
 /* drop the oldest entries that have been purged by the kernel */
 static void
 drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
@@ -695,11 +1152,363 @@ drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
 		    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED))
 			break;
 
-		DRMLISTDEL(&bo_gem->head);
+		drm_intel_gem_bo_cache_del(bufmgr_gem, bo_gem);
 		drm_intel_gem_bo_free(&bo_gem->bo);
 	}
 }
 
+/* Release the relocation arrays of a BO whose targets have been dropped */
+static void
+drm_intel_gem_bo_free_reloc_arrays(drm_intel_bo_gem *bo_gem)
+{
+	if (bo_gem->reloc_target_info) {
+		free(bo_gem->reloc_target_info);
+		bo_gem->reloc_target_info = NULL;
+	}
+	if (bo_gem->relocs) {
+		free(bo_gem->relocs);
+		bo_gem->relocs = NULL;
+	}
+	if (bo_gem->softpin_target) {
+		free(bo_gem->softpin_target);
+		bo_gem->softpin_target = NULL;
+		bo_gem->softpin_target_size = 0;
+	}
+	if (bo_gem->tree_set) {
+		free(bo_gem->tree_set);
+		bo_gem->tree_set = NULL;
+		bo_gem->tree_set_size = 0;
+	}
+	bo_gem->tree_set_count = 0;
+}
+
+static struct drm_intel_gem_bo_magazine *
+drm_intel_gem_bo_magazine_lookup(drm_intel_bufmgr_gem *bufmgr_gem,
+				 bool create)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+
+	if (!bufmgr_gem->has_magazines)
+		return NULL;
+
+	mag = pthread_getspecific(bufmgr_gem->magazine_key);
+	if (mag != NULL || !create)
+		return mag;
+
+	mag = calloc(1, sizeof(*mag));
+	if (mag == NULL)
+		return NULL;
+
+	if (pthread_setspecific(bufmgr_gem->magazine_key, mag) != 0) {
+		free(mag);
+		return NULL;
+	}
+
+	mag->bufmgr_gem = bufmgr_gem;
+	pthread_mutex_init(&mag->lock, NULL);
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	mag->flush_seen = atomic_read(&bufmgr_gem->magazine_flush);
+	DRMLISTADDTAIL(&mag->link, &bufmgr_gem->magazines);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return mag;
+}
+
+/* Adjusts the size of the BOs held in a magazine by @delta bytes */
+static void
+drm_intel_gem_bo_magazine_account(drm_intel_bufmgr_gem *bufmgr_gem,
+				  struct drm_intel_gem_bo_magazine *mag,
+				  long delta)
+{
+	mag->bytes += delta;
+	atomic_add(&bufmgr_gem->magazine_kbytes, delta / 1024);
+}
+
+/* Moves the @count oldest BOs of a magazine slot to the shared bucket.
+ * Must be called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_magazine_spill(drm_intel_bufmgr_gem *bufmgr_gem,
+				struct drm_intel_gem_bo_magazine *mag,
+				int i, int count, time_t time)
+{
+	struct drm_intel_gem_bo_bucket *bucket = &bufmgr_gem->cache_bucket[i];
+	int n;
+
+	for (n = 0; n < count; n++) {
+		drm_intel_bo_gem *bo_gem = mag->slot[i].bo[n];
+
+		drm_intel_gem_bo_magazine_account(bufmgr_gem, mag,
+						  -(long)bo_gem->bo.size);
+		if (drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
+						      I915_MADV_DONTNEED)) {
+			drm_intel_gem_bo_cache_add(bufmgr_gem, bucket,
+						   bo_gem, time);
+		} else {
+			drm_intel_gem_bo_free(&bo_gem->bo);
+		}
+	}
+
+	mag->slot[i].count -= count;
+	memmove(&mag->slot[i].bo[0], &mag->slot[i].bo[count],
+		mag->slot[i].count * sizeof(mag->slot[i].bo[0]));
+}
+
+/* Empties a magazine into the shared cache buckets.
+ * Must be called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_magazine_flush(drm_intel_bufmgr_gem *bufmgr_gem,
+				struct drm_intel_gem_bo_magazine *mag,
+				time_t time)
+{
+	int i;
+
+	for (i = 0; i < bufmgr_gem->num_buckets; i++)
+		drm_intel_gem_bo_magazine_spill(bufmgr_gem, mag, i,
+						mag->slot[i].count, time);
+	mag->flush_seen = atomic_read(&bufmgr_gem->magazine_flush);
+}
+
+/* Empties whatever magazines can be locked right away, and has the owners
+ * of the others empty theirs on their next use.
+ * Must be called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_magazines_drain(drm_intel_bufmgr_gem *bufmgr_gem,
+				 time_t time)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+
+	atomic_inc(&bufmgr_gem->magazine_flush);
+
+	DRMLISTFOREACHENTRY(mag, &bufmgr_gem->magazines, link) {
+		if (pthread_mutex_trylock(&mag->lock) != 0)
+			continue;
+
+		drm_intel_gem_bo_magazine_flush(bufmgr_gem, mag, time);
+		pthread_mutex_unlock(&mag->lock);
+	}
+}
+
+/* Locks this thread's magazine for use, first emptying it if a drain
+ * asked for that. Returns NULL if the thread has no magazine.
+ */
+static struct drm_intel_gem_bo_magazine *
+drm_intel_gem_bo_magazine_acquire(drm_intel_bufmgr_gem *bufmgr_gem,
+				  bool create)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+
+	mag = drm_intel_gem_bo_magazine_lookup(bufmgr_gem, create);
+	if (mag == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&mag->lock);
+	if (mag->flush_seen != atomic_read(&bufmgr_gem->magazine_flush)) {
+		struct timespec time;
+
+		clock_gettime(CLOCK_MONOTONIC, &time);
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_magazine_flush(bufmgr_gem, mag, time.tv_sec);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
+	return mag;
+}
+
+/* Tops up this thread's magazine with the most recently freed BOs of
+ * @bucket. Must be called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_magazine_refill(drm_intel_bufmgr_gem *bufmgr_gem,
+				 struct drm_intel_gem_bo_bucket *bucket)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+	int i = bucket - bufmgr_gem->cache_bucket;
+	int n;
+
+	if (bucket->size > MAGAZINE_MAX_BO_SIZE)
+		return;
+
+	/* bufmgr_gem->lock is enough for the owner to use it */
+	mag = drm_intel_gem_bo_magazine_lookup(bufmgr_gem, false);
+	if (mag == NULL)
+		return;
+
+	/* Due to be emptied, or would take the cache over budget */
+	if (mag->flush_seen != atomic_read(&bufmgr_gem->magazine_flush) ||
+	    (bufmgr_gem->cache_high &&
+	     drm_intel_gem_bo_magazine_bytes(bufmgr_gem) +
+	     MAGAZINE_BATCH * bucket->size > bufmgr_gem->cache_high))
+		return;
+
+	for (n = 0; n < MAGAZINE_BATCH; n++) {
+		drm_intel_bo_gem *bo_gem;
+
+		if (DRMLISTEMPTY(&bucket->head) ||
+		    mag->slot[i].count == MAGAZINE_SIZE ||
+		    mag->bytes + bucket->size > MAGAZINE_MAX_BYTES)
+			break;
+
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+				      bucket->head.prev, head);
+		drm_intel_gem_bo_cache_del(bufmgr_gem, bo_gem);
+		if (!drm_intel_gem_bo_madvise_internal
+		    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			drm_intel_gem_bo_cache_purge_bucket(bufmgr_gem, bucket);
+			break;
+		}
+
+		mag->slot[i].bo[mag->slot[i].count++] = bo_gem;
+		drm_intel_gem_bo_magazine_account(bufmgr_gem, mag,
+						  bo_gem->bo.size);
+	}
+}
+
+/* Takes a BO out of this thread's magazine, following the same
+ * MRU/idle policy as the shared cache in drm_intel_gem_bo_alloc_internal().
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_bo_magazine_get(drm_intel_bufmgr_gem *bufmgr_gem,
+			      struct drm_intel_gem_bo_bucket *bucket,
+			      bool for_render)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+	drm_intel_bo_gem *bo_gem = NULL;
+	int i = bucket - bufmgr_gem->cache_bucket;
+
+	mag = drm_intel_gem_bo_magazine_acquire(bufmgr_gem, false);
+	if (mag == NULL)
+		return NULL;
+
+	if (mag->slot[i].count == 0)
+		goto out;
+
+	if (for_render) {
+		bo_gem = mag->slot[i].bo[--mag->slot[i].count];
+	} else {
+		bo_gem = mag->slot[i].bo[0];
+		if (drm_intel_gem_bo_busy(&bo_gem->bo)) {
+			bo_gem = NULL;
+			goto out;
+		}
+
+		mag->slot[i].count--;
+		memmove(&mag->slot[i].bo[0], &mag->slot[i].bo[1],
+			mag->slot[i].count * sizeof(mag->slot[i].bo[0]));
+	}
+	drm_intel_gem_bo_magazine_account(bufmgr_gem, mag,
+					  -(long)bo_gem->bo.size);
+	mag->hits++;
+
+out:
+	pthread_mutex_unlock(&mag->lock);
+	return bo_gem;
+}
+
+/**
+ * Releases the last reference to a BO into this thread's magazine without
+ * taking bufmgr_gem->lock in the common case.
+ *
+ * Returns false if the BO must instead go through
+ * drm_intel_gem_bo_unreference_final(), in which case the reference is
+ * still held.
+ */
+static bool
+drm_intel_gem_bo_magazine_put(drm_intel_bufmgr_gem *bufmgr_gem,
+			      drm_intel_bo_gem *bo_gem, time_t time)
+{
+	struct drm_intel_gem_bo_magazine *mag;
+	struct drm_intel_gem_bo_bucket *bucket;
+	unsigned long size = bo_gem->bo.size;
+	int i, count;
+
+	/* Dropping relocation targets and cached mappings needs the lock */
+	if (!bufmgr_gem->bo_reuse || !bo_gem->reusable ||
+	    bo_gem->reloc_count || bo_gem->softpin_target_count ||
+	    bo_gem->map_count || size > MAGAZINE_MAX_BO_SIZE)
+		return false;
+
+	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, size);
+	if (bucket == NULL || bucket->size != size)
+		return false;
+
+	/* Leave the budget to the shared cache once the magazines use it */
+	if (bufmgr_gem->cache_high &&
+	    drm_intel_gem_bo_magazine_bytes(bufmgr_gem) + size >
+	    bufmgr_gem->cache_high)
+		return false;
+
+	mag = drm_intel_gem_bo_magazine_acquire(bufmgr_gem, true);
+	if (mag == NULL)
+		return false;
+
+	i = bucket - bufmgr_gem->cache_bucket;
+	if (mag->slot[i].count == MAGAZINE_SIZE ||
+	    mag->bytes + size > MAGAZINE_MAX_BYTES) {
+		count = MAGAZINE_BATCH;
+		if (count > mag->slot[i].count)
+			count = mag->slot[i].count;
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_magazine_spill(bufmgr_gem, mag, i,
+						count, time);
+		drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+
+		if (mag->bytes + size > MAGAZINE_MAX_BYTES) {
+			pthread_mutex_unlock(&mag->lock);
+			return false;
+		}
+	}
+
+	if (!atomic_dec_and_test(&bo_gem->refcount)) {
+		pthread_mutex_unlock(&mag->lock);
+		return true;
+	}
+
+	DBG("bo_unreference final: %d (%s) to magazine\n",
+	    bo_gem->gem_handle, bo_gem->name);
+
+	bo_gem->kflags &= bo_gem->gtt_block ?
+		EXEC_OBJECT_PINNED | EXEC_OBJECT_SUPPORTS_48B_ADDRESS : 0;
+	bo_gem->gtt_emitted = false;
+	bo_gem->used_as_reloc_target = false;
+	drm_intel_gem_bo_free_reloc_arrays(bo_gem);
+
+	bo_gem->name = NULL;
+	bo_gem->validate_index = -1;
+
+	mag->slot[i].bo[mag->slot[i].count++] = bo_gem;
+	drm_intel_gem_bo_magazine_account(bufmgr_gem, mag, size);
+	pthread_mutex_unlock(&mag->lock);
+
+	return true;
+}
+
+/* Thread exit: hand the magazine's BOs back to the shared cache */
+static void
+drm_intel_gem_bo_magazine_destroy(void *data)
+{
+	struct drm_intel_gem_bo_magazine *mag = data;
+	drm_intel_bufmgr_gem *bufmgr_gem = mag->bufmgr_gem;
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_bo_magazine_flush(bufmgr_gem, mag, time.tv_sec);
+	bufmgr_gem->cache_hits += mag->hits;
+	DRMLISTDEL(&mag->link);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	pthread_mutex_destroy(&mag->lock);
+	free(mag);
+}
+
 static drm_intel_bo *
 drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 				const char *name,
@@ -735,6 +1544,24 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 		bo_size = bucket->size;
 	}
 
+	/* Try this thread's magazine before contending for the lock */
+	if (bucket != NULL) {
+		bo_gem = drm_intel_gem_bo_magazine_get(bufmgr_gem, bucket,
+						       for_render);
+		if (bo_gem != NULL) {
+			if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+								 tiling_mode,
+								 stride) == 0) {
+				bo_gem->bo.align = alignment;
+				goto init;
+			}
+
+			pthread_mutex_lock(&bufmgr_gem->lock);
+			drm_intel_gem_bo_free(&bo_gem->bo);
+			pthread_mutex_unlock(&bufmgr_gem->lock);
+		}
+	}
+
 	pthread_mutex_lock(&bufmgr_gem->lock);
 	/* Get a buffer out of the cache if available */
 retry:
@@ -747,7 +1574,7 @@ retry:
 			 */
 			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
 					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
+			drm_intel_gem_bo_cache_del(bufmgr_gem, bo_gem);
 			alloc_from_cache = true;
 			bo_gem->bo.align = alignment;
 		} else {
@@ -763,7 +1590,7 @@ retry:
 					      bucket->head.next, head);
 			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
 				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
+				drm_intel_gem_bo_cache_del(bufmgr_gem, bo_gem);
 			}
 		}
 
@@ -794,7 +1621,7 @@ retry:
 
 		/* drm_intel_gem_bo_free calls DRMLISTDEL() for an uninitialized
 		   list (vma_list), so better set the list head here */
-		DRMINITLISTHEAD(&bo_gem->vma_list);
+		drm_intel_gem_bo_vma_init(bo_gem);
 
 		bo_gem->bo.size = bo_size;
 
@@ -826,18 +1653,49 @@ retry:
 							 tiling_mode,
 							 stride))
 			goto err_free;
+
+		if (bufmgr_gem->softpin &&
+		    drm_intel_gem_bo_assign_gtt(bufmgr_gem, bo_gem, false))
+			goto err_free;
+
+		/* Frees may mostly bypass the locked unreference path, so
+		 * also expire the cache as new memory is allocated.
+		 */
+		bufmgr_gem->cache_alloc_bytes += bo_size;
+		if (bufmgr_gem->cache_alloc_bytes >= CACHE_EXPIRE_ALLOC_BYTES) {
+			struct timespec time;
+
+			clock_gettime(CLOCK_MONOTONIC, &time);
+			bufmgr_gem->time = 0;
+			drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
+		}
+	}
+
+	if (bucket != NULL) {
+		if (alloc_from_cache)
+			bufmgr_gem->cache_hits++;
+		else
+			bufmgr_gem->cache_misses++;
 	}
 
+	/* Batch up further BOs of this size for the next allocations */
+	if (alloc_from_cache)
+		drm_intel_gem_bo_magazine_refill(bufmgr_gem, bucket);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+init:
 	bo_gem->name = name;
 	atomic_set(&bo_gem->refcount, 1);
 	bo_gem->validate_index = -1;
 	bo_gem->reloc_tree_fences = 0;
+	bo_gem->tree_overflow = false;
+	bo_gem->aperture_generation = 0;
+	bo_gem->fence_generation = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->has_error = false;
 	bo_gem->reusable = true;
 
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, alignment);
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	DBG("bo_create: buf %d (%s) %ldb\n",
 	    bo_gem->gem_handle, bo_gem->name, size);
@@ -950,7 +1808,7 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 		return NULL;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_vma_init(bo_gem);
 
 	bo_gem->bo.size = size;
 
@@ -995,6 +1853,11 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 	bo_gem->reusable = false;
 
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	/* Pin now, before the caller can read offset64 for a relocation.
+	 * On failure the BO stays unpinned and gets real relocations.
+	 */
+	if (bufmgr_gem->softpin)
+		drm_intel_gem_bo_assign_gtt(bufmgr_gem, bo_gem, false);
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	DBG("bo_create_userptr: "
@@ -1148,7 +2011,7 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 		goto out;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_vma_init(bo_gem);
 
 	bo_gem->bo.size = open_arg.size;
 	bo_gem->bo.offset = 0;
@@ -1174,6 +2037,8 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 
 	/* XXX stride is unknown */
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	if (bufmgr_gem->softpin)
+		drm_intel_gem_bo_assign_gtt(bufmgr_gem, bo_gem, false);
 	DBG("bo_create_from_handle: %d (%s)\n", handle, bo_gem->name);
 
 out:
@@ -1194,25 +2059,26 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 	struct drm_gem_close close;
 	int ret;
 
-	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->mem_virtual, 0));
-		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
-	if (bo_gem->wc_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->wc_virtual, 0));
-		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
-	if (bo_gem->gtt_virtual) {
-		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
+	int view;
+
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++) {
+		void **ptr = drm_intel_gem_bo_vma_ptr(bo_gem, view);
+
+		if (*ptr == NULL)
+			continue;
+
+#if HAVE_VALGRIND
+		if (view != DRM_INTEL_VMA_GTT)
+			VALGRIND_FREELIKE_BLOCK(*ptr, 0);
+#endif
+		drm_munmap(*ptr, bo_gem->bo.size);
+		drm_intel_gem_bo_vma_del(bufmgr_gem, bo_gem, view);
 	}
 
 	if (bo_gem->global_name)
 		HASH_DELETE(name_hh, bufmgr_gem->name_table, bo_gem);
 	HASH_DELETE(handle_hh, bufmgr_gem->handle_table, bo_gem);
+	drm_intel_gem_bo_release_gtt(bufmgr_gem, bo_gem);
 
 	/* Close this object */
 	memclear(close);
@@ -1242,7 +2108,10 @@ drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
 #endif
 }
 
-/** Frees all cached buffers significantly older than @time. */
+/**
+ * Frees all cached buffers significantly older than @time, keeping up to
+ * the low watermark of the cache regardless of age.
+ */
 static void
 drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 {
@@ -1255,7 +2124,8 @@ drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 		struct drm_intel_gem_bo_bucket *bucket =
 		    &bufmgr_gem->cache_bucket[i];
 
-		while (!DRMLISTEMPTY(&bucket->head)) {
+		while (!DRMLISTEMPTY(&bucket->head) &&
+		       bufmgr_gem->cache_bytes > bufmgr_gem->cache_low) {
 			drm_intel_bo_gem *bo_gem;
 
 			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
@@ -1263,22 +2133,127 @@ drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 			if (time - bo_gem->free_time <= 1)
 				break;
 
-			DRMLISTDEL(&bo_gem->head);
+			drm_intel_gem_bo_cache_del(bufmgr_gem, bo_gem);
+			bufmgr_gem->cache_expired_bytes += bo_gem->bo.size;
 
 			drm_intel_gem_bo_free(&bo_gem->bo);
 		}
 	}
 
 	bufmgr_gem->time = time;
+	bufmgr_gem->cache_alloc_bytes = 0;
+}
+
+static void
+drm_intel_gem_bo_evict_vma(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo_gem *bo_gem, int view)
+{
+	void **ptr = drm_intel_gem_bo_vma_ptr(bo_gem, view);
+
+	assert(bo_gem->map_count == 0);
+	drm_intel_gem_bo_vma_del(bufmgr_gem, bo_gem, view);
+	drm_munmap(*ptr, bo_gem->bo.size);
+	*ptr = NULL;
+
+	bufmgr_gem->vma_unmaps++;
+	bufmgr_gem->vma_unmapped_bytes += bo_gem->bo.size;
+}
+
+/**
+ * Finds the least recently used cached mapping of any view within the
+ * tiers set in @tiers, or NULL if there is none.
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_oldest_vma(drm_intel_bufmgr_gem *bufmgr_gem, unsigned tiers,
+			 int *view)
+{
+	drm_intel_bo_gem *oldest = NULL;
+	int v, t;
+
+	for (v = 0; v < DRM_INTEL_VMA_VIEWS; v++) {
+		for (t = 0; t < VMA_TIERS; t++) {
+			drmMMListHead *head = &bufmgr_gem->vma_cache[v][t].head;
+			drm_intel_bo_gem *bo_gem;
+
+			if (!(tiers & (1 << t)) || DRMLISTEMPTY(head))
+				continue;
+
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem, head->next,
+					      vma_list[v]);
+			if (oldest == NULL ||
+			    (int)(bo_gem->vma_stamp - oldest->vma_stamp) < 0) {
+				oldest = bo_gem;
+				*view = v;
+			}
+		}
+	}
+
+	return oldest;
+}
+
+static uint64_t
+drm_intel_gem_vma_large_bytes(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	uint64_t bytes = 0;
+	int view;
+
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++)
+		bytes += bufmgr_gem->vma_cache[view][VMA_TIER_LARGE].bytes;
+
+	return bytes;
 }
 
+static int
+drm_intel_gem_vma_small_count(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	int count = 0;
+	int view;
+
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++)
+		count += bufmgr_gem->vma_cache[view][VMA_TIER_SMALL].count;
+
+	return count;
+}
+
+/**
+ * Unmaps cached mappings, one view at a time and least recently used
+ * first, until the cache is within its limits.
+ */
 static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 {
-	int limit;
+	drm_intel_bo_gem *bo_gem;
+	int view, limit;
 
 	DBG("%s: cached=%d, open=%d, limit=%d\n", __FUNCTION__,
 	    bufmgr_gem->vma_count, bufmgr_gem->vma_open, bufmgr_gem->vma_max);
 
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++) {
+		struct drm_intel_gem_vma_lru *lru =
+			&bufmgr_gem->vma_cache[view][VMA_TIER_LARGE];
+
+		while (lru->bytes > bufmgr_gem->vma_view_budget[view]) {
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem, lru->head.next,
+					      vma_list[view]);
+			drm_intel_gem_bo_evict_vma(bufmgr_gem, bo_gem, view);
+		}
+	}
+
+	while (drm_intel_gem_vma_large_bytes(bufmgr_gem) > bufmgr_gem->vma_budget) {
+		bo_gem = drm_intel_gem_oldest_vma(bufmgr_gem,
+						  1 << VMA_TIER_LARGE, &view);
+		drm_intel_gem_bo_evict_vma(bufmgr_gem, bo_gem, view);
+	}
+
+	if (bufmgr_gem->vma_small_max >= 0) {
+		while (drm_intel_gem_vma_small_count(bufmgr_gem) >
+		       bufmgr_gem->vma_small_max) {
+			bo_gem = drm_intel_gem_oldest_vma(bufmgr_gem,
+							  1 << VMA_TIER_SMALL,
+							  &view);
+			drm_intel_gem_bo_evict_vma(bufmgr_gem, bo_gem, view);
+		}
+	}
+
 	if (bufmgr_gem->vma_max < 0)
 		return;
 
@@ -1288,57 +2263,44 @@ static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
 		limit = 0;
 
 	while (bufmgr_gem->vma_count > limit) {
-		drm_intel_bo_gem *bo_gem;
-
-		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-				      bufmgr_gem->vma_cache.next,
-				      vma_list);
-		assert(bo_gem->map_count == 0);
-		DRMLISTDELINIT(&bo_gem->vma_list);
-
-		if (bo_gem->mem_virtual) {
-			drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
-			bo_gem->mem_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->wc_virtual) {
-			drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
-			bo_gem->wc_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->gtt_virtual) {
-			drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
-			bo_gem->gtt_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
+		bo_gem = drm_intel_gem_oldest_vma(bufmgr_gem,
+						  (1 << VMA_TIERS) - 1, &view);
+		drm_intel_gem_bo_evict_vma(bufmgr_gem, bo_gem, view);
 	}
 }
 
 static void drm_intel_gem_bo_close_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				       drm_intel_bo_gem *bo_gem)
 {
+	int view;
+
 	bufmgr_gem->vma_open--;
-	DRMLISTADDTAIL(&bo_gem->vma_list, &bufmgr_gem->vma_cache);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->gtt_virtual)
+	bo_gem->vma_stamp = bufmgr_gem->vma_stamp++;
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++) {
+		struct drm_intel_gem_vma_lru *lru;
+
+		if (*drm_intel_gem_bo_vma_ptr(bo_gem, view) == NULL)
+			continue;
+
+		lru = drm_intel_gem_bo_vma_lru(bufmgr_gem, bo_gem, view);
+		DRMLISTADDTAIL(&bo_gem->vma_list[view], &lru->head);
+		lru->bytes += bo_gem->bo.size;
+		lru->count++;
 		bufmgr_gem->vma_count++;
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
 static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				      drm_intel_bo_gem *bo_gem)
 {
+	int view;
+
 	bufmgr_gem->vma_open++;
-	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->gtt_virtual)
-		bufmgr_gem->vma_count--;
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++) {
+		if (*drm_intel_gem_bo_vma_ptr(bo_gem, view))
+			drm_intel_gem_bo_vma_del(bufmgr_gem, bo_gem, view);
+	}
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
@@ -1359,9 +2321,14 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 		}
 	}
 	for (i = 0; i < bo_gem->softpin_target_count; i++)
-		drm_intel_gem_bo_unreference_locked_timed(bo_gem->softpin_target[i],
+		drm_intel_gem_bo_unreference_locked_timed(bo_gem->softpin_target[i].bo,
 								  time);
-	bo_gem->kflags = 0;
+	if (bufmgr_gem->refs_root == bo ||
+	    drm_intel_gem_bo_is_stamped(bufmgr_gem, bo_gem))
+		bufmgr_gem->refs_root = NULL;
+	bo_gem->kflags &= bo_gem->gtt_block ?
+		EXEC_OBJECT_PINNED | EXEC_OBJECT_SUPPORTS_48B_ADDRESS : 0;
+	bo_gem->gtt_emitted = false;
 	bo_gem->reloc_count = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->softpin_target_count = 0;
@@ -1370,19 +2337,7 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 	    bo_gem->gem_handle, bo_gem->name);
 
 	/* release memory associated with this object */
-	if (bo_gem->reloc_target_info) {
-		free(bo_gem->reloc_target_info);
-		bo_gem->reloc_target_info = NULL;
-	}
-	if (bo_gem->relocs) {
-		free(bo_gem->relocs);
-		bo_gem->relocs = NULL;
-	}
-	if (bo_gem->softpin_target) {
-		free(bo_gem->softpin_target);
-		bo_gem->softpin_target = NULL;
-		bo_gem->softpin_target_size = 0;
-	}
+	drm_intel_gem_bo_free_reloc_arrays(bo_gem);
 
 	/* Clear any left-over mappings */
 	if (bo_gem->map_count) {
@@ -1397,12 +2352,10 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 	if (bufmgr_gem->bo_reuse && bo_gem->reusable && bucket != NULL &&
 	    drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
 					      I915_MADV_DONTNEED)) {
-		bo_gem->free_time = time;
-
 		bo_gem->name = NULL;
 		bo_gem->validate_index = -1;
 
-		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
+		drm_intel_gem_bo_cache_add(bufmgr_gem, bucket, bo_gem, time);
 	} else {
 		drm_intel_gem_bo_free(bo);
 	}
@@ -1431,6 +2384,10 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 
 		clock_gettime(CLOCK_MONOTONIC, &time);
 
+		if (drm_intel_gem_bo_magazine_put(bufmgr_gem, bo_gem,
+						  time.tv_sec))
+			return;
+
 		pthread_mutex_lock(&bufmgr_gem->lock);
 
 		if (atomic_dec_and_test(&bo_gem->refcount)) {
@@ -1466,6 +2423,7 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
+		bufmgr_gem->vma_misses++;
 		memclear(mmap_arg);
 		mmap_arg.handle = bo_gem->gem_handle;
 		mmap_arg.size = bo->size;
@@ -1484,6 +2442,8 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		}
 		VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 		bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+	} else {
+		bufmgr_gem->vma_hits++;
 	}
 	DBG("bo_map: %d (%s) -> %p\n", bo_gem->gem_handle, bo_gem->name,
 	    bo_gem->mem_virtual);
@@ -1535,6 +2495,7 @@ map_gtt(drm_intel_bo *bo)
 		DBG("bo_map_gtt: mmap %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
+		bufmgr_gem->vma_misses++;
 		memclear(mmap_arg);
 		mmap_arg.handle = bo_gem->gem_handle;
 
@@ -1568,6 +2529,8 @@ map_gtt(drm_intel_bo *bo)
 				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
 			return ret;
 		}
+	} else {
+		bufmgr_gem->vma_hits++;
 	}
 
 	bo->virtual = bo_gem->gtt_virtual;
@@ -1767,17 +2730,18 @@ static int mmap_write(drm_intel_bo *bo, unsigned long offset,
 
 	if (is_cache_coherent(bo)) {
 		map = drm_intel_gem_bo_map__cpu(bo);
-		if (map)
+		if (map) {
 			set_domain(bo, I915_GEM_DOMAIN_CPU, I915_GEM_DOMAIN_CPU);
+			memcpy((char *)map + offset, buf, length);
+		}
 	}
 	if (!map) {
 		map = drm_intel_gem_bo_map__wc(bo);
-		if (map)
-			set_domain(bo, I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
+		assert(map);
+		set_domain(bo, I915_GEM_DOMAIN_WC, I915_GEM_DOMAIN_WC);
+		drm_intel_memcpy_to_wc((char *)map + offset, buf, length);
 	}
 
-	assert(map);
-	memcpy((char *)map + offset, buf, length);
 	drm_intel_gem_bo_unmap(bo);
 	return 0;
 }
@@ -1793,17 +2757,18 @@ static int mmap_read(drm_intel_bo *bo, unsigned long offset,
 
 	if (bufmgr_gem->has_llc || is_cache_coherent(bo)) {
 		map = drm_intel_gem_bo_map__cpu(bo);
-		if (map)
+		if (map) {
 			set_domain(bo, I915_GEM_DOMAIN_CPU, 0);
+			memcpy(buf, (char *)map + offset, length);
+		}
 	}
 	if (!map) {
 		map = drm_intel_gem_bo_map__wc(bo);
-		if (map)
-			set_domain(bo, I915_GEM_DOMAIN_WC, 0);
+		assert(map);
+		set_domain(bo, I915_GEM_DOMAIN_WC, 0);
+		drm_intel_memcpy_from_wc(buf, (char *)map + offset, length);
 	}
 
-	assert(map);
-	memcpy(buf, (char *)map + offset, length);
 	drm_intel_gem_bo_unmap(bo);
 	return 0;
 }
@@ -2005,10 +2970,46 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 	struct drm_gem_close close_bo;
 	int i, ret;
 
+	drm_intel_bufmgr_stop_trace(bufmgr);
+
+	if (bufmgr_gem->has_pressure_thread) {
+		char c = 0;
+
+		while (write(bufmgr_gem->pressure_wake[1], &c, 1) < 0 &&
+		       errno == EINTR)
+			;
+		pthread_join(bufmgr_gem->pressure_thread, NULL);
+		if (bufmgr_gem->pressure_fd >= 0)
+			close(bufmgr_gem->pressure_fd);
+		close(bufmgr_gem->pressure_wake[0]);
+		close(bufmgr_gem->pressure_wake[1]);
+	}
+
 	free(bufmgr_gem->exec2_objects);
 	free(bufmgr_gem->exec_objects);
 	free(bufmgr_gem->exec_bos);
 
+	/* Free the BOs held in per-thread magazines */
+	if (bufmgr_gem->has_magazines) {
+		pthread_key_delete(bufmgr_gem->magazine_key);
+
+		while (!DRMLISTEMPTY(&bufmgr_gem->magazines)) {
+			struct drm_intel_gem_bo_magazine *mag;
+			int n;
+
+			mag = DRMLISTENTRY(struct drm_intel_gem_bo_magazine,
+					   bufmgr_gem->magazines.next, link);
+			for (i = 0; i < bufmgr_gem->num_buckets; i++) {
+				for (n = 0; n < mag->slot[i].count; n++)
+					drm_intel_gem_bo_free(&mag->slot[i].bo[n]->bo);
+			}
+
+			DRMLISTDEL(&mag->link);
+			pthread_mutex_destroy(&mag->lock);
+			free(mag);
+		}
+	}
+
 	pthread_mutex_destroy(&bufmgr_gem->lock);
 
 	/* Free any cached buffer objects we were going to reuse */
@@ -2020,7 +3021,7 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 		while (!DRMLISTEMPTY(&bucket->head)) {
 			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
 					      bucket->head.next, head);
-			DRMLISTDEL(&bo_gem->head);
+			drm_intel_gem_bo_cache_del(bufmgr_gem, bo_gem);
 
 			drm_intel_gem_bo_free(&bo_gem->bo);
 		}
@@ -2038,9 +3039,210 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 				"i915 kernel driver may not be sane!\n", errno);
 	}
 
+	mmDestroy(bufmgr_gem->gtt_heap[0]);
+	mmDestroy(bufmgr_gem->gtt_heap[1]);
+
 	free(bufmgr);
 }
 
+static uint32_t
+drm_intel_gem_new_aperture_generation(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	uint32_t generation;
+
+	do {
+		generation = atomic_inc_return(&bufmgr_gem->aperture_generation);
+	} while (generation == 0);
+
+	return generation;
+}
+
+/** Whether the @i'th relocation of @bo_gem needs a fence register */
+static bool
+drm_intel_gem_bo_reloc_fenced(drm_intel_bo_gem *bo_gem, int i)
+{
+	drm_intel_bo_gem *target_bo_gem =
+		(drm_intel_bo_gem *) bo_gem->reloc_target_info[i].bo;
+
+	return (bo_gem->reloc_target_info[i].flags & DRM_INTEL_RELOC_FENCE) &&
+		target_bo_gem->tiling_mode != I915_TILING_NONE;
+}
+
+static unsigned int
+drm_intel_gem_tree_set_hash(drm_intel_bo_gem *bo_gem, unsigned int size)
+{
+	return ((uintptr_t)bo_gem >> 4) * 0x9e3779b1u & (size - 1);
+}
+
+/** Returns @root's tree_set entry for @bo_gem, or 0 if it isn't in it. */
+static uintptr_t
+drm_intel_gem_tree_set_find(drm_intel_bo_gem *root, drm_intel_bo_gem *bo_gem)
+{
+	unsigned int i;
+
+	if (root->tree_set_count == 0)
+		return 0;
+
+	for (i = drm_intel_gem_tree_set_hash(bo_gem, root->tree_set_size);
+	     root->tree_set[i];
+	     i = (i + 1) & (root->tree_set_size - 1)) {
+		if ((root->tree_set[i] & ~(uintptr_t)1) == (uintptr_t)bo_gem)
+			return root->tree_set[i];
+	}
+
+	return 0;
+}
+
+/**
+ * Returns the slot of @root's tree_set holding @bo_gem, or the empty one
+ * it goes in, growing the set as needed. Returns NULL when out of memory.
+ */
+static uintptr_t *
+drm_intel_gem_tree_set_slot(drm_intel_bo_gem *root, drm_intel_bo_gem *bo_gem)
+{
+	unsigned int i;
+
+	if ((root->tree_set_count + 1) * 2 > root->tree_set_size) {
+		unsigned int size = root->tree_set_size ?
+			root->tree_set_size * 2 : 64;
+		uintptr_t *set = calloc(size, sizeof(*set));
+
+		if (set == NULL) {
+			if (root->tree_set_count + 1 >= root->tree_set_size)
+				return NULL;
+		} else {
+			for (i = 0; i < root->tree_set_size; i++) {
+				unsigned int j;
+
+				if (!root->tree_set[i])
+					continue;
+
+				j = drm_intel_gem_tree_set_hash((drm_intel_bo_gem *)
+								(root->tree_set[i] & ~(uintptr_t)1),
+								size);
+				while (set[j])
+					j = (j + 1) & (size - 1);
+				set[j] = root->tree_set[i];
+			}
+			free(root->tree_set);
+			root->tree_set = set;
+			root->tree_set_size = size;
+		}
+	}
+
+	for (i = drm_intel_gem_tree_set_hash(bo_gem, root->tree_set_size);
+	     root->tree_set[i];
+	     i = (i + 1) & (root->tree_set_size - 1)) {
+		if ((root->tree_set[i] & ~(uintptr_t)1) == (uintptr_t)bo_gem)
+			break;
+	}
+
+	return &root->tree_set[i];
+}
+
+/**
+ * Adds @bo_gem and the part of its tree not yet in @root's to the
+ * accounting of @root's tree. A BO already in the set has its whole tree
+ * in there too: targets can't gain relocations once they are targets
+ * themselves.
+ *
+ * Only touches @root's own state and reads the frozen trees of its
+ * targets, so needs no locking beyond the caller's ownership of @root.
+ */
+static void
+drm_intel_gem_bo_account_tree(drm_intel_bo_gem *root,
+			      drm_intel_bo_gem *bo_gem, bool fenced)
+{
+	uintptr_t *slot;
+	int i;
+
+	if (root->tree_overflow)
+		return;
+
+	slot = drm_intel_gem_tree_set_slot(root, bo_gem);
+	if (slot == NULL) {
+		root->tree_overflow = true;
+		return;
+	}
+
+	if (*slot) {
+		if (fenced && !(*slot & 1)) {
+			*slot |= 1;
+			root->reloc_tree_fences++;
+		}
+		return;
+	}
+
+	*slot = (uintptr_t)bo_gem | fenced;
+	root->tree_set_count++;
+	root->reloc_tree_size += bo_gem->aperture_size;
+	root->reloc_tree_fences += fenced;
+
+	for (i = 0; i < bo_gem->reloc_count; i++)
+		drm_intel_gem_bo_account_tree(root, (drm_intel_bo_gem *)
+					      bo_gem->reloc_target_info[i].bo,
+					      drm_intel_gem_bo_reloc_fenced(bo_gem, i));
+	for (i = 0; i < bo_gem->softpin_target_count; i++)
+		drm_intel_gem_bo_account_tree(root, (drm_intel_bo_gem *)
+					      bo_gem->softpin_target[i].bo,
+					      false);
+}
+
+/** Adds @target_bo_gem's tree to the accounting of @bo_gem's. */
+static void
+drm_intel_gem_bo_account_target(drm_intel_bufmgr_gem *bufmgr_gem,
+				drm_intel_bo_gem *bo_gem,
+				drm_intel_bo_gem *target_bo_gem,
+				bool fenced)
+{
+	/* The root is in its own set, already counted, to stop self
+	 * relocations from counting it again.
+	 */
+	if (bo_gem->tree_set_count == 0 && !bo_gem->tree_overflow) {
+		uintptr_t *slot = drm_intel_gem_tree_set_slot(bo_gem, bo_gem);
+
+		if (slot == NULL) {
+			bo_gem->tree_overflow = true;
+			return;
+		}
+		*slot = (uintptr_t)bo_gem;
+		bo_gem->tree_set_count = 1;
+	}
+
+	drm_intel_gem_bo_account_tree(bo_gem, target_bo_gem, fenced);
+}
+
+/**
+ * Recomputes the accounting of @bo_gem's tree from scratch, after
+ * entries have been removed from it or sizes counted in it changed.
+ */
+static void
+drm_intel_gem_bo_reset_tree(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo_gem *bo_gem)
+{
+	int i;
+
+	if (bo_gem->tree_set)
+		memset(bo_gem->tree_set, 0,
+		       bo_gem->tree_set_size * sizeof(bo_gem->tree_set[0]));
+	bo_gem->tree_set_count = 0;
+	bo_gem->tree_overflow = false;
+	bo_gem->tree_changes = atomic_read(&bufmgr_gem->aperture_changes);
+	bo_gem->reloc_tree_size = bo_gem->aperture_size;
+	bo_gem->reloc_tree_fences = 0;
+
+	for (i = 0; i < bo_gem->reloc_count; i++)
+		drm_intel_gem_bo_account_target(bufmgr_gem, bo_gem,
+						(drm_intel_bo_gem *)
+						bo_gem->reloc_target_info[i].bo,
+						drm_intel_gem_bo_reloc_fenced(bo_gem, i));
+	for (i = 0; i < bo_gem->softpin_target_count; i++)
+		drm_intel_gem_bo_account_target(bufmgr_gem, bo_gem,
+						(drm_intel_bo_gem *)
+						bo_gem->softpin_target[i].bo,
+						false);
+}
+
 /**
  * Adds the target buffer to the validation list and adds the relocation
  * to the reloc_buffer's relocation list.
@@ -2091,19 +3293,19 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	/* An object needing a fence is a tiled buffer, so it won't have
 	 * relocs to other buffers.
 	 */
-	if (need_fence) {
+	if (need_fence)
 		assert(target_bo_gem->reloc_count == 0);
-		target_bo_gem->reloc_tree_fences = 1;
-	}
 
 	/* Make sure that we're not adding a reloc to something whose size has
 	 * already been accounted for.
 	 */
 	assert(!bo_gem->used_as_reloc_target);
 	if (target_bo_gem != bo_gem) {
-		target_bo_gem->used_as_reloc_target = true;
-		bo_gem->reloc_tree_size += target_bo_gem->reloc_tree_size;
-		bo_gem->reloc_tree_fences += target_bo_gem->reloc_tree_fences;
+		/* Shared with other threads' batches, so only dirty it once */
+		if (!target_bo_gem->used_as_reloc_target)
+			target_bo_gem->used_as_reloc_target = true;
+		drm_intel_gem_bo_account_target(bufmgr_gem, bo_gem,
+						target_bo_gem, need_fence);
 	}
 
 	bo_gem->reloc_target_info[bo_gem->reloc_count].bo = target_bo;
@@ -2123,23 +3325,56 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	bo_gem->relocs[bo_gem->reloc_count].write_domain = write_domain;
 	bo_gem->relocs[bo_gem->reloc_count].presumed_offset = target_bo->offset64;
 	bo_gem->reloc_count++;
+	if (drm_intel_gem_bo_is_stamped(bufmgr_gem, bo_gem))
+		atomic_inc(&bufmgr_gem->refs_serial);
 
 	return 0;
 }
 
-static void
+static int
 drm_intel_gem_bo_use_48b_address_range(drm_intel_bo *bo, uint32_t enable)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	struct mem_block *old_block;
+	int ret = 0;
 
-	if (enable)
+	if (enable) {
 		bo_gem->kflags |= EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
-	else
+		return 0;
+	}
+
+	if (!bo_gem->gtt_block ||
+	    !upper_32_bits(bo->offset64 + bo->size - 1)) {
+		bo_gem->kflags &= ~EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+		return 0;
+	}
+
+	/* In softpin mode, move the buffer below 4GiB. Batches written
+	 * since hold the old address and nothing would patch them, so
+	 * only before the buffer's first use. The buffer keeps its old
+	 * address if it can't move.
+	 */
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (bo_gem->gtt_emitted) {
+		ret = -EBUSY;
+	} else {
+		old_block = bo_gem->gtt_block;
 		bo_gem->kflags &= ~EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+		ret = drm_intel_gem_bo_assign_gtt(bufmgr_gem, bo_gem, true);
+		if (ret == 0)
+			mmFreeMem(old_block);
+		else
+			bo_gem->kflags |= EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
 }
 
 static int
-drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
+drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo,
+				    uint32_t write_domain)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
@@ -2156,6 +3391,7 @@ drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 		return -EINVAL;
 	if (target_bo_gem == bo_gem)
 		return -EINVAL;
+	target_bo_gem->gtt_emitted = true;
 
 	if (bo_gem->softpin_target_count == bo_gem->softpin_target_size) {
 		int new_size = bo_gem->softpin_target_size * 2;
@@ -2163,15 +3399,26 @@ drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 			new_size = bufmgr_gem->max_relocs;
 
 		bo_gem->softpin_target = realloc(bo_gem->softpin_target, new_size *
-				sizeof(drm_intel_bo *));
+				sizeof(drm_intel_reloc_target));
 		if (!bo_gem->softpin_target)
 			return -ENOMEM;
 
 		bo_gem->softpin_target_size = new_size;
 	}
-	bo_gem->softpin_target[bo_gem->softpin_target_count] = target_bo;
+	bo_gem->softpin_target[bo_gem->softpin_target_count].bo = target_bo;
+	/* Without a relocation to carry the write domain, the kernel only
+	 * learns of the write, and so fences it for implicit sync, from
+	 * EXEC_OBJECT_WRITE.
+	 */
+	bo_gem->softpin_target[bo_gem->softpin_target_count].flags =
+		write_domain ? DRM_INTEL_RELOC_WRITE : 0;
 	drm_intel_gem_bo_reference(target_bo);
 	bo_gem->softpin_target_count++;
+	if (drm_intel_gem_bo_is_stamped(bufmgr_gem, bo_gem))
+		atomic_inc(&bufmgr_gem->refs_serial);
+
+	drm_intel_gem_bo_account_target(bufmgr_gem, bo_gem, target_bo_gem,
+					false);
 
 	return 0;
 }
@@ -2183,9 +3430,23 @@ drm_intel_gem_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *)target_bo;
+	bool pinned;
+
+	/* In softpin mode every buffer has a fixed address, which the caller
+	 * has already written, so only the target needs to be tracked.
+	 * A target without one yet (created before softpin mode was
+	 * enabled, or whose address couldn't be assigned on import) gets
+	 * a real relocation instead: the offset the caller wrote is stale,
+	 * and only the kernel can patch it.
+	 *
+	 * PINNED is only set before the caller could have read the
+	 * address for this relocation, so this needs no lock.
+	 */
+	pinned = target_bo_gem->kflags & EXEC_OBJECT_PINNED;
 
-	if (target_bo_gem->kflags & EXEC_OBJECT_PINNED)
-		return drm_intel_gem_bo_add_softpin_target(bo, target_bo);
+	if (pinned)
+		return drm_intel_gem_bo_add_softpin_target(bo, target_bo,
+							   write_domain);
 	else
 		return do_bo_emit_reloc(bo, offset, target_bo, target_offset,
 					read_domains, write_domain,
@@ -2198,6 +3459,14 @@ drm_intel_gem_bo_emit_reloc_fence(drm_intel_bo *bo, uint32_t offset,
 				  uint32_t target_offset,
 				  uint32_t read_domains, uint32_t write_domain)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
+
+	/* Fences are unused on the gen8+ hardware softpin requires */
+	if (bufmgr_gem->softpin)
+		return drm_intel_gem_bo_emit_reloc(bo, offset,
+						   target_bo, target_offset,
+						   read_domains, write_domain);
+
 	return do_bo_emit_reloc(bo, offset, target_bo, target_offset,
 				read_domains, write_domain, true);
 }
@@ -2240,10 +3509,14 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 	/* Unreference the cleared target buffers */
 	pthread_mutex_lock(&bufmgr_gem->lock);
 
+	/* Removals could be cancelled out by later additions */
+	if (bufmgr_gem->refs_root == bo ||
+	    drm_intel_gem_bo_is_stamped(bufmgr_gem, bo_gem))
+		bufmgr_gem->refs_root = NULL;
+
 	for (i = start; i < bo_gem->reloc_count; i++) {
 		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->reloc_target_info[i].bo;
 		if (&target_bo_gem->bo != bo) {
-			bo_gem->reloc_tree_fences -= target_bo_gem->reloc_tree_fences;
 			drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo,
 								  time.tv_sec);
 		}
@@ -2251,13 +3524,14 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 	bo_gem->reloc_count = start;
 
 	for (i = 0; i < bo_gem->softpin_target_count; i++) {
-		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->softpin_target[i];
+		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->softpin_target[i].bo;
 		drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo, time.tv_sec);
 	}
 	bo_gem->softpin_target_count = 0;
 
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
+	drm_intel_gem_bo_reset_tree(bufmgr_gem, bo_gem);
 }
 
 /**
@@ -2290,14 +3564,15 @@ drm_intel_gem_bo_process_reloc(drm_intel_bo *bo)
 	}
 }
 
-static void
+static int
 drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *)bo;
-	int i;
+	int i, ret;
 
 	if (bo_gem->relocs == NULL && bo_gem->softpin_target == NULL)
-		return;
+		return 0;
 
 	for (i = 0; i < bo_gem->reloc_count; i++) {
 		drm_intel_bo *target_bo = bo_gem->reloc_target_info[i].bo;
@@ -2308,26 +3583,45 @@ drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 
-		/* Continue walking the tree depth-first. */
-		drm_intel_gem_bo_process_reloc2(target_bo);
+		/* Continue walking the tree depth-first, unless the target
+		 * and so everything below it is on the list already.
+		 */
+		if (to_bo_gem(target_bo)->exec_serial != bufmgr_gem->exec_serial) {
+			ret = drm_intel_gem_bo_process_reloc2(target_bo);
+			if (ret)
+				return ret;
+		}
 
 		need_fence = (bo_gem->reloc_target_info[i].flags &
 			      DRM_INTEL_RELOC_FENCE);
 
 		/* Add the target to the validate list */
-		drm_intel_add_validate_buffer2(target_bo, need_fence);
+		ret = drm_intel_add_validate_buffer2(target_bo, need_fence,
+						     false);
+		if (ret)
+			return ret;
 	}
 
 	for (i = 0; i < bo_gem->softpin_target_count; i++) {
-		drm_intel_bo *target_bo = bo_gem->softpin_target[i];
+		drm_intel_bo *target_bo = bo_gem->softpin_target[i].bo;
+		int write = (bo_gem->softpin_target[i].flags &
+			     DRM_INTEL_RELOC_WRITE);
 
 		if (target_bo == bo)
 			continue;
 
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
-		drm_intel_gem_bo_process_reloc2(target_bo);
-		drm_intel_add_validate_buffer2(target_bo, false);
+		if (to_bo_gem(target_bo)->exec_serial != bufmgr_gem->exec_serial) {
+			ret = drm_intel_gem_bo_process_reloc2(target_bo);
+			if (ret)
+				return ret;
+		}
+		ret = drm_intel_add_validate_buffer2(target_bo, false, write);
+		if (ret)
+			return ret;
 	}
+
+	return 0;
 }
 
 
@@ -2426,14 +3720,10 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 		ret = -errno;
 		if (errno == ENOSPC) {
 			DBG("Execbuffer fails to pin. "
-			    "Estimate: %u. Actual: %u. Available: %u\n",
-			    drm_intel_gem_estimate_batch_space(bufmgr_gem->exec_bos,
-							       bufmgr_gem->
-							       exec_count),
-			    drm_intel_gem_compute_batch_space(bufmgr_gem->exec_bos,
-							      bufmgr_gem->
-							      exec_count),
-			    (unsigned int)bufmgr_gem->gtt_size);
+			    "Required: %llu. Available: %u\n",
+			    (unsigned long long)
+			    drm_intel_gem_exec_aperture_space(bufmgr_gem),
+			    (unsigned int) bufmgr_gem->gtt_size);
 		}
 	}
 	drm_intel_update_buffer_offsets(bufmgr_gem);
@@ -2465,7 +3755,6 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
 	struct drm_i915_gem_execbuffer2 execbuf;
 	int ret = 0;
-	int i;
 
 	if (to_bo_gem(bo)->has_error)
 		return -ENOMEM;
@@ -2491,13 +3780,25 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	}
 
 	pthread_mutex_lock(&bufmgr_gem->lock);
+	/* Start a new list; serial 0 is left to BOs never validated, so
+	 * after a wrap the previous list can't be told apart from them.
+	 */
+	if (++bufmgr_gem->exec_serial == 0) {
+		bufmgr_gem->exec_serial = 1;
+		bufmgr_gem->exec_prev_count = 0;
+	}
+	bufmgr_gem->exec_has_relocs = false;
+
 	/* Update indices and set up the validate list. */
-	drm_intel_gem_bo_process_reloc2(bo);
+	ret = drm_intel_gem_bo_process_reloc2(bo);
 
 	/* Add the batch buffer to the validation list.  There are no relocations
 	 * pointing to it.
 	 */
-	drm_intel_add_validate_buffer2(bo, 0);
+	if (ret == 0)
+		ret = drm_intel_add_validate_buffer2(bo, 0, 0);
+	if (ret != 0)
+		goto skip_execution;
 
 	memclear(execbuf);
 	execbuf.buffers_ptr = (uintptr_t)bufmgr_gem->exec2_objects;
@@ -2523,6 +3824,13 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 		execbuf.flags |= I915_EXEC_FENCE_OUT;
 	}
 
+	/* With every buffer pinned there is nothing for the kernel to
+	 * relocate, unless relocations were emitted before softpin mode
+	 * was enabled.
+	 */
+	if (bufmgr_gem->softpin && !bufmgr_gem->exec_has_relocs)
+		execbuf.flags |= I915_EXEC_NO_RELOC | I915_EXEC_HANDLE_LUT;
+
 	if (bufmgr_gem->no_exec)
 		goto skip_execution;
 
@@ -2533,11 +3841,9 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 		ret = -errno;
 		if (ret == -ENOSPC) {
 			DBG("Execbuffer fails to pin. "
-			    "Estimate: %u. Actual: %u. Available: %u\n",
-			    drm_intel_gem_estimate_batch_space(bufmgr_gem->exec_bos,
-							       bufmgr_gem->exec_count),
-			    drm_intel_gem_compute_batch_space(bufmgr_gem->exec_bos,
-							      bufmgr_gem->exec_count),
+			    "Required: %llu. Available: %u\n",
+			    (unsigned long long)
+			    drm_intel_gem_exec_aperture_space(bufmgr_gem),
 			    (unsigned int) bufmgr_gem->gtt_size);
 		}
 	}
@@ -2548,17 +3854,13 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 
 skip_execution:
 	if (bufmgr_gem->bufmgr.debug)
-		drm_intel_gem_dump_validation_list(bufmgr_gem);
-
-	for (i = 0; i < bufmgr_gem->exec_count; i++) {
-		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
-
-		bo_gem->idle = false;
+		drm_intel_gem_dump_validation_list(bufmgr_gem);
 
-		/* Disconnect the buffer from the validate list */
-		bo_gem->validate_index = -1;
-		bufmgr_gem->exec_bos[i] = NULL;
-	}
+	/* Keep the list for the next batch.  Its BOs drop off it when the
+	 * next one bumps exec_serial, and exec_bos[] is only compared
+	 * against, so entries of since-freed BOs are harmless.
+	 */
+	bufmgr_gem->exec_prev_count = bufmgr_gem->exec_count;
 	bufmgr_gem->exec_count = 0;
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
@@ -2587,6 +3889,7 @@ drm_public int
 drm_intel_gem_bo_context_exec(drm_intel_bo *bo, drm_intel_context *ctx,
 			      int used, unsigned int flags)
 {
+	drm_intel_bufmgr_trace_exec(bo, used, flags);
 	return do_exec2(bo, used, ctx, NULL, 0, 0, -1, NULL, flags);
 }
 
@@ -2598,6 +3901,7 @@ drm_intel_gem_bo_fence_exec(drm_intel_bo *bo,
 			    int *out_fence,
 			    unsigned int flags)
 {
+	drm_intel_bufmgr_trace_exec(bo, used, flags);
 	return do_exec2(bo, used, ctx, NULL, 0, 0, in_fence, out_fence, flags);
 }
 
@@ -2686,6 +3990,8 @@ drm_intel_gem_bo_set_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	uint32_t old_tiling_mode;
+	unsigned int old_size;
 	int ret;
 
 	/* Tiling with userptr surfaces is not supported
@@ -2700,9 +4006,18 @@ drm_intel_gem_bo_set_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
 	if (*tiling_mode == I915_TILING_NONE)
 		stride = 0;
 
+	old_tiling_mode = bo_gem->tiling_mode;
+	old_size = bo_gem->aperture_size;
 	ret = drm_intel_gem_bo_set_tiling_internal(bo, *tiling_mode, stride);
-	if (ret == 0)
+	if (ret == 0) {
 		drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+		/* Trees that already counted it did so at the old size, or
+		 * with the old need for a fence.
+		 */
+		if (bo_gem->aperture_size != old_size ||
+		    bo_gem->tiling_mode != old_tiling_mode)
+			atomic_inc(&bufmgr_gem->aperture_changes);
+	}
 
 	*tiling_mode = bo_gem->tiling_mode;
 	return ret;
@@ -2722,8 +4037,16 @@ drm_intel_gem_bo_get_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
 static int
 drm_intel_gem_bo_set_softpin_offset(drm_intel_bo *bo, uint64_t offset)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
+	/* An explicit offset replaces the one from softpin mode */
+	if (bo_gem->gtt_block) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_release_gtt(bufmgr_gem, bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
 	bo->offset64 = offset;
 	bo->offset = offset;
 	bo_gem->kflags |= EXEC_OBJECT_PINNED;
@@ -2764,7 +4087,7 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 		goto out;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_vma_init(bo_gem);
 
 	/* Determine size of bo.  The fd-to-handle ioctl really should
 	 * return the size, but it doesn't.  If we have kernel 3.12 or
@@ -2798,6 +4121,8 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 
 	/* XXX stride is unknown */
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	if (bufmgr_gem->softpin)
+		drm_intel_gem_bo_assign_gtt(bufmgr_gem, bo_gem, false);
 
 out:
 	pthread_mutex_unlock(&bufmgr_gem->lock);
@@ -2934,130 +4259,68 @@ drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
 
-	if (bufmgr_gem->bufmgr.bo_exec == drm_intel_gem_bo_exec2)
+	/* Only execbuffer2 provides bo_mrb_exec.  bo_exec can't be
+	 * compared, as a trace may have wrapped it.
+	 */
+	if (bufmgr_gem->bufmgr.bo_mrb_exec != NULL)
 		bufmgr_gem->fenced_relocs = true;
 }
 
 /**
- * Return the additional aperture space required by the tree of buffer objects
- * rooted at bo.
- */
-static int
-drm_intel_gem_bo_get_aperture_space(drm_intel_bo *bo)
-{
-	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	int i;
-	int total = 0;
-
-	if (bo == NULL || bo_gem->included_in_check_aperture)
-		return 0;
-
-	total += bo->size;
-	bo_gem->included_in_check_aperture = true;
-
-	for (i = 0; i < bo_gem->reloc_count; i++)
-		total +=
-		    drm_intel_gem_bo_get_aperture_space(bo_gem->
-							reloc_target_info[i].bo);
-
-	return total;
-}
-
-/**
- * Count the number of buffers in this list that need a fence reg
- *
- * If the count is greater than the number of available regs, we'll have
- * to ask the caller to resubmit a batch with fewer tiled buffers.
- *
- * This function over-counts if the same buffer is used multiple times.
+ * Return the aperture space required by the buffers on the exec list,
+ * which holds each of them once.
  */
-static unsigned int
-drm_intel_gem_total_fences(drm_intel_bo ** bo_array, int count)
+static uint64_t
+drm_intel_gem_exec_aperture_space(drm_intel_bufmgr_gem *bufmgr_gem)
 {
+	uint64_t total = 0;
 	int i;
-	unsigned int total = 0;
 
-	for (i = 0; i < count; i++) {
-		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo_array[i];
-
-		if (bo_gem == NULL)
-			continue;
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo_gem *bo_gem =
+			(drm_intel_bo_gem *) bufmgr_gem->exec_bos[i];
 
-		total += bo_gem->reloc_tree_fences;
+		total += bo_gem->aperture_size;
 	}
 	return total;
 }
 
 /**
- * Clear the flag set by drm_intel_gem_bo_get_aperture_space() so we're ready
- * for the next drm_intel_bufmgr_check_aperture_space() call.
+ * Adds the aperture space and fences of the tree rooted at @bo_gem to
+ * @size and @fences, stamping every BO counted with @generation. BOs
+ * already stamped, or in @root's tree_set and so already counted, are
+ * left out along with their descendants. Must be called with
+ * bufmgr_gem->lock held.
  */
 static void
-drm_intel_gem_bo_clear_aperture_space_flag(drm_intel_bo *bo)
+drm_intel_gem_bo_check_tree(drm_intel_bo_gem *root, drm_intel_bo_gem *bo_gem,
+			    uint32_t generation, bool fenced,
+			    uint64_t *size, int *fences)
 {
-	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	uintptr_t entry = root ? drm_intel_gem_tree_set_find(root, bo_gem) : 0;
 	int i;
 
-	if (bo == NULL || !bo_gem->included_in_check_aperture)
+	if (fenced && !(entry & 1) && bo_gem->fence_generation != generation) {
+		bo_gem->fence_generation = generation;
+		(*fences)++;
+	}
+
+	if (entry || bo_gem->aperture_generation == generation)
 		return;
 
-	bo_gem->included_in_check_aperture = false;
+	bo_gem->aperture_generation = generation;
+	*size += bo_gem->aperture_size;
 
 	for (i = 0; i < bo_gem->reloc_count; i++)
-		drm_intel_gem_bo_clear_aperture_space_flag(bo_gem->
-							   reloc_target_info[i].bo);
-}
-
-/**
- * Return a conservative estimate for the amount of aperture required
- * for a collection of buffers. This may double-count some buffers.
- */
-static unsigned int
-drm_intel_gem_estimate_batch_space(drm_intel_bo **bo_array, int count)
-{
-	int i;
-	unsigned int total = 0;
-
-	for (i = 0; i < count; i++) {
-		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo_array[i];
-		if (bo_gem != NULL)
-			total += bo_gem->reloc_tree_size;
-	}
-	return total;
-}
-
-/**
- * Return the amount of aperture needed for a collection of buffers.
- * This avoids double counting any buffers, at the cost of looking
- * at every buffer in the set.
- */
-static unsigned int
-drm_intel_gem_compute_batch_space(drm_intel_bo **bo_array, int count)
-{
-	int i;
-	unsigned int total = 0;
-
-	for (i = 0; i < count; i++) {
-		total += drm_intel_gem_bo_get_aperture_space(bo_array[i]);
-		/* For the first buffer object in the array, we get an
-		 * accurate count back for its reloc_tree size (since nothing
-		 * had been flagged as being counted yet).  We can save that
-		 * value out as a more conservative reloc_tree_size that
-		 * avoids double-counting target buffers.  Since the first
-		 * buffer happens to usually be the batch buffer in our
-		 * callers, this can pull us back from doing the tree
-		 * walk on every new batch emit.
-		 */
-		if (i == 0) {
-			drm_intel_bo_gem *bo_gem =
-			    (drm_intel_bo_gem *) bo_array[i];
-			bo_gem->reloc_tree_size = total;
-		}
-	}
-
-	for (i = 0; i < count; i++)
-		drm_intel_gem_bo_clear_aperture_space_flag(bo_array[i]);
-	return total;
+		drm_intel_gem_bo_check_tree(root, (drm_intel_bo_gem *)
+					    bo_gem->reloc_target_info[i].bo,
+					    generation,
+					    drm_intel_gem_bo_reloc_fenced(bo_gem, i),
+					    size, fences);
+	for (i = 0; i < bo_gem->softpin_target_count; i++)
+		drm_intel_gem_bo_check_tree(root, (drm_intel_bo_gem *)
+					    bo_gem->softpin_target[i].bo,
+					    generation, false, size, fences);
 }
 
 /**
@@ -3081,29 +4344,57 @@ drm_intel_gem_check_aperture_space(drm_intel_bo **bo_array, int count)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem =
 	    (drm_intel_bufmgr_gem *) bo_array[0]->bufmgr;
-	unsigned int total = 0;
-	unsigned int threshold = bufmgr_gem->gtt_size * 3 / 4;
-	int total_fences;
+	drm_intel_bo_gem *root = (drm_intel_bo_gem *) bo_array[0];
+	uint64_t threshold = bufmgr_gem->gtt_size * 3 / 4;
+	uint64_t total = 0;
+	int total_fences = 0;
+	uint32_t generation;
+	int i;
 
-	/* Check for fence reg constraints if necessary */
-	if (bufmgr_gem->available_fences) {
-		total_fences = drm_intel_gem_total_fences(bo_array, count);
-		if (total_fences > bufmgr_gem->available_fences)
-			return -ENOSPC;
+	/* Sizes or fences counted in the root's tree have changed since */
+	if (root->tree_changes != atomic_read(&bufmgr_gem->aperture_changes))
+		drm_intel_gem_bo_reset_tree(bufmgr_gem, root);
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+
+	/* The first buffer, usually the batch, keeps its tree accounted as
+	 * relocations are emitted. The others only need counting for the
+	 * parts of their trees it doesn't already include.
+	 */
+	generation = drm_intel_gem_new_aperture_generation(bufmgr_gem);
+	if (root->tree_overflow) {
+		drm_intel_gem_bo_check_tree(NULL, root, generation, false,
+					    &total, &total_fences);
+		root = NULL;
+	} else {
+		total = root->reloc_tree_size;
+		total_fences = root->reloc_tree_fences;
+	}
+	for (i = 1; i < count; i++) {
+		if (bo_array[i] == NULL || bo_array[i] == bo_array[0])
+			continue;
+
+		drm_intel_gem_bo_check_tree(root,
+					    (drm_intel_bo_gem *) bo_array[i],
+					    generation, false,
+					    &total, &total_fences);
 	}
 
-	total = drm_intel_gem_estimate_batch_space(bo_array, count);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 
-	if (total > threshold)
-		total = drm_intel_gem_compute_batch_space(bo_array, count);
+	/* Check for fence reg constraints if necessary */
+	if (bufmgr_gem->available_fences &&
+	    total_fences > bufmgr_gem->available_fences)
+		return -ENOSPC;
 
 	if (total > threshold) {
 		DBG("check_space: overflowed available aperture, "
 		    "%dkb vs %dkb\n",
-		    total / 1024, (int)bufmgr_gem->gtt_size / 1024);
+		    (int)(total / 1024), (int)bufmgr_gem->gtt_size / 1024);
 		return -ENOSPC;
 	} else {
-		DBG("drm_check_space: total %dkb vs bufgr %dkb\n", total / 1024,
+		DBG("drm_check_space: total %dkb vs bufgr %dkb\n",
+		    (int)(total / 1024),
 		    (int)bufmgr_gem->gtt_size / 1024);
 		return 0;
 	}
@@ -3130,30 +4421,83 @@ drm_intel_gem_bo_is_reusable(drm_intel_bo *bo)
 	return bo_gem->reusable;
 }
 
-static int
-_drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
+/**
+ * Stamps every BO reachable through the relocations and softpin targets
+ * of @bo, starting at the given indices, with @generation. Each BO is
+ * only walked once.
+ */
+static void
+drm_intel_gem_bo_mark_references(drm_intel_bo *bo, uint32_t generation,
+				 int reloc_start, int softpin_start)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	drm_intel_bo_gem *target_bo_gem;
 	int i;
 
-	for (i = 0; i < bo_gem->reloc_count; i++) {
-		if (bo_gem->reloc_target_info[i].bo == target_bo)
-			return 1;
-		if (bo == bo_gem->reloc_target_info[i].bo)
+	for (i = reloc_start; i < bo_gem->reloc_count; i++) {
+		target_bo_gem = (drm_intel_bo_gem *)
+			bo_gem->reloc_target_info[i].bo;
+		if (target_bo_gem->refs_generation == generation)
 			continue;
-		if (_drm_intel_gem_bo_references(bo_gem->reloc_target_info[i].bo,
-						target_bo))
-			return 1;
+
+		target_bo_gem->refs_generation = generation;
+		drm_intel_gem_bo_mark_references(&target_bo_gem->bo,
+						 generation, 0, 0);
 	}
 
-	for (i = 0; i< bo_gem->softpin_target_count; i++) {
-		if (bo_gem->softpin_target[i] == target_bo)
-			return 1;
-		if (_drm_intel_gem_bo_references(bo_gem->softpin_target[i], target_bo))
-			return 1;
+	for (i = softpin_start; i < bo_gem->softpin_target_count; i++) {
+		target_bo_gem = (drm_intel_bo_gem *) bo_gem->softpin_target[i].bo;
+		if (target_bo_gem->refs_generation == generation)
+			continue;
+
+		target_bo_gem->refs_generation = generation;
+		drm_intel_gem_bo_mark_references(&target_bo_gem->bo,
+						 generation, 0, 0);
 	}
+}
 
-	return 0;
+static int
+_drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
+	unsigned int serial;
+	uint32_t generation;
+	int new_relocs, new_softpins, ret;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+
+	serial = atomic_read(&bufmgr_gem->refs_serial);
+	generation = atomic_read(&bufmgr_gem->refs_generation);
+	new_relocs = bo_gem->reloc_count - bufmgr_gem->refs_reloc_count;
+	new_softpins = bo_gem->softpin_target_count -
+		bufmgr_gem->refs_softpin_count;
+
+	if (bufmgr_gem->refs_root == bo &&
+	    new_relocs >= 0 && new_softpins >= 0 &&
+	    serial == bufmgr_gem->refs_seen) {
+		/* Only bo itself gained relocations: extend the set */
+		drm_intel_gem_bo_mark_references(bo, generation,
+						 bufmgr_gem->refs_reloc_count,
+						 bufmgr_gem->refs_softpin_count);
+	} else {
+		if (++generation == 0)
+			generation = 1;
+		atomic_set(&bufmgr_gem->refs_generation, generation);
+		bufmgr_gem->refs_root = bo;
+		drm_intel_gem_bo_mark_references(bo, generation, 0, 0);
+	}
+
+	bufmgr_gem->refs_seen = serial;
+	bufmgr_gem->refs_reloc_count = bo_gem->reloc_count;
+	bufmgr_gem->refs_softpin_count = bo_gem->softpin_target_count;
+
+	ret = target_bo_gem->refs_generation == generation;
+
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
 }
 
 /** Return true if target_bo is referenced by bo's relocation tree. */
@@ -3208,6 +4552,247 @@ init_cache_buckets(drm_intel_bufmgr_gem *bufmgr_gem)
 	}
 }
 
+/**
+ * Enables softpin mode for all buffers of this bufmgr.
+ *
+ * Every buffer gets a fixed address in the per-process GTT from a
+ * userspace allocator, and relocations only record the target buffer:
+ * the presumed offset the caller writes is final. Execbuffer then skips
+ * relocation processing entirely. Imported buffers get their address on
+ * import; relocations to a buffer without one are real relocations.
+ *
+ * Addresses are handed out within the size of the VM the kernel reports
+ * for the default context.
+ *
+ * Must be called before any buffer is allocated. Returns -ENODEV if the
+ * kernel does not support softpin with a full per-process GTT.
+ */
+drm_public int
+drm_intel_bufmgr_gem_enable_softpin(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_i915_gem_context_param cp;
+	drm_i915_getparam_t gp;
+	uint64_t vm_size, low_end, high_end;
+	int ret, ppgtt = 0;
+
+	if (bufmgr_gem->bufmgr.bo_set_softpin_offset == NULL)
+		return -ENODEV;
+
+	memclear(gp);
+	gp.param = I915_PARAM_HAS_ALIASING_PPGTT;
+	gp.value = &ppgtt;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	if (ret != 0 || ppgtt < 2)
+		return -ENODEV;
+
+	memclear(cp);
+	cp.param = I915_CONTEXT_PARAM_GTT_SIZE;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_CONTEXT_GETPARAM, &cp);
+	if (ret == 0 && cp.value != 0) {
+		vm_size = cp.value;
+	} else {
+		/* Kernels before the query: a 2GiB full PPGTT on gen7, and
+		 * 32 or 48 bits of address on gen8+.
+		 */
+		if (bufmgr_gem->gen < 8)
+			vm_size = 1ULL << 31;
+		else
+			vm_size = ppgtt >= 3 ? 1ULL << 48 : 1ULL << 32;
+	}
+
+	/* Stay below bit 47 to avoid non-canonical addresses, and within
+	 * what the heaps can count in pages.
+	 */
+	low_end = MIN2(vm_size, 1ULL << 32);
+	high_end = MIN2(vm_size, 1ULL << 47);
+	high_end = MIN2(high_end, (uint64_t)INT_MAX << GTT_PAGE_SHIFT);
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	/* Keep the first page unused, so no BO ever sits at address 0 */
+	bufmgr_gem->gtt_heap[0] =
+		mmInit(1, (low_end >> GTT_PAGE_SHIFT) - 1);
+	if (high_end > low_end)
+		bufmgr_gem->gtt_heap[1] =
+			mmInit(low_end >> GTT_PAGE_SHIFT,
+			       (high_end - low_end) >> GTT_PAGE_SHIFT);
+	if (bufmgr_gem->gtt_heap[0] == NULL) {
+		mmDestroy(bufmgr_gem->gtt_heap[1]);
+		bufmgr_gem->gtt_heap[1] = NULL;
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return -ENOMEM;
+	}
+	bufmgr_gem->softpin = true;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return 0;
+}
+
+/**
+ * Sets the byte budget of the BO reuse cache.
+ *
+ * Once more than @high bytes are cached, the least recently freed buffers
+ * are released until no more than @low bytes remain. Buffers within @low
+ * are also exempt from the usual expiry of unused buffers, so a budget
+ * avoids thrashing the cache as well as bounding it. Zero disables the
+ * budget, which is the default.
+ *
+ * The buffers held by each thread for lock-free reuse count against the
+ * budget too.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_cache_size(drm_intel_bufmgr *bufmgr,
+				    uint64_t high, uint64_t low)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	if (high && low > high)
+		low = high;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->cache_high = high;
+	bufmgr_gem->cache_low = high ? low : 0;
+	if (high && bufmgr_gem->cache_bytes +
+	    drm_intel_gem_bo_magazine_bytes(bufmgr_gem) > high) {
+		struct timespec time;
+
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		drm_intel_gem_bo_magazines_drain(bufmgr_gem, time.tv_sec);
+		drm_intel_gem_bo_cache_shrink(bufmgr_gem, bufmgr_gem->cache_low);
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+static void *
+drm_intel_gem_pressure_thread(void *arg)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = arg;
+	struct pollfd pfd[2];
+	int nfds = bufmgr_gem->pressure_fd >= 0 ? 2 : 1;
+
+	pfd[0].fd = bufmgr_gem->pressure_wake[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = bufmgr_gem->pressure_fd;
+	pfd[1].events = POLLPRI;
+
+	for (;;) {
+		struct timespec time;
+		int ret;
+
+		pfd[1].revents = 0;
+		ret = poll(pfd, nfds, 1000);
+		if (ret < 0 && errno != EINTR)
+			break;
+		if (pfd[0].revents)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &time);
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		if (pfd[1].revents & POLLPRI) {
+			DBG("memory pressure, dropping %llu cached bytes\n",
+			    (unsigned long long)(bufmgr_gem->cache_bytes +
+			    drm_intel_gem_bo_magazine_bytes(bufmgr_gem)));
+			bufmgr_gem->cache_pressure_events++;
+			/* The magazines' BOs are WILLNEED, so they have to
+			 * come back to the buckets to be let go of.
+			 */
+			drm_intel_gem_bo_magazines_drain(bufmgr_gem,
+							 time.tv_sec);
+			drm_intel_gem_bo_cache_shrink(bufmgr_gem, 0);
+		}
+		drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+
+		/* The trigger went away, keep expiring by time only */
+		if (pfd[1].revents & (POLLERR | POLLNVAL))
+			nfds = 1;
+	}
+
+	return NULL;
+}
+
+/**
+ * Starts a thread that trims the BO reuse cache in the background.
+ *
+ * The thread expires unused buffers once a second, even when the process
+ * is otherwise idle, and drops the whole cache when the kernel reports
+ * memory pressure through /proc/pressure/memory (where available).
+ */
+drm_public int
+drm_intel_bufmgr_gem_enable_pressure_trim(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	/* 150ms of partial stall within a 2s window */
+	static const char trigger[] = "some 150000 2000000";
+	int ret = 0;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (bufmgr_gem->has_pressure_thread)
+		goto out;
+
+	if (pipe2(bufmgr_gem->pressure_wake, O_CLOEXEC)) {
+		ret = -errno;
+		goto out;
+	}
+
+	bufmgr_gem->pressure_fd = open("/proc/pressure/memory",
+				       O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (bufmgr_gem->pressure_fd >= 0 &&
+	    write(bufmgr_gem->pressure_fd, trigger, sizeof(trigger)) < 0) {
+		DBG("failed to set memory pressure trigger: %s\n",
+		    strerror(errno));
+		close(bufmgr_gem->pressure_fd);
+		bufmgr_gem->pressure_fd = -1;
+	}
+
+	ret = -pthread_create(&bufmgr_gem->pressure_thread, NULL,
+			      drm_intel_gem_pressure_thread, bufmgr_gem);
+	if (ret) {
+		if (bufmgr_gem->pressure_fd >= 0)
+			close(bufmgr_gem->pressure_fd);
+		close(bufmgr_gem->pressure_wake[0]);
+		close(bufmgr_gem->pressure_wake[1]);
+		goto out;
+	}
+
+	bufmgr_gem->has_pressure_thread = true;
+out:
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+	return ret;
+}
+
+/**
+ * Reports the occupancy and hit rate of the BO reuse cache.
+ *
+ * Per-thread cache counters are read without synchronisation, so they
+ * are only approximate while other threads are allocating.
+ */
+drm_public int
+drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+				     struct drm_intel_bufmgr_gem_cache_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_intel_gem_bo_magazine *mag;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	stats->cached_bytes = bufmgr_gem->cache_bytes;
+	stats->cached_bos = bufmgr_gem->cache_count;
+	stats->pressure_events = bufmgr_gem->cache_pressure_events;
+	stats->hits = bufmgr_gem->cache_hits;
+	stats->misses = bufmgr_gem->cache_misses;
+	stats->trimmed_bytes = bufmgr_gem->cache_trimmed_bytes;
+	stats->expired_bytes = bufmgr_gem->cache_expired_bytes;
+	stats->thread_cached_bytes = drm_intel_gem_bo_magazine_bytes(bufmgr_gem);
+	DRMLISTFOREACHENTRY(mag, &bufmgr_gem->magazines, link)
+		stats->hits += mag->hits;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return 0;
+}
+
 drm_public void
 drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 {
@@ -3218,6 +4803,83 @@ drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
 }
 
+/**
+ * Limits the mappings kept around by unmapped buffers.
+ *
+ * The mappings of buffers larger than 64KiB are limited to @bytes in
+ * total across all views, and those of smaller buffers to @small_count
+ * mappings.  UINT64_MAX and -1 respectively mean no limit.  The least
+ * recently used mapping is released first, one view at a time.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_vma_cache_budget(drm_intel_bufmgr *bufmgr,
+					  uint64_t bytes, int small_count)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->vma_budget = bytes;
+	bufmgr_gem->vma_small_max = small_count;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Additionally limits the cached mappings of buffers larger than 64KiB
+ * for one kind of view, so that e.g. GTT mappings, which also use up
+ * aperture space, can be kept tighter than CPU mappings.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_vma_view_budget(drm_intel_bufmgr *bufmgr,
+					 enum drm_intel_vma_view view,
+					 uint64_t bytes)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	if (view >= DRM_INTEL_VMA_VIEWS)
+		return;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->vma_view_budget[view] = bytes;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Reports the occupancy of the VMA cache and how often maps reused a
+ * mapping.  Hits are counted by drm_intel_bo_map() and
+ * drm_intel_gem_bo_map_gtt(); the persistent drm_intel_gem_bo_map__*()
+ * mappings only count their misses.
+ */
+drm_public int
+drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr,
+					 struct drm_intel_bufmgr_gem_vma_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	int view, tier;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++) {
+		for (tier = 0; tier < VMA_TIERS; tier++) {
+			struct drm_intel_gem_vma_lru *lru =
+				&bufmgr_gem->vma_cache[view][tier];
+
+			stats->cached[view] += lru->count;
+			stats->cached_bytes[view] += lru->bytes;
+		}
+	}
+	stats->open = bufmgr_gem->vma_open;
+	stats->hits = bufmgr_gem->vma_hits;
+	stats->misses = bufmgr_gem->vma_misses;
+	stats->unmaps = bufmgr_gem->vma_unmaps;
+	stats->unmapped_bytes = bufmgr_gem->vma_unmapped_bytes;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return 0;
+}
+
 static int
 parse_devid_override(const char *devid_override)
 {
@@ -3574,6 +5236,7 @@ drm_public void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 		if (bo_gem->map_count++ == 0)
 			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
 
+		bufmgr_gem->vma_misses++;
 		memclear(mmap_arg);
 		mmap_arg.handle = bo_gem->gem_handle;
 
@@ -3623,6 +5286,7 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
+		bufmgr_gem->vma_misses++;
 		memclear(mmap_arg);
 		mmap_arg.handle = bo_gem->gem_handle;
 		mmap_arg.size = bo->size;
@@ -3665,6 +5329,7 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
+		bufmgr_gem->vma_misses++;
 		memclear(mmap_arg);
 		mmap_arg.handle = bo_gem->gem_handle;
 		mmap_arg.size = bo->size;
@@ -3699,7 +5364,7 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	drm_intel_bufmgr_gem *bufmgr_gem;
 	struct drm_i915_gem_get_aperture aperture;
 	drm_i915_getparam_t gp;
-	int ret, tmp;
+	int ret, tmp, view;
 	bool exec2 = false;
 
 	pthread_mutex_lock(&bufmgr_list_mutex);
@@ -3898,11 +5563,27 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 
 	init_cache_buckets(bufmgr_gem);
 
-	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
-	bufmgr_gem->vma_max = -1; /* unlimited by default */
+	DRMINITLISTHEAD(&bufmgr_gem->magazines);
+	bufmgr_gem->has_magazines =
+		pthread_key_create(&bufmgr_gem->magazine_key,
+				   drm_intel_gem_bo_magazine_destroy) == 0;
+
+	for (view = 0; view < DRM_INTEL_VMA_VIEWS; view++) {
+		int tier;
+
+		for (tier = 0; tier < VMA_TIERS; tier++)
+			DRMINITLISTHEAD(&bufmgr_gem->vma_cache[view][tier].head);
+		bufmgr_gem->vma_view_budget[view] = UINT64_MAX;
+	}
+	/* unlimited by default */
+	bufmgr_gem->vma_budget = UINT64_MAX;
+	bufmgr_gem->vma_small_max = -1;
+	bufmgr_gem->vma_max = -1;
 
 	DRMLISTADD(&bufmgr_gem->managers, &bufmgr_list);
 
+	drm_intel_bufmgr_trace_from_env(&bufmgr_gem->bufmgr);
+
 exit:
 	pthread_mutex_unlock(&bufmgr_list_mutex);
 
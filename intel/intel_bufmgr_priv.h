@@ -34,6 +34,8 @@
 #ifndef INTEL_BUFMGR_PRIV_H
 #define INTEL_BUFMGR_PRIV_H
 
+#include "libdrm_macros.h"
+
 /**
  * Context for a buffer manager instance.
  *
@@ -162,8 +164,10 @@ struct _drm_intel_bufmgr {
 	 *
 	 * \param bo Buffer to set the use_48b_address_range flag.
 	 * \param enable The flag value.
+	 * \return 0 on success, or a negative errno if the buffer can't be
+	 * restricted to the 32-bit range anymore.
 	 */
-	void (*bo_use_48b_address_range) (drm_intel_bo *bo, uint32_t enable);
+	int (*bo_use_48b_address_range) (drm_intel_bo *bo, uint32_t enable);
 
 	/**
 	 * Add relocation entry in reloc_buf, which will be updated with the
@@ -309,6 +313,12 @@ struct _drm_intel_bufmgr {
 	/** Returns true if target_bo is in the relocation tree rooted at bo. */
 	int (*bo_references) (drm_intel_bo *bo, drm_intel_bo *target_bo);
 
+	/**
+	 * Recorder wrapping the methods above, while
+	 * drm_intel_bufmgr_start_trace() is in effect.
+	 */
+	struct drm_intel_bufmgr_trace *trace;
+
 	/**< Enables verbose debugging printouts */
 	int debug;
 };
@@ -318,6 +328,10 @@ struct _drm_intel_context {
 	struct _drm_intel_bufmgr *bufmgr;
 };
 
+drm_private void drm_intel_bufmgr_trace_from_env(drm_intel_bufmgr *bufmgr);
+drm_private void drm_intel_bufmgr_trace_exec(drm_intel_bo *bo, int used,
+					     unsigned int flags);
+
 #define ALIGN(value, alignment)	((value + alignment - 1) & ~(alignment - 1))
 #define ROUND_UP_TO(x, y)	(((x) + (y) - 1) / (y) * (y))
 #define ROUND_UP_TO_MB(x)	ROUND_UP_TO((x), 1024*1024)
@@ -0,0 +1,495 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * @file intel_bufmgr_trace.c
+ *
+ * Records the buffer operations an application makes through a bufmgr, so
+ * that they can be replayed later against any bufmgr (see test_replay.c).
+ *
+ * Recording works by swapping the bufmgr's methods for wrappers that log
+ * each call and then chain to the original.  The trace is plain text, one
+ * operation per line, with BOs named by small integers in the order they
+ * were first seen.  BOs the application got from outside the bufmgr
+ * methods, by flink name or dma-buf, are logged as "import" when first
+ * used.
+ *
+ * Only the metadata of each call is kept, never buffer contents.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "xf86drm.h"
+#include "libdrm_macros.h"
+#include "intel_bufmgr.h"
+#include "intel_bufmgr_priv.h"
+#include "uthash.h"
+
+#define TRACE_VERSION 1
+
+struct trace_bo {
+	drm_intel_bo *bo;
+	unsigned int id;
+	/** References held by the application, as seen through the trace */
+	int refcount;
+	UT_hash_handle hh;
+};
+
+struct drm_intel_bufmgr_trace {
+	/** The methods of the bufmgr before tracing started */
+	drm_intel_bufmgr orig;
+
+	FILE *file;
+	bool owns_file;
+	pthread_mutex_t lock;
+	struct trace_bo *bos;
+	unsigned int next_id;
+};
+
+static struct trace_bo *
+trace_add_bo(struct drm_intel_bufmgr_trace *trace, drm_intel_bo *bo)
+{
+	struct trace_bo *tbo;
+
+	/* A freed BO's storage may be handed out again */
+	HASH_FIND_PTR(trace->bos, &bo, tbo);
+	if (tbo) {
+		HASH_DEL(trace->bos, tbo);
+		free(tbo);
+	}
+
+	tbo = calloc(1, sizeof(*tbo));
+	if (tbo == NULL)
+		return NULL;
+
+	tbo->bo = bo;
+	tbo->id = trace->next_id++;
+	tbo->refcount = 1;
+	HASH_ADD_PTR(trace->bos, bo, tbo);
+
+	return tbo;
+}
+
+/** Returns the trace id of @bo, logging an import if it is new. */
+static unsigned int
+trace_bo_id(struct drm_intel_bufmgr_trace *trace, drm_intel_bo *bo)
+{
+	struct trace_bo *tbo;
+
+	HASH_FIND_PTR(trace->bos, &bo, tbo);
+	if (tbo)
+		return tbo->id;
+
+	tbo = trace_add_bo(trace, bo);
+	if (tbo == NULL)
+		return ~0u;
+
+	fprintf(trace->file, "import %u %lu\n", tbo->id, bo->size);
+	return tbo->id;
+}
+
+static void
+trace_alloc(struct drm_intel_bufmgr_trace *trace, drm_intel_bo *bo,
+	    const char *op, unsigned long size, unsigned int alignment)
+{
+	struct trace_bo *tbo;
+
+	if (bo == NULL)
+		return;
+
+	pthread_mutex_lock(&trace->lock);
+	tbo = trace_add_bo(trace, bo);
+	if (tbo)
+		fprintf(trace->file, "%s %u %lu %u\n", op, tbo->id, size,
+			alignment);
+	pthread_mutex_unlock(&trace->lock);
+}
+
+static drm_intel_bo *
+trace_bo_alloc(drm_intel_bufmgr *bufmgr, const char *name,
+	       unsigned long size, unsigned int alignment)
+{
+	struct drm_intel_bufmgr_trace *trace = bufmgr->trace;
+	drm_intel_bo *bo;
+
+	bo = trace->orig.bo_alloc(bufmgr, name, size, alignment);
+	trace_alloc(trace, bo, "alloc", size, alignment);
+	return bo;
+}
+
+static drm_intel_bo *
+trace_bo_alloc_for_render(drm_intel_bufmgr *bufmgr, const char *name,
+			  unsigned long size, unsigned int alignment)
+{
+	struct drm_intel_bufmgr_trace *trace = bufmgr->trace;
+	drm_intel_bo *bo;
+
+	bo = trace->orig.bo_alloc_for_render(bufmgr, name, size, alignment);
+	trace_alloc(trace, bo, "alloc_render", size, alignment);
+	return bo;
+}
+
+static drm_intel_bo *
+trace_bo_alloc_userptr(drm_intel_bufmgr *bufmgr, const char *name,
+		       void *addr, uint32_t tiling_mode, uint32_t stride,
+		       unsigned long size, unsigned long flags)
+{
+	struct drm_intel_bufmgr_trace *trace = bufmgr->trace;
+	drm_intel_bo *bo;
+
+	bo = trace->orig.bo_alloc_userptr(bufmgr, name, addr, tiling_mode,
+					  stride, size, flags);
+	/* Replayed as ordinary memory */
+	trace_alloc(trace, bo, "alloc", size, 0);
+	return bo;
+}
+
+static drm_intel_bo *
+trace_bo_alloc_tiled(drm_intel_bufmgr *bufmgr, const char *name,
+		     int x, int y, int cpp, uint32_t *tiling_mode,
+		     unsigned long *pitch, unsigned long flags)
+{
+	struct drm_intel_bufmgr_trace *trace = bufmgr->trace;
+	uint32_t requested_tiling = *tiling_mode;
+	struct trace_bo *tbo;
+	drm_intel_bo *bo;
+
+	bo = trace->orig.bo_alloc_tiled(bufmgr, name, x, y, cpp, tiling_mode,
+					pitch, flags);
+	if (bo == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&trace->lock);
+	tbo = trace_add_bo(trace, bo);
+	if (tbo)
+		fprintf(trace->file, "alloc_tiled %u %d %d %d %u %lu\n",
+			tbo->id, x, y, cpp, requested_tiling, flags);
+	pthread_mutex_unlock(&trace->lock);
+	return bo;
+}
+
+static void
+trace_bo_reference(drm_intel_bo *bo)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+	struct trace_bo *tbo;
+
+	pthread_mutex_lock(&trace->lock);
+	fprintf(trace->file, "ref %u\n", trace_bo_id(trace, bo));
+	HASH_FIND_PTR(trace->bos, &bo, tbo);
+	if (tbo)
+		tbo->refcount++;
+	pthread_mutex_unlock(&trace->lock);
+
+	trace->orig.bo_reference(bo);
+}
+
+static void
+trace_bo_unreference(drm_intel_bo *bo)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+	struct trace_bo *tbo;
+
+	pthread_mutex_lock(&trace->lock);
+	fprintf(trace->file, "unref %u\n", trace_bo_id(trace, bo));
+	HASH_FIND_PTR(trace->bos, &bo, tbo);
+	if (tbo && --tbo->refcount == 0) {
+		HASH_DEL(trace->bos, tbo);
+		free(tbo);
+	}
+	pthread_mutex_unlock(&trace->lock);
+
+	trace->orig.bo_unreference(bo);
+}
+
+/** Logs a line about @bo, substituting its id for the first %u */
+#define TRACE_BO(trace, bo, fmt, ...) do {				\
+	pthread_mutex_lock(&(trace)->lock);				\
+	fprintf((trace)->file, fmt "\n",				\
+		trace_bo_id((trace), (bo)), ##__VA_ARGS__);		\
+	pthread_mutex_unlock(&(trace)->lock);				\
+} while (0)
+
+static int
+trace_bo_map(drm_intel_bo *bo, int write_enable)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "map %u %d", write_enable);
+	return trace->orig.bo_map(bo, write_enable);
+}
+
+static int
+trace_bo_unmap(drm_intel_bo *bo)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "unmap %u");
+	return trace->orig.bo_unmap(bo);
+}
+
+static int
+trace_bo_subdata(drm_intel_bo *bo, unsigned long offset,
+		 unsigned long size, const void *data)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "subdata %u %lu %lu", offset, size);
+	return trace->orig.bo_subdata(bo, offset, size, data);
+}
+
+static int
+trace_bo_get_subdata(drm_intel_bo *bo, unsigned long offset,
+		     unsigned long size, void *data)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "get_subdata %u %lu %lu", offset, size);
+	return trace->orig.bo_get_subdata(bo, offset, size, data);
+}
+
+static void
+trace_bo_wait_rendering(drm_intel_bo *bo)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "wait %u");
+	trace->orig.bo_wait_rendering(bo);
+}
+
+static void
+trace_emit_reloc(struct drm_intel_bufmgr_trace *trace, const char *op,
+		 drm_intel_bo *bo, uint32_t offset, drm_intel_bo *target_bo,
+		 uint32_t target_offset, uint32_t read_domains,
+		 uint32_t write_domain)
+{
+	unsigned int id, target_id;
+
+	pthread_mutex_lock(&trace->lock);
+	id = trace_bo_id(trace, bo);
+	target_id = trace_bo_id(trace, target_bo);
+	fprintf(trace->file, "%s %u %u %u %u %u %u\n", op, id, offset,
+		target_id, target_offset, read_domains, write_domain);
+	pthread_mutex_unlock(&trace->lock);
+}
+
+static int
+trace_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
+		    drm_intel_bo *target_bo, uint32_t target_offset,
+		    uint32_t read_domains, uint32_t write_domain)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	trace_emit_reloc(trace, "reloc", bo, offset, target_bo,
+			 target_offset, read_domains, write_domain);
+	return trace->orig.bo_emit_reloc(bo, offset, target_bo, target_offset,
+					 read_domains, write_domain);
+}
+
+static int
+trace_bo_emit_reloc_fence(drm_intel_bo *bo, uint32_t offset,
+			  drm_intel_bo *target_bo, uint32_t target_offset,
+			  uint32_t read_domains, uint32_t write_domain)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	trace_emit_reloc(trace, "reloc_fence", bo, offset, target_bo,
+			 target_offset, read_domains, write_domain);
+	return trace->orig.bo_emit_reloc_fence(bo, offset, target_bo,
+					       target_offset, read_domains,
+					       write_domain);
+}
+
+static int
+trace_bo_exec(drm_intel_bo *bo, int used, drm_clip_rect_t *cliprects,
+	      int num_cliprects, int DR4)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "exec %u %d 0", used);
+	return trace->orig.bo_exec(bo, used, cliprects, num_cliprects, DR4);
+}
+
+static int
+trace_bo_mrb_exec(drm_intel_bo *bo, int used, drm_clip_rect_t *cliprects,
+		  int num_cliprects, int DR4, unsigned flags)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "exec %u %d %u", used, flags);
+	return trace->orig.bo_mrb_exec(bo, used, cliprects, num_cliprects,
+				       DR4, flags);
+}
+
+static int
+trace_bo_set_tiling(drm_intel_bo *bo, uint32_t *tiling_mode, uint32_t stride)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	TRACE_BO(trace, bo, "set_tiling %u %u %u", *tiling_mode, stride);
+	return trace->orig.bo_set_tiling(bo, tiling_mode, stride);
+}
+
+static int
+trace_check_aperture_space(drm_intel_bo **bo_array, int count)
+{
+	struct drm_intel_bufmgr_trace *trace = bo_array[0]->bufmgr->trace;
+	int i;
+
+	pthread_mutex_lock(&trace->lock);
+	fprintf(trace->file, "check %d", count);
+	for (i = 0; i < count; i++) {
+		if (bo_array[i])
+			fprintf(trace->file, " %u",
+				trace_bo_id(trace, bo_array[i]));
+		else
+			fprintf(trace->file, " -");
+	}
+	fprintf(trace->file, "\n");
+	pthread_mutex_unlock(&trace->lock);
+
+	return trace->orig.check_aperture_space(bo_array, count);
+}
+
+/**
+ * Logs an execbuffer made outside the bufmgr methods, such as through
+ * drm_intel_gem_bo_context_exec().
+ */
+drm_private void
+drm_intel_bufmgr_trace_exec(drm_intel_bo *bo, int used, unsigned int flags)
+{
+	struct drm_intel_bufmgr_trace *trace = bo->bufmgr->trace;
+
+	if (trace)
+		TRACE_BO(trace, bo, "exec %u %d %u", used, flags);
+}
+
+/**
+ * Starts logging the buffer operations made through @bufmgr to @file.
+ *
+ * The trace ends on drm_intel_bufmgr_stop_trace() or when the bufmgr is
+ * destroyed.  @file stays owned by the caller.  Only BOs from @bufmgr may
+ * be used with the traced methods from then on.
+ */
+drm_public int
+drm_intel_bufmgr_start_trace(drm_intel_bufmgr *bufmgr, FILE *file)
+{
+	struct drm_intel_bufmgr_trace *trace;
+
+	if (bufmgr->trace)
+		return -EBUSY;
+
+	trace = calloc(1, sizeof(*trace));
+	if (trace == NULL)
+		return -ENOMEM;
+
+	if (pthread_mutex_init(&trace->lock, NULL) != 0) {
+		free(trace);
+		return -ENOMEM;
+	}
+
+	trace->orig = *bufmgr;
+	trace->file = file;
+	fprintf(file, "# libdrm_intel trace %d\n", TRACE_VERSION);
+
+#define WRAP(method) \
+	if (bufmgr->method) \
+		bufmgr->method = trace_##method
+
+	WRAP(bo_alloc);
+	WRAP(bo_alloc_for_render);
+	WRAP(bo_alloc_userptr);
+	WRAP(bo_alloc_tiled);
+	WRAP(bo_reference);
+	WRAP(bo_unreference);
+	WRAP(bo_map);
+	WRAP(bo_unmap);
+	WRAP(bo_subdata);
+	WRAP(bo_get_subdata);
+	WRAP(bo_wait_rendering);
+	WRAP(bo_emit_reloc);
+	WRAP(bo_emit_reloc_fence);
+	WRAP(bo_exec);
+	WRAP(bo_mrb_exec);
+	WRAP(bo_set_tiling);
+	WRAP(check_aperture_space);
+#undef WRAP
+
+	bufmgr->trace = trace;
+	return 0;
+}
+
+/** Stops the trace started by drm_intel_bufmgr_start_trace(). */
+drm_public void
+drm_intel_bufmgr_stop_trace(drm_intel_bufmgr *bufmgr)
+{
+	struct drm_intel_bufmgr_trace *trace = bufmgr->trace;
+	struct trace_bo *tbo, *tmp;
+	int debug = bufmgr->debug;
+
+	if (trace == NULL)
+		return;
+
+	*bufmgr = trace->orig;
+	bufmgr->debug = debug;
+	bufmgr->trace = NULL;
+
+	if (trace->owns_file)
+		fclose(trace->file);
+	else
+		fflush(trace->file);
+	HASH_ITER(hh, trace->bos, tbo, tmp) {
+		HASH_DEL(trace->bos, tbo);
+		free(tbo);
+	}
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+}
+
+/**
+ * Starts a trace of @bufmgr into the file named by $INTEL_BUFMGR_TRACE,
+ * if set, to record an unmodified application.
+ */
+drm_private void
+drm_intel_bufmgr_trace_from_env(drm_intel_bufmgr *bufmgr)
+{
+	const char *path = getenv("INTEL_BUFMGR_TRACE");
+	FILE *file;
+
+	if (path == NULL || bufmgr->trace)
+		return;
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Failed to open trace file %s\n", path);
+		return;
+	}
+
+	if (drm_intel_bufmgr_start_trace(bufmgr, file) != 0) {
+		fclose(file);
+		return;
+	}
+	bufmgr->trace->owns_file = true;
+}
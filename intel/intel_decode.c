@@ -28,16 +28,46 @@
 #include <stdbool.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/types.h>
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
 #include "intel_chipset.h"
 #include "intel_bufmgr.h"
 
+struct drm_intel_decode;
+
+/**
+ * A consumer of decoder output.  Decoders describe each DWORD of a packet
+ * with a printf template, its arguments, and names for the arguments that
+ * are fields of the packet; each sink does what it wants with that.
+ */
+struct decode_sink {
+	/** Start of a packet. */
+	void (*begin)(struct drm_intel_decode *ctx);
+	/**
+	 * A DWORD of the current packet.  \p names, if not NULL, is a NULL
+	 * terminated list naming the arguments of \p fmt in order; see
+	 * FIELDS().
+	 */
+	void (*dword)(struct drm_intel_decode *ctx, unsigned int index,
+		      const char *const *names, const char *fmt, va_list va)
+		DRM_PRINTFLIKE(4, 0);
+	/** Anything else the decoder has to say, e.g. errors. */
+	void (*message)(struct drm_intel_decode *ctx, const char *fmt,
+			va_list va) DRM_PRINTFLIKE(2, 0);
+	/** End of the current packet, which was \p count DWORDs. */
+	void (*end)(struct drm_intel_decode *ctx, uint32_t count);
+	/** End of drm_intel_decode(). */
+	void (*finish)(struct drm_intel_decode *ctx);
+};
 
 /* Struct for tracking drm_intel_decode state. */
 struct drm_intel_decode {
-	/** stdio file where the output should land.  Defaults to stdout. */
+	/**
+	 * stdio file where the text output should land.  Defaults to
+	 * stdout; NULL disables text output entirely.
+	 */
 	FILE *out;
 
 	/** PCI device ID. */
@@ -78,24 +108,217 @@ struct drm_intel_decode {
 	bool dump_past_end;
 
 	bool overflowed;
+
+	/** @{
+	 * i915 S2/S4 immediate state, needed to size inline vertices.
+	 */
+	uint32_t saved_s2, saved_s4;
+	bool saved_s2_set, saved_s4_set;
+	/** @} */
+
+	/**
+	 * Output staging buffer, written to \c out when it fills up and
+	 * once at the end of drm_intel_decode().
+	 */
+	char *outbuf;
+	/** Number of bytes pending in outbuf. */
+	size_t outbuf_len;
+
+	/**
+	 * Padded copy of the end of the batchbuffer.
+	 *
+	 * Packets are decoded straight out of the caller's buffer.  Only
+	 * once a packet's length could run past the end of it is the
+	 * remainder copied here, right-aligned against
+	 * DECODE_TAIL_PAD_DWORDS of 0xd0 filler, so that the fixed-size
+	 * decoders never read outside of memory we own.
+	 */
+	uint32_t *tail_data;
+	/** Number of DWORDs of batch data tail_data can hold before the pad. */
+	uint32_t tail_size;
+
+	/** Packet decoder for each command type (bits 31:29) on this gen. */
+	int (*decode_type[8])(struct drm_intel_decode *ctx);
+
+	/** @{
+	 * Direct-indexed opcode lookup for each pipeline, built for this gen
+	 * by drm_intel_decode_context_alloc().  Each entry is 1 + the index
+	 * into the matching opcodes_* table, or 0 if the opcode is unknown.
+	 */
+	uint8_t index_mi[64];		/* bits 28:23 */
+	uint8_t index_2d[128];		/* bits 28:22 */
+	uint8_t index_3d[32];		/* bits 28:24, i830 or i915 table */
+	uint8_t index_3d_1d[256];	/* bits 23:16 */
+	uint8_t index_3d_965[0x2000];	/* bits 28:16 */
+	/** @} */
+
+	/** Sinks attached: the text output and/or the packet callback. */
+	const struct decode_sink *sinks[2];
+	unsigned int num_sinks;
+
+	/** Packet callback, or NULL. */
+	drm_intel_decode_packet_func packet_func;
+	void *packet_closure;
+
+	/** @{
+	 * Record of the packet being decoded, handed to packet_func.
+	 */
+	struct drm_intel_decode_packet packet;
+	struct drm_intel_decode_field *fields;
+	unsigned int fields_size;
+	/** @} */
+
+	/** @{
+	 * Copies of string field values, which may live on a decoder's
+	 * stack.  Fields point into this by offset until the packet is
+	 * handed out.
+	 */
+	char *strings;
+	size_t strings_len, strings_size;
+	/** @} */
 };
 
-static FILE *out;
-static uint32_t saved_s2 = 0, saved_s4 = 0;
-static char saved_s2_set = 0, saved_s4_set = 0;
-static uint32_t head_offset = 0xffffffff;	/* undefined */
-static uint32_t tail_offset = 0xffffffff;	/* undefined */
+/** Describes a command opcode within one of the per-pipeline tables. */
+struct decode_opcode {
+	uint32_t opcode;
+	uint32_t len_mask;
+	unsigned int min_len;
+	unsigned int max_len;
+	const char *name;
+	/** Generation the entry applies to, or 0 for all. */
+	int gen;
+	/** Custom decoder, or NULL to print each DWORD generically. */
+	int (*func)(struct drm_intel_decode *ctx);
+};
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(A[0]))
 #endif
 
+#define DECODE_OUTBUF_SIZE	(64 * 1024)
+
+/**
+ * Slack for decoders that read a fixed number of DWORDs regardless of
+ * the length field (e.g. the 20 DWORD gen6 3DSTATE_SF).
+ */
+#define DECODE_FIXED_DWORDS	64
+
+/**
+ * Largest number of DWORDs any packet decoder may touch: the 16-bit
+ * length field plus the fixed slack.  3DPRIMITIVE's wider length is
+ * checked against the remaining count by the decoder itself.
+ */
+#define DECODE_TAIL_PAD_DWORDS	(0xffff + 2 + DECODE_FIXED_DWORDS)
+
 #define BUFFER_FAIL(_count, _len, _name) do {			\
-    fprintf(out, "Buffer size too small in %s (%d < %d)\n",	\
-	    (_name), (_count), (_len));				\
+    decode_printf(ctx, "Buffer size too small in %s (%d < %d)\n",	\
+		  (_name), (_count), (_len));			\
     return _count;						\
 } while (0)
 
+/*
+ * The text sink: formats everything into outbuf, and writes that out to
+ * ctx->out.
+ */
+
+static void
+decode_flush(struct drm_intel_decode *ctx)
+{
+	if (ctx->outbuf_len) {
+		fwrite(ctx->outbuf, 1, ctx->outbuf_len, ctx->out);
+		ctx->outbuf_len = 0;
+	}
+}
+
+static void DRM_PRINTFLIKE(2, 0)
+decode_vprintf(struct drm_intel_decode *ctx, const char *fmt, va_list va)
+{
+	size_t avail = DECODE_OUTBUF_SIZE - ctx->outbuf_len;
+	va_list copy;
+	int len;
+
+	va_copy(copy, va);
+	len = vsnprintf(ctx->outbuf + ctx->outbuf_len, avail, fmt, copy);
+	va_end(copy);
+	if (len < 0)
+		return;
+
+	if ((size_t)len >= avail) {
+		decode_flush(ctx);
+
+		/* Not even an empty buffer is big enough; go straight
+		 * to the stream.
+		 */
+		if (len >= DECODE_OUTBUF_SIZE) {
+			vfprintf(ctx->out, fmt, va);
+			return;
+		}
+
+		vsnprintf(ctx->outbuf, DECODE_OUTBUF_SIZE, fmt, va);
+	}
+
+	ctx->outbuf_len += len;
+}
+
+static void DRM_PRINTFLIKE(2, 3)
+text_printf(struct drm_intel_decode *ctx, const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	decode_vprintf(ctx, fmt, va);
+	va_end(va);
+}
+
+static void DRM_PRINTFLIKE(4, 0)
+text_dword(struct drm_intel_decode *ctx, unsigned int index,
+	   const char *const *names, const char *fmt, va_list va)
+{
+	const char *parseinfo;
+	uint32_t offset = ctx->hw_offset + index * 4;
+
+	if (offset == ctx->head)
+		parseinfo = "HEAD";
+	else if (offset == ctx->tail)
+		parseinfo = "TAIL";
+	else
+		parseinfo = "    ";
+
+	text_printf(ctx, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
+		    ctx->data[index], index == 0 ? "" : "   ");
+	decode_vprintf(ctx, fmt, va);
+}
+
+static void
+text_finish(struct drm_intel_decode *ctx)
+{
+	decode_flush(ctx);
+	fflush(ctx->out);
+}
+
+static const struct decode_sink text_sink = {
+	.dword = text_dword,
+	.message = decode_vprintf,
+	.finish = text_finish,
+};
+
+static void DRM_PRINTFLIKE(2, 3)
+decode_printf(struct drm_intel_decode *ctx, const char *fmt, ...)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->num_sinks; i++) {
+		va_list va;
+
+		if (!ctx->sinks[i]->message)
+			continue;
+
+		va_start(va, fmt);
+		ctx->sinks[i]->message(ctx, fmt, va);
+		va_end(va);
+	}
+}
+
 static float int_as_float(uint32_t intval)
 {
 	union intfloat {
@@ -107,33 +330,81 @@ static float int_as_float(uint32_t intval)
 	return uval.f;
 }
 
-static void DRM_PRINTFLIKE(3, 4)
-instr_out(struct drm_intel_decode *ctx, unsigned int index,
-	  const char *fmt, ...)
+/**
+ * Names the arguments of an instr_fields() template, one per conversion.
+ * An empty name leaves the argument out of the packet record (it only
+ * matters to the text).  A name starting with '?' records a "%s" that is
+ * either some text or "" as a 1/0 flag, and one starting with '!' records
+ * it inverted, for text like "%stiled" that reads "" or "not ".  A "%s"
+ * followed by "able" is taken to be "en" or "dis", and is also recorded
+ * as a 1/0 flag.
+ */
+#define FIELDS(...) ((const char *const []) { __VA_ARGS__, NULL })
+
+static void DRM_PRINTFLIKE(4, 0)
+decode_dispatch(struct drm_intel_decode *ctx, unsigned int index,
+		const char *const *names, const char *fmt, va_list va)
 {
-	va_list va;
-	const char *parseinfo;
-	uint32_t offset = ctx->hw_offset + index * 4;
+	unsigned int i;
 
 	if (index > ctx->count) {
 		if (!ctx->overflowed) {
-			fprintf(out, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
+			decode_printf(ctx, "ERROR: Decode attempted to continue beyond end of batchbuffer\n");
 			ctx->overflowed = true;
 		}
 		return;
 	}
 
-	if (offset == head_offset)
-		parseinfo = "HEAD";
-	else if (offset == tail_offset)
-		parseinfo = "TAIL";
-	else
-		parseinfo = "    ";
+	for (i = 0; i < ctx->num_sinks; i++) {
+		va_list copy;
+
+		va_copy(copy, va);
+		ctx->sinks[i]->dword(ctx, index, names, fmt, copy);
+		va_end(copy);
+	}
+}
+
+/** Describes DWORD \p index of the current packet. */
+static void DRM_PRINTFLIKE(3, 4)
+instr_out(struct drm_intel_decode *ctx, unsigned int index,
+	  const char *fmt, ...)
+{
+	va_list va;
+
+	va_start(va, fmt);
+	decode_dispatch(ctx, index, NULL, fmt, va);
+	va_end(va);
+}
+
+/**
+ * Describes DWORD \p index of the current packet, recording the
+ * arguments of \p fmt as fields called \p names.
+ */
+static void DRM_PRINTFLIKE(4, 5)
+instr_fields(struct drm_intel_decode *ctx, unsigned int index,
+	     const char *const *names, const char *fmt, ...)
+{
+	va_list va;
 
-	fprintf(out, "0x%08x: %s 0x%08x: %s", offset, parseinfo,
-		ctx->data[index], index == 0 ? "" : "   ");
 	va_start(va, fmt);
-	vfprintf(out, fmt, va);
+	decode_dispatch(ctx, index, names, fmt, va);
+	va_end(va);
+}
+
+/**
+ * Describes the header of the current packet, which is the command
+ * \p name, recording the arguments of \p fmt as fields called \p names.
+ */
+static void DRM_PRINTFLIKE(4, 5)
+instr_header(struct drm_intel_decode *ctx, const char *name,
+	     const char *const *names, const char *fmt, ...)
+{
+	va_list va;
+
+	ctx->packet.name = name;
+
+	va_start(va, fmt);
+	decode_dispatch(ctx, 0, names, fmt, va);
 	va_end(va);
 }
 
@@ -144,11 +415,13 @@ decode_MI_SET_CONTEXT(struct drm_intel_decode *ctx)
 	if (ctx->gen > 7)
 		return 1;
 
-	instr_out(ctx, 0, "MI_SET_CONTEXT\n");
-	instr_out(ctx, 1, "gtt offset = 0x%x%s%s\n",
-		  data & ~0xfff,
-		  data & (1<<1)? ", Force Restore": "",
-		  data & (1<<0)? ", Restore Inhibit": "");
+	instr_header(ctx, "MI_SET_CONTEXT", NULL, "MI_SET_CONTEXT\n");
+	instr_fields(ctx, 1,
+		     FIELDS("gtt_offset", "?force_restore", "?restore_inhibit"),
+		     "gtt offset = 0x%x%s%s\n",
+		     data & ~0xfff,
+		     data & (1<<1)? ", Force Restore": "",
+		     data & (1<<0)? ", Restore Inhibit": "");
 
 	return 2;
 }
@@ -187,99 +460,116 @@ decode_MI_WAIT_FOR_EVENT(struct drm_intel_decode *ctx)
 	}
 
 	if (ctx->gen <= 5) {
-		instr_out(ctx, 0, "MI_WAIT_FOR_EVENT%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
-			  data & (1<<18)? ", pipe B start vblank wait": "",
-			  data & (1<<17)? ", pipe A start vblank wait": "",
-			  data & (1<<16)? ", overlay flip pending wait": "",
-			  data & (1<<14)? ", pipe B hblank wait": "",
-			  data & (1<<13)? ", pipe A hblank wait": "",
-			  cc_wait,
-			  data & (1<<8)? ", plane C pending flip wait": "",
-			  data & (1<<7)? ", pipe B vblank wait": "",
-			  data & (1<<6)? ", plane B pending flip wait": "",
-			  data & (1<<5)? ", pipe B scan line wait": "",
-			  data & (1<<4)? ", fbc idle wait": "",
-			  data & (1<<3)? ", pipe A vblank wait": "",
-			  data & (1<<2)? ", plane A pending flip wait": "",
-			  data & (1<<1)? ", plane A scan line wait": "");
+		instr_header(ctx, "MI_WAIT_FOR_EVENT",
+			     FIELDS("?pipe_b_start_vblank_wait",
+				    "?pipe_a_start_vblank_wait",
+				    "?overlay_flip_pending_wait",
+				    "?pipe_b_hblank_wait",
+				    "?pipe_a_hblank_wait", "",
+				    "?plane_c_pending_flip_wait",
+				    "?pipe_b_vblank_wait",
+				    "?plane_b_pending_flip_wait",
+				    "?pipe_b_scan_line_wait", "?fbc_idle_wait",
+				    "?pipe_a_vblank_wait",
+				    "?plane_a_pending_flip_wait",
+				    "?plane_a_scan_line_wait"),
+			     "MI_WAIT_FOR_EVENT%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
+			     data & (1<<18)? ", pipe B start vblank wait": "",
+			     data & (1<<17)? ", pipe A start vblank wait": "",
+			     data & (1<<16)? ", overlay flip pending wait": "",
+			     data & (1<<14)? ", pipe B hblank wait": "",
+			     data & (1<<13)? ", pipe A hblank wait": "",
+			     cc_wait,
+			     data & (1<<8)? ", plane C pending flip wait": "",
+			     data & (1<<7)? ", pipe B vblank wait": "",
+			     data & (1<<6)? ", plane B pending flip wait": "",
+			     data & (1<<5)? ", pipe B scan line wait": "",
+			     data & (1<<4)? ", fbc idle wait": "",
+			     data & (1<<3)? ", pipe A vblank wait": "",
+			     data & (1<<2)? ", plane A pending flip wait": "",
+			     data & (1<<1)? ", plane A scan line wait": "");
 	} else {
-		instr_out(ctx, 0, "MI_WAIT_FOR_EVENT%s%s%s%s%s%s%s%s%s%s%s%s\n",
-			  data & (1<<20)? ", sprite C pending flip wait": "", /* ivb */
-			  cc_wait,
-			  data & (1<<13)? ", pipe B hblank wait": "",
-			  data & (1<<11)? ", pipe B vblank wait": "",
-			  data & (1<<10)? ", sprite B pending flip wait": "",
-			  data & (1<<9)? ", plane B pending flip wait": "",
-			  data & (1<<8)? ", plane B scan line wait": "",
-			  data & (1<<5)? ", pipe A hblank wait": "",
-			  data & (1<<3)? ", pipe A vblank wait": "",
-			  data & (1<<2)? ", sprite A pending flip wait": "",
-			  data & (1<<1)? ", plane A pending flip wait": "",
-			  data & (1<<0)? ", plane A scan line wait": "");
+		instr_header(ctx, "MI_WAIT_FOR_EVENT",
+			     FIELDS("?sprite_c_pending_flip_wait", "",
+				    "?pipe_b_hblank_wait",
+				    "?pipe_b_vblank_wait",
+				    "?sprite_b_pending_flip_wait",
+				    "?plane_b_pending_flip_wait",
+				    "?plane_b_scan_line_wait",
+				    "?pipe_a_hblank_wait",
+				    "?pipe_a_vblank_wait",
+				    "?sprite_a_pending_flip_wait",
+				    "?plane_a_pending_flip_wait",
+				    "?plane_a_scan_line_wait"),
+			     "MI_WAIT_FOR_EVENT%s%s%s%s%s%s%s%s%s%s%s%s\n",
+			     data & (1<<20)? ", sprite C pending flip wait": "", /* ivb */
+			     cc_wait,
+			     data & (1<<13)? ", pipe B hblank wait": "",
+			     data & (1<<11)? ", pipe B vblank wait": "",
+			     data & (1<<10)? ", sprite B pending flip wait": "",
+			     data & (1<<9)? ", plane B pending flip wait": "",
+			     data & (1<<8)? ", plane B scan line wait": "",
+			     data & (1<<5)? ", pipe A hblank wait": "",
+			     data & (1<<3)? ", pipe A vblank wait": "",
+			     data & (1<<2)? ", sprite A pending flip wait": "",
+			     data & (1<<1)? ", plane A pending flip wait": "",
+			     data & (1<<0)? ", plane A scan line wait": "");
 	}
 
 	return 1;
 }
 
+static const struct decode_opcode opcodes_mi[] = {
+	{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
+	{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
+	{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
+	{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
+	{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
+	{ 0x04, 0, 1, 1, "MI_FLUSH" },
+	{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
+	{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
+	{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
+	{ 0x00, 0, 1, 1, "MI_NOOP" },
+	{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
+	{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
+	{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", 0, decode_MI_SET_CONTEXT },
+	{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
+	{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
+	{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
+	{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
+	{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", 0, decode_MI_WAIT_FOR_EVENT },
+	{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
+	{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
+	{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
+	{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
+	{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
+};
+
 static int
 decode_mi(struct drm_intel_decode *ctx)
 {
-	unsigned int opcode, len = -1;
+	unsigned int len = -1;
 	const char *post_sync_op = "";
 	uint32_t *data = ctx->data;
+	const struct decode_opcode *opcode_mi = NULL;
+	unsigned int idx;
 
-	struct {
-		uint32_t opcode;
-		int len_mask;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_mi[] = {
-		{ 0x08, 0, 1, 1, "MI_ARB_ON_OFF" },
-		{ 0x0a, 0, 1, 1, "MI_BATCH_BUFFER_END" },
-		{ 0x30, 0x3f, 3, 3, "MI_BATCH_BUFFER" },
-		{ 0x31, 0x3f, 2, 2, "MI_BATCH_BUFFER_START" },
-		{ 0x14, 0x3f, 3, 3, "MI_DISPLAY_BUFFER_INFO" },
-		{ 0x04, 0, 1, 1, "MI_FLUSH" },
-		{ 0x22, 0x1f, 3, 3, "MI_LOAD_REGISTER_IMM" },
-		{ 0x13, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_EXCL" },
-		{ 0x12, 0x3f, 2, 2, "MI_LOAD_SCAN_LINES_INCL" },
-		{ 0x00, 0, 1, 1, "MI_NOOP" },
-		{ 0x11, 0x3f, 2, 2, "MI_OVERLAY_FLIP" },
-		{ 0x07, 0, 1, 1, "MI_REPORT_HEAD" },
-		{ 0x18, 0x3f, 2, 2, "MI_SET_CONTEXT", decode_MI_SET_CONTEXT },
-		{ 0x20, 0x3f, 3, 4, "MI_STORE_DATA_IMM" },
-		{ 0x21, 0x3f, 3, 4, "MI_STORE_DATA_INDEX" },
-		{ 0x24, 0x3f, 3, 3, "MI_STORE_REGISTER_MEM" },
-		{ 0x02, 0, 1, 1, "MI_USER_INTERRUPT" },
-		{ 0x03, 0, 1, 1, "MI_WAIT_FOR_EVENT", decode_MI_WAIT_FOR_EVENT },
-		{ 0x16, 0x7f, 3, 3, "MI_SEMAPHORE_MBOX" },
-		{ 0x26, 0x1f, 3, 4, "MI_FLUSH_DW" },
-		{ 0x28, 0x3f, 3, 3, "MI_REPORT_PERF_COUNT" },
-		{ 0x29, 0xff, 3, 3, "MI_LOAD_REGISTER_MEM" },
-		{ 0x0b, 0, 1, 1, "MI_SUSPEND_FLUSH"},
-	}, *opcode_mi = NULL;
-
-	/* check instruction length */
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			len = 1;
-			if (opcodes_mi[opcode].max_len > 1) {
-				len =
-				    (data[0] & opcodes_mi[opcode].len_mask) + 2;
-				if (len < opcodes_mi[opcode].min_len
-				    || len > opcodes_mi[opcode].max_len) {
-					fprintf(out,
-						"Bad length (%d) in %s, [%d, %d]\n",
-						len, opcodes_mi[opcode].name,
-						opcodes_mi[opcode].min_len,
-						opcodes_mi[opcode].max_len);
-				}
+	idx = ctx->index_mi[(data[0] & 0x1f800000) >> 23];
+	if (idx) {
+		opcode_mi = &opcodes_mi[idx - 1];
+
+		/* check instruction length */
+		len = 1;
+		if (opcode_mi->max_len > 1) {
+			len = (data[0] & opcode_mi->len_mask) + 2;
+			if (len < opcode_mi->min_len ||
+			    len > opcode_mi->max_len) {
+				decode_printf(ctx,
+					      "Bad length (%d) in %s, [%d, %d]\n",
+					      len, opcode_mi->name,
+					      opcode_mi->min_len,
+					      opcode_mi->max_len);
 			}
-			opcode_mi = &opcodes_mi[opcode];
-			break;
 		}
 	}
 
@@ -288,21 +578,27 @@ decode_mi(struct drm_intel_decode *ctx)
 
 	switch ((data[0] & 0x1f800000) >> 23) {
 	case 0x0a:
-		instr_out(ctx, 0, "MI_BATCH_BUFFER_END\n");
+		instr_header(ctx, "MI_BATCH_BUFFER_END", NULL,
+			     "MI_BATCH_BUFFER_END\n");
 		return -1;
 	case 0x16:
-		instr_out(ctx, 0, "MI_SEMAPHORE_MBOX%s%s%s%s %u\n",
-			  data[0] & (1 << 22) ? " global gtt," : "",
-			  data[0] & (1 << 21) ? " update semaphore," : "",
-			  data[0] & (1 << 20) ? " compare semaphore," : "",
-			  data[0] & (1 << 18) ? " use compare reg" : "",
-			  (data[0] & (0x3 << 16)) >> 16);
+		instr_header(ctx, "MI_SEMAPHORE_MBOX",
+			     FIELDS("?global_gtt", "?update_semaphore",
+				    "?compare_semaphore", "?use_compare_reg",
+				    "length"), "MI_SEMAPHORE_MBOX%s%s%s%s %u\n",
+			     data[0] & (1 << 22) ? " global gtt," : "",
+			     data[0] & (1 << 21) ? " update semaphore," : "",
+			     data[0] & (1 << 20) ? " compare semaphore," : "",
+			     data[0] & (1 << 18) ? " use compare reg" : "",
+			     (data[0] & (0x3 << 16)) >> 16);
 		instr_out(ctx, 1, "value\n");
 		instr_out(ctx, 2, "address\n");
 		return len;
 	case 0x21:
-		instr_out(ctx, 0, "MI_STORE_DATA_INDEX%s\n",
-			  data[0] & (1 << 21) ? " use per-process HWS," : "");
+		instr_header(ctx, "MI_STORE_DATA_INDEX",
+			     FIELDS("?use_per_process_hws"),
+			     "MI_STORE_DATA_INDEX%s\n",
+			     data[0] & (1 << 21) ? " use per-process HWS," : "");
 		instr_out(ctx, 1, "index\n");
 		instr_out(ctx, 2, "dword\n");
 		if (len == 4)
@@ -310,11 +606,11 @@ decode_mi(struct drm_intel_decode *ctx)
 		return len;
 	case 0x00:
 		if (data[0] & (1 << 22))
-			instr_out(ctx, 0,
-				  "MI_NOOP write NOPID reg, val=0x%x\n",
-				  data[0] & ((1 << 22) - 1));
+			instr_header(ctx, "MI_NOOP", FIELDS("nopid"),
+				     "MI_NOOP write NOPID reg, val=0x%x\n",
+				     data[0] & ((1 << 22) - 1));
 		else
-			instr_out(ctx, 0, "MI_NOOP\n");
+			instr_header(ctx, "MI_NOOP", NULL, "MI_NOOP\n");
 		return len;
 	case 0x26:
 		switch (data[0] & (0x3 << 14)) {
@@ -331,17 +627,21 @@ decode_mi(struct drm_intel_decode *ctx)
 			post_sync_op = "write TIMESTAMP";
 			break;
 		}
-		instr_out(ctx, 0,
-			  "MI_FLUSH_DW%s%s%s%s post_sync_op='%s' %s%s\n",
-			  data[0] & (1 << 22) ?
-			  " enable protected mem (BCS-only)," : "",
-			  data[0] & (1 << 21) ? " store in hws," : "",
-			  data[0] & (1 << 18) ? " invalidate tlb," : "",
-			  data[0] & (1 << 17) ? " flush gfdt," : "",
-			  post_sync_op,
-			  data[0] & (1 << 8) ? " enable notify interrupt," : "",
-			  data[0] & (1 << 7) ?
-			  " invalidate video state (BCS-only)," : "");
+		instr_header(ctx, "MI_FLUSH_DW",
+			     FIELDS("?enable_protected_mem", "?store_in_hws",
+				    "?invalidate_tlb", "?flush_gfdt",
+				    "post_sync_op", "?notify_enable",
+				    "?invalidate_video_state"),
+			     "MI_FLUSH_DW%s%s%s%s post_sync_op='%s' %s%s\n",
+			     data[0] & (1 << 22) ?
+			     " enable protected mem (BCS-only)," : "",
+			     data[0] & (1 << 21) ? " store in hws," : "",
+			     data[0] & (1 << 18) ? " invalidate tlb," : "",
+			     data[0] & (1 << 17) ? " flush gfdt," : "",
+			     post_sync_op,
+			     data[0] & (1 << 8) ? " enable notify interrupt," : "",
+			     data[0] & (1 << 7) ?
+			     " invalidate video state (BCS-only)," : "");
 		if (data[0] & (1 << 21))
 			instr_out(ctx, 1, "hws index\n");
 		else
@@ -352,35 +652,34 @@ decode_mi(struct drm_intel_decode *ctx)
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_mi) / sizeof(opcodes_mi[0]);
-	     opcode++) {
-		if ((data[0] & 0x1f800000) >> 23 == opcodes_mi[opcode].opcode) {
-			unsigned int i;
-
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_mi[opcode].name);
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
-			}
+	if (opcode_mi) {
+		unsigned int i;
 
-			return len;
+		instr_header(ctx, opcode_mi->name, FIELDS(""),
+			     "%s\n", opcode_mi->name);
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
-	instr_out(ctx, 0, "MI UNKNOWN\n");
+	instr_header(ctx, "UNKNOWN", NULL, "MI UNKNOWN\n");
 	return 1;
 }
 
 static void
 decode_2d_br00(struct drm_intel_decode *ctx, const char *cmd)
 {
-	instr_out(ctx, 0,
-		  "%s (rgb %sabled, alpha %sabled, src tile %d, dst tile %d)\n",
-		  cmd,
-		  (ctx->data[0] & (1 << 20)) ? "en" : "dis",
-		  (ctx->data[0] & (1 << 21)) ? "en" : "dis",
-		  (ctx->data[0] >> 15) & 1,
-		  (ctx->data[0] >> 11) & 1);
+	instr_header(ctx, cmd,
+		     FIELDS("", "rgb_enable", "alpha_enable", "src_tile",
+			    "dst_tile"),
+		     "%s (rgb %sabled, alpha %sabled, src tile %d, dst tile %d)\n",
+		     cmd,
+		     (ctx->data[0] & (1 << 20)) ? "en" : "dis",
+		     (ctx->data[0] & (1 << 21)) ? "en" : "dis",
+		     (ctx->data[0] >> 15) & 1,
+		     (ctx->data[0] >> 11) & 1);
 }
 
 static void
@@ -402,88 +701,93 @@ decode_2d_br01(struct drm_intel_decode *ctx)
 		break;
 	}
 
-	instr_out(ctx, 1,
-		  "format %s, pitch %d, rop 0x%02x, "
-		  "clipping %sabled, %s%s \n",
-		  format,
-		  (short)(ctx->data[1] & 0xffff),
-		  (ctx->data[1] >> 16) & 0xff,
-		  ctx->data[1] & (1 << 30) ? "en" : "dis",
-		  ctx->data[1] & (1 << 31) ? "solid pattern enabled, " : "",
-		  ctx->data[1] & (1 << 31) ?
-		  "mono pattern transparency enabled, " : "");
+	instr_fields(ctx, 1,
+		     FIELDS("format", "pitch", "rop", "clipping",
+			    "?solid_pattern", "?mono_pattern_transparency"),
+		     "format %s, pitch %d, rop 0x%02x, "
+		     "clipping %sabled, %s%s \n",
+		     format,
+		     (short)(ctx->data[1] & 0xffff),
+		     (ctx->data[1] >> 16) & 0xff,
+		     ctx->data[1] & (1 << 30) ? "en" : "dis",
+		     ctx->data[1] & (1 << 31) ? "solid pattern enabled, " : "",
+		     ctx->data[1] & (1 << 31) ?
+		     "mono pattern transparency enabled, " : "");
 
 }
 
+static const struct decode_opcode opcodes_2d[] = {
+	{ 0x40, 0xff, 5, 5, "COLOR_BLT" },
+	{ 0x43, 0xff, 6, 6, "SRC_COPY_BLT" },
+	{ 0x01, 0xff, 8, 8, "XY_SETUP_BLT" },
+	{ 0x11, 0xff, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
+	{ 0x03, 0xff, 3, 3, "XY_SETUP_CLIP_BLT" },
+	{ 0x24, 0xff, 2, 2, "XY_PIXEL_BLT" },
+	{ 0x25, 0xff, 3, 3, "XY_SCANLINES_BLT" },
+	{ 0x26, 0xff, 4, 4, "Y_TEXT_BLT" },
+	{ 0x31, 0xff, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
+	{ 0x50, 0xff, 6, 6, "XY_COLOR_BLT" },
+	{ 0x51, 0xff, 6, 6, "XY_PAT_BLT" },
+	{ 0x76, 0xff, 8, 8, "XY_PAT_CHROMA_BLT" },
+	{ 0x72, 0xff, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
+	{ 0x77, 0xff, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
+	{ 0x52, 0xff, 9, 9, "XY_MONO_PAT_BLT" },
+	{ 0x59, 0xff, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
+	{ 0x53, 0xff, 8, 8, "XY_SRC_COPY_BLT" },
+	{ 0x54, 0xff, 8, 8, "XY_MONO_SRC_COPY_BLT" },
+	{ 0x71, 0xff, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
+	{ 0x55, 0xff, 9, 9, "XY_FULL_BLT" },
+	{ 0x55, 0xff, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
+	{ 0x56, 0xff, 9, 9, "XY_FULL_MONO_SRC_BLT" },
+	{ 0x75, 0xff, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
+	{ 0x57, 0xff, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
+	{ 0x58, 0xff, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
+};
+
 static int
 decode_2d(struct drm_intel_decode *ctx)
 {
-	unsigned int opcode, len;
+	unsigned int idx, len;
 	uint32_t *data = ctx->data;
-
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_2d[] = {
-		{ 0x40, 5, 5, "COLOR_BLT" },
-		{ 0x43, 6, 6, "SRC_COPY_BLT" },
-		{ 0x01, 8, 8, "XY_SETUP_BLT" },
-		{ 0x11, 9, 9, "XY_SETUP_MONO_PATTERN_SL_BLT" },
-		{ 0x03, 3, 3, "XY_SETUP_CLIP_BLT" },
-		{ 0x24, 2, 2, "XY_PIXEL_BLT" },
-		{ 0x25, 3, 3, "XY_SCANLINES_BLT" },
-		{ 0x26, 4, 4, "Y_TEXT_BLT" },
-		{ 0x31, 5, 134, "XY_TEXT_IMMEDIATE_BLT" },
-		{ 0x50, 6, 6, "XY_COLOR_BLT" },
-		{ 0x51, 6, 6, "XY_PAT_BLT" },
-		{ 0x76, 8, 8, "XY_PAT_CHROMA_BLT" },
-		{ 0x72, 7, 135, "XY_PAT_BLT_IMMEDIATE" },
-		{ 0x77, 9, 137, "XY_PAT_CHROMA_BLT_IMMEDIATE" },
-		{ 0x52, 9, 9, "XY_MONO_PAT_BLT" },
-		{ 0x59, 7, 7, "XY_MONO_PAT_FIXED_BLT" },
-		{ 0x53, 8, 8, "XY_SRC_COPY_BLT" },
-		{ 0x54, 8, 8, "XY_MONO_SRC_COPY_BLT" },
-		{ 0x71, 9, 137, "XY_MONO_SRC_COPY_IMMEDIATE_BLT" },
-		{ 0x55, 9, 9, "XY_FULL_BLT" },
-		{ 0x55, 9, 137, "XY_FULL_IMMEDIATE_PATTERN_BLT" },
-		{ 0x56, 9, 9, "XY_FULL_MONO_SRC_BLT" },
-		{ 0x75, 10, 138, "XY_FULL_MONO_SRC_IMMEDIATE_PATTERN_BLT" },
-		{ 0x57, 12, 12, "XY_FULL_MONO_PATTERN_BLT" },
-		{ 0x58, 12, 12, "XY_FULL_MONO_PATTERN_MONO_SRC_BLT"},
-	};
+	const struct decode_opcode *opcode_2d;
 
 	switch ((data[0] & 0x1fc00000) >> 22) {
 	case 0x25:
-		instr_out(ctx, 0,
-			  "XY_SCANLINES_BLT (pattern seed (%d, %d), dst tile %d)\n",
-			  (data[0] >> 12) & 0x8,
-			  (data[0] >> 8) & 0x8, (data[0] >> 11) & 1);
+		instr_header(ctx, "XY_SCANLINES_BLT",
+			     FIELDS("pattern_seed_x", "pattern_seed_y",
+				    "dst_tile"),
+			     "XY_SCANLINES_BLT (pattern seed (%d, %d), dst tile %d)\n",
+			     (data[0] >> 12) & 0x8,
+			     (data[0] >> 8) & 0x8, (data[0] >> 11) & 1);
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SCANLINES_BLT\n");
-
-		instr_out(ctx, 1, "dest (%d,%d)\n",
-			  data[1] & 0xffff, data[1] >> 16);
-		instr_out(ctx, 2, "dest (%d,%d)\n",
-			  data[2] & 0xffff, data[2] >> 16);
+			decode_printf(ctx, "Bad count in XY_SCANLINES_BLT\n");
+
+		instr_fields(ctx, 1, FIELDS("dst_x1", "dst_y1"),
+			     "dest (%d,%d)\n",
+			     data[1] & 0xffff, data[1] >> 16);
+		instr_fields(ctx, 2, FIELDS("dst_x2", "dst_y2"),
+			     "dest (%d,%d)\n",
+			     data[2] & 0xffff, data[2] >> 16);
 		return len;
 	case 0x01:
 		decode_2d_br00(ctx, "XY_SETUP_BLT");
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SETUP_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SETUP_BLT\n");
 
 		decode_2d_br01(ctx);
-		instr_out(ctx, 2, "cliprect (%d,%d)\n",
-			  data[2] & 0xffff, data[2] >> 16);
-		instr_out(ctx, 3, "cliprect (%d,%d)\n",
-			  data[3] & 0xffff, data[3] >> 16);
-		instr_out(ctx, 4, "setup dst offset 0x%08x\n",
-			  data[4]);
+		instr_fields(ctx, 2, FIELDS("cliprect_x1", "cliprect_y1"),
+			     "cliprect (%d,%d)\n",
+			     data[2] & 0xffff, data[2] >> 16);
+		instr_fields(ctx, 3, FIELDS("cliprect_x2", "cliprect_y2"),
+			     "cliprect (%d,%d)\n",
+			     data[3] & 0xffff, data[3] >> 16);
+		instr_fields(ctx, 4, FIELDS("setup_dst_offset"),
+			     "setup dst offset 0x%08x\n",
+			     data[4]);
 		instr_out(ctx, 5, "setup background color\n");
 		instr_out(ctx, 6, "setup foreground color\n");
 		instr_out(ctx, 7, "color pattern offset\n");
@@ -493,28 +797,33 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 3)
-			fprintf(out, "Bad count in XY_SETUP_CLIP_BLT\n");
-
-		instr_out(ctx, 1, "cliprect (%d,%d)\n",
-			  data[1] & 0xffff, data[2] >> 16);
-		instr_out(ctx, 2, "cliprect (%d,%d)\n",
-			  data[2] & 0xffff, data[3] >> 16);
+			decode_printf(ctx, "Bad count in XY_SETUP_CLIP_BLT\n");
+
+		instr_fields(ctx, 1, FIELDS("cliprect_x1", "cliprect_y1"),
+			     "cliprect (%d,%d)\n",
+			     data[1] & 0xffff, data[2] >> 16);
+		instr_fields(ctx, 2, FIELDS("cliprect_x2", "cliprect_y2"),
+			     "cliprect (%d,%d)\n",
+			     data[2] & 0xffff, data[3] >> 16);
 		return len;
 	case 0x11:
 		decode_2d_br00(ctx, "XY_SETUP_MONO_PATTERN_SL_BLT");
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 9)
-			fprintf(out,
-				"Bad count in XY_SETUP_MONO_PATTERN_SL_BLT\n");
+			decode_printf(ctx,
+				      "Bad count in XY_SETUP_MONO_PATTERN_SL_BLT\n");
 
 		decode_2d_br01(ctx);
-		instr_out(ctx, 2, "cliprect (%d,%d)\n",
-			  data[2] & 0xffff, data[2] >> 16);
-		instr_out(ctx, 3, "cliprect (%d,%d)\n",
-			  data[3] & 0xffff, data[3] >> 16);
-		instr_out(ctx, 4, "setup dst offset 0x%08x\n",
-			  data[4]);
+		instr_fields(ctx, 2, FIELDS("cliprect_x1", "cliprect_y1"),
+			     "cliprect (%d,%d)\n",
+			     data[2] & 0xffff, data[2] >> 16);
+		instr_fields(ctx, 3, FIELDS("cliprect_x2", "cliprect_y2"),
+			     "cliprect (%d,%d)\n",
+			     data[3] & 0xffff, data[3] >> 16);
+		instr_fields(ctx, 4, FIELDS("setup_dst_offset"),
+			     "setup dst offset 0x%08x\n",
+			     data[4]);
 		instr_out(ctx, 5, "setup background color\n");
 		instr_out(ctx, 6, "setup foreground color\n");
 		instr_out(ctx, 7, "mono pattern dw0\n");
@@ -525,14 +834,15 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 6)
-			fprintf(out, "Bad count in XY_COLOR_BLT\n");
+			decode_printf(ctx, "Bad count in XY_COLOR_BLT\n");
 
 		decode_2d_br01(ctx);
-		instr_out(ctx, 2, "(%d,%d)\n",
-			  data[2] & 0xffff, data[2] >> 16);
-		instr_out(ctx, 3, "(%d,%d)\n",
-			  data[3] & 0xffff, data[3] >> 16);
-		instr_out(ctx, 4, "offset 0x%08x\n", data[4]);
+		instr_fields(ctx, 2, FIELDS("dst_x1", "dst_y1"), "(%d,%d)\n",
+			     data[2] & 0xffff, data[2] >> 16);
+		instr_fields(ctx, 3, FIELDS("dst_x2", "dst_y2"), "(%d,%d)\n",
+			     data[3] & 0xffff, data[3] >> 16);
+		instr_fields(ctx, 4, FIELDS("dst_offset"),
+			     "offset 0x%08x\n", data[4]);
 		instr_out(ctx, 5, "color\n");
 		return len;
 	case 0x53:
@@ -540,48 +850,52 @@ decode_2d(struct drm_intel_decode *ctx)
 
 		len = (data[0] & 0x000000ff) + 2;
 		if (len != 8)
-			fprintf(out, "Bad count in XY_SRC_COPY_BLT\n");
+			decode_printf(ctx, "Bad count in XY_SRC_COPY_BLT\n");
 
 		decode_2d_br01(ctx);
-		instr_out(ctx, 2, "dst (%d,%d)\n",
-			  data[2] & 0xffff, data[2] >> 16);
-		instr_out(ctx, 3, "dst (%d,%d)\n",
-			  data[3] & 0xffff, data[3] >> 16);
-		instr_out(ctx, 4, "dst offset 0x%08x\n", data[4]);
-		instr_out(ctx, 5, "src (%d,%d)\n",
-			  data[5] & 0xffff, data[5] >> 16);
-		instr_out(ctx, 6, "src pitch %d\n",
-			  (short)(data[6] & 0xffff));
-		instr_out(ctx, 7, "src offset 0x%08x\n", data[7]);
+		instr_fields(ctx, 2, FIELDS("dst_x1", "dst_y1"),
+			     "dst (%d,%d)\n",
+			     data[2] & 0xffff, data[2] >> 16);
+		instr_fields(ctx, 3, FIELDS("dst_x2", "dst_y2"),
+			     "dst (%d,%d)\n",
+			     data[3] & 0xffff, data[3] >> 16);
+		instr_fields(ctx, 4, FIELDS("dst_offset"),
+			     "dst offset 0x%08x\n", data[4]);
+		instr_fields(ctx, 5, FIELDS("src_x1", "src_y1"),
+			     "src (%d,%d)\n",
+			     data[5] & 0xffff, data[5] >> 16);
+		instr_fields(ctx, 6, FIELDS("src_pitch"), "src pitch %d\n",
+			     (short)(data[6] & 0xffff));
+		instr_fields(ctx, 7, FIELDS("src_offset"),
+			     "src offset 0x%08x\n", data[7]);
 		return len;
 	}
 
-	for (opcode = 0; opcode < sizeof(opcodes_2d) / sizeof(opcodes_2d[0]);
-	     opcode++) {
-		if ((data[0] & 0x1fc00000) >> 22 == opcodes_2d[opcode].opcode) {
-			unsigned int i;
-
-			len = 1;
-			instr_out(ctx, 0, "%s\n",
-				  opcodes_2d[opcode].name);
-			if (opcodes_2d[opcode].max_len > 1) {
-				len = (data[0] & 0x000000ff) + 2;
-				if (len < opcodes_2d[opcode].min_len ||
-				    len > opcodes_2d[opcode].max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcodes_2d[opcode].name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+	idx = ctx->index_2d[(data[0] & 0x1fc00000) >> 22];
+	if (idx) {
+		unsigned int i;
+
+		opcode_2d = &opcodes_2d[idx - 1];
+		len = 1;
+		instr_header(ctx, opcode_2d->name, FIELDS(""),
+			     "%s\n", opcode_2d->name);
+		if (opcode_2d->max_len > 1) {
+			len = (data[0] & opcode_2d->len_mask) + 2;
+			if (len < opcode_2d->min_len ||
+			    len > opcode_2d->max_len) {
+				decode_printf(ctx, "Bad count in %s\n",
+					      opcode_2d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
-	instr_out(ctx, 0, "2D UNKNOWN\n");
+	instr_header(ctx, "UNKNOWN", NULL, "2D UNKNOWN\n");
 	return 1;
 }
 
@@ -595,34 +909,40 @@ decode_3d_1c(struct drm_intel_decode *ctx)
 
 	switch (opcode) {
 	case 0x11:
-		instr_out(ctx, 0,
-			  "3DSTATE_DEPTH_SUBRECTANGLE_DISABLE\n");
+		instr_header(ctx, "3DSTATE_DEPTH_SUBRECTANGLE_DISABLE", NULL,
+			     "3DSTATE_DEPTH_SUBRECTANGLE_DISABLE\n");
 		return 1;
 	case 0x10:
-		instr_out(ctx, 0, "3DSTATE_SCISSOR_ENABLE %s\n",
-			  data[0] & 1 ? "enabled" : "disabled");
+		instr_header(ctx, "3DSTATE_SCISSOR_ENABLE", FIELDS("enable"),
+			     "3DSTATE_SCISSOR_ENABLE %s\n",
+			     data[0] & 1 ? "enabled" : "disabled");
 		return 1;
 	case 0x01:
-		instr_out(ctx, 0, "3DSTATE_MAP_COORD_SET_I830\n");
+		instr_header(ctx, "3DSTATE_MAP_COORD_SET_I830", NULL,
+			     "3DSTATE_MAP_COORD_SET_I830\n");
 		return 1;
 	case 0x0a:
-		instr_out(ctx, 0, "3DSTATE_MAP_CUBE_I830\n");
+		instr_header(ctx, "3DSTATE_MAP_CUBE_I830", NULL,
+			     "3DSTATE_MAP_CUBE_I830\n");
 		return 1;
 	case 0x05:
-		instr_out(ctx, 0, "3DSTATE_MAP_TEX_STREAM_I830\n");
+		instr_header(ctx, "3DSTATE_MAP_TEX_STREAM_I830", NULL,
+			     "3DSTATE_MAP_TEX_STREAM_I830\n");
 		return 1;
 	}
 
-	instr_out(ctx, 0, "3D UNKNOWN: 3d_1c opcode = 0x%x\n",
-		  opcode);
+	instr_header(ctx, "UNKNOWN", FIELDS("opcode"),
+		     "3D UNKNOWN: 3d_1c opcode = 0x%x\n",
+		     opcode);
 	return 1;
 }
 
 /** Sets the string dstname to describe the destination of the PS instruction */
 static void
-i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
+i915_get_instruction_dst(struct drm_intel_decode *ctx, int i, char *dstname,
+			 int do_mask)
 {
-	uint32_t a0 = data[i];
+	uint32_t a0 = ctx->data[i];
 	int dst_nr = (a0 >> 14) & 0xf;
 	char dstmask[8];
 	const char *sat;
@@ -657,22 +977,22 @@ i915_get_instruction_dst(uint32_t *data, int i, char *dstname, int do_mask)
 	switch ((a0 >> 19) & 0x7) {
 	case 0:
 		if (dst_nr > 15)
-			fprintf(out, "bad destination reg R%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg R%d\n", dst_nr);
 		sprintf(dstname, "R%d%s%s", dst_nr, dstmask, sat);
 		break;
 	case 4:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oC%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg oC%d\n", dst_nr);
 		sprintf(dstname, "oC%s%s", dstmask, sat);
 		break;
 	case 5:
 		if (dst_nr > 0)
-			fprintf(out, "bad destination reg oD%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg oD%d\n", dst_nr);
 		sprintf(dstname, "oD%s%s", dstmask, sat);
 		break;
 	case 6:
 		if (dst_nr > 3)
-			fprintf(out, "bad destination reg U%d\n", dst_nr);
+			decode_printf(ctx, "bad destination reg U%d\n", dst_nr);
 		sprintf(dstname, "U%d%s%s", dst_nr, dstmask, sat);
 		break;
 	default:
@@ -703,13 +1023,14 @@ i915_get_channel_swizzle(uint32_t select)
 }
 
 static void
-i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_src_name(struct drm_intel_decode *ctx, uint32_t src_type,
+			      uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -721,39 +1042,41 @@ i915_get_instruction_src_name(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			decode_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 2:
 		sprintf(name, "C%d", src_nr);
 		if (src_nr > 31)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	case 6:
 		sprintf(name, "U%d", src_nr);
 		if (src_nr > 3)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		decode_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
 }
 
-static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src0(struct drm_intel_decode *ctx, int i,
+				       char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a0 = data[i];
 	uint32_t a1 = data[i + 1];
 	int src_nr = (a0 >> 2) & 0x1f;
@@ -763,15 +1086,17 @@ static void i915_get_instruction_src0(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a1 >> 16) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a0 >> 7) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a0 >> 7) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src1(struct drm_intel_decode *ctx, int i,
+				       char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a1 = data[i + 1];
 	uint32_t a2 = data[i + 2];
 	int src_nr = (a1 >> 8) & 0x1f;
@@ -781,15 +1106,17 @@ static void i915_get_instruction_src1(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 24) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a1 >> 13) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a1 >> 13) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
 		strcat(srcname, swizzle);
 }
 
-static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
+static void i915_get_instruction_src2(struct drm_intel_decode *ctx, int i,
+				       char *srcname)
 {
+	uint32_t *data = ctx->data;
 	uint32_t a2 = data[i + 2];
 	int src_nr = (a2 >> 16) & 0x1f;
 	const char *swizzle_x = i915_get_channel_swizzle((a2 >> 12) & 0xf);
@@ -798,7 +1125,7 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 	const char *swizzle_w = i915_get_channel_swizzle((a2 >> 0) & 0xf);
 	char swizzle[100];
 
-	i915_get_instruction_src_name((a2 >> 21) & 0x7, src_nr, srcname);
+	i915_get_instruction_src_name(ctx, (a2 >> 21) & 0x7, src_nr, srcname);
 	sprintf(swizzle, ".%s%s%s%s", swizzle_x, swizzle_y, swizzle_z,
 		swizzle_w);
 	if (strcmp(swizzle, ".xyzw") != 0)
@@ -806,13 +1133,14 @@ static void i915_get_instruction_src2(uint32_t *data, int i, char *srcname)
 }
 
 static void
-i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
+i915_get_instruction_addr(struct drm_intel_decode *ctx, uint32_t src_type,
+			  uint32_t src_nr, char *name)
 {
 	switch (src_type) {
 	case 0:
 		sprintf(name, "R%d", src_nr);
 		if (src_nr > 15)
-			fprintf(out, "bad src reg %s\n", name);
+			decode_printf(ctx, "bad src reg %s\n", name);
 		break;
 	case 1:
 		if (src_nr < 8)
@@ -824,22 +1152,22 @@ i915_get_instruction_addr(uint32_t src_type, uint32_t src_nr, char *name)
 		else if (src_nr == 10)
 			sprintf(name, "FOG");
 		else {
-			fprintf(out, "bad src reg T%d\n", src_nr);
+			decode_printf(ctx, "bad src reg T%d\n", src_nr);
 			sprintf(name, "RESERVED");
 		}
 		break;
 	case 4:
 		sprintf(name, "oC");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oC%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oC%d\n", src_nr);
 		break;
 	case 5:
 		sprintf(name, "oD");
 		if (src_nr > 0)
-			fprintf(out, "bad src reg oD%d\n", src_nr);
+			decode_printf(ctx, "bad src reg oD%d\n", src_nr);
 		break;
 	default:
-		fprintf(out, "bad src reg type %d\n", src_type);
+		decode_printf(ctx, "bad src reg type %d\n", src_type);
 		sprintf(name, "RESERVED");
 		break;
 	}
@@ -851,8 +1179,8 @@ i915_decode_alu1(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
 
 	instr_out(ctx, i++, "%s: %s %s, %s\n", instr_prefix,
 		  op_name, dst, src0);
@@ -866,9 +1194,9 @@ i915_decode_alu2(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1);
@@ -882,10 +1210,10 @@ i915_decode_alu3(struct drm_intel_decode *ctx,
 {
 	char dst[100], src0[100], src1[100], src2[100];
 
-	i915_get_instruction_dst(ctx->data, i, dst, 1);
-	i915_get_instruction_src0(ctx->data, i, src0);
-	i915_get_instruction_src1(ctx->data, i, src1);
-	i915_get_instruction_src2(ctx->data, i, src2);
+	i915_get_instruction_dst(ctx, i, dst, 1);
+	i915_get_instruction_src0(ctx, i, src0);
+	i915_get_instruction_src1(ctx, i, src1);
+	i915_get_instruction_src2(ctx, i, src2);
 
 	instr_out(ctx, i++, "%s: %s %s, %s, %s, %s\n", instr_prefix,
 		  op_name, dst, src0, src1, src2);
@@ -903,8 +1231,8 @@ i915_decode_tex(struct drm_intel_decode *ctx, int i,
 	char addr_name[100];
 	int sampler_nr;
 
-	i915_get_instruction_dst(ctx->data, i, dst_name, 0);
-	i915_get_instruction_addr((t1 >> 24) & 0x7,
+	i915_get_instruction_dst(ctx, i, dst_name, 0);
+	i915_get_instruction_addr(ctx, (t1 >> 24) & 0x7,
 				  (t1 >> 17) & 0xf, addr_name);
 	sampler_nr = t0 & 0xf;
 
@@ -930,31 +1258,31 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 	case 1:
 		sprintf(dcl_mask, ".%s%s%s%s", dcl_x, dcl_y, dcl_z, dcl_w);
 		if (strcmp(dcl_mask, ".") == 0)
-			fprintf(out, "bad (empty) dcl mask\n");
+			decode_printf(ctx, "bad (empty) dcl mask\n");
 
 		if (dcl_nr > 10)
-			fprintf(out, "bad T%d dcl register number\n", dcl_nr);
+			decode_printf(ctx, "bad T%d dcl register number\n", dcl_nr);
 		if (dcl_nr < 8) {
 			if (strcmp(dcl_mask, ".x") != 0 &&
 			    strcmp(dcl_mask, ".xy") != 0 &&
 			    strcmp(dcl_mask, ".xz") != 0 &&
 			    strcmp(dcl_mask, ".w") != 0 &&
 			    strcmp(dcl_mask, ".xyzw") != 0) {
-				fprintf(out, "bad T%d.%s dcl mask\n", dcl_nr,
-					dcl_mask);
+				decode_printf(ctx, "bad T%d.%s dcl mask\n", dcl_nr,
+					      dcl_mask);
 			}
 			instr_out(ctx, i++, "%s: DCL T%d%s\n",
 				  instr_prefix, dcl_nr, dcl_mask);
 		} else {
 			if (strcmp(dcl_mask, ".xz") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
-					dcl_mask);
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
+					      dcl_mask);
 			else if (strcmp(dcl_mask, ".xw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
-					dcl_mask);
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
+					      dcl_mask);
 			else if (strcmp(dcl_mask, ".xzw") == 0)
-				fprintf(out, "errataed bad dcl mask %s\n",
-					dcl_mask);
+				decode_printf(ctx, "errataed bad dcl mask %s\n",
+					      dcl_mask);
 
 			if (dcl_nr == 8) {
 				instr_out(ctx, i++,
@@ -989,7 +1317,7 @@ i915_decode_dcl(struct drm_intel_decode *ctx, int i, char *instr_prefix)
 			break;
 		}
 		if (dcl_nr > 15)
-			fprintf(out, "bad S%d dcl register number\n", dcl_nr);
+			decode_printf(ctx, "bad S%d dcl register number\n", dcl_nr);
 		instr_out(ctx, i++, "%s: DCL S%d %s\n",
 			  instr_prefix, dcl_nr, sampletype);
 		instr_out(ctx, i++, "%s\n", instr_prefix);
@@ -1263,6 +1591,25 @@ decode_sample_filter(uint32_t mode)
 	return "";
 }
 
+static const struct decode_opcode opcodes_3d_1d[] = {
+	{ 0x86, 0xffff, 4, 4, "3DSTATE_CHROMA_KEY" },
+	{ 0x88, 0xffff, 2, 2, "3DSTATE_CONSTANT_BLEND_COLOR" },
+	{ 0x99, 0xffff, 2, 2, "3DSTATE_DEFAULT_DIFFUSE" },
+	{ 0x9a, 0xffff, 2, 2, "3DSTATE_DEFAULT_SPECULAR" },
+	{ 0x98, 0xffff, 2, 2, "3DSTATE_DEFAULT_Z" },
+	{ 0x97, 0xffff, 2, 2, "3DSTATE_DEPTH_OFFSET_SCALE" },
+	{ 0x9d, 0xffff, 65, 65, "3DSTATE_FILTER_COEFFICIENTS_4X4" },
+	{ 0x9e, 0xffff, 4, 4, "3DSTATE_MONO_FILTER" },
+	{ 0x89, 0xffff, 4, 4, "3DSTATE_FOG_MODE" },
+	{ 0x8f, 0xffff, 2, 16, "3DSTATE_MAP_PALLETE_LOAD_32" },
+	{ 0x83, 0xffff, 2, 2, "3DSTATE_SPAN_STIPPLE" },
+	{ 0x8c, 0xffff, 2, 2, "3DSTATE_MAP_COORD_TRANSFORM_I830", 2 },
+	{ 0x8b, 0xffff, 2, 2, "3DSTATE_MAP_VERTEX_TRANSFORM_I830", 2 },
+	{ 0x8d, 0xffff, 3, 3, "3DSTATE_W_STATE_I830", 2 },
+	{ 0x01, 0xffff, 2, 2, "3DSTATE_COLOR_FACTOR_I830", 2 },
+	{ 0x02, 0xffff, 2, 2, "3DSTATE_MAP_COORD_SETBIND_I830", 2 },
+};
+
 static int
 decode_3d_1d(struct drm_intel_decode *ctx)
 {
@@ -1270,32 +1617,7 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 	const char *format, *zformat, *type;
 	uint32_t opcode;
 	uint32_t *data = ctx->data;
-	uint32_t devid = ctx->devid;
-
-	struct {
-		uint32_t opcode;
-		int i830_only;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d_1d[] = {
-		{ 0x86, 0, 4, 4, "3DSTATE_CHROMA_KEY" },
-		{ 0x88, 0, 2, 2, "3DSTATE_CONSTANT_BLEND_COLOR" },
-		{ 0x99, 0, 2, 2, "3DSTATE_DEFAULT_DIFFUSE" },
-		{ 0x9a, 0, 2, 2, "3DSTATE_DEFAULT_SPECULAR" },
-		{ 0x98, 0, 2, 2, "3DSTATE_DEFAULT_Z" },
-		{ 0x97, 0, 2, 2, "3DSTATE_DEPTH_OFFSET_SCALE" },
-		{ 0x9d, 0, 65, 65, "3DSTATE_FILTER_COEFFICIENTS_4X4" },
-		{ 0x9e, 0, 4, 4, "3DSTATE_MONO_FILTER" },
-		{ 0x89, 0, 4, 4, "3DSTATE_FOG_MODE" },
-		{ 0x8f, 0, 2, 16, "3DSTATE_MAP_PALLETE_LOAD_32" },
-		{ 0x83, 0, 2, 2, "3DSTATE_SPAN_STIPPLE" },
-		{ 0x8c, 1, 2, 2, "3DSTATE_MAP_COORD_TRANSFORM_I830" },
-		{ 0x8b, 1, 2, 2, "3DSTATE_MAP_VERTEX_TRANSFORM_I830" },
-		{ 0x8d, 1, 3, 3, "3DSTATE_W_STATE_I830" },
-		{ 0x01, 1, 2, 2, "3DSTATE_COLOR_FACTOR_I830" },
-		{ 0x02, 1, 2, 2, "3DSTATE_MAP_COORD_SETBIND_I830"},
-	}, *opcode_3d_1d;
+	const struct decode_opcode *opcode_3d_1d;
 
 	opcode = (data[0] & 0x00ff0000) >> 16;
 
@@ -1307,7 +1629,8 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		 * required in another, and 0 length LOAD_INDIRECTs
 		 * appear to cause no harm at least.
 		 */
-		instr_out(ctx, 0, "3DSTATE_LOAD_INDIRECT\n");
+		instr_header(ctx, "3DSTATE_LOAD_INDIRECT", NULL,
+			     "3DSTATE_LOAD_INDIRECT\n");
 		len = (data[0] & 0x000000ff) + 1;
 		i = 1;
 		if (data[0] & (0x01 << 8)) {
@@ -1334,46 +1657,50 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			instr_out(ctx, i++, "PSC.1\n");
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_LOAD_INDIRECT\n");
 			return len;
 		}
 		return len;
 	case 0x04:
-		instr_out(ctx, 0,
-			  "3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
+		instr_header(ctx, "3DSTATE_LOAD_STATE_IMMEDIATE_1", NULL,
+			     "3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		len = (data[0] & 0x0000000f) + 2;
 		i = 1;
 		for (word = 0; word <= 8; word++) {
 			if (data[0] & (1 << (4 + word))) {
 				/* save vertex state for decode */
-				if (!IS_GEN2(devid)) {
+				if (ctx->gen != 2) {
 					int tex_num;
 
 					if (word == 2) {
-						saved_s2_set = 1;
-						saved_s2 = data[i];
+						ctx->saved_s2_set = 1;
+						ctx->saved_s2 = data[i];
 					}
 					if (word == 4) {
-						saved_s4_set = 1;
-						saved_s4 = data[i];
+						ctx->saved_s4_set = 1;
+						ctx->saved_s4 = data[i];
 					}
 
 					switch (word) {
 					case 0:
-						instr_out(ctx, i,
-							  "S0: vbo offset: 0x%08x%s\n",
-							  data[i] & (~1),
-							  data[i] & 1 ?
-							  ", auto cache invalidate disabled"
-							  : "");
+						instr_fields(ctx, i,
+							     FIELDS("vbo_offset",
+								    "?auto_cache_invalidate_disable"),
+							     "S0: vbo offset: 0x%08x%s\n",
+							     data[i] & (~1),
+							     data[i] & 1 ?
+							     ", auto cache invalidate disabled"
+							     : "");
 						break;
 					case 1:
-						instr_out(ctx, i,
-							  "S1: vertex width: %i, vertex pitch: %i\n",
-							  (data[i] >> 24) &
-							  0x3f,
-							  (data[i] >> 16) &
-							  0x3f);
+						instr_fields(ctx, i,
+							     FIELDS("vertex_width",
+								    "vertex_pitch"),
+							     "S1: vertex width: %i, vertex pitch: %i\n",
+							     (data[i] >> 24) &
+							     0x3f,
+							     (data[i] >> 16) &
+							     0x3f);
 						break;
 					case 2:
 						instr_out(ctx, i,
@@ -1384,43 +1711,43 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 								 tex_num *
 								 4) & 0xf) {
 							case 0:
-								fprintf(out,
-									"%i=2D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=2D ",
+									      tex_num);
 								break;
 							case 1:
-								fprintf(out,
-									"%i=3D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=3D ",
+									      tex_num);
 								break;
 							case 2:
-								fprintf(out,
-									"%i=4D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=4D ",
+									      tex_num);
 								break;
 							case 3:
-								fprintf(out,
-									"%i=1D ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=1D ",
+									      tex_num);
 								break;
 							case 4:
-								fprintf(out,
-									"%i=2D_16 ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=2D_16 ",
+									      tex_num);
 								break;
 							case 5:
-								fprintf(out,
-									"%i=4D_16 ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=4D_16 ",
+									      tex_num);
 								break;
 							case 0xf:
-								fprintf(out,
-									"%i=NP ",
-									tex_num);
+								decode_printf(ctx,
+									      "%i=NP ",
+									      tex_num);
 								break;
 							}
 						}
-						fprintf(out, "\n");
+						decode_printf(ctx, "\n");
 
 						break;
 					case 3:
@@ -1485,249 +1812,298 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 								    "XYWF,";
 								break;
 							}
-							instr_out(ctx, i,
-								  "S4: point_width=%i, line_width=%.1f,"
-								  "%s%s%s%s%s cullmode=%s, vfmt=%s%s%s%s%s%s "
-								  "%s%s%s%s%s\n",
-								  (data[i] >>
-								   23) & 0x1ff,
-								  ((data[i] >>
-								    19) & 0xf) /
-								  2.0,
-								  data[i] & (0xf
-									     <<
-									     15)
-								  ?
-								  " flatshade="
-								  : "",
-								  data[i] & (1
-									     <<
-									     18)
-								  ? "Alpha," :
-								  "",
-								  data[i] & (1
-									     <<
-									     17)
-								  ? "Fog," : "",
-								  data[i] & (1
-									     <<
-									     16)
-								  ? "Specular,"
-								  : "",
-								  data[i] & (1
-									     <<
-									     15)
-								  ? "Color," :
-								  "", cullmode,
-								  data[i] & (1
-									     <<
-									     12)
-								  ?
-								  "PointWidth,"
-								  : "",
-								  data[i] & (1
-									     <<
-									     11)
-								  ? "SpecFog," :
-								  "",
-								  data[i] & (1
-									     <<
-									     10)
-								  ? "Color," :
-								  "",
-								  data[i] & (1
-									     <<
-									     9)
-								  ? "DepthOfs,"
-								  : "",
-								  vfmt_xyzw,
-								  data[i] & (1
-									     <<
-									     9)
-								  ? "FogParam,"
-								  : "",
-								  data[i] & (1
-									     <<
-									     5)
-								  ?
-								  "force default diffuse, "
-								  : "",
-								  data[i] & (1
-									     <<
-									     4)
-								  ?
-								  "force default specular, "
-								  : "",
-								  data[i] & (1
-									     <<
-									     3)
-								  ?
-								  "local depth ofs enable, "
-								  : "",
-								  data[i] & (1
-									     <<
-									     1)
-								  ?
-								  "point sprite enable, "
-								  : "",
-								  data[i] & (1
-									     <<
-									     0)
-								  ?
-								  "line AA enable, "
-								  : "");
+							instr_fields(ctx, i,
+								     FIELDS("point_width",
+									    "line_width",
+									    "",
+									    "?flatshade_alpha",
+									    "?flatshade_fog",
+									    "?flatshade_specular",
+									    "?flatshade_color",
+									    "cull_mode",
+									    "?vfmt_point_width",
+									    "?vfmt_spec_fog",
+									    "?vfmt_color",
+									    "?vfmt_depth_offset",
+									    "vfmt_xyzw",
+									    "?vfmt_fog_param",
+									    "?force_default_diffuse",
+									    "?force_default_specular",
+									    "?local_depth_offset_enable",
+									    "?point_sprite_enable",
+									    "?line_aa_enable"),
+								     "S4: point_width=%i, line_width=%.1f,"
+								     "%s%s%s%s%s cullmode=%s, vfmt=%s%s%s%s%s%s "
+								     "%s%s%s%s%s\n",
+								     (data[i] >>
+								      23) & 0x1ff,
+								     ((data[i] >>
+								       19) & 0xf) /
+								     2.0,
+								     data[i] & (0xf
+										<<
+										15)
+								     ?
+								     " flatshade="
+								     : "",
+								     data[i] & (1
+										<<
+										18)
+								     ? "Alpha," :
+								     "",
+								     data[i] & (1
+										<<
+										17)
+								     ? "Fog," : "",
+								     data[i] & (1
+										<<
+										16)
+								     ? "Specular,"
+								     : "",
+								     data[i] & (1
+										<<
+										15)
+								     ? "Color," :
+								     "", cullmode,
+								     data[i] & (1
+										<<
+										12)
+								     ?
+								     "PointWidth,"
+								     : "",
+								     data[i] & (1
+										<<
+										11)
+								     ? "SpecFog," :
+								     "",
+								     data[i] & (1
+										<<
+										10)
+								     ? "Color," :
+								     "",
+								     data[i] & (1
+										<<
+										9)
+								     ? "DepthOfs,"
+								     : "",
+								     vfmt_xyzw,
+								     data[i] & (1
+										<<
+										9)
+								     ? "FogParam,"
+								     : "",
+								     data[i] & (1
+										<<
+										5)
+								     ?
+								     "force default diffuse, "
+								     : "",
+								     data[i] & (1
+										<<
+										4)
+								     ?
+								     "force default specular, "
+								     : "",
+								     data[i] & (1
+										<<
+										3)
+								     ?
+								     "local depth ofs enable, "
+								     : "",
+								     data[i] & (1
+										<<
+										1)
+								     ?
+								     "point sprite enable, "
+								     : "",
+								     data[i] & (1
+										<<
+										0)
+								     ?
+								     "line AA enable, "
+								     : "");
 							break;
 						}
 					case 5:
 						{
-							instr_out(ctx, i,
-								  "S5:%s%s%s%s%s"
-								  "%s%s%s%s stencil_ref=0x%x, stencil_test=%s, "
-								  "stencil_fail=%s, stencil_pass_z_fail=%s, "
-								  "stencil_pass_z_pass=%s, %s%s%s%s\n",
-								  data[i] & (0xf
-									     <<
-									     28)
-								  ?
-								  " write_disable="
-								  : "",
-								  data[i] & (1
-									     <<
-									     31)
-								  ? "Alpha," :
-								  "",
-								  data[i] & (1
-									     <<
-									     30)
-								  ? "Red," : "",
-								  data[i] & (1
-									     <<
-									     29)
-								  ? "Green," :
-								  "",
-								  data[i] & (1
-									     <<
-									     28)
-								  ? "Blue," :
-								  "",
-								  data[i] & (1
-									     <<
-									     27)
-								  ?
-								  " force default point size,"
-								  : "",
-								  data[i] & (1
-									     <<
-									     26)
-								  ?
-								  " last pixel enable,"
-								  : "",
-								  data[i] & (1
-									     <<
-									     25)
-								  ?
-								  " global depth ofs enable,"
-								  : "",
-								  data[i] & (1
-									     <<
-									     24)
-								  ?
-								  " fog enable,"
-								  : "",
-								  (data[i] >>
-								   16) & 0xff,
-								  decode_compare_func
-								  (data[i] >>
-								   13),
-								  decode_stencil_op
-								  (data[i] >>
-								   10),
-								  decode_stencil_op
-								  (data[i] >>
-								   7),
-								  decode_stencil_op
-								  (data[i] >>
-								   4),
-								  data[i] & (1
-									     <<
-									     3)
-								  ?
-								  "stencil write enable, "
-								  : "",
-								  data[i] & (1
-									     <<
-									     2)
-								  ?
-								  "stencil test enable, "
-								  : "",
-								  data[i] & (1
-									     <<
-									     1)
-								  ?
-								  "color dither enable, "
-								  : "",
-								  data[i] & (1
-									     <<
-									     0)
-								  ?
-								  "logicop enable, "
-								  : "");
+							instr_fields(ctx, i,
+								     FIELDS("",
+									    "?write_disable_alpha",
+									    "?write_disable_red",
+									    "?write_disable_green",
+									    "?write_disable_blue",
+									    "?force_default_point_size",
+									    "?last_pixel_enable",
+									    "?global_depth_offset_enable",
+									    "?fog_enable",
+									    "stencil_ref",
+									    "stencil_test",
+									    "stencil_fail",
+									    "stencil_pass_z_fail",
+									    "stencil_pass_z_pass",
+									    "?stencil_write_enable",
+									    "?stencil_test_enable",
+									    "?color_dither_enable",
+									    "?logicop_enable"),
+								     "S5:%s%s%s%s%s"
+								     "%s%s%s%s stencil_ref=0x%x, stencil_test=%s, "
+								     "stencil_fail=%s, stencil_pass_z_fail=%s, "
+								     "stencil_pass_z_pass=%s, %s%s%s%s\n",
+								     data[i] & (0xf
+										<<
+										28)
+								     ?
+								     " write_disable="
+								     : "",
+								     data[i] & (1
+										<<
+										31)
+								     ? "Alpha," :
+								     "",
+								     data[i] & (1
+										<<
+										30)
+								     ? "Red," : "",
+								     data[i] & (1
+										<<
+										29)
+								     ? "Green," :
+								     "",
+								     data[i] & (1
+										<<
+										28)
+								     ? "Blue," :
+								     "",
+								     data[i] & (1
+										<<
+										27)
+								     ?
+								     " force default point size,"
+								     : "",
+								     data[i] & (1
+										<<
+										26)
+								     ?
+								     " last pixel enable,"
+								     : "",
+								     data[i] & (1
+										<<
+										25)
+								     ?
+								     " global depth ofs enable,"
+								     : "",
+								     data[i] & (1
+										<<
+										24)
+								     ?
+								     " fog enable,"
+								     : "",
+								     (data[i] >>
+								      16) & 0xff,
+								     decode_compare_func
+								     (data[i] >>
+								      13),
+								     decode_stencil_op
+								     (data[i] >>
+								      10),
+								     decode_stencil_op
+								     (data[i] >>
+								      7),
+								     decode_stencil_op
+								     (data[i] >>
+								      4),
+								     data[i] & (1
+										<<
+										3)
+								     ?
+								     "stencil write enable, "
+								     : "",
+								     data[i] & (1
+										<<
+										2)
+								     ?
+								     "stencil test enable, "
+								     : "",
+								     data[i] & (1
+										<<
+										1)
+								     ?
+								     "color dither enable, "
+								     : "",
+								     data[i] & (1
+										<<
+										0)
+								     ?
+								     "logicop enable, "
+								     : "");
 						}
 						break;
 					case 6:
-						instr_out(ctx, i,
-							  "S6: %salpha_test=%s, alpha_ref=0x%x, "
-							  "depth_test=%s, %ssrc_blnd_fct=%s, dst_blnd_fct=%s, "
-							  "%s%stristrip_provoking_vertex=%i\n",
-							  data[i] & (1 << 31) ?
-							  "alpha test enable, "
-							  : "",
-							  decode_compare_func
-							  (data[i] >> 28),
-							  data[i] & (0xff <<
-								     20),
-							  decode_compare_func
-							  (data[i] >> 16),
-							  data[i] & (1 << 15) ?
-							  "cbuf blend enable, "
-							  : "",
-							  decode_blend_fact(data
-									    [i]
-									    >>
-									    8),
-							  decode_blend_fact(data
-									    [i]
-									    >>
-									    4),
-							  data[i] & (1 << 3) ?
-							  "depth write enable, "
-							  : "",
-							  data[i] & (1 << 2) ?
-							  "cbuf write enable, "
-							  : "",
-							  data[i] & (0x3));
+						instr_fields(ctx, i,
+							     FIELDS("?alpha_test_enable",
+								    "alpha_test",
+								    "alpha_ref",
+								    "depth_test",
+								    "?cbuf_blend_enable",
+								    "src_blend_factor",
+								    "dst_blend_factor",
+								    "?depth_write_enable",
+								    "?cbuf_write_enable",
+								    "tristrip_provoking_vertex"),
+							     "S6: %salpha_test=%s, alpha_ref=0x%x, "
+							     "depth_test=%s, %ssrc_blnd_fct=%s, dst_blnd_fct=%s, "
+							     "%s%stristrip_provoking_vertex=%i\n",
+							     data[i] & (1 << 31) ?
+							     "alpha test enable, "
+							     : "",
+							     decode_compare_func
+							     (data[i] >> 28),
+							     data[i] & (0xff <<
+									20),
+							     decode_compare_func
+							     (data[i] >> 16),
+							     data[i] & (1 << 15) ?
+							     "cbuf blend enable, "
+							     : "",
+							     decode_blend_fact(data
+									       [i]
+									       >>
+									       8),
+							     decode_blend_fact(data
+									       [i]
+									       >>
+									       4),
+							     data[i] & (1 << 3) ?
+							     "depth write enable, "
+							     : "",
+							     data[i] & (1 << 2) ?
+							     "cbuf write enable, "
+							     : "",
+							     data[i] & (0x3));
 						break;
 					case 7:
-						instr_out(ctx, i,
-							  "S7: depth offset constant: 0x%08x\n",
-							  data[i]);
+						instr_fields(ctx, i,
+							     FIELDS("depth_offset_constant"),
+							     "S7: depth offset constant: 0x%08x\n",
+							     data[i]);
 						break;
 					}
 				} else {
-					instr_out(ctx, i,
-						  "S%d: 0x%08x\n", word, data[i]);
+					instr_fields(ctx, i,
+						     FIELDS("word", "value"),
+						     "S%d: 0x%08x\n", word, data[i]);
 				}
 				i++;
 			}
 		}
 		if (len != i) {
-			fprintf(out,
-				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_1\n");
 		}
 		return len;
 	case 0x03:
-		instr_out(ctx, 0,
-			  "3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
+		instr_header(ctx, "3DSTATE_LOAD_STATE_IMMEDIATE_2", NULL,
+			     "3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		len = (data[0] & 0x0000000f) + 2;
 		i = 1;
 		for (word = 6; word <= 14; word++) {
@@ -1736,47 +2112,53 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 					instr_out(ctx, i++,
 						  "TBCF\n");
 				else if (word >= 7 && word <= 10) {
-					instr_out(ctx, i++,
-						  "TB%dC\n", word - 7);
-					instr_out(ctx, i++,
-						  "TB%dA\n", word - 7);
+					instr_fields(ctx, i++, FIELDS("stage"),
+						     "TB%dC\n", word - 7);
+					instr_fields(ctx, i++, FIELDS("stage"),
+						     "TB%dA\n", word - 7);
 				} else if (word >= 11 && word <= 14) {
-					instr_out(ctx, i,
-						  "TM%dS0: offset=0x%08x, %s\n",
-						  word - 11,
-						  data[i] & 0xfffffffe,
-						  data[i] & 1 ? "use fence" :
-						  "");
+					instr_fields(ctx, i,
+						     FIELDS("map", "offset",
+							    "?use_fence"),
+						     "TM%dS0: offset=0x%08x, %s\n",
+						     word - 11,
+						     data[i] & 0xfffffffe,
+						     data[i] & 1 ? "use fence" :
+						     "");
 					i++;
-					instr_out(ctx, i,
-						  "TM%dS1: height=%i, width=%i, %s\n",
-						  word - 11, data[i] >> 21,
-						  (data[i] >> 10) & 0x3ff,
-						  data[i] & 2 ? (data[i] & 1 ?
-								 "y-tiled" :
-								 "x-tiled") :
-						  "");
+					instr_fields(ctx, i,
+						     FIELDS("map", "height",
+							    "width", "tiling"),
+						     "TM%dS1: height=%i, width=%i, %s\n",
+						     word - 11, data[i] >> 21,
+						     (data[i] >> 10) & 0x3ff,
+						     data[i] & 2 ? (data[i] & 1 ?
+								    "y-tiled" :
+								    "x-tiled") :
+						     "");
 					i++;
-					instr_out(ctx, i,
-						  "TM%dS2: pitch=%i, \n",
-						  word - 11,
-						  ((data[i] >> 21) + 1) * 4);
+					instr_fields(ctx, i,
+						     FIELDS("map", "pitch"),
+						     "TM%dS2: pitch=%i, \n",
+						     word - 11,
+						     ((data[i] >> 21) + 1) * 4);
 					i++;
-					instr_out(ctx, i++,
-						  "TM%dS3\n", word - 11);
-					instr_out(ctx, i++,
-						  "TM%dS4: dflt color\n",
-						  word - 11);
+					instr_fields(ctx, i++, FIELDS("map"),
+						     "TM%dS3\n", word - 11);
+					instr_fields(ctx, i++, FIELDS("map"),
+						     "TM%dS4: dflt color\n",
+						     word - 11);
 				}
 			}
 		}
 		if (len != i) {
-			fprintf(out,
-				"Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_LOAD_STATE_IMMEDIATE_2\n");
 		}
 		return len;
 	case 0x00:
-		instr_out(ctx, 0, "3DSTATE_MAP_STATE\n");
+		instr_header(ctx, "3DSTATE_MAP_STATE", NULL,
+			     "3DSTATE_MAP_STATE\n");
 		len = (data[0] & 0x0000003f) + 2;
 		instr_out(ctx, 1, "mask\n");
 
@@ -1787,14 +2169,17 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 				const char *tiling;
 
 				dword = data[i];
-				instr_out(ctx, i++,
-					  "map %d MS2 %s%s%s\n", map,
-					  dword & (1 << 31) ?
-					  "untrusted surface, " : "",
-					  dword & (1 << 1) ?
-					  "vertical line stride enable, " : "",
-					  dword & (1 << 0) ?
-					  "vertical ofs enable, " : "");
+				instr_fields(ctx, i++,
+					     FIELDS("map", "?untrusted_surface",
+						    "?vertical_line_stride_enable",
+						    "?vertical_offset_enable"),
+					     "map %d MS2 %s%s%s\n", map,
+					     dword & (1 << 31) ?
+					     "untrusted surface, " : "",
+					     dword & (1 << 1) ?
+					     "vertical line stride enable, " : "",
+					     dword & (1 << 0) ?
+					     "vertical ofs enable, " : "");
 
 				dword = data[i];
 				width = ((dword >> 10) & ((1 << 11) - 1)) + 1;
@@ -1954,62 +2339,74 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 					break;
 				}
 				dword = data[i];
-				instr_out(ctx, i++,
-					  "map %d MS3 [width=%d, height=%d, format=%s%s, tiling=%s%s]\n",
-					  map, width, height, type, format,
-					  tiling,
-					  dword & (1 << 9) ? " palette select" :
-					  "");
+				instr_fields(ctx, i++,
+					     FIELDS("map", "width", "height",
+						    "format_type", "format",
+						    "tiling",
+						    "?palette_select"),
+					     "map %d MS3 [width=%d, height=%d, format=%s%s, tiling=%s%s]\n",
+					     map, width, height, type, format,
+					     tiling,
+					     dword & (1 << 9) ? " palette select" :
+					     "");
 
 				dword = data[i];
 				pitch =
 				    4 * (((dword >> 21) & ((1 << 11) - 1)) + 1);
-				instr_out(ctx, i++,
-					  "map %d MS4 [pitch=%d, max_lod=%i, vol_depth=%i, cube_face_ena=%x, %s]\n",
-					  map, pitch, (dword >> 9) & 0x3f,
-					  dword & 0xff, (dword >> 15) & 0x3f,
-					  dword & (1 << 8) ? "miplayout legacy"
-					  : "miplayout right");
+				instr_fields(ctx, i++,
+					     FIELDS("map", "pitch", "max_lod",
+						    "depth", "cube_face_enable",
+						    "mip_layout"),
+					     "map %d MS4 [pitch=%d, max_lod=%i, vol_depth=%i, cube_face_ena=%x, %s]\n",
+					     map, pitch, (dword >> 9) & 0x3f,
+					     dword & 0xff, (dword >> 15) & 0x3f,
+					     dword & (1 << 8) ? "miplayout legacy"
+					     : "miplayout right");
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_MAP_STATE\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_MAP_STATE\n");
 			return len;
 		}
 		return len;
 	case 0x06:
-		instr_out(ctx, 0,
-			  "3DSTATE_PIXEL_SHADER_CONSTANTS\n");
+		instr_header(ctx, "3DSTATE_PIXEL_SHADER_CONSTANTS", NULL,
+			     "3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		len = (data[0] & 0x000000ff) + 2;
 
 		i = 2;
 		for (c = 0; c <= 31; c++) {
 			if (data[1] & (1 << c)) {
-				instr_out(ctx, i, "C%d.X = %f\n", c,
-					  int_as_float(data[i]));
+				instr_fields(ctx, i, FIELDS("constant", "x"),
+					     "C%d.X = %f\n", c,
+					     int_as_float(data[i]));
 				i++;
-				instr_out(ctx, i, "C%d.Y = %f\n",
-					  c, int_as_float(data[i]));
+				instr_fields(ctx, i, FIELDS("constant", "y"),
+					     "C%d.Y = %f\n",
+					     c, int_as_float(data[i]));
 				i++;
-				instr_out(ctx, i, "C%d.Z = %f\n",
-					  c, int_as_float(data[i]));
+				instr_fields(ctx, i, FIELDS("constant", "z"),
+					     "C%d.Z = %f\n",
+					     c, int_as_float(data[i]));
 				i++;
-				instr_out(ctx, i, "C%d.W = %f\n",
-					  c, int_as_float(data[i]));
+				instr_fields(ctx, i, FIELDS("constant", "w"),
+					     "C%d.W = %f\n",
+					     c, int_as_float(data[i]));
 				i++;
 			}
 		}
 		if (len != i) {
-			fprintf(out,
-				"Bad count in 3DSTATE_PIXEL_SHADER_CONSTANTS\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_PIXEL_SHADER_CONSTANTS\n");
 		}
 		return len;
 	case 0x05:
-		instr_out(ctx, 0, "3DSTATE_PIXEL_SHADER_PROGRAM\n");
+		instr_header(ctx, "3DSTATE_PIXEL_SHADER_PROGRAM", NULL,
+			     "3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		len = (data[0] & 0x000000ff) + 2;
 		if ((len - 1) % 3 != 0 || len > 370) {
-			fprintf(out,
-				"Bad count in 3DSTATE_PIXEL_SHADER_PROGRAM\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_PIXEL_SHADER_PROGRAM\n");
 		}
 		i = 1;
 		for (instr = 0; instr < (len - 1) / 3; instr++) {
@@ -2022,9 +2419,10 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		}
 		return len;
 	case 0x01:
-		if (IS_GEN2(devid))
+		if (ctx->gen == 2)
 			break;
-		instr_out(ctx, 0, "3DSTATE_SAMPLER_STATE\n");
+		instr_header(ctx, "3DSTATE_SAMPLER_STATE", NULL,
+			     "3DSTATE_SAMPLER_STATE\n");
 		instr_out(ctx, 1, "mask\n");
 		len = (data[0] & 0x0000003f) + 2;
 		i = 2;
@@ -2045,59 +2443,74 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 					mip_filter = "linear";
 					break;
 				}
-				instr_out(ctx, i++,
-					  "sampler %d SS2:%s%s%s "
-					  "base_mip_level=%i, mip_filter=%s, mag_filter=%s, min_filter=%s "
-					  "lod_bias=%.2f,%s max_aniso=%i, shadow_func=%s\n",
-					  sampler,
-					  dword & (1 << 31) ? " reverse gamma,"
-					  : "",
-					  dword & (1 << 30) ? " packed2planar,"
-					  : "",
-					  dword & (1 << 29) ?
-					  " colorspace conversion," : "",
-					  (dword >> 22) & 0x1f, mip_filter,
-					  decode_sample_filter(dword >> 17),
-					  decode_sample_filter(dword >> 14),
-					  ((dword >> 5) & 0x1ff) / (0x10 * 1.0),
-					  dword & (1 << 4) ? " shadow," : "",
-					  dword & (1 << 3) ? 4 : 2,
-					  decode_compare_func(dword));
+				instr_fields(ctx, i++,
+					     FIELDS("sampler", "?reverse_gamma",
+						    "?packed_to_planar",
+						    "?colorspace_conversion",
+						    "base_mip_level",
+						    "mip_filter", "mag_filter",
+						    "min_filter", "lod_bias",
+						    "?shadow_enable",
+						    "max_aniso", "shadow_func"),
+					     "sampler %d SS2:%s%s%s "
+					     "base_mip_level=%i, mip_filter=%s, mag_filter=%s, min_filter=%s "
+					     "lod_bias=%.2f,%s max_aniso=%i, shadow_func=%s\n",
+					     sampler,
+					     dword & (1 << 31) ? " reverse gamma,"
+					     : "",
+					     dword & (1 << 30) ? " packed2planar,"
+					     : "",
+					     dword & (1 << 29) ?
+					     " colorspace conversion," : "",
+					     (dword >> 22) & 0x1f, mip_filter,
+					     decode_sample_filter(dword >> 17),
+					     decode_sample_filter(dword >> 14),
+					     ((dword >> 5) & 0x1ff) / (0x10 * 1.0),
+					     dword & (1 << 4) ? " shadow," : "",
+					     dword & (1 << 3) ? 4 : 2,
+					     decode_compare_func(dword));
 				dword = data[i];
-				instr_out(ctx, i++,
-					  "sampler %d SS3: min_lod=%.2f,%s "
-					  "tcmode_x=%s, tcmode_y=%s, tcmode_z=%s,%s texmap_idx=%i,%s\n",
-					  sampler,
-					  ((dword >> 24) & 0xff) / (0x10 * 1.0),
-					  dword & (1 << 17) ?
-					  " kill pixel enable," : "",
-					  decode_tex_coord_mode(dword >> 12),
-					  decode_tex_coord_mode(dword >> 9),
-					  decode_tex_coord_mode(dword >> 6),
-					  dword & (1 << 5) ?
-					  " normalized coords," : "",
-					  (dword >> 1) & 0xf,
-					  dword & (1 << 0) ? " deinterlacer," :
-					  "");
+				instr_fields(ctx, i++,
+					     FIELDS("sampler", "min_lod",
+						    "?kill_pixel_enable",
+						    "tcmode_x", "tcmode_y",
+						    "tcmode_z",
+						    "?normalized_coords",
+						    "texmap_idx",
+						    "?deinterlacer"),
+					     "sampler %d SS3: min_lod=%.2f,%s "
+					     "tcmode_x=%s, tcmode_y=%s, tcmode_z=%s,%s texmap_idx=%i,%s\n",
+					     sampler,
+					     ((dword >> 24) & 0xff) / (0x10 * 1.0),
+					     dword & (1 << 17) ?
+					     " kill pixel enable," : "",
+					     decode_tex_coord_mode(dword >> 12),
+					     decode_tex_coord_mode(dword >> 9),
+					     decode_tex_coord_mode(dword >> 6),
+					     dword & (1 << 5) ?
+					     " normalized coords," : "",
+					     (dword >> 1) & 0xf,
+					     dword & (1 << 0) ? " deinterlacer," :
+					     "");
 				dword = data[i];
-				instr_out(ctx, i++,
-					  "sampler %d SS4: border color\n",
-					  sampler);
+				instr_fields(ctx, i++, FIELDS("sampler"),
+					     "sampler %d SS4: border color\n",
+					     sampler);
 			}
 		}
 		if (len != i) {
-			fprintf(out, "Bad count in 3DSTATE_SAMPLER_STATE\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_SAMPLER_STATE\n");
 		}
 		return len;
 	case 0x85:
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 2)
-			fprintf(out,
-				"Bad count in 3DSTATE_DEST_BUFFER_VARIABLES\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_DEST_BUFFER_VARIABLES\n");
 
-		instr_out(ctx, 0,
-			  "3DSTATE_DEST_BUFFER_VARIABLES\n");
+		instr_header(ctx, "3DSTATE_DEST_BUFFER_VARIABLES", NULL,
+			     "3DSTATE_DEST_BUFFER_VARIABLES\n");
 
 		switch ((data[1] >> 8) & 0xf) {
 		case 0x0:
@@ -2151,10 +2564,11 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			zformat = "BAD";
 			break;
 		}
-		instr_out(ctx, 1,
-			  "%s format, %s depth format, early Z %sabled\n",
-			  format, zformat,
-			  (data[1] & (1 << 31)) ? "en" : "dis");
+		instr_fields(ctx, 1,
+			     FIELDS("color_format", "depth_format", "early_z"),
+			     "%s format, %s depth format, early Z %sabled\n",
+			     format, zformat,
+			     (data[1] & (1 << 31)) ? "en" : "dis");
 		return len;
 
 	case 0x8e:
@@ -2163,8 +2577,8 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 
 			len = (data[0] & 0x0000000f) + 2;
 			if (len != 3)
-				fprintf(out,
-					"Bad count in 3DSTATE_BUFFER_INFO\n");
+				decode_printf(ctx,
+					      "Bad count in 3DSTATE_BUFFER_INFO\n");
 
 			switch ((data[1] >> 24) & 0x7) {
 			case 0x3:
@@ -2184,10 +2598,12 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 			else if (data[1] & (1 << 22))
 				tiling = data[1] & (1 << 21) ? "Y" : "X";
 
-			instr_out(ctx, 0, "3DSTATE_BUFFER_INFO\n");
-			instr_out(ctx, 1,
-				  "%s, tiling = %s, pitch=%d\n", name, tiling,
-				  data[1] & 0xffff);
+			instr_header(ctx, "3DSTATE_BUFFER_INFO", NULL,
+				     "3DSTATE_BUFFER_INFO\n");
+			instr_fields(ctx, 1,
+				     FIELDS("buffer", "tiling", "pitch"),
+				     "%s, tiling = %s, pitch=%d\n", name, tiling,
+				     data[1] & 0xffff);
 
 			instr_out(ctx, 2, "address\n");
 			return len;
@@ -2196,84 +2612,89 @@ decode_3d_1d(struct drm_intel_decode *ctx)
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 3)
-			fprintf(out,
-				"Bad count in 3DSTATE_SCISSOR_RECTANGLE\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_SCISSOR_RECTANGLE\n");
 
-		instr_out(ctx, 0, "3DSTATE_SCISSOR_RECTANGLE\n");
-		instr_out(ctx, 1, "(%d,%d)\n",
-			  data[1] & 0xffff, data[1] >> 16);
-		instr_out(ctx, 2, "(%d,%d)\n",
-			  data[2] & 0xffff, data[2] >> 16);
+		instr_header(ctx, "3DSTATE_SCISSOR_RECTANGLE", NULL,
+			     "3DSTATE_SCISSOR_RECTANGLE\n");
+		instr_fields(ctx, 1, FIELDS("x1", "y1"), "(%d,%d)\n",
+			     data[1] & 0xffff, data[1] >> 16);
+		instr_fields(ctx, 2, FIELDS("x2", "y2"), "(%d,%d)\n",
+			     data[2] & 0xffff, data[2] >> 16);
 
 		return len;
 	case 0x80:
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 5)
-			fprintf(out,
-				"Bad count in 3DSTATE_DRAWING_RECTANGLE\n");
-
-		instr_out(ctx, 0, "3DSTATE_DRAWING_RECTANGLE\n");
-		instr_out(ctx, 1, "%s\n",
-			  data[1] & (1 << 30) ? "depth ofs disabled " : "");
-		instr_out(ctx, 2, "(%d,%d)\n",
-			  data[2] & 0xffff, data[2] >> 16);
-		instr_out(ctx, 3, "(%d,%d)\n",
-			  data[3] & 0xffff, data[3] >> 16);
-		instr_out(ctx, 4, "(%d,%d)\n",
-			  data[4] & 0xffff, data[4] >> 16);
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_DRAWING_RECTANGLE\n");
+
+		instr_header(ctx, "3DSTATE_DRAWING_RECTANGLE", NULL,
+			     "3DSTATE_DRAWING_RECTANGLE\n");
+		instr_fields(ctx, 1, FIELDS("?depth_ofs_disable"), "%s\n",
+			     data[1] & (1 << 30) ? "depth ofs disabled " : "");
+		instr_fields(ctx, 2, FIELDS("x1", "y1"), "(%d,%d)\n",
+			     data[2] & 0xffff, data[2] >> 16);
+		instr_fields(ctx, 3, FIELDS("x2", "y2"), "(%d,%d)\n",
+			     data[3] & 0xffff, data[3] >> 16);
+		instr_fields(ctx, 4, FIELDS("origin_x", "origin_y"),
+			     "(%d,%d)\n",
+			     data[4] & 0xffff, data[4] >> 16);
 
 		return len;
 	case 0x9c:
 		len = (data[0] & 0x0000000f) + 2;
 
 		if (len != 7)
-			fprintf(out, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
-
-		instr_out(ctx, 0, "3DSTATE_CLEAR_PARAMETERS\n");
-		instr_out(ctx, 1, "prim_type=%s, clear=%s%s%s\n",
-			  data[1] & (1 << 16) ? "CLEAR_RECT" : "ZONE_INIT",
-			  data[1] & (1 << 2) ? "color," : "",
-			  data[1] & (1 << 1) ? "depth," : "",
-			  data[1] & (1 << 0) ? "stencil," : "");
+			decode_printf(ctx, "Bad count in 3DSTATE_CLEAR_PARAMETERS\n");
+
+		instr_header(ctx, "3DSTATE_CLEAR_PARAMETERS", NULL,
+			     "3DSTATE_CLEAR_PARAMETERS\n");
+		instr_fields(ctx, 1,
+			     FIELDS("prim_type", "?clear_color", "?clear_depth",
+				    "?clear_stencil"),
+			     "prim_type=%s, clear=%s%s%s\n",
+			     data[1] & (1 << 16) ? "CLEAR_RECT" : "ZONE_INIT",
+			     data[1] & (1 << 2) ? "color," : "",
+			     data[1] & (1 << 1) ? "depth," : "",
+			     data[1] & (1 << 0) ? "stencil," : "");
 		instr_out(ctx, 2, "clear color\n");
 		instr_out(ctx, 3, "clear depth/stencil\n");
 		instr_out(ctx, 4, "color value (rgba8888)\n");
-		instr_out(ctx, 5, "depth value %f\n",
-			  int_as_float(data[5]));
+		instr_fields(ctx, 5, FIELDS("clear_depth_value"),
+			     "depth value %f\n",
+			     int_as_float(data[5]));
 		instr_out(ctx, 6, "clear stencil\n");
 		return len;
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d_1d); idx++) {
-		opcode_3d_1d = &opcodes_3d_1d[idx];
-		if (opcode_3d_1d->i830_only && !IS_GEN2(devid))
-			continue;
-
-		if (((data[0] & 0x00ff0000) >> 16) == opcode_3d_1d->opcode) {
-			len = 1;
-
-			instr_out(ctx, 0, "%s\n",
-				  opcode_3d_1d->name);
-			if (opcode_3d_1d->max_len > 1) {
-				len = (data[0] & 0x0000ffff) + 2;
-				if (len < opcode_3d_1d->min_len ||
-				    len > opcode_3d_1d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d_1d->name);
-				}
-			}
-
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+	idx = ctx->index_3d_1d[opcode];
+	if (idx) {
+		opcode_3d_1d = &opcodes_3d_1d[idx - 1];
+		len = 1;
+
+		instr_header(ctx, opcode_3d_1d->name, FIELDS(""),
+			     "%s\n", opcode_3d_1d->name);
+		if (opcode_3d_1d->max_len > 1) {
+			len = (data[0] & opcode_3d_1d->len_mask) + 2;
+			if (len < opcode_3d_1d->min_len ||
+			    len > opcode_3d_1d->max_len) {
+				decode_printf(ctx, "Bad count in %s\n",
+					      opcode_3d_1d->name);
 			}
+		}
 
-			return len;
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
 		}
+
+		return len;
 	}
 
-	instr_out(ctx, 0, "3D UNKNOWN: 3d_1d opcode = 0x%x\n",
-		  opcode);
+	instr_header(ctx, "UNKNOWN", FIELDS("opcode"),
+		     "3D UNKNOWN: 3d_1d opcode = 0x%x\n",
+		     opcode);
 	return 1;
 }
 
@@ -2285,8 +2706,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	char immediate = (data[0] & (1 << 23)) == 0;
 	unsigned int len, i, j, ret;
 	const char *primtype;
-	int original_s2 = saved_s2;
-	int original_s4 = saved_s4;
+	int original_s2 = ctx->saved_s2;
+	int original_s4 = ctx->saved_s4;
 
 	switch ((data[0] >> 18) & 0xf) {
 	case 0x0:
@@ -2321,8 +2742,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 		break;
 	case 0xa:
 		primtype = "CLEAR_RECT";
-		saved_s4 = 3 << 6;
-		saved_s2 = ~0;
+		ctx->saved_s4 = 3 << 6;
+		ctx->saved_s2 = ~0;
 		break;
 	default:
 		primtype = "unknown";
@@ -2332,12 +2753,13 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	/* XXX: 3DPRIM_DIB not supported */
 	if (immediate) {
 		len = (data[0] & 0x0003ffff) + 2;
-		instr_out(ctx, 0, "3DPRIMITIVE inline %s\n",
-			  primtype);
+		instr_header(ctx, "3DPRIMITIVE", FIELDS("prim_type"),
+			     "3DPRIMITIVE inline %s\n",
+			     primtype);
 		if (count < len)
 			BUFFER_FAIL(count, len, "3DPRIMITIVE inline");
-		if (!saved_s2_set || !saved_s4_set) {
-			fprintf(out, "unknown vertex format\n");
+		if (!ctx->saved_s2_set || !ctx->saved_s4_set) {
+			decode_printf(ctx, "unknown vertex format\n");
 			for (i = 1; i < len; i++) {
 				instr_out(ctx, i,
 					  "           vertex data (%f float)\n",
@@ -2348,115 +2770,135 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 			for (i = 1; i < len;) {
 				unsigned int tc;
 
-#define VERTEX_OUT(fmt, ...) do {					\
+#define VERTEX_OUT(names, fmt, ...) do {				\
     if (i < len)							\
-	instr_out(ctx, i, " V%d."fmt"\n", vertex, __VA_ARGS__); \
+	instr_fields(ctx, i, names,					\
+		     " V%d."fmt"\n", vertex, __VA_ARGS__);		\
     else								\
-	fprintf(out, " missing data in V%d\n", vertex);			\
+	decode_printf(ctx, " missing data in V%d\n", vertex);		\
     i++;								\
 } while (0)
 
-				VERTEX_OUT("X = %f", int_as_float(data[i]));
-				VERTEX_OUT("Y = %f", int_as_float(data[i]));
-				switch (saved_s4 >> 6 & 0x7) {
+				VERTEX_OUT(FIELDS("vertex", "x"),
+					   "X = %f", int_as_float(data[i]));
+				VERTEX_OUT(FIELDS("vertex", "y"),
+					   "Y = %f", int_as_float(data[i]));
+				switch (ctx->saved_s4 >> 6 & 0x7) {
 				case 0x1:
-					VERTEX_OUT("Z = %f",
+					VERTEX_OUT(FIELDS("vertex", "z"),
+						   "Z = %f",
 						   int_as_float(data[i]));
 					break;
 				case 0x2:
-					VERTEX_OUT("Z = %f",
+					VERTEX_OUT(FIELDS("vertex", "z"),
+						   "Z = %f",
 						   int_as_float(data[i]));
-					VERTEX_OUT("W = %f",
+					VERTEX_OUT(FIELDS("vertex", "w"),
+						   "W = %f",
 						   int_as_float(data[i]));
 					break;
 				case 0x3:
 					break;
 				case 0x4:
-					VERTEX_OUT("W = %f",
+					VERTEX_OUT(FIELDS("vertex", "w"),
+						   "W = %f",
 						   int_as_float(data[i]));
 					break;
 				default:
-					fprintf(out, "bad S4 position mask\n");
+					decode_printf(ctx, "bad S4 position mask\n");
 				}
 
-				if (saved_s4 & (1 << 10)) {
-					VERTEX_OUT
-					    ("color = (A=0x%02x, R=0x%02x, G=0x%02x, "
-					     "B=0x%02x)", data[i] >> 24,
-					     (data[i] >> 16) & 0xff,
-					     (data[i] >> 8) & 0xff,
-					     data[i] & 0xff);
+				if (ctx->saved_s4 & (1 << 10)) {
+					VERTEX_OUT(FIELDS("vertex", "color_a", "color_r",
+							  "color_g", "color_b"),
+						   "color = (A=0x%02x, R=0x%02x, G=0x%02x, "
+						   "B=0x%02x)", data[i] >> 24,
+						   (data[i] >> 16) & 0xff,
+						   (data[i] >> 8) & 0xff,
+						   data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 11)) {
-					VERTEX_OUT
-					    ("spec = (A=0x%02x, R=0x%02x, G=0x%02x, "
-					     "B=0x%02x)", data[i] >> 24,
-					     (data[i] >> 16) & 0xff,
-					     (data[i] >> 8) & 0xff,
-					     data[i] & 0xff);
+				if (ctx->saved_s4 & (1 << 11)) {
+					VERTEX_OUT(FIELDS("vertex", "spec_a", "spec_r",
+							  "spec_g", "spec_b"),
+						   "spec = (A=0x%02x, R=0x%02x, G=0x%02x, "
+						   "B=0x%02x)", data[i] >> 24,
+						   (data[i] >> 16) & 0xff,
+						   (data[i] >> 8) & 0xff,
+						   data[i] & 0xff);
 				}
-				if (saved_s4 & (1 << 12))
-					VERTEX_OUT("width = 0x%08x)", data[i]);
+				if (ctx->saved_s4 & (1 << 12))
+					VERTEX_OUT(FIELDS("vertex", "width"),
+						   "width = 0x%08x)", data[i]);
 
 				for (tc = 0; tc <= 7; tc++) {
-					switch ((saved_s2 >> (tc * 4)) & 0xf) {
+					switch ((ctx->saved_s2 >> (tc * 4)) & 0xf) {
 					case 0x0:
-						VERTEX_OUT("T%d.X = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "x"),
+							   "T%d.X = %f", tc,
 							   int_as_float(data
 									[i]));
-						VERTEX_OUT("T%d.Y = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "y"),
+							   "T%d.Y = %f", tc,
 							   int_as_float(data
 									[i]));
 						break;
 					case 0x1:
-						VERTEX_OUT("T%d.X = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "x"),
+							   "T%d.X = %f", tc,
 							   int_as_float(data
 									[i]));
-						VERTEX_OUT("T%d.Y = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "y"),
+							   "T%d.Y = %f", tc,
 							   int_as_float(data
 									[i]));
-						VERTEX_OUT("T%d.Z = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "z"),
+							   "T%d.Z = %f", tc,
 							   int_as_float(data
 									[i]));
 						break;
 					case 0x2:
-						VERTEX_OUT("T%d.X = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "x"),
+							   "T%d.X = %f", tc,
 							   int_as_float(data
 									[i]));
-						VERTEX_OUT("T%d.Y = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "y"),
+							   "T%d.Y = %f", tc,
 							   int_as_float(data
 									[i]));
-						VERTEX_OUT("T%d.Z = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "z"),
+							   "T%d.Z = %f", tc,
 							   int_as_float(data
 									[i]));
-						VERTEX_OUT("T%d.W = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "w"),
+							   "T%d.W = %f", tc,
 							   int_as_float(data
 									[i]));
 						break;
 					case 0x3:
-						VERTEX_OUT("T%d.X = %f", tc,
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "x"),
+							   "T%d.X = %f", tc,
 							   int_as_float(data
 									[i]));
 						break;
 					case 0x4:
-						VERTEX_OUT
-						    ("T%d.XY = 0x%08x half-float",
-						     tc, data[i]);
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "xy_half"),
+							   "T%d.XY = 0x%08x half-float",
+							   tc, data[i]);
 						break;
 					case 0x5:
-						VERTEX_OUT
-						    ("T%d.XY = 0x%08x half-float",
-						     tc, data[i]);
-						VERTEX_OUT
-						    ("T%d.ZW = 0x%08x half-float",
-						     tc, data[i]);
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "xy_half"),
+							   "T%d.XY = 0x%08x half-float",
+							   tc, data[i]);
+						VERTEX_OUT(FIELDS("vertex", "texcoord", "zw_half"),
+							   "T%d.ZW = 0x%08x half-float",
+							   tc, data[i]);
 						break;
 					case 0xf:
 						break;
 					default:
-						fprintf(out,
-							"bad S2.T%d format\n",
-							tc);
+						decode_printf(ctx,
+							      "bad S2.T%d format\n",
+							      tc);
 					}
 				}
 				vertex++;
@@ -2473,9 +2915,10 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 				BUFFER_FAIL(count, (len + 1) / 2 + 1,
 					    "3DPRIMITIVE random indirect");
 			}
-			instr_out(ctx, 0,
-				  "3DPRIMITIVE random indirect %s (%d)\n",
-				  primtype, len);
+			instr_header(ctx, "3DPRIMITIVE",
+				     FIELDS("prim_type", "vertex_count"),
+				     "3DPRIMITIVE random indirect %s (%d)\n",
+				     primtype, len);
 			if (len == 0) {
 				/* vertex indices continue until 0xffff is
 				 * found
@@ -2499,8 +2942,8 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 							  data[i] >> 16);
 					}
 				}
-				fprintf(out,
-					"3DPRIMITIVE: no terminator found in index buffer\n");
+				decode_printf(ctx,
+					      "3DPRIMITIVE: no terminator found in index buffer\n");
 				ret = count;
 				goto out;
 			} else {
@@ -2522,9 +2965,11 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 			goto out;
 		} else {
 			/* sequential vertex access */
-			instr_out(ctx, 0,
-				  "3DPRIMITIVE sequential indirect %s, %d starting from "
-				  "%d\n", primtype, len, data[1] & 0xffff);
+			instr_header(ctx, "3DPRIMITIVE",
+				     FIELDS("prim_type", "vertex_count",
+					    "start_vertex"),
+				     "3DPRIMITIVE sequential indirect %s, %d starting from "
+				     "%d\n", primtype, len, data[1] & 0xffff);
 			instr_out(ctx, 1, "           start\n");
 			ret = 2;
 			goto out;
@@ -2532,34 +2977,30 @@ decode_3d_primitive(struct drm_intel_decode *ctx)
 	}
 
 out:
-	saved_s2 = original_s2;
-	saved_s4 = original_s4;
+	ctx->saved_s2 = original_s2;
+	ctx->saved_s4 = original_s4;
 	return ret;
 }
 
+static const struct decode_opcode opcodes_3d[] = {
+	{ 0x06, 0xff, 1, 1, "3DSTATE_ANTI_ALIASING" },
+	{ 0x08, 0xff, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
+	{ 0x09, 0xff, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
+	{ 0x16, 0xff, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
+	{ 0x15, 0xff, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x0b, 0xff, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
+	{ 0x0d, 0xff, 1, 1, "3DSTATE_MODES_4" },
+	{ 0x0c, 0xff, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x07, 0xff, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
+};
+
 static int
 decode_3d(struct drm_intel_decode *ctx)
 {
 	uint32_t opcode;
 	unsigned int idx;
 	uint32_t *data = ctx->data;
-
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x06, 1, 1, "3DSTATE_ANTI_ALIASING" },
-		{ 0x08, 1, 1, "3DSTATE_BACKFACE_STENCIL_OPS" },
-		{ 0x09, 1, 1, "3DSTATE_BACKFACE_STENCIL_MASKS" },
-		{ 0x16, 1, 1, "3DSTATE_COORD_SET_BINDINGS" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x0b, 1, 1, "3DSTATE_INDEPENDENT_ALPHA_BLEND" },
-		{ 0x0d, 1, 1, "3DSTATE_MODES_4" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES"},
-	}, *opcode_3d;
+	const struct decode_opcode *opcode_3d;
 
 	opcode = (data[0] & 0x1f000000) >> 24;
 
@@ -2572,29 +3013,30 @@ decode_3d(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if (opcode == opcode_3d->opcode) {
-			unsigned int len = 1, i;
-
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
-			}
+	idx = ctx->index_3d[opcode];
+	if (idx) {
+		unsigned int len = 1, i;
 
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+		opcode_3d = &opcodes_3d[idx - 1];
+		instr_header(ctx, opcode_3d->name, FIELDS(""),
+			     "%s\n", opcode_3d->name);
+		if (opcode_3d->max_len > 1) {
+			len = (data[0] & opcode_3d->len_mask) + 2;
+			if (len < opcode_3d->min_len ||
+			    len > opcode_3d->max_len) {
+				decode_printf(ctx, "Bad count in %s\n",
+					      opcode_3d->name);
 			}
-			return len;
 		}
+
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
+		}
+		return len;
 	}
 
-	instr_out(ctx, 0, "3D UNKNOWN: 3d opcode = 0x%x\n", opcode);
+	instr_header(ctx, "UNKNOWN", FIELDS("opcode"),
+		     "3D UNKNOWN: 3d opcode = 0x%x\n", opcode);
 	return 1;
 }
 
@@ -2724,7 +3166,7 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 	uint32_t *data = ctx->data;
 
 	if (len != 3)
-		fprintf(out, "Bad count in URB_FENCE\n");
+		decode_printf(ctx, "Bad count in URB_FENCE\n");
 
 	vs_fence = data[1] & 0x3ff;
 	gs_fence = (data[1] >> 10) & 0x3ff;
@@ -2733,27 +3175,30 @@ i965_decode_urb_fence(struct drm_intel_decode *ctx, int len)
 	vfe_fence = (data[2] >> 10) & 0x3ff;
 	cs_fence = (data[2] >> 20) & 0x7ff;
 
-	instr_out(ctx, 0, "URB_FENCE: %s%s%s%s%s%s\n",
-		  (data[0] >> 13) & 1 ? "cs " : "",
-		  (data[0] >> 12) & 1 ? "vfe " : "",
-		  (data[0] >> 11) & 1 ? "sf " : "",
-		  (data[0] >> 10) & 1 ? "clip " : "",
-		  (data[0] >> 9) & 1 ? "gs " : "",
-		  (data[0] >> 8) & 1 ? "vs " : "");
-	instr_out(ctx, 1,
-		  "vs fence: %d, clip_fence: %d, gs_fence: %d\n",
-		  vs_fence, clip_fence, gs_fence);
-	instr_out(ctx, 2,
-		  "sf fence: %d, vfe_fence: %d, cs_fence: %d\n",
-		  sf_fence, vfe_fence, cs_fence);
+	instr_header(ctx, "URB_FENCE",
+		     FIELDS("?cs_realloc", "?vfe_realloc", "?sf_realloc",
+			    "?clip_realloc", "?gs_realloc", "?vs_realloc"),
+		     "URB_FENCE: %s%s%s%s%s%s\n",
+		     (data[0] >> 13) & 1 ? "cs " : "",
+		     (data[0] >> 12) & 1 ? "vfe " : "",
+		     (data[0] >> 11) & 1 ? "sf " : "",
+		     (data[0] >> 10) & 1 ? "clip " : "",
+		     (data[0] >> 9) & 1 ? "gs " : "",
+		     (data[0] >> 8) & 1 ? "vs " : "");
+	instr_fields(ctx, 1, FIELDS("vs_fence", "clip_fence", "gs_fence"),
+		     "vs fence: %d, clip_fence: %d, gs_fence: %d\n",
+		     vs_fence, clip_fence, gs_fence);
+	instr_fields(ctx, 2, FIELDS("sf_fence", "vfe_fence", "cs_fence"),
+		     "sf fence: %d, vfe_fence: %d, cs_fence: %d\n",
+		     sf_fence, vfe_fence, cs_fence);
 	if (gs_fence < vs_fence)
-		fprintf(out, "gs fence < vs fence!\n");
+		decode_printf(ctx, "gs fence < vs fence!\n");
 	if (clip_fence < gs_fence)
-		fprintf(out, "clip fence < gs fence!\n");
+		decode_printf(ctx, "clip fence < gs fence!\n");
 	if (sf_fence < clip_fence)
-		fprintf(out, "sf fence < clip fence!\n");
+		decode_printf(ctx, "sf fence < clip fence!\n");
 	if (cs_fence < sf_fence)
-		fprintf(out, "cs fence < sf fence!\n");
+		decode_printf(ctx, "cs fence < sf fence!\n");
 
 	return len;
 }
@@ -2763,9 +3208,9 @@ state_base_out(struct drm_intel_decode *ctx, unsigned int index,
 	       const char *name)
 {
 	if (ctx->data[index] & 1) {
-		instr_out(ctx, index,
-			  "%s state base address 0x%08x\n", name,
-			  ctx->data[index] & ~1);
+		instr_fields(ctx, index, FIELDS("", "base_address"),
+			     "%s state base address 0x%08x\n", name,
+			     ctx->data[index] & ~1);
 	} else {
 		instr_out(ctx, index, "%s state base not updated\n",
 			  name);
@@ -2781,9 +3226,9 @@ state_max_out(struct drm_intel_decode *ctx, unsigned int index,
 			instr_out(ctx, index,
 				  "%s state upper bound disabled\n", name);
 		} else {
-			instr_out(ctx, index,
-				  "%s state upper bound 0x%08x\n", name,
-				  ctx->data[index] & ~1);
+			instr_fields(ctx, index, FIELDS("", "upper_bound"),
+				     "%s state upper bound 0x%08x\n", name,
+				     ctx->data[index] & ~1);
 		}
 	} else {
 		instr_out(ctx, index,
@@ -2794,7 +3239,8 @@ state_max_out(struct drm_intel_decode *ctx, unsigned int index,
 static int
 gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_VIEWPORT_STATE_POINTERS_CC\n");
+	instr_header(ctx, "3DSTATE_VIEWPORT_STATE_POINTERS_CC", NULL,
+		     "3DSTATE_VIEWPORT_STATE_POINTERS_CC\n");
 	instr_out(ctx, 1, "pointer to CC viewport\n");
 
 	return 2;
@@ -2803,7 +3249,8 @@ gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP\n");
+	instr_header(ctx, "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP", NULL,
+		     "3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP\n");
 	instr_out(ctx, 1, "pointer to SF_CLIP viewport\n");
 
 	return 2;
@@ -2812,10 +3259,12 @@ gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_BLEND_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_BLEND_STATE_POINTERS\n");
-	instr_out(ctx, 1, "pointer to BLEND_STATE at 0x%08x (%s)\n",
-		  ctx->data[1] & ~1,
-		  (ctx->data[1] & 1) ? "changed" : "unchanged");
+	instr_header(ctx, "3DSTATE_BLEND_STATE_POINTERS", NULL,
+		     "3DSTATE_BLEND_STATE_POINTERS\n");
+	instr_fields(ctx, 1, FIELDS("blend_state_offset", ""),
+		     "pointer to BLEND_STATE at 0x%08x (%s)\n",
+		     ctx->data[1] & ~1,
+		     (ctx->data[1] & 1) ? "changed" : "unchanged");
 
 	return 2;
 }
@@ -2823,11 +3272,12 @@ gen7_3DSTATE_BLEND_STATE_POINTERS(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS\n");
-	instr_out(ctx, 1,
-		  "pointer to DEPTH_STENCIL_STATE at 0x%08x (%s)\n",
-		  ctx->data[1] & ~1,
-		  (ctx->data[1] & 1) ? "changed" : "unchanged");
+	instr_header(ctx, "3DSTATE_DEPTH_STENCIL_STATE_POINTERS", NULL,
+		     "3DSTATE_DEPTH_STENCIL_STATE_POINTERS\n");
+	instr_fields(ctx, 1, FIELDS("depth_stencil_state_offset", ""),
+		     "pointer to DEPTH_STENCIL_STATE at 0x%08x (%s)\n",
+		     ctx->data[1] & ~1,
+		     (ctx->data[1] & 1) ? "changed" : "unchanged");
 
 	return 2;
 }
@@ -2835,9 +3285,10 @@ gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_HIER_DEPTH_BUFFER(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_HIER_DEPTH_BUFFER\n");
-	instr_out(ctx, 1, "pitch %db\n",
-		  (ctx->data[1] & 0x1ffff) + 1);
+	instr_header(ctx, "3DSTATE_HIER_DEPTH_BUFFER", NULL,
+		     "3DSTATE_HIER_DEPTH_BUFFER\n");
+	instr_fields(ctx, 1, FIELDS("pitch"), "pitch %db\n",
+		     (ctx->data[1] & 0x1ffff) + 1);
 	instr_out(ctx, 2, "pointer to HiZ buffer\n");
 
 	return 3;
@@ -2846,11 +3297,15 @@ gen7_3DSTATE_HIER_DEPTH_BUFFER(struct drm_intel_decode *ctx)
 static int
 gen6_3DSTATE_CC_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_CC_STATE_POINTERS\n");
-	instr_out(ctx, 1, "blend change %d\n", ctx->data[1] & 1);
-	instr_out(ctx, 2, "depth stencil change %d\n",
-		  ctx->data[2] & 1);
-	instr_out(ctx, 3, "cc change %d\n", ctx->data[3] & 1);
+	instr_header(ctx, "3DSTATE_CC_STATE_POINTERS", NULL,
+		     "3DSTATE_CC_STATE_POINTERS\n");
+	instr_fields(ctx, 1, FIELDS("blend_change"),
+		     "blend change %d\n", ctx->data[1] & 1);
+	instr_fields(ctx, 2, FIELDS("depth_stencil_change"),
+		     "depth stencil change %d\n",
+		     ctx->data[2] & 1);
+	instr_fields(ctx, 3, FIELDS("cc_change"),
+		     "cc change %d\n", ctx->data[3] & 1);
 
 	return 4;
 }
@@ -2858,27 +3313,30 @@ gen6_3DSTATE_CC_STATE_POINTERS(struct drm_intel_decode *ctx)
 static int
 gen7_3DSTATE_CC_STATE_POINTERS(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_CC_STATE_POINTERS\n");
-	instr_out(ctx, 1, "pointer to COLOR_CALC_STATE at 0x%08x "
-		  "(%s)\n",
-		  ctx->data[1] & ~1,
-		  (ctx->data[1] & 1) ? "changed" : "unchanged");
+	instr_header(ctx, "3DSTATE_CC_STATE_POINTERS", NULL,
+		     "3DSTATE_CC_STATE_POINTERS\n");
+	instr_fields(ctx, 1, FIELDS("color_calc_state_offset", ""),
+		     "pointer to COLOR_CALC_STATE at 0x%08x "
+		     "(%s)\n",
+		     ctx->data[1] & ~1,
+		     (ctx->data[1] & 1) ? "changed" : "unchanged");
 
 	return 2;
 }
 
 static int
-gen7_3DSTATE_URB_unit(struct drm_intel_decode *ctx, const char *unit)
+gen7_3DSTATE_URB_unit(struct drm_intel_decode *ctx, const char *name)
 {
     int start_kb = ((ctx->data[1] >> 25) & 0x3f) * 8;
     /* the field is # of 512-bit rows - 1, we print bytes */
     int entry_size = (((ctx->data[1] >> 16) & 0x1ff) + 1);
     int nr_entries = ctx->data[1] & 0xffff;
 
-    instr_out(ctx, 0, "3DSTATE_URB_%s\n", unit);
-    instr_out(ctx, 1,
-	      "%dKB start, size=%d 64B rows, nr_entries=%d, total size %dB\n",
-	      start_kb, entry_size, nr_entries, nr_entries * 64 * entry_size);
+    instr_header(ctx, name, FIELDS(""), "%s\n", name);
+    instr_fields(ctx, 1,
+		 FIELDS("start_kb", "entry_size", "nr_entries", "total_size"),
+		 "%dKB start, size=%d 64B rows, nr_entries=%d, total size %dB\n",
+		 start_kb, entry_size, nr_entries, nr_entries * 64 * entry_size);
 
     return 2;
 }
@@ -2886,29 +3344,29 @@ gen7_3DSTATE_URB_unit(struct drm_intel_decode *ctx, const char *unit)
 static int
 gen7_3DSTATE_URB_VS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_URB_unit(ctx, "VS");
+	return gen7_3DSTATE_URB_unit(ctx, "3DSTATE_URB_VS");
 }
 
 static int
 gen7_3DSTATE_URB_HS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_URB_unit(ctx, "HS");
+	return gen7_3DSTATE_URB_unit(ctx, "3DSTATE_URB_HS");
 }
 
 static int
 gen7_3DSTATE_URB_DS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_URB_unit(ctx, "DS");
+	return gen7_3DSTATE_URB_unit(ctx, "3DSTATE_URB_DS");
 }
 
 static int
 gen7_3DSTATE_URB_GS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_URB_unit(ctx, "GS");
+	return gen7_3DSTATE_URB_unit(ctx, "3DSTATE_URB_GS");
 }
 
 static int
-gen7_3DSTATE_CONSTANT(struct drm_intel_decode *ctx, const char *unit)
+gen7_3DSTATE_CONSTANT(struct drm_intel_decode *ctx, const char *name)
 {
 	int rlen[4];
 
@@ -2917,9 +3375,11 @@ gen7_3DSTATE_CONSTANT(struct drm_intel_decode *ctx, const char *unit)
 	rlen[2] = (ctx->data[2] >> 0) & 0xffff;
 	rlen[3] = (ctx->data[2] >> 16) & 0xffff;
 
-	instr_out(ctx, 0, "3DSTATE_CONSTANT_%s\n", unit);
-	instr_out(ctx, 1, "len 0 = %d, len 1 = %d\n", rlen[0], rlen[1]);
-	instr_out(ctx, 2, "len 2 = %d, len 3 = %d\n", rlen[2], rlen[3]);
+	instr_header(ctx, name, FIELDS(""), "%s\n", name);
+	instr_fields(ctx, 1, FIELDS("read_length_0", "read_length_1"),
+		     "len 0 = %d, len 1 = %d\n", rlen[0], rlen[1]);
+	instr_fields(ctx, 2, FIELDS("read_length_2", "read_length_3"),
+		     "len 2 = %d, len 3 = %d\n", rlen[2], rlen[3]);
 	instr_out(ctx, 3, "pointer to constbuf 0\n");
 	instr_out(ctx, 4, "pointer to constbuf 1\n");
 	instr_out(ctx, 5, "pointer to constbuf 2\n");
@@ -2931,81 +3391,93 @@ gen7_3DSTATE_CONSTANT(struct drm_intel_decode *ctx, const char *unit)
 static int
 gen7_3DSTATE_CONSTANT_VS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_CONSTANT(ctx, "VS");
+	return gen7_3DSTATE_CONSTANT(ctx, "3DSTATE_CONSTANT_VS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_GS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_CONSTANT(ctx, "GS");
+	return gen7_3DSTATE_CONSTANT(ctx, "3DSTATE_CONSTANT_GS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_PS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_CONSTANT(ctx, "PS");
+	return gen7_3DSTATE_CONSTANT(ctx, "3DSTATE_CONSTANT_PS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_DS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_CONSTANT(ctx, "DS");
+	return gen7_3DSTATE_CONSTANT(ctx, "3DSTATE_CONSTANT_DS");
 }
 
 static int
 gen7_3DSTATE_CONSTANT_HS(struct drm_intel_decode *ctx)
 {
-	return gen7_3DSTATE_CONSTANT(ctx, "HS");
+	return gen7_3DSTATE_CONSTANT(ctx, "3DSTATE_CONSTANT_HS");
 }
 
 
 static int
 gen6_3DSTATE_WM(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0, "3DSTATE_WM\n");
+	instr_header(ctx, "3DSTATE_WM", NULL, "3DSTATE_WM\n");
 	instr_out(ctx, 1, "kernel start pointer 0\n");
-	instr_out(ctx, 2,
-		  "SPF=%d, VME=%d, Sampler Count %d, "
-		  "Binding table count %d\n",
-		  (ctx->data[2] >> 31) & 1,
-		  (ctx->data[2] >> 30) & 1,
-		  (ctx->data[2] >> 27) & 7,
-		  (ctx->data[2] >> 18) & 0xff);
+	instr_fields(ctx, 2,
+		     FIELDS("spf", "vme", "sampler_count",
+			    "binding_table_count"),
+		     "SPF=%d, VME=%d, Sampler Count %d, "
+		     "Binding table count %d\n",
+		     (ctx->data[2] >> 31) & 1,
+		     (ctx->data[2] >> 30) & 1,
+		     (ctx->data[2] >> 27) & 7,
+		     (ctx->data[2] >> 18) & 0xff);
 	instr_out(ctx, 3, "scratch offset\n");
-	instr_out(ctx, 4,
-		  "Depth Clear %d, Depth Resolve %d, HiZ Resolve %d, "
-		  "Dispatch GRF start[0] %d, start[1] %d, start[2] %d\n",
-		  (ctx->data[4] & (1 << 30)) != 0,
-		  (ctx->data[4] & (1 << 28)) != 0,
-		  (ctx->data[4] & (1 << 27)) != 0,
-		  (ctx->data[4] >> 16) & 0x7f,
-		  (ctx->data[4] >> 8) & 0x7f,
-		  (ctx->data[4] & 0x7f));
-	instr_out(ctx, 5,
-		  "MaxThreads %d, PS KillPixel %d, PS computed Z %d, "
-		  "PS use sourceZ %d, Thread Dispatch %d, PS use sourceW %d, "
-		  "Dispatch32 %d, Dispatch16 %d, Dispatch8 %d\n",
-		  ((ctx->data[5] >> 25) & 0x7f) + 1,
-		  (ctx->data[5] & (1 << 22)) != 0,
-		  (ctx->data[5] & (1 << 21)) != 0,
-		  (ctx->data[5] & (1 << 20)) != 0,
-		  (ctx->data[5] & (1 << 19)) != 0,
-		  (ctx->data[5] & (1 << 8)) != 0,
-		  (ctx->data[5] & (1 << 2)) != 0,
-		  (ctx->data[5] & (1 << 1)) != 0,
-		  (ctx->data[5] & (1 << 0)) != 0);
-	instr_out(ctx, 6,
-		  "Num SF output %d, Pos XY offset %d, ZW interp mode %d , "
-		  "Barycentric interp mode 0x%x, Point raster rule %d, "
-		  "Multisample mode %d, "
-		  "Multisample Dispatch mode %d\n",
-		  (ctx->data[6] >> 20) & 0x3f,
-		  (ctx->data[6] >> 18) & 3,
-		  (ctx->data[6] >> 16) & 3,
-		  (ctx->data[6] >> 10) & 0x3f,
-		  (ctx->data[6] & (1 << 9)) != 0,
-		  (ctx->data[6] >> 1) & 3,
-		  (ctx->data[6] & 1));
+	instr_fields(ctx, 4,
+		     FIELDS("depth_clear", "depth_resolve", "hiz_resolve",
+			    "dispatch_grf_start_0", "dispatch_grf_start_1",
+			    "dispatch_grf_start_2"),
+		     "Depth Clear %d, Depth Resolve %d, HiZ Resolve %d, "
+		     "Dispatch GRF start[0] %d, start[1] %d, start[2] %d\n",
+		     (ctx->data[4] & (1 << 30)) != 0,
+		     (ctx->data[4] & (1 << 28)) != 0,
+		     (ctx->data[4] & (1 << 27)) != 0,
+		     (ctx->data[4] >> 16) & 0x7f,
+		     (ctx->data[4] >> 8) & 0x7f,
+		     (ctx->data[4] & 0x7f));
+	instr_fields(ctx, 5,
+		     FIELDS("max_threads", "ps_kill_pixel", "ps_computed_z",
+			    "ps_use_source_z", "thread_dispatch",
+			    "ps_use_source_w", "dispatch_32", "dispatch_16",
+			    "dispatch_8"),
+		     "MaxThreads %d, PS KillPixel %d, PS computed Z %d, "
+		     "PS use sourceZ %d, Thread Dispatch %d, PS use sourceW %d, "
+		     "Dispatch32 %d, Dispatch16 %d, Dispatch8 %d\n",
+		     ((ctx->data[5] >> 25) & 0x7f) + 1,
+		     (ctx->data[5] & (1 << 22)) != 0,
+		     (ctx->data[5] & (1 << 21)) != 0,
+		     (ctx->data[5] & (1 << 20)) != 0,
+		     (ctx->data[5] & (1 << 19)) != 0,
+		     (ctx->data[5] & (1 << 8)) != 0,
+		     (ctx->data[5] & (1 << 2)) != 0,
+		     (ctx->data[5] & (1 << 1)) != 0,
+		     (ctx->data[5] & (1 << 0)) != 0);
+	instr_fields(ctx, 6,
+		     FIELDS("num_sf_outputs", "pos_xy_offset", "zw_interp_mode",
+			    "barycentric_interp_mode", "point_raster_rule",
+			    "multisample_mode", "multisample_dispatch_mode"),
+		     "Num SF output %d, Pos XY offset %d, ZW interp mode %d , "
+		     "Barycentric interp mode 0x%x, Point raster rule %d, "
+		     "Multisample mode %d, "
+		     "Multisample Dispatch mode %d\n",
+		     (ctx->data[6] >> 20) & 0x3f,
+		     (ctx->data[6] >> 18) & 3,
+		     (ctx->data[6] >> 16) & 3,
+		     (ctx->data[6] >> 10) & 0x3f,
+		     (ctx->data[6] & (1 << 9)) != 0,
+		     (ctx->data[6] >> 1) & 3,
+		     (ctx->data[6] & 1));
 	instr_out(ctx, 7, "kernel start pointer 1\n");
 	instr_out(ctx, 8, "kernel start pointer 2\n");
 
@@ -3064,29 +3536,35 @@ gen7_3DSTATE_WM(struct drm_intel_decode *ctx)
 		break;
 	}
 
-	instr_out(ctx, 0, "3DSTATE_WM\n");
-	instr_out(ctx, 1, "(%s%s%s%s%s%s)%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
-		  (ctx->data[1] & (1 << 11)) ? "PP " : "",
-		  (ctx->data[1] & (1 << 12)) ? "PC " : "",
-		  (ctx->data[1] & (1 << 13)) ? "PS " : "",
-		  (ctx->data[1] & (1 << 14)) ? "NPP " : "",
-		  (ctx->data[1] & (1 << 15)) ? "NPC " : "",
-		  (ctx->data[1] & (1 << 16)) ? "NPS " : "",
-		  (ctx->data[1] & (1 << 30)) ? ", depth clear" : "",
-		  (ctx->data[1] & (1 << 29)) ? "" : ", disabled",
-		  (ctx->data[1] & (1 << 28)) ? ", depth resolve" : "",
-		  (ctx->data[1] & (1 << 27)) ? ", hiz resolve" : "",
-		  (ctx->data[1] & (1 << 25)) ? ", kill" : "",
-		  computed_depth,
-		  early_depth,
-		  zw_interp,
-		  (ctx->data[1] & (1 << 20)) ? ", source depth" : "",
-		  (ctx->data[1] & (1 << 19)) ? ", source W" : "",
-		  (ctx->data[1] & (1 << 10)) ? ", coverage" : "",
-		  (ctx->data[1] & (1 << 4)) ? ", poly stipple" : "",
-		  (ctx->data[1] & (1 << 3)) ? ", line stipple" : "",
-		  (ctx->data[1] & (1 << 2)) ? ", point UL" : ", point UR"
-		  );
+	instr_header(ctx, "3DSTATE_WM", NULL, "3DSTATE_WM\n");
+	instr_fields(ctx, 1,
+		     FIELDS("?pp", "?pc", "?ps", "?npp", "?npc", "?nps",
+			    "?depth_clear", "", "?depth_resolve",
+			    "?hiz_resolve", "?kill_pixel", "", "", "",
+			    "?source_depth", "?source_w", "?coverage",
+			    "?poly_stipple", "?line_stipple", ""),
+		     "(%s%s%s%s%s%s)%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
+		     (ctx->data[1] & (1 << 11)) ? "PP " : "",
+		     (ctx->data[1] & (1 << 12)) ? "PC " : "",
+		     (ctx->data[1] & (1 << 13)) ? "PS " : "",
+		     (ctx->data[1] & (1 << 14)) ? "NPP " : "",
+		     (ctx->data[1] & (1 << 15)) ? "NPC " : "",
+		     (ctx->data[1] & (1 << 16)) ? "NPS " : "",
+		     (ctx->data[1] & (1 << 30)) ? ", depth clear" : "",
+		     (ctx->data[1] & (1 << 29)) ? "" : ", disabled",
+		     (ctx->data[1] & (1 << 28)) ? ", depth resolve" : "",
+		     (ctx->data[1] & (1 << 27)) ? ", hiz resolve" : "",
+		     (ctx->data[1] & (1 << 25)) ? ", kill" : "",
+		     computed_depth,
+		     early_depth,
+		     zw_interp,
+		     (ctx->data[1] & (1 << 20)) ? ", source depth" : "",
+		     (ctx->data[1] & (1 << 19)) ? ", source W" : "",
+		     (ctx->data[1] & (1 << 10)) ? ", coverage" : "",
+		     (ctx->data[1] & (1 << 4)) ? ", poly stipple" : "",
+		     (ctx->data[1] & (1 << 3)) ? ", line stipple" : "",
+		     (ctx->data[1] & (1 << 2)) ? ", point UL" : ", point UR"
+		     );
 	instr_out(ctx, 2, "MS\n");
 
 	return 3;
@@ -3095,10 +3573,10 @@ gen7_3DSTATE_WM(struct drm_intel_decode *ctx)
 static int
 gen4_3DPRIMITIVE(struct drm_intel_decode *ctx)
 {
-	instr_out(ctx, 0,
-		  "3DPRIMITIVE: %s %s\n",
-		  get_965_prim_type((ctx->data[0] >> 10) & 0x1f),
-		  (ctx->data[0] & (1 << 15)) ? "random" : "sequential");
+	instr_header(ctx, "3DPRIMITIVE", FIELDS("prim_type", "access"),
+		     "3DPRIMITIVE: %s %s\n",
+		     get_965_prim_type((ctx->data[0] >> 10) & 0x1f),
+		     (ctx->data[0] & (1 << 15)) ? "random" : "sequential");
 	instr_out(ctx, 1, "vertex count\n");
 	instr_out(ctx, 2, "start vertex\n");
 	instr_out(ctx, 3, "instance count\n");
@@ -3113,13 +3591,13 @@ gen7_3DPRIMITIVE(struct drm_intel_decode *ctx)
 {
 	bool indirect = !!(ctx->data[0] & (1 << 10));
 
-	instr_out(ctx, 0,
-		  "3DPRIMITIVE: %s%s\n",
-		  indirect ? " indirect" : "",
-		  (ctx->data[0] & (1 << 8)) ? " predicated" : "");
-	instr_out(ctx, 1, "%s %s\n",
-		  get_965_prim_type(ctx->data[1] & 0x3f),
-		  (ctx->data[1] & (1 << 8)) ? "random" : "sequential");
+	instr_header(ctx, "3DPRIMITIVE", FIELDS("?indirect", "?predicated"),
+		     "3DPRIMITIVE: %s%s\n",
+		     indirect ? " indirect" : "",
+		     (ctx->data[0] & (1 << 8)) ? " predicated" : "");
+	instr_fields(ctx, 1, FIELDS("prim_type", "access"), "%s %s\n",
+		     get_965_prim_type(ctx->data[1] & 0x3f),
+		     (ctx->data[1] & (1 << 8)) ? "random" : "sequential");
 	instr_out(ctx, 2, indirect ? "ignored" : "vertex count\n");
 	instr_out(ctx, 3, indirect ? "ignored" : "start vertex\n");
 	instr_out(ctx, 4, indirect ? "ignored" : "instance count\n");
@@ -3129,128 +3607,112 @@ gen7_3DPRIMITIVE(struct drm_intel_decode *ctx)
 	return 7;
 }
 
+static const struct decode_opcode opcodes_3d_965[] = {
+	{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
+	{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
+	{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
+	{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
+	{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
+	{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
+	{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
+	{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
+	{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
+	{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
+	{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
+	{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
+	{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
+	{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
+	{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
+	{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
+	{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
+	{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
+	{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
+	{ 0x780e, 0xffff, 4, 4, NULL, 6, gen6_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780e, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_CC_STATE_POINTERS },
+	{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
+	{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
+	{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
+	{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
+	{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
+	{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
+	{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
+	{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
+	{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
+	{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
+	{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
+	{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
+	{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
+	{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
+	{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
+	{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
+	{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
+	{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
+	{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
+	{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
+	{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
+	{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
+	{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
+	{ 0x7821, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
+	{ 0x7823, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
+	{ 0x7824, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
+	{ 0x7825, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
+	{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
+	{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
+	{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
+	{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
+	{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
+	{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
+	{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
+	{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
+	{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
+	{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
+	{ 0x7830, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_VS },
+	{ 0x7831, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_HS },
+	{ 0x7832, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_DS },
+	{ 0x7833, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_GS },
+	{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
+	{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
+	{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
+	{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
+	{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
+	{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
+	{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
+	{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
+	{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
+	{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
+	{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
+	{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
+	{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
+	{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
+	{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
+	{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
+	{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
+	{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
+	{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
+	{ 0x7b00, 0x00ff, 7, 7, NULL, 7, gen7_3DPRIMITIVE },
+	{ 0x7b00, 0x00ff, 6, 6, NULL, 0, gen4_3DPRIMITIVE },
+};
+
 static int
 decode_3d_965(struct drm_intel_decode *ctx)
 {
 	uint32_t opcode;
 	unsigned int len;
-	unsigned int i, j, sba_len;
+	unsigned int i, j, entry, sba_len;
 	const char *desc1 = NULL;
 	uint32_t *data = ctx->data;
-	uint32_t devid = ctx->devid;
-
-	struct {
-		uint32_t opcode;
-		uint32_t len_mask;
-		int unsigned min_len;
-		int unsigned max_len;
-		const char *name;
-		int gen;
-		int (*func)(struct drm_intel_decode *ctx);
-	} opcodes_3d[] = {
-		{ 0x6000, 0x00ff, 3, 3, "URB_FENCE" },
-		{ 0x6001, 0xffff, 2, 2, "CS_URB_STATE" },
-		{ 0x6002, 0x00ff, 2, 2, "CONSTANT_BUFFER" },
-		{ 0x6101, 0xffff, 6, 10, "STATE_BASE_ADDRESS" },
-		{ 0x6102, 0xffff, 2, 2, "STATE_SIP" },
-		{ 0x6104, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x680b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x6904, 0xffff, 1, 1, "3DSTATE_PIPELINE_SELECT" },
-		{ 0x7800, 0xffff, 7, 7, "3DSTATE_PIPELINED_POINTERS" },
-		{ 0x7801, 0x00ff, 4, 6, "3DSTATE_BINDING_TABLE_POINTERS" },
-		{ 0x7802, 0x00ff, 4, 4, "3DSTATE_SAMPLER_STATE_POINTERS" },
-		{ 0x7805, 0x00ff, 7, 7, "3DSTATE_DEPTH_BUFFER", 7 },
-		{ 0x7805, 0x00ff, 3, 3, "3DSTATE_URB" },
-		{ 0x7804, 0x00ff, 3, 3, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7806, 0x00ff, 3, 3, "3DSTATE_STENCIL_BUFFER" },
-		{ 0x790f, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 6 },
-		{ 0x7807, 0x00ff, 3, 3, "3DSTATE_HIER_DEPTH_BUFFER", 7, gen7_3DSTATE_HIER_DEPTH_BUFFER },
-		{ 0x7808, 0x00ff, 5, 257, "3DSTATE_VERTEX_BUFFERS" },
-		{ 0x7809, 0x00ff, 3, 256, "3DSTATE_VERTEX_ELEMENTS" },
-		{ 0x780a, 0x00ff, 3, 3, "3DSTATE_INDEX_BUFFER" },
-		{ 0x780b, 0xffff, 1, 1, "3DSTATE_VF_STATISTICS" },
-		{ 0x780d, 0x00ff, 4, 4, "3DSTATE_VIEWPORT_STATE_POINTERS" },
-		{ 0x780e, 0xffff, 4, 4, NULL, 6, gen6_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780e, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_CC_STATE_POINTERS },
-		{ 0x780f, 0x00ff, 2, 2, "3DSTATE_SCISSOR_POINTERS" },
-		{ 0x7810, 0x00ff, 6, 6, "3DSTATE_VS" },
-		{ 0x7811, 0x00ff, 7, 7, "3DSTATE_GS" },
-		{ 0x7812, 0x00ff, 4, 4, "3DSTATE_CLIP" },
-		{ 0x7813, 0x00ff, 20, 20, "3DSTATE_SF", 6 },
-		{ 0x7813, 0x00ff, 7, 7, "3DSTATE_SF", 7 },
-		{ 0x7814, 0x00ff, 3, 3, "3DSTATE_WM", 7, gen7_3DSTATE_WM },
-		{ 0x7814, 0x00ff, 9, 9, "3DSTATE_WM", 6, gen6_3DSTATE_WM },
-		{ 0x7815, 0x00ff, 5, 5, "3DSTATE_CONSTANT_VS_STATE", 6 },
-		{ 0x7815, 0x00ff, 7, 7, "3DSTATE_CONSTANT_VS", 7, gen7_3DSTATE_CONSTANT_VS },
-		{ 0x7816, 0x00ff, 5, 5, "3DSTATE_CONSTANT_GS_STATE", 6 },
-		{ 0x7816, 0x00ff, 7, 7, "3DSTATE_CONSTANT_GS", 7, gen7_3DSTATE_CONSTANT_GS },
-		{ 0x7817, 0x00ff, 5, 5, "3DSTATE_CONSTANT_PS_STATE", 6 },
-		{ 0x7817, 0x00ff, 7, 7, "3DSTATE_CONSTANT_PS", 7, gen7_3DSTATE_CONSTANT_PS },
-		{ 0x7818, 0xffff, 2, 2, "3DSTATE_SAMPLE_MASK" },
-		{ 0x7819, 0x00ff, 7, 7, "3DSTATE_CONSTANT_HS", 7, gen7_3DSTATE_CONSTANT_HS },
-		{ 0x781a, 0x00ff, 7, 7, "3DSTATE_CONSTANT_DS", 7, gen7_3DSTATE_CONSTANT_DS },
-		{ 0x781b, 0x00ff, 7, 7, "3DSTATE_HS" },
-		{ 0x781c, 0x00ff, 4, 4, "3DSTATE_TE" },
-		{ 0x781d, 0x00ff, 6, 6, "3DSTATE_DS" },
-		{ 0x781e, 0x00ff, 3, 3, "3DSTATE_STREAMOUT" },
-		{ 0x781f, 0x00ff, 14, 14, "3DSTATE_SBE" },
-		{ 0x7820, 0x00ff, 8, 8, "3DSTATE_PS" },
-		{ 0x7821, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_SF_CLIP },
-		{ 0x7823, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_VIEWPORT_STATE_POINTERS_CC },
-		{ 0x7824, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_BLEND_STATE_POINTERS },
-		{ 0x7825, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_DEPTH_STENCIL_STATE_POINTERS },
-		{ 0x7826, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_VS" },
-		{ 0x7827, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_HS" },
-		{ 0x7828, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_DS" },
-		{ 0x7829, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_GS" },
-		{ 0x782a, 0x00ff, 2, 2, "3DSTATE_BINDING_TABLE_POINTERS_PS" },
-		{ 0x782b, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_VS" },
-		{ 0x782c, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_HS" },
-		{ 0x782d, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_DS" },
-		{ 0x782e, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_GS" },
-		{ 0x782f, 0x00ff, 2, 2, "3DSTATE_SAMPLER_STATE_POINTERS_PS" },
-		{ 0x7830, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_VS },
-		{ 0x7831, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_HS },
-		{ 0x7832, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_DS },
-		{ 0x7833, 0x00ff, 2, 2, NULL, 7, gen7_3DSTATE_URB_GS },
-		{ 0x7900, 0xffff, 4, 4, "3DSTATE_DRAWING_RECTANGLE" },
-		{ 0x7901, 0xffff, 5, 5, "3DSTATE_CONSTANT_COLOR" },
-		{ 0x7905, 0xffff, 5, 7, "3DSTATE_DEPTH_BUFFER" },
-		{ 0x7906, 0xffff, 2, 2, "3DSTATE_POLY_STIPPLE_OFFSET" },
-		{ 0x7907, 0xffff, 33, 33, "3DSTATE_POLY_STIPPLE_PATTERN" },
-		{ 0x7908, 0xffff, 3, 3, "3DSTATE_LINE_STIPPLE" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_GLOBAL_DEPTH_OFFSET_CLAMP" },
-		{ 0x7909, 0xffff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x790a, 0xffff, 3, 3, "3DSTATE_AA_LINE_PARAMETERS" },
-		{ 0x790b, 0xffff, 4, 4, "3DSTATE_GS_SVB_INDEX" },
-		{ 0x790d, 0xffff, 3, 3, "3DSTATE_MULTISAMPLE", 6 },
-		{ 0x790d, 0xffff, 4, 4, "3DSTATE_MULTISAMPLE", 7 },
-		{ 0x7910, 0x00ff, 2, 2, "3DSTATE_CLEAR_PARAMS" },
-		{ 0x7912, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_VS" },
-		{ 0x7913, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_HS" },
-		{ 0x7914, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_DS" },
-		{ 0x7915, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_GS" },
-		{ 0x7916, 0x00ff, 2, 2, "3DSTATE_PUSH_CONSTANT_ALLOC_PS" },
-		{ 0x7917, 0x00ff, 2, 2+128*2, "3DSTATE_SO_DECL_LIST" },
-		{ 0x7918, 0x00ff, 4, 4, "3DSTATE_SO_BUFFER" },
-		{ 0x7a00, 0x00ff, 4, 6, "PIPE_CONTROL" },
-		{ 0x7b00, 0x00ff, 7, 7, NULL, 7, gen7_3DPRIMITIVE },
-		{ 0x7b00, 0x00ff, 6, 6, NULL, 0, gen4_3DPRIMITIVE },
-	}, *opcode_3d = NULL;
+	const struct decode_opcode *opcode_3d = NULL;
 
 	opcode = (data[0] & 0xffff0000) >> 16;
 
-	for (i = 0; i < ARRAY_SIZE(opcodes_3d); i++) {
-		if (opcode != opcodes_3d[i].opcode)
-			continue;
-
-		/* If it's marked as not our gen, skip. */
-		if (opcodes_3d[i].gen && opcodes_3d[i].gen != ctx->gen)
-			continue;
-
-		opcode_3d = &opcodes_3d[i];
-		break;
-	}
+	entry = ctx->index_3d_965[opcode & 0x1fff];
+	if (entry)
+		opcode_3d = &opcodes_3d_965[entry - 1];
 
 	if (opcode_3d) {
 		if (opcode_3d->max_len == 1)
@@ -3260,9 +3722,9 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		if (len < opcode_3d->min_len ||
 		    len > opcode_3d->max_len) {
-			fprintf(out, "Bad length %d in %s, expected %d-%d\n",
-				len, opcode_3d->name,
-				opcode_3d->min_len, opcode_3d->max_len);
+			decode_printf(ctx, "Bad length %d in %s, expected %d-%d\n",
+				      len, opcode_3d->name,
+				      opcode_3d->min_len, opcode_3d->max_len);
 		}
 	} else {
 		len = (data[0] & 0x0000ffff) + 2;
@@ -3272,51 +3734,54 @@ decode_3d_965(struct drm_intel_decode *ctx)
 	case 0x6000:
 		return i965_decode_urb_fence(ctx, len);
 	case 0x6001:
-		instr_out(ctx, 0, "CS_URB_STATE\n");
-		instr_out(ctx, 1,
-			  "entry_size: %d [%d bytes], n_entries: %d\n",
-			  (data[1] >> 4) & 0x1f,
-			  (((data[1] >> 4) & 0x1f) + 1) * 64, data[1] & 0x7);
+		instr_header(ctx, "CS_URB_STATE", NULL, "CS_URB_STATE\n");
+		instr_fields(ctx, 1, FIELDS("entry_size", "", "nr_entries"),
+			     "entry_size: %d [%d bytes], n_entries: %d\n",
+			     (data[1] >> 4) & 0x1f,
+			     (((data[1] >> 4) & 0x1f) + 1) * 64, data[1] & 0x7);
 		return len;
 	case 0x6002:
-		instr_out(ctx, 0, "CONSTANT_BUFFER: %s\n",
-			  (data[0] >> 8) & 1 ? "valid" : "invalid");
-		instr_out(ctx, 1,
-			  "offset: 0x%08x, length: %d bytes\n", data[1] & ~0x3f,
-			  ((data[1] & 0x3f) + 1) * 64);
+		instr_header(ctx, "CONSTANT_BUFFER", FIELDS("valid"),
+			     "CONSTANT_BUFFER: %s\n",
+			     (data[0] >> 8) & 1 ? "valid" : "invalid");
+		instr_fields(ctx, 1, FIELDS("offset", "length"),
+			     "offset: 0x%08x, length: %d bytes\n", data[1] & ~0x3f,
+			     ((data[1] & 0x3f) + 1) * 64);
 		return len;
 	case 0x6101:
 		i = 0;
-		instr_out(ctx, 0, "STATE_BASE_ADDRESS\n");
+		instr_header(ctx, "STATE_BASE_ADDRESS", NULL,
+			     "STATE_BASE_ADDRESS\n");
 		i++;
 
-		if (IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen == 6 || ctx->gen == 7)
 			sba_len = 10;
-		else if (IS_GEN5(devid))
+		else if (ctx->gen == 5)
 			sba_len = 8;
 		else
 			sba_len = 6;
 		if (len != sba_len)
-			fprintf(out, "Bad count in STATE_BASE_ADDRESS\n");
+			decode_printf(ctx, "Bad count in STATE_BASE_ADDRESS\n");
 
 		state_base_out(ctx, i++, "general");
 		state_base_out(ctx, i++, "surface");
-		if (IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen == 6 || ctx->gen == 7)
 			state_base_out(ctx, i++, "dynamic");
 		state_base_out(ctx, i++, "indirect");
-		if (IS_GEN5(devid) || IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen >= 5 && ctx->gen <= 7)
 			state_base_out(ctx, i++, "instruction");
 
 		state_max_out(ctx, i++, "general");
-		if (IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen == 6 || ctx->gen == 7)
 			state_max_out(ctx, i++, "dynamic");
 		state_max_out(ctx, i++, "indirect");
-		if (IS_GEN5(devid) || IS_GEN6(devid) || IS_GEN7(devid))
+		if (ctx->gen >= 5 && ctx->gen <= 7)
 			state_max_out(ctx, i++, "instruction");
 
 		return len;
 	case 0x7800:
-		instr_out(ctx, 0, "3DSTATE_PIPELINED_POINTERS\n");
+		instr_header(ctx, "3DSTATE_PIPELINED_POINTERS", NULL,
+			     "3DSTATE_PIPELINED_POINTERS\n");
 		instr_out(ctx, 1, "VS state\n");
 		instr_out(ctx, 2, "GS state\n");
 		instr_out(ctx, 3, "Clip state\n");
@@ -3326,23 +3791,24 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 	case 0x7801:
 		if (len != 6 && len != 4)
-			fprintf(out,
-				"Bad count in 3DSTATE_BINDING_TABLE_POINTERS\n");
+			decode_printf(ctx,
+				      "Bad count in 3DSTATE_BINDING_TABLE_POINTERS\n");
 		if (len == 6) {
-			instr_out(ctx, 0,
-				  "3DSTATE_BINDING_TABLE_POINTERS\n");
+			instr_header(ctx, "3DSTATE_BINDING_TABLE_POINTERS", NULL,
+				     "3DSTATE_BINDING_TABLE_POINTERS\n");
 			instr_out(ctx, 1, "VS binding table\n");
 			instr_out(ctx, 2, "GS binding table\n");
 			instr_out(ctx, 3, "Clip binding table\n");
 			instr_out(ctx, 4, "SF binding table\n");
 			instr_out(ctx, 5, "WM binding table\n");
 		} else {
-			instr_out(ctx, 0,
-				  "3DSTATE_BINDING_TABLE_POINTERS: VS mod %d, "
-				  "GS mod %d, PS mod %d\n",
-				  (data[0] & (1 << 8)) != 0,
-				  (data[0] & (1 << 9)) != 0,
-				  (data[0] & (1 << 12)) != 0);
+			instr_header(ctx, "3DSTATE_BINDING_TABLE_POINTERS",
+				     FIELDS("vs_mod", "gs_mod", "ps_mod"),
+				     "3DSTATE_BINDING_TABLE_POINTERS: VS mod %d, "
+				     "GS mod %d, PS mod %d\n",
+				     (data[0] & (1 << 8)) != 0,
+				     (data[0] & (1 << 9)) != 0,
+				     (data[0] & (1 << 12)) != 0);
 			instr_out(ctx, 1, "VS binding table\n");
 			instr_out(ctx, 2, "GS binding table\n");
 			instr_out(ctx, 3, "WM binding table\n");
@@ -3350,11 +3816,12 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 		return len;
 	case 0x7802:
-		instr_out(ctx, 0,
-			  "3DSTATE_SAMPLER_STATE_POINTERS: VS mod %d, "
-			  "GS mod %d, PS mod %d\n", (data[0] & (1 << 8)) != 0,
-			  (data[0] & (1 << 9)) != 0,
-			  (data[0] & (1 << 12)) != 0);
+		instr_header(ctx, "3DSTATE_SAMPLER_STATE_POINTERS",
+			     FIELDS("vs_mod", "gs_mod", "ps_mod"),
+			     "3DSTATE_SAMPLER_STATE_POINTERS: VS mod %d, "
+			     "GS mod %d, PS mod %d\n", (data[0] & (1 << 8)) != 0,
+			     (data[0] & (1 << 9)) != 0,
+			     (data[0] & (1 << 12)) != 0);
 		instr_out(ctx, 1, "VS sampler state\n");
 		instr_out(ctx, 2, "GS sampler state\n");
 		instr_out(ctx, 3, "WM sampler state\n");
@@ -3364,33 +3831,35 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		if (ctx->gen == 7)
 			break;
 
-		instr_out(ctx, 0, "3DSTATE_URB\n");
-		instr_out(ctx, 1,
-			  "VS entries %d, alloc size %d (1024bit row)\n",
-			  data[1] & 0xffff, ((data[1] >> 16) & 0x07f) + 1);
-		instr_out(ctx, 2,
-			  "GS entries %d, alloc size %d (1024bit row)\n",
-			  (data[2] >> 8) & 0x3ff, (data[2] & 7) + 1);
+		instr_header(ctx, "3DSTATE_URB", NULL, "3DSTATE_URB\n");
+		instr_fields(ctx, 1, FIELDS("vs_entries", "vs_alloc_size"),
+			     "VS entries %d, alloc size %d (1024bit row)\n",
+			     data[1] & 0xffff, ((data[1] >> 16) & 0x07f) + 1);
+		instr_fields(ctx, 2, FIELDS("gs_entries", "gs_alloc_size"),
+			     "GS entries %d, alloc size %d (1024bit row)\n",
+			     (data[2] >> 8) & 0x3ff, (data[2] & 7) + 1);
 		return len;
 
 	case 0x7808:
 		if ((len - 1) % 4 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
-		instr_out(ctx, 0, "3DSTATE_VERTEX_BUFFERS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_VERTEX_BUFFERS\n");
+		instr_header(ctx, "3DSTATE_VERTEX_BUFFERS", NULL,
+			     "3DSTATE_VERTEX_BUFFERS\n");
 
 		for (i = 1; i < len;) {
 			int idx, access;
-			if (IS_GEN6(devid)) {
+			if (ctx->gen == 6) {
 				idx = 26;
 				access = 20;
 			} else {
 				idx = 27;
 				access = 26;
 			}
-			instr_out(ctx, i,
-				  "buffer %d: %s, pitch %db\n", data[i] >> idx,
-				  data[i] & (1 << access) ? "random" :
-				  "sequential", data[i] & 0x07ff);
+			instr_fields(ctx, i,
+				     FIELDS("buffer", "access", "pitch"),
+				     "buffer %d: %s, pitch %db\n", data[i] >> idx,
+				     data[i] & (1 << access) ? "random" :
+				     "sequential", data[i] & 0x07ff);
 			i++;
 			instr_out(ctx, i++, "buffer address\n");
 			instr_out(ctx, i++, "max index\n");
@@ -3400,175 +3869,226 @@ decode_3d_965(struct drm_intel_decode *ctx)
 
 	case 0x7809:
 		if ((len + 1) % 2 != 0)
-			fprintf(out, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
-		instr_out(ctx, 0, "3DSTATE_VERTEX_ELEMENTS\n");
+			decode_printf(ctx, "Bad count in 3DSTATE_VERTEX_ELEMENTS\n");
+		instr_header(ctx, "3DSTATE_VERTEX_ELEMENTS", NULL,
+			     "3DSTATE_VERTEX_ELEMENTS\n");
 
 		for (i = 1; i < len;) {
-			instr_out(ctx, i,
-				  "buffer %d: %svalid, type 0x%04x, "
-				  "src offset 0x%04x bytes\n",
-				  data[i] >> ((IS_GEN6(devid) || IS_GEN7(devid)) ? 26 : 27),
-				  data[i] & (1 << ((IS_GEN6(devid) || IS_GEN7(devid)) ? 25 : 26)) ?
-				  "" : "in", (data[i] >> 16) & 0x1ff,
-				  data[i] & 0x07ff);
+			instr_fields(ctx, i,
+				     FIELDS("buffer", "!valid", "format",
+					    "src_offset"),
+				     "buffer %d: %svalid, type 0x%04x, "
+				     "src offset 0x%04x bytes\n",
+				     data[i] >> ((ctx->gen == 6 || ctx->gen == 7) ? 26 : 27),
+				     data[i] & (1 << ((ctx->gen == 6 || ctx->gen == 7) ? 25 : 26)) ?
+				     "" : "in", (data[i] >> 16) & 0x1ff,
+				     data[i] & 0x07ff);
 			i++;
-			instr_out(ctx, i, "(%s, %s, %s, %s), "
-				  "dst offset 0x%02x bytes\n",
-				  get_965_element_component(data[i], 0),
-				  get_965_element_component(data[i], 1),
-				  get_965_element_component(data[i], 2),
-				  get_965_element_component(data[i], 3),
-				  (data[i] & 0xff) * 4);
+			instr_fields(ctx, i,
+				     FIELDS("component_0", "component_1",
+					    "component_2", "component_3",
+					    "dst_offset"), "(%s, %s, %s, %s), "
+				     "dst offset 0x%02x bytes\n",
+				     get_965_element_component(data[i], 0),
+				     get_965_element_component(data[i], 1),
+				     get_965_element_component(data[i], 2),
+				     get_965_element_component(data[i], 3),
+				     (data[i] & 0xff) * 4);
 			i++;
 		}
 		return len;
 
 	case 0x780d:
-		instr_out(ctx, 0,
-			  "3DSTATE_VIEWPORT_STATE_POINTERS\n");
+		instr_header(ctx, "3DSTATE_VIEWPORT_STATE_POINTERS", NULL,
+			     "3DSTATE_VIEWPORT_STATE_POINTERS\n");
 		instr_out(ctx, 1, "clip\n");
 		instr_out(ctx, 2, "sf\n");
 		instr_out(ctx, 3, "cc\n");
 		return len;
 
 	case 0x780a:
-		instr_out(ctx, 0, "3DSTATE_INDEX_BUFFER\n");
+		instr_header(ctx, "3DSTATE_INDEX_BUFFER", NULL,
+			     "3DSTATE_INDEX_BUFFER\n");
 		instr_out(ctx, 1, "beginning buffer address\n");
 		instr_out(ctx, 2, "ending buffer address\n");
 		return len;
 
 	case 0x780f:
-		instr_out(ctx, 0, "3DSTATE_SCISSOR_POINTERS\n");
+		instr_header(ctx, "3DSTATE_SCISSOR_POINTERS", NULL,
+			     "3DSTATE_SCISSOR_POINTERS\n");
 		instr_out(ctx, 1, "scissor rect offset\n");
 		return len;
 
 	case 0x7810:
-		instr_out(ctx, 0, "3DSTATE_VS\n");
+		instr_header(ctx, "3DSTATE_VS", NULL, "3DSTATE_VS\n");
 		instr_out(ctx, 1, "kernel pointer\n");
-		instr_out(ctx, 2,
-			  "SPF=%d, VME=%d, Sampler Count %d, "
-			  "Binding table count %d\n", (data[2] >> 31) & 1,
-			  (data[2] >> 30) & 1, (data[2] >> 27) & 7,
-			  (data[2] >> 18) & 0xff);
+		instr_fields(ctx, 2,
+			     FIELDS("spf", "vme", "sampler_count",
+				    "binding_table_count"),
+			     "SPF=%d, VME=%d, Sampler Count %d, "
+			     "Binding table count %d\n", (data[2] >> 31) & 1,
+			     (data[2] >> 30) & 1, (data[2] >> 27) & 7,
+			     (data[2] >> 18) & 0xff);
 		instr_out(ctx, 3, "scratch offset\n");
-		instr_out(ctx, 4,
-			  "Dispatch GRF start %d, VUE read length %d, "
-			  "VUE read offset %d\n", (data[4] >> 20) & 0x1f,
-			  (data[4] >> 11) & 0x3f, (data[4] >> 4) & 0x3f);
-		instr_out(ctx, 5,
-			  "Max Threads %d, Vertex Cache %sable, "
-			  "VS func %sable\n", ((data[5] >> 25) & 0x7f) + 1,
-			  (data[5] & (1 << 1)) != 0 ? "dis" : "en",
-			  (data[5] & 1) != 0 ? "en" : "dis");
+		instr_fields(ctx, 4,
+			     FIELDS("dispatch_grf_start", "vue_read_length",
+				    "vue_read_offset"),
+			     "Dispatch GRF start %d, VUE read length %d, "
+			     "VUE read offset %d\n", (data[4] >> 20) & 0x1f,
+			     (data[4] >> 11) & 0x3f, (data[4] >> 4) & 0x3f);
+		instr_fields(ctx, 5,
+			     FIELDS("max_threads", "vertex_cache_enable",
+				    "vs_enable"),
+			     "Max Threads %d, Vertex Cache %sable, "
+			     "VS func %sable\n", ((data[5] >> 25) & 0x7f) + 1,
+			     (data[5] & (1 << 1)) != 0 ? "dis" : "en",
+			     (data[5] & 1) != 0 ? "en" : "dis");
 		return len;
 
 	case 0x7811:
-		instr_out(ctx, 0, "3DSTATE_GS\n");
+		instr_header(ctx, "3DSTATE_GS", NULL, "3DSTATE_GS\n");
 		instr_out(ctx, 1, "kernel pointer\n");
-		instr_out(ctx, 2,
-			  "SPF=%d, VME=%d, Sampler Count %d, "
-			  "Binding table count %d\n", (data[2] >> 31) & 1,
-			  (data[2] >> 30) & 1, (data[2] >> 27) & 7,
-			  (data[2] >> 18) & 0xff);
+		instr_fields(ctx, 2,
+			     FIELDS("spf", "vme", "sampler_count",
+				    "binding_table_count"),
+			     "SPF=%d, VME=%d, Sampler Count %d, "
+			     "Binding table count %d\n", (data[2] >> 31) & 1,
+			     (data[2] >> 30) & 1, (data[2] >> 27) & 7,
+			     (data[2] >> 18) & 0xff);
 		instr_out(ctx, 3, "scratch offset\n");
-		instr_out(ctx, 4,
-			  "Dispatch GRF start %d, VUE read length %d, "
-			  "VUE read offset %d\n", (data[4] & 0xf),
-			  (data[4] >> 11) & 0x3f, (data[4] >> 4) & 0x3f);
-		instr_out(ctx, 5,
-			  "Max Threads %d, Rendering %sable\n",
-			  ((data[5] >> 25) & 0x7f) + 1,
-			  (data[5] & (1 << 8)) != 0 ? "en" : "dis");
-		instr_out(ctx, 6,
-			  "Reorder %sable, Discard Adjaceny %sable, "
-			  "GS %sable\n",
-			  (data[6] & (1 << 30)) != 0 ? "en" : "dis",
-			  (data[6] & (1 << 29)) != 0 ? "en" : "dis",
-			  (data[6] & (1 << 15)) != 0 ? "en" : "dis");
+		instr_fields(ctx, 4,
+			     FIELDS("dispatch_grf_start", "vue_read_length",
+				    "vue_read_offset"),
+			     "Dispatch GRF start %d, VUE read length %d, "
+			     "VUE read offset %d\n", (data[4] & 0xf),
+			     (data[4] >> 11) & 0x3f, (data[4] >> 4) & 0x3f);
+		instr_fields(ctx, 5, FIELDS("max_threads", "rendering_enable"),
+			     "Max Threads %d, Rendering %sable\n",
+			     ((data[5] >> 25) & 0x7f) + 1,
+			     (data[5] & (1 << 8)) != 0 ? "en" : "dis");
+		instr_fields(ctx, 6,
+			     FIELDS("reorder_enable",
+				    "discard_adjacency_enable", "gs_enable"),
+			     "Reorder %sable, Discard Adjaceny %sable, "
+			     "GS %sable\n",
+			     (data[6] & (1 << 30)) != 0 ? "en" : "dis",
+			     (data[6] & (1 << 29)) != 0 ? "en" : "dis",
+			     (data[6] & (1 << 15)) != 0 ? "en" : "dis");
 		return len;
 
 	case 0x7812:
-		instr_out(ctx, 0, "3DSTATE_CLIP\n");
-		instr_out(ctx, 1,
-			  "UserClip distance cull test mask 0x%x\n",
-			  data[1] & 0xff);
-		instr_out(ctx, 2,
-			  "Clip %sable, API mode %s, Viewport XY test %sable, "
-			  "Viewport Z test %sable, Guardband test %sable, Clip mode %d, "
-			  "Perspective Divide %sable, Non-Perspective Barycentric %sable, "
-			  "Tri Provoking %d, Line Provoking %d, Trifan Provoking %d\n",
-			  (data[2] & (1 << 31)) != 0 ? "en" : "dis",
-			  (data[2] & (1 << 30)) != 0 ? "D3D" : "OGL",
-			  (data[2] & (1 << 28)) != 0 ? "en" : "dis",
-			  (data[2] & (1 << 27)) != 0 ? "en" : "dis",
-			  (data[2] & (1 << 26)) != 0 ? "en" : "dis",
-			  (data[2] >> 13) & 7,
-			  (data[2] & (1 << 9)) != 0 ? "dis" : "en",
-			  (data[2] & (1 << 8)) != 0 ? "en" : "dis",
-			  (data[2] >> 4) & 3, (data[2] >> 2) & 3,
-			  (data[2] & 3));
-		instr_out(ctx, 3,
-			  "Min PointWidth %d, Max PointWidth %d, "
-			  "Force Zero RTAIndex %sable, Max VPIndex %d\n",
-			  (data[3] >> 17) & 0x7ff, (data[3] >> 6) & 0x7ff,
-			  (data[3] & (1 << 5)) != 0 ? "en" : "dis",
-			  (data[3] & 0xf));
+		instr_header(ctx, "3DSTATE_CLIP", NULL, "3DSTATE_CLIP\n");
+		instr_fields(ctx, 1,
+			     FIELDS("user_clip_distance_cull_test_mask"),
+			     "UserClip distance cull test mask 0x%x\n",
+			     data[1] & 0xff);
+		instr_fields(ctx, 2,
+			     FIELDS("clip_enable", "api_mode",
+				    "viewport_xy_test_enable",
+				    "viewport_z_test_enable",
+				    "guardband_test_enable", "clip_mode",
+				    "perspective_divide_disable",
+				    "non_perspective_barycentric_enable",
+				    "tri_provoking", "line_provoking",
+				    "trifan_provoking"),
+			     "Clip %sable, API mode %s, Viewport XY test %sable, "
+			     "Viewport Z test %sable, Guardband test %sable, Clip mode %d, "
+			     "Perspective Divide %sable, Non-Perspective Barycentric %sable, "
+			     "Tri Provoking %d, Line Provoking %d, Trifan Provoking %d\n",
+			     (data[2] & (1 << 31)) != 0 ? "en" : "dis",
+			     (data[2] & (1 << 30)) != 0 ? "D3D" : "OGL",
+			     (data[2] & (1 << 28)) != 0 ? "en" : "dis",
+			     (data[2] & (1 << 27)) != 0 ? "en" : "dis",
+			     (data[2] & (1 << 26)) != 0 ? "en" : "dis",
+			     (data[2] >> 13) & 7,
+			     (data[2] & (1 << 9)) != 0 ? "dis" : "en",
+			     (data[2] & (1 << 8)) != 0 ? "en" : "dis",
+			     (data[2] >> 4) & 3, (data[2] >> 2) & 3,
+			     (data[2] & 3));
+		instr_fields(ctx, 3,
+			     FIELDS("min_point_width", "max_point_width",
+				    "force_zero_rta_index_enable",
+				    "max_vp_index"),
+			     "Min PointWidth %d, Max PointWidth %d, "
+			     "Force Zero RTAIndex %sable, Max VPIndex %d\n",
+			     (data[3] >> 17) & 0x7ff, (data[3] >> 6) & 0x7ff,
+			     (data[3] & (1 << 5)) != 0 ? "en" : "dis",
+			     (data[3] & 0xf));
 		return len;
 
 	case 0x7813:
 		if (ctx->gen == 7)
 			break;
 
-		instr_out(ctx, 0, "3DSTATE_SF\n");
-		instr_out(ctx, 1,
-			  "Attrib Out %d, Attrib Swizzle %sable, VUE read length %d, "
-			  "VUE read offset %d\n", (data[1] >> 22) & 0x3f,
-			  (data[1] & (1 << 21)) != 0 ? "en" : "dis",
-			  (data[1] >> 11) & 0x1f, (data[1] >> 4) & 0x3f);
-		instr_out(ctx, 2,
-			  "Legacy Global DepthBias %sable, FrontFace fill %d, BF fill %d, "
-			  "VP transform %sable, FrontWinding_%s\n",
-			  (data[2] & (1 << 11)) != 0 ? "en" : "dis",
-			  (data[2] >> 5) & 3, (data[2] >> 3) & 3,
-			  (data[2] & (1 << 1)) != 0 ? "en" : "dis",
-			  (data[2] & 1) != 0 ? "CCW" : "CW");
-		instr_out(ctx, 3,
-			  "AA %sable, CullMode %d, Scissor %sable, Multisample m ode %d\n",
-			  (data[3] & (1 << 31)) != 0 ? "en" : "dis",
-			  (data[3] >> 29) & 3,
-			  (data[3] & (1 << 11)) != 0 ? "en" : "dis",
-			  (data[3] >> 8) & 3);
-		instr_out(ctx, 4,
-			  "Last Pixel %sable, SubPixel Precision %d, Use PixelWidth %d\n",
-			  (data[4] & (1 << 31)) != 0 ? "en" : "dis",
-			  (data[4] & (1 << 12)) != 0 ? 4 : 8,
-			  (data[4] & (1 << 11)) != 0);
-		instr_out(ctx, 5,
-			  "Global Depth Offset Constant %f\n",
-			  *(float *)(&data[5]));
-		instr_out(ctx, 6, "Global Depth Offset Scale %f\n",
-			  *(float *)(&data[6]));
-		instr_out(ctx, 7, "Global Depth Offset Clamp %f\n",
-			  *(float *)(&data[7]));
+		instr_header(ctx, "3DSTATE_SF", NULL, "3DSTATE_SF\n");
+		instr_fields(ctx, 1,
+			     FIELDS("attrib_out", "attrib_swizzle_enable",
+				    "vue_read_length", "vue_read_offset"),
+			     "Attrib Out %d, Attrib Swizzle %sable, VUE read length %d, "
+			     "VUE read offset %d\n", (data[1] >> 22) & 0x3f,
+			     (data[1] & (1 << 21)) != 0 ? "en" : "dis",
+			     (data[1] >> 11) & 0x1f, (data[1] >> 4) & 0x3f);
+		instr_fields(ctx, 2,
+			     FIELDS("legacy_global_depth_bias_enable",
+				    "front_face_fill", "back_face_fill",
+				    "vp_transform_enable", "front_winding"),
+			     "Legacy Global DepthBias %sable, FrontFace fill %d, BF fill %d, "
+			     "VP transform %sable, FrontWinding_%s\n",
+			     (data[2] & (1 << 11)) != 0 ? "en" : "dis",
+			     (data[2] >> 5) & 3, (data[2] >> 3) & 3,
+			     (data[2] & (1 << 1)) != 0 ? "en" : "dis",
+			     (data[2] & 1) != 0 ? "CCW" : "CW");
+		instr_fields(ctx, 3,
+			     FIELDS("aa_enable", "cull_mode", "scissor_enable",
+				    "multisample_mode"),
+			     "AA %sable, CullMode %d, Scissor %sable, Multisample m ode %d\n",
+			     (data[3] & (1 << 31)) != 0 ? "en" : "dis",
+			     (data[3] >> 29) & 3,
+			     (data[3] & (1 << 11)) != 0 ? "en" : "dis",
+			     (data[3] >> 8) & 3);
+		instr_fields(ctx, 4,
+			     FIELDS("last_pixel_enable", "subpixel_precision",
+				    "use_point_width"),
+			     "Last Pixel %sable, SubPixel Precision %d, Use PixelWidth %d\n",
+			     (data[4] & (1 << 31)) != 0 ? "en" : "dis",
+			     (data[4] & (1 << 12)) != 0 ? 4 : 8,
+			     (data[4] & (1 << 11)) != 0);
+		instr_fields(ctx, 5, FIELDS("global_depth_offset_constant"),
+			     "Global Depth Offset Constant %f\n",
+			     *(float *)(&data[5]));
+		instr_fields(ctx, 6, FIELDS("global_depth_offset_scale"),
+			     "Global Depth Offset Scale %f\n",
+			     *(float *)(&data[6]));
+		instr_fields(ctx, 7, FIELDS("global_depth_offset_clamp"),
+			     "Global Depth Offset Clamp %f\n",
+			     *(float *)(&data[7]));
 
 		for (i = 0, j = 0; i < 8; i++, j += 2)
-			instr_out(ctx, i + 8,
-				  "Attrib %d (Override %s%s%s%s, Const Source %d, Swizzle Select %d, "
-				  "Source %d); Attrib %d (Override %s%s%s%s, Const Source %d, Swizzle Select %d, Source %d)\n",
-				  j + 1,
-				  (data[8 + i] & (1 << 31)) != 0 ? "W" : "",
-				  (data[8 + i] & (1 << 30)) != 0 ? "Z" : "",
-				  (data[8 + i] & (1 << 29)) != 0 ? "Y" : "",
-				  (data[8 + i] & (1 << 28)) != 0 ? "X" : "",
-				  (data[8 + i] >> 25) & 3,
-				  (data[8 + i] >> 22) & 3,
-				  (data[8 + i] >> 16) & 0x1f, j,
-				  (data[8 + i] & (1 << 15)) != 0 ? "W" : "",
-				  (data[8 + i] & (1 << 14)) != 0 ? "Z" : "",
-				  (data[8 + i] & (1 << 13)) != 0 ? "Y" : "",
-				  (data[8 + i] & (1 << 12)) != 0 ? "X" : "",
-				  (data[8 + i] >> 9) & 3,
-				  (data[8 + i] >> 6) & 3, (data[8 + i] & 0x1f));
+			instr_fields(ctx, i + 8,
+				     FIELDS("attrib", "?override_w",
+					    "?override_z", "?override_y",
+					    "?override_x", "const_source",
+					    "swizzle_select", "source",
+					    "attrib", "?override_w",
+					    "?override_z", "?override_y",
+					    "?override_x", "const_source",
+					    "swizzle_select", "source"),
+				     "Attrib %d (Override %s%s%s%s, Const Source %d, Swizzle Select %d, "
+				     "Source %d); Attrib %d (Override %s%s%s%s, Const Source %d, Swizzle Select %d, Source %d)\n",
+				     j + 1,
+				     (data[8 + i] & (1 << 31)) != 0 ? "W" : "",
+				     (data[8 + i] & (1 << 30)) != 0 ? "Z" : "",
+				     (data[8 + i] & (1 << 29)) != 0 ? "Y" : "",
+				     (data[8 + i] & (1 << 28)) != 0 ? "X" : "",
+				     (data[8 + i] >> 25) & 3,
+				     (data[8 + i] >> 22) & 3,
+				     (data[8 + i] >> 16) & 0x1f, j,
+				     (data[8 + i] & (1 << 15)) != 0 ? "W" : "",
+				     (data[8 + i] & (1 << 14)) != 0 ? "Z" : "",
+				     (data[8 + i] & (1 << 13)) != 0 ? "Y" : "",
+				     (data[8 + i] & (1 << 12)) != 0 ? "X" : "",
+				     (data[8 + i] >> 9) & 3,
+				     (data[8 + i] >> 6) & 3, (data[8 + i] & 0x1f));
 		instr_out(ctx, 16,
 			  "Point Sprite TexCoord Enable\n");
 		instr_out(ctx, 17, "Const Interp Enable\n");
@@ -3580,43 +4100,52 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x7900:
-		instr_out(ctx, 0, "3DSTATE_DRAWING_RECTANGLE\n");
-		instr_out(ctx, 1, "top left: %d,%d\n",
-			  data[1] & 0xffff, (data[1] >> 16) & 0xffff);
-		instr_out(ctx, 2, "bottom right: %d,%d\n",
-			  data[2] & 0xffff, (data[2] >> 16) & 0xffff);
-		instr_out(ctx, 3, "origin: %d,%d\n",
-			  (int)data[3] & 0xffff, ((int)data[3] >> 16) & 0xffff);
+		instr_header(ctx, "3DSTATE_DRAWING_RECTANGLE", NULL,
+			     "3DSTATE_DRAWING_RECTANGLE\n");
+		instr_fields(ctx, 1, FIELDS("x1", "y1"), "top left: %d,%d\n",
+			     data[1] & 0xffff, (data[1] >> 16) & 0xffff);
+		instr_fields(ctx, 2, FIELDS("x2", "y2"),
+			     "bottom right: %d,%d\n",
+			     data[2] & 0xffff, (data[2] >> 16) & 0xffff);
+		instr_fields(ctx, 3, FIELDS("origin_x", "origin_y"),
+			     "origin: %d,%d\n",
+			     (int)data[3] & 0xffff, ((int)data[3] >> 16) & 0xffff);
 
 		return len;
 
 	case 0x7905:
-		instr_out(ctx, 0, "3DSTATE_DEPTH_BUFFER\n");
-		if (IS_GEN5(devid) || IS_GEN6(devid))
-			instr_out(ctx, 1,
-				  "%s, %s, pitch = %d bytes, %stiled, HiZ %d, Separate Stencil %d\n",
-				  get_965_surfacetype(data[1] >> 29),
-				  get_965_depthformat((data[1] >> 18) & 0x7),
-				  (data[1] & 0x0001ffff) + 1,
-				  data[1] & (1 << 27) ? "" : "not ",
-				  (data[1] & (1 << 22)) != 0,
-				  (data[1] & (1 << 21)) != 0);
+		instr_header(ctx, "3DSTATE_DEPTH_BUFFER", NULL,
+			     "3DSTATE_DEPTH_BUFFER\n");
+		if (ctx->gen == 5 || ctx->gen == 6)
+			instr_fields(ctx, 1,
+				     FIELDS("surface_type", "format", "pitch",
+					    "!tiled", "hiz_enable",
+					    "separate_stencil_enable"),
+				     "%s, %s, pitch = %d bytes, %stiled, HiZ %d, Separate Stencil %d\n",
+				     get_965_surfacetype(data[1] >> 29),
+				     get_965_depthformat((data[1] >> 18) & 0x7),
+				     (data[1] & 0x0001ffff) + 1,
+				     data[1] & (1 << 27) ? "" : "not ",
+				     (data[1] & (1 << 22)) != 0,
+				     (data[1] & (1 << 21)) != 0);
 		else
-			instr_out(ctx, 1,
-				  "%s, %s, pitch = %d bytes, %stiled\n",
-				  get_965_surfacetype(data[1] >> 29),
-				  get_965_depthformat((data[1] >> 18) & 0x7),
-				  (data[1] & 0x0001ffff) + 1,
-				  data[1] & (1 << 27) ? "" : "not ");
+			instr_fields(ctx, 1,
+				     FIELDS("surface_type", "format", "pitch",
+					    "!tiled"),
+				     "%s, %s, pitch = %d bytes, %stiled\n",
+				     get_965_surfacetype(data[1] >> 29),
+				     get_965_depthformat((data[1] >> 18) & 0x7),
+				     (data[1] & 0x0001ffff) + 1,
+				     data[1] & (1 << 27) ? "" : "not ");
 		instr_out(ctx, 2, "depth offset\n");
-		instr_out(ctx, 3, "%dx%d\n",
-			  ((data[3] & 0x0007ffc0) >> 6) + 1,
-			  ((data[3] & 0xfff80000) >> 19) + 1);
+		instr_fields(ctx, 3, FIELDS("width", "height"), "%dx%d\n",
+			     ((data[3] & 0x0007ffc0) >> 6) + 1,
+			     ((data[3] & 0xfff80000) >> 19) + 1);
 		instr_out(ctx, 4, "volume depth\n");
 		if (len >= 6)
 			instr_out(ctx, 5, "\n");
 		if (len >= 7) {
-			if (IS_GEN6(devid))
+			if (ctx->gen == 6)
 				instr_out(ctx, 6, "\n");
 			else
 				instr_out(ctx, 6,
@@ -3626,9 +4155,9 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		return len;
 
 	case 0x7a00:
-		if (IS_GEN6(devid) || IS_GEN7(devid)) {
+		if (ctx->gen == 6 || ctx->gen == 7) {
 			if (len != 4 && len != 5)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				decode_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[1] >> 14) & 0x3) {
 			case 0:
@@ -3644,41 +4173,59 @@ decode_3d_965(struct drm_intel_decode *ctx)
 				desc1 = "TIMESTAMP write";
 				break;
 			}
-			instr_out(ctx, 0, "PIPE_CONTROL\n");
-			instr_out(ctx, 1,
-				  "%s, %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
-				  desc1,
-				  data[1] & (1 << 20) ? "cs stall, " : "",
-				  data[1] & (1 << 19) ?
-				  "global snapshot count reset, " : "",
-				  data[1] & (1 << 18) ? "tlb invalidate, " : "",
-				  data[1] & (1 << 17) ? "gfdt flush, " : "",
-				  data[1] & (1 << 17) ? "media state clear, " :
-				  "",
-				  data[1] & (1 << 13) ? "depth stall, " : "",
-				  data[1] & (1 << 12) ?
-				  "render target cache flush, " : "",
-				  data[1] & (1 << 11) ?
-				  "instruction cache invalidate, " : "",
-				  data[1] & (1 << 10) ?
-				  "texture cache invalidate, " : "",
-				  data[1] & (1 << 9) ?
-				  "indirect state invalidate, " : "",
-				  data[1] & (1 << 8) ? "notify irq, " : "",
-				  data[1] & (1 << 7) ? "PIPE_CONTROL flush, " :
-				  "",
-				  data[1] & (1 << 6) ? "protect mem app_id, " :
-				  "", data[1] & (1 << 5) ? "DC flush, " : "",
-				  data[1] & (1 << 4) ? "vf fetch invalidate, " :
-				  "",
-				  data[1] & (1 << 3) ?
-				  "constant cache invalidate, " : "",
-				  data[1] & (1 << 2) ?
-				  "state cache invalidate, " : "",
-				  data[1] & (1 << 1) ? "stall at scoreboard, " :
-				  "",
-				  data[1] & (1 << 0) ? "depth cache flush, " :
-				  "");
+			instr_header(ctx, "PIPE_CONTROL", NULL,
+				     "PIPE_CONTROL\n");
+			instr_fields(ctx, 1,
+				     FIELDS("post_sync_op", "?cs_stall",
+					    "?global_snapshot_count_reset",
+					    "?tlb_invalidate", "?gfdt_flush",
+					    "?media_state_clear",
+					    "?depth_stall",
+					    "?render_target_cache_flush",
+					    "?instruction_cache_invalidate",
+					    "?texture_cache_invalidate",
+					    "?indirect_state_invalidate",
+					    "?notify_enable",
+					    "?pipe_control_flush",
+					    "?protect_mem_app_id", "?dc_flush",
+					    "?vf_fetch_invalidate",
+					    "?constant_cache_invalidate",
+					    "?state_cache_invalidate",
+					    "?stall_at_scoreboard",
+					    "?depth_cache_flush"),
+				     "%s, %s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s\n",
+				     desc1,
+				     data[1] & (1 << 20) ? "cs stall, " : "",
+				     data[1] & (1 << 19) ?
+				     "global snapshot count reset, " : "",
+				     data[1] & (1 << 18) ? "tlb invalidate, " : "",
+				     data[1] & (1 << 17) ? "gfdt flush, " : "",
+				     data[1] & (1 << 17) ? "media state clear, " :
+				     "",
+				     data[1] & (1 << 13) ? "depth stall, " : "",
+				     data[1] & (1 << 12) ?
+				     "render target cache flush, " : "",
+				     data[1] & (1 << 11) ?
+				     "instruction cache invalidate, " : "",
+				     data[1] & (1 << 10) ?
+				     "texture cache invalidate, " : "",
+				     data[1] & (1 << 9) ?
+				     "indirect state invalidate, " : "",
+				     data[1] & (1 << 8) ? "notify irq, " : "",
+				     data[1] & (1 << 7) ? "PIPE_CONTROL flush, " :
+				     "",
+				     data[1] & (1 << 6) ? "protect mem app_id, " :
+				     "", data[1] & (1 << 5) ? "DC flush, " : "",
+				     data[1] & (1 << 4) ? "vf fetch invalidate, " :
+				     "",
+				     data[1] & (1 << 3) ?
+				     "constant cache invalidate, " : "",
+				     data[1] & (1 << 2) ?
+				     "state cache invalidate, " : "",
+				     data[1] & (1 << 1) ? "stall at scoreboard, " :
+				     "",
+				     data[1] & (1 << 0) ? "depth cache flush, " :
+				     "");
 			if (len == 5) {
 				instr_out(ctx, 2,
 					  "destination address\n");
@@ -3694,7 +4241,7 @@ decode_3d_965(struct drm_intel_decode *ctx)
 			return len;
 		} else {
 			if (len != 4)
-				fprintf(out, "Bad count in PIPE_CONTROL\n");
+				decode_printf(ctx, "Bad count in PIPE_CONTROL\n");
 
 			switch ((data[0] >> 14) & 0x3) {
 			case 0:
@@ -3710,13 +4257,15 @@ decode_3d_965(struct drm_intel_decode *ctx)
 				desc1 = "TIMESTAMP write";
 				break;
 			}
-			instr_out(ctx, 0,
-				  "PIPE_CONTROL: %s, %sdepth stall, %sRC write flush, "
-				  "%sinst flush\n",
-				  desc1,
-				  data[0] & (1 << 13) ? "" : "no ",
-				  data[0] & (1 << 12) ? "" : "no ",
-				  data[0] & (1 << 11) ? "" : "no ");
+			instr_header(ctx, "PIPE_CONTROL",
+				     FIELDS("post_sync_op", "!depth_stall",
+					    "!rc_write_flush", "!inst_flush"),
+				     "PIPE_CONTROL: %s, %sdepth stall, %sRC write flush, "
+				     "%sinst flush\n",
+				     desc1,
+				     data[0] & (1 << 13) ? "" : "no ",
+				     data[0] & (1 << 12) ? "" : "no ",
+				     data[0] & (1 << 11) ? "" : "no ");
 			instr_out(ctx, 1, "destination address\n");
 			instr_out(ctx, 2, "immediate dword low\n");
 			instr_out(ctx, 3, "immediate dword high\n");
@@ -3728,7 +4277,8 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		if (opcode_3d->func) {
 			return opcode_3d->func(ctx);
 		} else {
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
+			instr_header(ctx, opcode_3d->name, FIELDS(""),
+				     "%s\n", opcode_3d->name);
 
 			for (i = 1; i < len; i++) {
 				instr_out(ctx, i, "dword %d\n", i);
@@ -3737,41 +4287,38 @@ decode_3d_965(struct drm_intel_decode *ctx)
 		}
 	}
 
-	instr_out(ctx, 0, "3D UNKNOWN: 3d_965 opcode = 0x%x\n",
-		  opcode);
+	instr_header(ctx, "UNKNOWN", FIELDS("opcode"),
+		     "3D UNKNOWN: 3d_965 opcode = 0x%x\n",
+		     opcode);
 	return 1;
 }
 
+static const struct decode_opcode opcodes_3d_i830[] = {
+	{ 0x02, 0xff, 1, 1, "3DSTATE_MODES_3" },
+	{ 0x03, 0xff, 1, 1, "3DSTATE_ENABLES_1" },
+	{ 0x04, 0xff, 1, 1, "3DSTATE_ENABLES_2" },
+	{ 0x05, 0xff, 1, 1, "3DSTATE_VFT0" },
+	{ 0x06, 0xff, 1, 1, "3DSTATE_AA" },
+	{ 0x07, 0xff, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
+	{ 0x08, 0xff, 1, 1, "3DSTATE_MODES_1" },
+	{ 0x09, 0xff, 1, 1, "3DSTATE_STENCIL_TEST" },
+	{ 0x0a, 0xff, 1, 1, "3DSTATE_VFT1" },
+	{ 0x0b, 0xff, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
+	{ 0x0c, 0xff, 1, 1, "3DSTATE_MODES_5" },
+	{ 0x0d, 0xff, 1, 1, "3DSTATE_MAP_BLEND_OP" },
+	{ 0x0e, 0xff, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
+	{ 0x0f, 0xff, 1, 1, "3DSTATE_MODES_2" },
+	{ 0x15, 0xff, 1, 1, "3DSTATE_FOG_COLOR" },
+	{ 0x16, 0xff, 1, 1, "3DSTATE_MODES_4"},
+};
+
 static int
 decode_3d_i830(struct drm_intel_decode *ctx)
 {
 	unsigned int idx;
 	uint32_t opcode;
 	uint32_t *data = ctx->data;
-
-	struct {
-		uint32_t opcode;
-		unsigned int min_len;
-		unsigned int max_len;
-		const char *name;
-	} opcodes_3d[] = {
-		{ 0x02, 1, 1, "3DSTATE_MODES_3" },
-		{ 0x03, 1, 1, "3DSTATE_ENABLES_1" },
-		{ 0x04, 1, 1, "3DSTATE_ENABLES_2" },
-		{ 0x05, 1, 1, "3DSTATE_VFT0" },
-		{ 0x06, 1, 1, "3DSTATE_AA" },
-		{ 0x07, 1, 1, "3DSTATE_RASTERIZATION_RULES" },
-		{ 0x08, 1, 1, "3DSTATE_MODES_1" },
-		{ 0x09, 1, 1, "3DSTATE_STENCIL_TEST" },
-		{ 0x0a, 1, 1, "3DSTATE_VFT1" },
-		{ 0x0b, 1, 1, "3DSTATE_INDPT_ALPHA_BLEND" },
-		{ 0x0c, 1, 1, "3DSTATE_MODES_5" },
-		{ 0x0d, 1, 1, "3DSTATE_MAP_BLEND_OP" },
-		{ 0x0e, 1, 1, "3DSTATE_MAP_BLEND_ARG" },
-		{ 0x0f, 1, 1, "3DSTATE_MODES_2" },
-		{ 0x15, 1, 1, "3DSTATE_FOG_COLOR" },
-		{ 0x16, 1, 1, "3DSTATE_MODES_4"},
-	}, *opcode_3d;
+	const struct decode_opcode *opcode_3d;
 
 	opcode = (data[0] & 0x1f000000) >> 24;
 
@@ -3784,33 +4331,305 @@ decode_3d_i830(struct drm_intel_decode *ctx)
 		return decode_3d_1c(ctx);
 	}
 
-	for (idx = 0; idx < ARRAY_SIZE(opcodes_3d); idx++) {
-		opcode_3d = &opcodes_3d[idx];
-		if ((data[0] & 0x1f000000) >> 24 == opcode_3d->opcode) {
-			unsigned int len = 1, i;
-
-			instr_out(ctx, 0, "%s\n", opcode_3d->name);
-			if (opcode_3d->max_len > 1) {
-				len = (data[0] & 0xff) + 2;
-				if (len < opcode_3d->min_len ||
-				    len > opcode_3d->max_len) {
-					fprintf(out, "Bad count in %s\n",
-						opcode_3d->name);
-				}
-			}
+	idx = ctx->index_3d[opcode];
+	if (idx) {
+		unsigned int len = 1, i;
 
-			for (i = 1; i < len; i++) {
-				instr_out(ctx, i, "dword %d\n", i);
+		opcode_3d = &opcodes_3d_i830[idx - 1];
+		instr_header(ctx, opcode_3d->name, FIELDS(""),
+			     "%s\n", opcode_3d->name);
+		if (opcode_3d->max_len > 1) {
+			len = (data[0] & opcode_3d->len_mask) + 2;
+			if (len < opcode_3d->min_len ||
+			    len > opcode_3d->max_len) {
+				decode_printf(ctx, "Bad count in %s\n",
+					      opcode_3d->name);
 			}
-			return len;
 		}
+
+		for (i = 1; i < len; i++) {
+			instr_out(ctx, i, "dword %d\n", i);
+		}
+		return len;
 	}
 
-	instr_out(ctx, 0, "3D UNKNOWN: 3d_i830 opcode = 0x%x\n",
-		  opcode);
+	instr_header(ctx, "UNKNOWN", FIELDS("opcode"),
+		     "3D UNKNOWN: 3d_i830 opcode = 0x%x\n",
+		     opcode);
+	return 1;
+}
+
+static int
+decode_unknown(struct drm_intel_decode *ctx)
+{
+	instr_header(ctx, "UNKNOWN", NULL, "UNKNOWN\n");
 	return 1;
 }
 
+static void
+decode_build_index(uint8_t *index, unsigned int index_size,
+		   const struct decode_opcode *opcodes, unsigned int count,
+		   int gen)
+{
+	unsigned int i;
+
+	assert(count < 256);
+
+	for (i = 0; i < count; i++) {
+		uint32_t key = opcodes[i].opcode & (index_size - 1);
+
+		if (opcodes[i].gen && opcodes[i].gen != gen)
+			continue;
+
+		/* First match wins, as it did for the old table walks. */
+		if (!index[key])
+			index[key] = i + 1;
+	}
+}
+
+/*
+ * The record sink: collects the named fields of each packet, and hands
+ * the packet to the packet callback.
+ */
+
+static void
+record_begin(struct drm_intel_decode *ctx)
+{
+	ctx->packet.num_fields = 0;
+	ctx->strings_len = 0;
+}
+
+static struct drm_intel_decode_field *
+record_add_field(struct drm_intel_decode *ctx)
+{
+	if (ctx->packet.num_fields == ctx->fields_size) {
+		unsigned int size = ctx->fields_size ? ctx->fields_size * 2 : 64;
+		struct drm_intel_decode_field *fields;
+
+		fields = realloc(ctx->fields, size * sizeof(*fields));
+		if (!fields)
+			return NULL;
+
+		ctx->fields = fields;
+		ctx->fields_size = size;
+	}
+
+	return &ctx->fields[ctx->packet.num_fields++];
+}
+
+/** Copies \p str into ctx->strings, returning its offset or -1. */
+static ssize_t
+record_add_string(struct drm_intel_decode *ctx, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	size_t offset = ctx->strings_len;
+
+	if (offset + len > ctx->strings_size) {
+		size_t size = ctx->strings_size ? ctx->strings_size : 1024;
+		char *strings;
+
+		while (offset + len > size)
+			size *= 2;
+
+		strings = realloc(ctx->strings, size);
+		if (!strings)
+			return -1;
+
+		ctx->strings = strings;
+		ctx->strings_size = size;
+	}
+
+	memcpy(ctx->strings + offset, str, len);
+	ctx->strings_len += len;
+
+	return offset;
+}
+
+/**
+ * Walks the conversions of \p fmt alongside \p names, turning the named
+ * arguments into fields.  Only the conversions the decoders use are
+ * handled: flags, width and precision, and d, i, u, x, X, f and s.
+ */
+static void
+record_dword(struct drm_intel_decode *ctx, unsigned int index,
+	     const char *const *names, const char *fmt, va_list va)
+{
+	const char *p;
+
+	if (!names)
+		return;
+
+	for (p = strchr(fmt, '%'); p && *names; p = strchr(p, '%')) {
+		struct drm_intel_decode_field field;
+		const char *name;
+		const char *str;
+
+		p++;
+		if (*p == '%') {
+			p++;
+			continue;
+		}
+		p += strspn(p, "-#0 +.0123456789");
+
+		name = *names++;
+		field.index = index;
+		field.name = name[0] == '?' || name[0] == '!' ? name + 1 : name;
+
+		switch (*p++) {
+		case 'd':
+		case 'i':
+			field.type = DRM_INTEL_DECODE_FIELD_INT;
+			field.value.i = va_arg(va, int);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+			field.type = DRM_INTEL_DECODE_FIELD_UINT;
+			field.value.u = va_arg(va, unsigned int);
+			break;
+		case 'f':
+			field.type = DRM_INTEL_DECODE_FIELD_FLOAT;
+			field.value.f = va_arg(va, double);
+			break;
+		case 's':
+			str = va_arg(va, const char *);
+			if (name[0] == '?' || name[0] == '!') {
+				field.type = DRM_INTEL_DECODE_FIELD_UINT;
+				field.value.u = (str[0] != '\0') ^ (name[0] == '!');
+			} else if (strncmp(p, "able", 4) == 0) {
+				/* "%sabled" with "en" or "dis" */
+				field.type = DRM_INTEL_DECODE_FIELD_UINT;
+				field.value.u = str[0] == 'e';
+			} else if (name[0]) {
+				ssize_t offset = record_add_string(ctx, str);
+
+				if (offset < 0)
+					continue;
+				field.type = DRM_INTEL_DECODE_FIELD_STRING;
+				field.value.u = offset;
+			}
+			break;
+		default:
+			/* Can't tell how to step over the argument, so the
+			 * rest of the DWORD goes in as it is.
+			 */
+			field.type = DRM_INTEL_DECODE_FIELD_UINT;
+			field.value.u = ctx->data[index];
+			if (!name[0])
+				name = field.name = "dword";
+			names = NULL;
+			break;
+		}
+
+		if (name[0]) {
+			struct drm_intel_decode_field *f = record_add_field(ctx);
+
+			if (f)
+				*f = field;
+		}
+		if (!names)
+			return;
+	}
+}
+
+static void
+record_end(struct drm_intel_decode *ctx, uint32_t count)
+{
+	struct drm_intel_decode_packet *packet = &ctx->packet;
+	uint32_t header = ctx->data[0];
+	unsigned int i;
+
+	packet->offset = ctx->hw_offset;
+	packet->header = header;
+	switch (header >> 29) {
+	case 0x0:
+		packet->opcode = (header & 0x1f800000) >> 23;
+		break;
+	case 0x2:
+		packet->opcode = (header & 0x1fc00000) >> 22;
+		break;
+	case 0x3:
+		if (ctx->gen >= 4)
+			packet->opcode = header >> 16;
+		else
+			packet->opcode = (header & 0x1f000000) >> 24;
+		break;
+	default:
+		packet->opcode = header >> 29;
+		break;
+	}
+	packet->data = ctx->data;
+	packet->count = count;
+	packet->fields = ctx->fields;
+
+	/* ctx->strings is done growing for this packet. */
+	for (i = 0; i < packet->num_fields; i++) {
+		struct drm_intel_decode_field *field = &ctx->fields[i];
+
+		if (field->type == DRM_INTEL_DECODE_FIELD_STRING)
+			field->value.s = ctx->strings + field->value.u;
+	}
+
+	ctx->packet_func(ctx->packet_closure, packet);
+}
+
+static const struct decode_sink record_sink = {
+	.begin = record_begin,
+	.dword = record_dword,
+	.end = record_end,
+};
+
+static void
+decode_update_sinks(struct drm_intel_decode *ctx)
+{
+	ctx->num_sinks = 0;
+	if (ctx->out)
+		ctx->sinks[ctx->num_sinks++] = &text_sink;
+	if (ctx->packet_func)
+		ctx->sinks[ctx->num_sinks++] = &record_sink;
+}
+
+/**
+ * Resolves the packet decoders and opcode tables for ctx->gen once, so
+ * that decoding a packet is a table lookup rather than a walk of the
+ * opcode lists and a chain of device id checks.
+ */
+static void
+decode_build_dispatch(struct drm_intel_decode *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(ctx->decode_type); i++)
+		ctx->decode_type[i] = decode_unknown;
+
+	ctx->decode_type[0x0] = decode_mi;
+	ctx->decode_type[0x2] = decode_2d;
+	if (ctx->gen >= 4)
+		ctx->decode_type[0x3] = decode_3d_965;
+	else if (ctx->gen == 3)
+		ctx->decode_type[0x3] = decode_3d;
+	else
+		ctx->decode_type[0x3] = decode_3d_i830;
+
+	decode_build_index(ctx->index_mi, ARRAY_SIZE(ctx->index_mi),
+			   opcodes_mi, ARRAY_SIZE(opcodes_mi), ctx->gen);
+	decode_build_index(ctx->index_2d, ARRAY_SIZE(ctx->index_2d),
+			   opcodes_2d, ARRAY_SIZE(opcodes_2d), ctx->gen);
+	decode_build_index(ctx->index_3d_1d, ARRAY_SIZE(ctx->index_3d_1d),
+			   opcodes_3d_1d, ARRAY_SIZE(opcodes_3d_1d), ctx->gen);
+	if (ctx->gen == 3)
+		decode_build_index(ctx->index_3d, ARRAY_SIZE(ctx->index_3d),
+				   opcodes_3d, ARRAY_SIZE(opcodes_3d),
+				   ctx->gen);
+	else
+		decode_build_index(ctx->index_3d, ARRAY_SIZE(ctx->index_3d),
+				   opcodes_3d_i830, ARRAY_SIZE(opcodes_3d_i830),
+				   ctx->gen);
+	decode_build_index(ctx->index_3d_965, ARRAY_SIZE(ctx->index_3d_965),
+			   opcodes_3d_965, ARRAY_SIZE(opcodes_3d_965),
+			   ctx->gen);
+}
+
 drm_public struct drm_intel_decode *
 drm_intel_decode_context_alloc(uint32_t devid)
 {
@@ -3820,8 +4639,15 @@ drm_intel_decode_context_alloc(uint32_t devid)
 	if (!ctx)
 		return NULL;
 
+	ctx->outbuf = malloc(DECODE_OUTBUF_SIZE);
+	if (!ctx->outbuf) {
+		free(ctx);
+		return NULL;
+	}
+
 	ctx->devid = devid;
 	ctx->out = stdout;
+	decode_update_sinks(ctx);
 
 	if (intel_get_genx(devid, &ctx->gen))
 		;
@@ -3837,17 +4663,32 @@ drm_intel_decode_context_alloc(uint32_t devid)
 		ctx->gen = 4;
 	else if (IS_9XX(devid))
 		ctx->gen = 3;
-	else {
-		assert(IS_GEN2(devid));
+	else if (IS_GEN2(devid))
 		ctx->gen = 2;
+	else {
+		/* Decoding with some other gen's tables would only produce
+		 * plausible looking garbage.
+		 */
+		free(ctx->outbuf);
+		free(ctx);
+		return NULL;
 	}
 
+	decode_build_dispatch(ctx);
+
 	return ctx;
 }
 
 drm_public void
 drm_intel_decode_context_free(struct drm_intel_decode *ctx)
 {
+	if (!ctx)
+		return;
+
+	free(ctx->fields);
+	free(ctx->strings);
+	free(ctx->tail_data);
+	free(ctx->outbuf);
 	free(ctx);
 }
 
@@ -3875,11 +4716,62 @@ drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 	ctx->tail = tail;
 }
 
+/**
+ * Sets where the text output goes.  Defaults to stdout; NULL turns the
+ * text output off, so that nothing gets formatted.
+ */
 drm_public void
 drm_intel_decode_set_output_file(struct drm_intel_decode *ctx,
 				 FILE *output)
 {
 	ctx->out = output;
+	decode_update_sinks(ctx);
+}
+
+/**
+ * Sets a callback to receive a structured record of each decoded packet.
+ *
+ * This can be used alongside the text output, or instead of it by
+ * setting a NULL output file, in which case nothing gets formatted.
+ */
+drm_public void
+drm_intel_decode_set_packet_callback(struct drm_intel_decode *ctx,
+				     drm_intel_decode_packet_func func,
+				     void *closure)
+{
+	ctx->packet_func = func;
+	ctx->packet_closure = closure;
+	decode_update_sinks(ctx);
+}
+
+/**
+ * Moves decoding of the rest of the batchbuffer over to the padded
+ * tail_data copy.
+ */
+static bool
+decode_copy_tail(struct drm_intel_decode *ctx)
+{
+	if (ctx->count > ctx->tail_size) {
+		uint32_t size = ctx->count;
+
+		if (size < DECODE_FIXED_DWORDS * 16)
+			size = DECODE_FIXED_DWORDS * 16;
+
+		free(ctx->tail_data);
+		ctx->tail_data = malloc((size + DECODE_TAIL_PAD_DWORDS) * 4);
+		if (!ctx->tail_data) {
+			ctx->tail_size = 0;
+			return false;
+		}
+		ctx->tail_size = size;
+
+		memset(ctx->tail_data + size, 0xd0,
+		       DECODE_TAIL_PAD_DWORDS * 4);
+	}
+
+	ctx->data = memcpy(ctx->tail_data + ctx->tail_size - ctx->count,
+			   ctx->data, ctx->count * 4);
+	return true;
 }
 
 /**
@@ -3893,80 +4785,67 @@ drm_public void
 drm_intel_decode(struct drm_intel_decode *ctx)
 {
 	int ret;
-	unsigned int index = 0;
-	uint32_t devid;
-	int size;
-	void *temp;
+	unsigned int i, index = 0;
+	bool in_tail = false;
 
 	if (!ctx)
 		return;
 
-	/* Put a scratch page full of obviously undefined data after
-	 * the batchbuffer.  This lets us avoid a bunch of length
-	 * checking in statically sized packets.
-	 */
-	size = ctx->base_count * 4;
-	temp = malloc(size + 4096);
-	memcpy(temp, ctx->base_data, size);
-	memset((char *)temp + size, 0xd0, 4096);
-	ctx->data = temp;
-
+	ctx->data = ctx->base_data;
 	ctx->hw_offset = ctx->base_hw_offset;
 	ctx->count = ctx->base_count;
 
-	devid = ctx->devid;
-	head_offset = ctx->head;
-	tail_offset = ctx->tail;
-	out = ctx->out;
-
-	saved_s2_set = 0;
-	saved_s4_set = 1;
+	ctx->saved_s2_set = false;
+	ctx->saved_s4_set = true;
 
 	while (ctx->count > 0) {
 		index = 0;
 
-		switch ((ctx->data[index] & 0xe0000000) >> 29) {
-		case 0x0:
-			ret = decode_mi(ctx);
+		/* Bounds-check the packet against the caller's buffer.
+		 * If its length field, or a fixed-size decoder, could take
+		 * it past the end, finish up from a padded copy instead.
+		 */
+		if (!in_tail &&
+		    (ctx->data[0] & 0xffff) + 2 + DECODE_FIXED_DWORDS >
+		    ctx->count) {
+			if (!decode_copy_tail(ctx)) {
+				decode_printf(ctx, "ERROR: Out of memory decoding "
+					      "end of batchbuffer\n");
+				break;
+			}
+			in_tail = true;
+		}
 
-			/* If MI_BATCHBUFFER_END happened, then dump
-			 * the rest of the output in case we some day
-			 * want it in debugging, but don't decode it
-			 * since it'll just confuse in the common
-			 * case.
-			 */
-			if (ret == -1) {
-				if (ctx->dump_past_end) {
-					index++;
-				} else {
-					for (index = index + 1; index < ctx->count;
-					     index++) {
-						instr_out(ctx, index, "\n");
-					}
-				}
-			} else
-				index += ret;
-			break;
-		case 0x2:
-			index += decode_2d(ctx);
-			break;
-		case 0x3:
-			if (IS_9XX(devid) && !IS_GEN3(devid)) {
-				index +=
-				    decode_3d_965(ctx);
-			} else if (IS_GEN3(devid)) {
-				index += decode_3d(ctx);
+		ctx->packet.name = "UNKNOWN";
+		for (i = 0; i < ctx->num_sinks; i++) {
+			if (ctx->sinks[i]->begin)
+				ctx->sinks[i]->begin(ctx);
+		}
+
+		ret = ctx->decode_type[ctx->data[0] >> 29](ctx);
+
+		/* If MI_BATCHBUFFER_END happened, then dump the rest of the
+		 * output in case we some day want it in debugging, but
+		 * don't decode it since it'll just confuse in the common
+		 * case.
+		 */
+		if (ret == -1) {
+			if (ctx->dump_past_end) {
+				index++;
 			} else {
-				index +=
-				    decode_3d_i830(ctx);
+				for (index = index + 1; index < ctx->count;
+				     index++) {
+					instr_out(ctx, index, "\n");
+				}
 			}
-			break;
-		default:
-			instr_out(ctx, index, "UNKNOWN\n");
-			index++;
-			break;
+		} else
+			index += ret;
+
+		for (i = 0; i < ctx->num_sinks; i++) {
+			if (ctx->sinks[i]->end)
+				ctx->sinks[i]->end(ctx, index < ctx->count ?
+						   index : ctx->count);
 		}
-		fflush(out);
 
 		if (ctx->count < index)
 			break;
@@ -3976,5 +4855,8 @@ drm_intel_decode(struct drm_intel_decode *ctx)
 		ctx->hw_offset += 4 * index;
 	}
 
-	free(temp);
+	for (i = 0; i < ctx->num_sinks; i++) {
+		if (ctx->sinks[i]->finish)
+			ctx->sinks[i]->finish(ctx);
+	}
 }
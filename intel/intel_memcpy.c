@@ -0,0 +1,184 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Copies in and out of write-combined mappings.
+ *
+ * Reads from WC memory are uncached, so a plain memcpy() stalls on every
+ * load.  SSE4.1's MOVNTDQA streams whole lines through the fill buffers
+ * instead; the data is staged in a small bounce buffer that stays in cache
+ * and then copied out.  Large uploads use non-temporal stores so as not to
+ * evict the caller's working set on the way through.
+ *
+ * The SIMD paths are picked at runtime, and everything falls back to
+ * memcpy() on other CPUs and compilers.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libdrm_macros.h"
+#include "intel_bufmgr.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) || \
+     defined(__clang__))
+#define HAVE_X86_COPY 1
+#include <immintrin.h>
+#endif
+
+/** Below this, non-temporal stores aren't worth the final fence */
+#define NT_STORE_THRESHOLD (16 * 1024)
+
+/** Size of the cached staging buffer for streaming loads */
+#define BOUNCE_SIZE 4096
+
+typedef void (*copy_func)(void *dst, const void *src, size_t n);
+
+static void
+plain_copy(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+static copy_func copy_from_wc = plain_copy;
+static copy_func copy_to_wc = plain_copy;
+static pthread_once_t copy_once = PTHREAD_ONCE_INIT;
+
+#ifdef HAVE_X86_COPY
+__attribute__((target("sse4.1")))
+static void
+stream_load_copy(void *dst, const void *src, size_t n)
+{
+	__m128i bounce[BOUNCE_SIZE / sizeof(__m128i)];
+	const char *s = src;
+	char *d = dst;
+	size_t head = -(uintptr_t) s & 15;
+
+	/* MOVNTDQA wants aligned sources */
+	if (head > n)
+		head = n;
+	memcpy(d, s, head);
+	s += head;
+	d += head;
+	n -= head;
+
+	while (n >= 64) {
+		size_t chunk = n < BOUNCE_SIZE ? n & ~(size_t) 63 : BOUNCE_SIZE;
+		__m128i *src128 = (__m128i *) s;
+		size_t i;
+
+		for (i = 0; i < chunk / 16; i += 4) {
+			__m128i a = _mm_stream_load_si128(src128 + i + 0);
+			__m128i b = _mm_stream_load_si128(src128 + i + 1);
+			__m128i c = _mm_stream_load_si128(src128 + i + 2);
+			__m128i e = _mm_stream_load_si128(src128 + i + 3);
+
+			_mm_store_si128(bounce + i + 0, a);
+			_mm_store_si128(bounce + i + 1, b);
+			_mm_store_si128(bounce + i + 2, c);
+			_mm_store_si128(bounce + i + 3, e);
+		}
+
+		memcpy(d, bounce, chunk);
+		s += chunk;
+		d += chunk;
+		n -= chunk;
+	}
+
+	memcpy(d, s, n);
+}
+
+__attribute__((target("sse2")))
+static void
+stream_store_copy(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+	size_t head;
+
+	if (n < NT_STORE_THRESHOLD) {
+		memcpy(dst, src, n);
+		return;
+	}
+
+	/* MOVNTDQ wants aligned destinations */
+	head = -(uintptr_t) d & 15;
+	memcpy(d, s, head);
+	s += head;
+	d += head;
+	n -= head;
+
+	for (; n >= 64; s += 64, d += 64, n -= 64) {
+		const __m128i *src128 = (const __m128i *) s;
+		__m128i *dst128 = (__m128i *) d;
+		__m128i a = _mm_loadu_si128(src128 + 0);
+		__m128i b = _mm_loadu_si128(src128 + 1);
+		__m128i c = _mm_loadu_si128(src128 + 2);
+		__m128i e = _mm_loadu_si128(src128 + 3);
+
+		_mm_stream_si128(dst128 + 0, a);
+		_mm_stream_si128(dst128 + 1, b);
+		_mm_stream_si128(dst128 + 2, c);
+		_mm_stream_si128(dst128 + 3, e);
+	}
+
+	/* Order the streaming stores before anything that may kick the GPU */
+	_mm_sfence();
+	memcpy(d, s, n);
+}
+#endif
+
+static void
+select_copy_funcs(void)
+{
+#ifdef HAVE_X86_COPY
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.1"))
+		copy_from_wc = stream_load_copy;
+	if (__builtin_cpu_supports("sse2"))
+		copy_to_wc = stream_store_copy;
+#endif
+}
+
+/**
+ * Copies @n bytes from @src, typically a drm_intel_gem_bo_map__wc()
+ * mapping, into ordinary cached memory at @dst.
+ */
+drm_public void
+drm_intel_memcpy_from_wc(void *dst, const void *src, size_t n)
+{
+	pthread_once(&copy_once, select_copy_funcs);
+	copy_from_wc(dst, src, n);
+}
+
+/**
+ * Copies @n bytes from ordinary memory at @src into @dst, typically a
+ * drm_intel_gem_bo_map__wc() mapping, bypassing the CPU caches for large
+ * copies.
+ */
+drm_public void
+drm_intel_memcpy_to_wc(void *dst, const void *src, size_t n)
+{
+	pthread_once(&copy_once, select_copy_funcs);
+	copy_to_wc(dst, src, n);
+}
@@ -23,19 +23,182 @@
  */
 
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
 
 #include "xf86drm.h"
 #include "libdrm_macros.h"
 #include "mm.h"
 
+/*
+ * Free blocks are kept in segregated lists, two-level as in TLSF: the
+ * first level splits sizes into powers of two, and the second splits each
+ * of those linearly into MM_SL_COUNT classes.  A bitmap per level tracks
+ * which lists are non-empty, so that finding a list whose blocks are all
+ * large enough, and freeing, don't depend on the number of blocks.
+ */
+#define MM_SL_LOG2	4
+#define MM_SL_COUNT	(1 << MM_SL_LOG2)
+#define MM_FL_COUNT	(32 - MM_SL_LOG2)
+
+struct mem_heap {
+	/* Sentinel of the address-ordered block list, must be first */
+	struct mem_block head;
+	unsigned int fl_bitmap;
+	unsigned int sl_bitmap[MM_FL_COUNT];
+	struct mem_block *free[MM_FL_COUNT][MM_SL_COUNT];
+};
+
+static int fls_int(unsigned int x)
+{
+	return 32 - __builtin_clz(x);
+}
+
+static void MapSize(int size, int *fl, int *sl)
+{
+	if (size < MM_SL_COUNT) {
+		*fl = 0;
+		*sl = size;
+	} else {
+		int t = fls_int(size) - 1;
+
+		*sl = (size >> (t - MM_SL_LOG2)) ^ MM_SL_COUNT;
+		*fl = t - MM_SL_LOG2 + 1;
+	}
+}
+
+static void InsertFree(struct mem_heap *h, struct mem_block *p)
+{
+	int fl, sl;
+
+	MapSize(p->size, &fl, &sl);
+	p->prev_free = NULL;
+	p->next_free = h->free[fl][sl];
+	if (p->next_free)
+		p->next_free->prev_free = p;
+	h->free[fl][sl] = p;
+
+	h->fl_bitmap |= 1u << fl;
+	h->sl_bitmap[fl] |= 1u << sl;
+}
+
+static void RemoveFree(struct mem_heap *h, struct mem_block *p)
+{
+	int fl, sl;
+
+	MapSize(p->size, &fl, &sl);
+	if (p->next_free)
+		p->next_free->prev_free = p->prev_free;
+	if (p->prev_free)
+		p->prev_free->next_free = p->next_free;
+	else
+		h->free[fl][sl] = p->next_free;
+
+	if (!h->free[fl][sl]) {
+		h->sl_bitmap[fl] &= ~(1u << sl);
+		if (!h->sl_bitmap[fl])
+			h->fl_bitmap &= ~(1u << fl);
+	}
+
+	p->next_free = NULL;
+	p->prev_free = NULL;
+}
+
+static int BlockFits(const struct mem_block *p, int size, int mask,
+		     int startSearch, int *startofs)
+{
+	int ofs = (p->ofs + mask) & ~mask;
+
+	if (ofs < startSearch)
+		ofs = startSearch;
+	*startofs = ofs;
+
+	return ofs + size <= p->ofs + p->size;
+}
+
+/**
+ * Returns the head of the first non-empty list at or above the given
+ * class, or NULL.
+ */
+static struct mem_block *FindClass(const struct mem_heap *h, int fl, int sl)
+{
+	unsigned int bits;
+
+	if (fl >= MM_FL_COUNT)
+		return NULL;
+
+	bits = h->sl_bitmap[fl] & (~0u << sl);
+	if (!bits) {
+		bits = fl + 1 < MM_FL_COUNT ? h->fl_bitmap & (~0u << (fl + 1)) : 0;
+		if (!bits)
+			return NULL;
+		fl = __builtin_ctz(bits);
+		bits = h->sl_bitmap[fl];
+	}
+
+	return h->free[fl][__builtin_ctz(bits)];
+}
+
+static struct mem_block *FindFreeBlock(const struct mem_heap *h, int size,
+				       int mask, int *startofs)
+{
+	struct mem_block *p;
+	int fl, sl, last_fl, last_sl;
+
+	/* Every block in a class above size + mask fits, whatever its
+	 * alignment.  Round up to the next class boundary so that the head
+	 * of the list found is good.
+	 */
+	if (size <= INT_MAX - mask) {
+		int request = size + mask;
+
+		if (request >= MM_SL_COUNT) {
+			int round = (1 << (fls_int(request) - 1 - MM_SL_LOG2)) - 1;
+
+			request = request <= INT_MAX - round ? request + round :
+							       INT_MAX;
+		}
+		MapSize(request, &last_fl, &last_sl);
+
+		p = FindClass(h, last_fl, last_sl);
+		if (p) {
+			BlockFits(p, size, mask, 0, startofs);
+			return p;
+		}
+	} else {
+		last_fl = MM_FL_COUNT;
+		last_sl = 0;
+	}
+
+	/* Near the limit, the classes in between may still hold a block
+	 * that fits.
+	 */
+	MapSize(size, &fl, &sl);
+	while (fl < last_fl || (fl == last_fl && sl < last_sl)) {
+		if (h->sl_bitmap[fl] & (1u << sl)) {
+			for (p = h->free[fl][sl]; p; p = p->next_free) {
+				if (BlockFits(p, size, mask, 0, startofs))
+					return p;
+			}
+		}
+		if (++sl == MM_SL_COUNT) {
+			sl = 0;
+			fl++;
+		}
+	}
+
+	return NULL;
+}
+
 drm_private void mmDumpMemInfo(const struct mem_block *heap)
 {
 	drmMsg("Memory heap %p:\n", (void *)heap);
 	if (heap == 0) {
 		drmMsg("  heap == 0\n");
 	} else {
+		const struct mem_heap *h = (const struct mem_heap *)heap;
 		const struct mem_block *p;
+		int fl, sl;
 
 		for (p = heap->next; p != heap; p = p->next) {
 			drmMsg("  Offset:%08x, Size:%08x, %c%c\n", p->ofs,
@@ -45,10 +208,15 @@ drm_private void mmDumpMemInfo(const struct mem_block *heap)
 
 		drmMsg("\nFree list:\n");
 
-		for (p = heap->next_free; p != heap; p = p->next_free) {
-			drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n", p->ofs,
-			       p->size, p->free ? 'F' : '.',
-			       p->reserved ? 'R' : '.');
+		for (fl = 0; fl < MM_FL_COUNT; fl++) {
+			for (sl = 0; sl < MM_SL_COUNT; sl++) {
+				for (p = h->free[fl][sl]; p; p = p->next_free) {
+					drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n",
+					       p->ofs, p->size,
+					       p->free ? 'F' : '.',
+					       p->reserved ? 'R' : '.');
+				}
+			}
 		}
 
 	}
@@ -57,42 +225,45 @@ drm_private void mmDumpMemInfo(const struct mem_block *heap)
 
 drm_private struct mem_block *mmInit(int ofs, int size)
 {
+	struct mem_heap *h;
 	struct mem_block *heap, *block;
 
 	if (size <= 0)
 		return NULL;
 
-	heap = (struct mem_block *)calloc(1, sizeof(struct mem_block));
-	if (!heap)
+	h = (struct mem_heap *)calloc(1, sizeof(struct mem_heap));
+	if (!h)
 		return NULL;
+	heap = &h->head;
 
 	block = (struct mem_block *)calloc(1, sizeof(struct mem_block));
 	if (!block) {
-		free(heap);
+		free(h);
 		return NULL;
 	}
 
 	heap->next = block;
 	heap->prev = block;
-	heap->next_free = block;
-	heap->prev_free = block;
 
 	block->heap = heap;
 	block->next = heap;
 	block->prev = heap;
-	block->next_free = heap;
-	block->prev_free = heap;
 
 	block->ofs = ofs;
 	block->size = size;
 	block->free = 1;
+	InsertFree(h, block);
 
 	return heap;
 }
 
-static struct mem_block *SliceBlock(struct mem_block *p,
-				    int startofs, int size,
-				    int reserved, int alignment)
+/**
+ * Carves [startofs, startofs + size) out of the free block p, which must
+ * already be off the free lists, and returns it.  The pieces left either
+ * side go back on the free lists.
+ */
+static struct mem_block *SliceBlock(struct mem_heap *h, struct mem_block *p,
+				    int startofs, int size, int reserved)
 {
 	struct mem_block *newblock;
 
@@ -100,8 +271,10 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 	if (startofs > p->ofs) {
 		newblock =
 		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		if (!newblock) {
+			InsertFree(h, p);
 			return NULL;
+		}
 		newblock->ofs = startofs;
 		newblock->size = p->size - (startofs - p->ofs);
 		newblock->free = 1;
@@ -112,12 +285,8 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 		p->next->prev = newblock;
 		p->next = newblock;
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
 		p->size -= newblock->size;
+		InsertFree(h, p);
 		p = newblock;
 	}
 
@@ -125,8 +294,10 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 	if (size < p->size) {
 		newblock =
 		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		if (!newblock) {
+			InsertFree(h, p);
 			return NULL;
+		}
 		newblock->ofs = startofs + size;
 		newblock->size = p->size - size;
 		newblock->free = 1;
@@ -137,25 +308,12 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 		p->next->prev = newblock;
 		p->next = newblock;
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
+		InsertFree(h, newblock);
 		p->size = size;
 	}
 
 	/* p = middle block */
 	p->free = 0;
-
-	/* Remove p from the free list: 
-	 */
-	p->next_free->prev_free = p->prev_free;
-	p->prev_free->next_free = p->next_free;
-
-	p->next_free = 0;
-	p->prev_free = 0;
-
 	p->reserved = reserved;
 	return p;
 }
@@ -163,61 +321,58 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 drm_private struct mem_block *mmAllocMem(struct mem_block *heap, int size,
 					 int align2, int startSearch)
 {
+	struct mem_heap *h = (struct mem_heap *)heap;
 	struct mem_block *p;
-	const int mask = (1 << align2) - 1;
+	int mask;
 	int startofs = 0;
-	int endofs;
 
-	if (!heap || align2 < 0 || size <= 0)
+	if (!heap || align2 < 0 || align2 > 30 || size <= 0)
 		return NULL;
+	mask = (1 << align2) - 1;
 
-	for (p = heap->next_free; p != heap; p = p->next_free) {
-		assert(p->free);
-
-		startofs = (p->ofs + mask) & ~mask;
-		if (startofs < startSearch) {
-			startofs = startSearch;
+	if (startSearch > heap->next->ofs) {
+		/* The size classes know nothing of offsets, so fall back to
+		 * a first-fit walk in address order.
+		 */
+		for (p = heap->next; p != heap; p = p->next) {
+			if (p->free && BlockFits(p, size, mask, startSearch,
+						 &startofs))
+				break;
 		}
-		endofs = startofs + size;
-		if (endofs <= (p->ofs + p->size))
-			break;
+		if (p == heap)
+			return NULL;
+	} else {
+		p = FindFreeBlock(h, size, mask, &startofs);
+		if (!p)
+			return NULL;
 	}
 
-	if (p == heap)
-		return NULL;
-
 	assert(p->free);
-	p = SliceBlock(p, startofs, size, 0, mask + 1);
-
-	return p;
+	RemoveFree(h, p);
+	return SliceBlock(h, p, startofs, size, 0);
 }
 
-static int Join2Blocks(struct mem_block *p)
+/**
+ * Merges p->next into p.  Both must be free and off the free lists.
+ */
+static void Join2Blocks(struct mem_block *p)
 {
-	/* XXX there should be some assertions here */
-
-	/* NOTE: heap->free == 0 */
+	struct mem_block *q = p->next;
 
-	if (p->free && p->next->free) {
-		struct mem_block *q = p->next;
+	assert(p->free && q->free);
+	assert(p->ofs + p->size == q->ofs);
+	p->size += q->size;
 
-		assert(p->ofs + p->size == q->ofs);
-		p->size += q->size;
+	p->next = q->next;
+	q->next->prev = p;
 
-		p->next = q->next;
-		q->next->prev = p;
-
-		q->next_free->prev_free = q->prev_free;
-		q->prev_free->next_free = q->next_free;
-
-		free(q);
-		return 1;
-	}
-	return 0;
+	free(q);
 }
 
 drm_private int mmFreeMem(struct mem_block *b)
 {
+	struct mem_heap *h;
+
 	if (!b)
 		return 0;
 
@@ -230,19 +385,47 @@ drm_private int mmFreeMem(struct mem_block *b)
 		return -1;
 	}
 
+	/* NOTE: heap->free == 0, so the sentinel never joins */
+	h = (struct mem_heap *)b->heap;
 	b->free = 1;
-	b->next_free = b->heap->next_free;
-	b->prev_free = b->heap;
-	b->next_free->prev_free = b;
-	b->prev_free->next_free = b;
 
-	Join2Blocks(b);
-	if (b->prev != b->heap)
-		Join2Blocks(b->prev);
+	if (b->next->free) {
+		RemoveFree(h, b->next);
+		Join2Blocks(b);
+	}
+	if (b->prev->free) {
+		b = b->prev;
+		RemoveFree(h, b);
+		Join2Blocks(b);
+	}
+	InsertFree(h, b);
 
 	return 0;
 }
 
+drm_private void mmFreeInfo(const struct mem_block *heap,
+			    int *free_bytes, int *largest, int *blocks)
+{
+	const struct mem_block *p;
+
+	*free_bytes = 0;
+	*largest = 0;
+	*blocks = 0;
+
+	if (!heap)
+		return;
+
+	for (p = heap->next; p != heap; p = p->next) {
+		if (!p->free)
+			continue;
+
+		*free_bytes += p->size;
+		if (p->size > *largest)
+			*largest = p->size;
+		(*blocks)++;
+	}
+}
+
 drm_private void mmDestroy(struct mem_block *heap)
 {
 	struct mem_block *p;
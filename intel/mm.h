@@ -72,6 +72,16 @@ drm_private extern int mmFreeMem(struct mem_block *b);
  */
 drm_private extern void mmDestroy(struct mem_block *mmInit);
 
+/**
+ * Summarise the free space of the heap
+ * output: free_bytes = total size of the free blocks
+ *         largest = size of the largest free block
+ *         blocks = number of free blocks
+ */
+drm_private extern void mmFreeInfo(const struct mem_block *heap,
+				   int *free_bytes, int *largest,
+				   int *blocks);
+
 /**
  * For debugging purpose.
  */
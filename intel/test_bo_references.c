@@ -0,0 +1,228 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Times drm_intel_bo_references() on a synthetic relocation lattice, where
+ * every BO points at the next two, so that the number of paths from the
+ * root grows as fibonacci(depth).
+ *
+ * Needs an i915 render node; exits with 77 (skip) when there is none.
+ * Built with FAKE_I915, the bufmgr is compiled in with its ioctls going
+ * to a stand-in for the kernel instead, so the test runs anywhere and
+ * also fails if relocations elsewhere make queries redo the whole walk.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "i915_drm.h"
+#include "intel_bufmgr.h"
+
+#define DEFAULT_DEPTH 2048
+#define QUERIES 1000
+#define BATCH_SIZE 16384
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#ifdef FAKE_I915
+/* Just enough of i915 for buffers that are never mapped or executed. The
+ * build renames drmIoctl in this target, so libdrm's own still links.
+ */
+int
+drmIoctl(int fd, unsigned long request, void *arg)
+{
+	static uint32_t handles;
+
+	switch (request) {
+	case DRM_IOCTL_I915_GETPARAM: {
+		drm_i915_getparam_t *gp = arg;
+
+		*gp->value = gp->param == I915_PARAM_CHIPSET_ID ? 0x1912 : 1;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_GET_APERTURE: {
+		struct drm_i915_gem_get_aperture *aperture = arg;
+
+		aperture->aper_size = 1ull << 32;
+		aperture->aper_available_size = aperture->aper_size;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_CREATE: {
+		struct drm_i915_gem_create *create = arg;
+
+		create->handle = ++handles;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_MADVISE: {
+		struct drm_i915_gem_madvise *madv = arg;
+
+		madv->retained = 1;
+		return 0;
+	}
+	case DRM_IOCTL_I915_GEM_BUSY: {
+		struct drm_i915_gem_busy *busy = arg;
+
+		busy->busy = 0;
+		return 0;
+	}
+	default:
+		return 0;
+	}
+}
+#endif
+
+static void
+emit(drm_intel_bo *bo, uint32_t offset, drm_intel_bo *target)
+{
+	if (drm_intel_bo_emit_reloc(bo, offset, target, 0,
+				    I915_GEM_DOMAIN_RENDER, 0)) {
+		fprintf(stderr, "failed to emit relocation\n");
+		exit(1);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	drm_intel_bufmgr *bufmgr;
+	drm_intel_bo **bos, *holder, *unrelated, *extra[QUERIES];
+	double start, negative, positive, interleaved, elsewhere, alternating;
+	int depth = DEFAULT_DEPTH;
+	int fd, i, found = 0;
+
+	if (argc > 1)
+		depth = atoi(argv[1]);
+	if (depth < 3) {
+		fprintf(stderr, "usage: test_bo_references [depth >= 3]\n");
+		return 1;
+	}
+
+#ifdef FAKE_I915
+	fd = -1;
+#else
+	fd = drmOpenWithType("i915", NULL, DRM_NODE_RENDER);
+	if (fd < 0) {
+		fprintf(stderr, "no i915 device, skipping\n");
+		return 77;
+	}
+#endif
+
+	bufmgr = drm_intel_bufmgr_gem_init(fd, BATCH_SIZE);
+	if (bufmgr == NULL) {
+		fprintf(stderr, "failed to create bufmgr, skipping\n");
+		return 77;
+	}
+
+	bos = calloc(depth, sizeof(*bos));
+	for (i = 0; i < depth; i++)
+		bos[i] = drm_intel_bo_alloc(bufmgr, "lattice", 4096, 0);
+
+	/* Build bottom-up, as a BO can't gain relocations once it is a
+	 * relocation target itself.
+	 */
+	for (i = depth - 2; i >= 0; i--) {
+		emit(bos[i], 0, bos[i + 1]);
+		if (i + 2 < depth)
+			emit(bos[i], 4, bos[i + 2]);
+	}
+
+	/* A relocation target that bos[0] does not reach */
+	holder = drm_intel_bo_alloc(bufmgr, "holder", 4096, 0);
+	unrelated = drm_intel_bo_alloc(bufmgr, "unrelated", 4096, 0);
+	emit(holder, 0, unrelated);
+
+	start = get_time();
+	for (i = 0; i < QUERIES; i++)
+		found += drm_intel_bo_references(bos[0], unrelated);
+	negative = get_time() - start;
+
+	start = get_time();
+	for (i = 0; i < QUERIES; i++)
+		found += drm_intel_bo_references(bos[0], bos[depth - 1]);
+	positive = get_time() - start;
+
+	/* The flush-decision pattern: relocations added to the root
+	 * between queries.
+	 */
+	start = get_time();
+	for (i = 0; i < QUERIES; i++) {
+		extra[i] = drm_intel_bo_alloc(bufmgr, "extra", 4096, 0);
+		emit(bos[0], 8 + 4 * i, extra[i]);
+		found += drm_intel_bo_references(bos[0], extra[i]);
+	}
+	interleaved = get_time() - start;
+
+	/* Other batches being built between queries */
+	start = get_time();
+	for (i = 0; i < QUERIES; i++) {
+		emit(holder, 4 + 4 * i, unrelated);
+		found += drm_intel_bo_references(bos[0], bos[depth - 1]);
+	}
+	elsewhere = get_time() - start;
+
+	/* Baseline: every query walks the whole lattice */
+	start = get_time();
+	for (i = 0; i < QUERIES; i++)
+		found += drm_intel_bo_references(bos[i & 1], bos[depth - 1]);
+	alternating = get_time() - start;
+
+	if (found != 4 * QUERIES) {
+		fprintf(stderr, "wrong answers: %d of %d found\n",
+			found, 4 * QUERIES);
+		return 1;
+	}
+
+	printf("depth %d: unreachable %.3f us, reachable %.3f us, "
+	       "after new reloc %.3f us, after reloc elsewhere %.3f us, "
+	       "full walk %.3f us per query\n", depth,
+	       negative * 1e6 / QUERIES, positive * 1e6 / QUERIES,
+	       interleaved * 1e6 / QUERIES, elsewhere * 1e6 / QUERIES,
+	       alternating * 1e6 / QUERIES);
+
+	/* Generous, as the gap is a couple of orders of magnitude */
+	if (elsewhere * 4 > alternating) {
+		fprintf(stderr, "relocations elsewhere defeat the memo\n");
+		return 1;
+	}
+
+	for (i = 0; i < QUERIES; i++)
+		drm_intel_bo_unreference(extra[i]);
+	drm_intel_bo_unreference(unrelated);
+	drm_intel_bo_unreference(holder);
+	for (i = 0; i < depth; i++)
+		drm_intel_bo_unreference(bos[i]);
+	free(bos);
+	drm_intel_bufmgr_destroy(bufmgr);
+	if (fd >= 0)
+		close(fd);
+
+	return 0;
+}
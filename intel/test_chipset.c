@@ -0,0 +1,129 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Checks intel_get_genx() and intel_is_genx() against a linear scan of
+ * i915_pciids.h for every possible device id, and times both the way a
+ * tool probing many devices would use them.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "intel_chipset.h"
+#include "i915_pciids.h"
+
+#undef INTEL_VGA_DEVICE
+#define INTEL_VGA_DEVICE(id, gen) { id, gen }
+
+static const struct {
+	uint16_t device;
+	uint16_t gen;
+} linear_ids[] = {
+	INTEL_ADLP_IDS(12),
+	INTEL_ADLS_IDS(12),
+	INTEL_RKL_IDS(12),
+	INTEL_DG1_IDS(12),
+	INTEL_TGL_12_IDS(12),
+	INTEL_JSL_IDS(11),
+	INTEL_EHL_IDS(11),
+	INTEL_ICL_11_IDS(11),
+	INTEL_CNL_IDS(10),
+	INTEL_CFL_IDS(9),
+	INTEL_GLK_IDS(9),
+	INTEL_KBL_IDS(9),
+	INTEL_BXT_IDS(9),
+	INTEL_SKL_IDS(9),
+};
+
+#define NUM_IDS (sizeof(linear_ids) / sizeof(linear_ids[0]))
+
+static bool
+linear_get_genx(unsigned int devid, int *gen)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_IDS; i++) {
+		if (linear_ids[i].device == devid) {
+			*gen = linear_ids[i].gen;
+			return true;
+		}
+	}
+	return false;
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(void)
+{
+	double start, first, lookup, linear;
+	unsigned int devid, found = 0;
+	int gen, expected, sum = 0;
+
+	/* The first call pays for sorting the table */
+	start = get_time();
+	intel_get_genx(0, NULL);
+	first = get_time() - start;
+
+	for (devid = 0; devid <= UINT16_MAX + 1; devid++) {
+		bool ok = linear_get_genx(devid, &expected);
+
+		gen = -1;
+		if (intel_get_genx(devid, &gen) != ok ||
+		    (ok && gen != expected) ||
+		    (ok && !intel_is_genx(devid, expected)) ||
+		    intel_is_genx(devid, ok ? expected + 1 : 9)) {
+			fprintf(stderr, "mismatch for device 0x%04x\n", devid);
+			return 1;
+		}
+		found += ok;
+	}
+	if (found != NUM_IDS) {
+		fprintf(stderr, "found %u of %u devices\n", found,
+			(unsigned int) NUM_IDS);
+		return 1;
+	}
+
+	start = get_time();
+	for (devid = 0; devid <= UINT16_MAX; devid++)
+		sum += intel_get_genx(devid, &gen) ? gen : 0;
+	lookup = get_time() - start;
+
+	start = get_time();
+	for (devid = 0; devid <= UINT16_MAX; devid++)
+		sum -= linear_get_genx(devid, &gen) ? gen : 0;
+	linear = get_time() - start;
+
+	printf("%u devices, first lookup %.1f us\n", found, first * 1e6);
+	printf("bsearch %.1f ns/lookup, linear %.1f ns/lookup\n",
+	       lookup * 1e9 / (UINT16_MAX + 1), linear * 1e9 / (UINT16_MAX + 1));
+
+	return sum != 0;
+}
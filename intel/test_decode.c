@@ -24,17 +24,22 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <err.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "libdrm_macros.h"
 #include "intel_bufmgr.h"
 #include "intel_chipset.h"
 
 #define HW_OFFSET 0x12300000
+#define BENCH_ITERATIONS 200
 
 static void
 usage(void)
@@ -42,29 +47,55 @@ usage(void)
 	fprintf(stderr, "usage:\n");
 	fprintf(stderr, "  test_decode <batch>\n");
 	fprintf(stderr, "  test_decode <batch> -dump\n");
+	fprintf(stderr, "  test_decode <batch> -fields\n");
+	fprintf(stderr, "  test_decode <batch> -bench [iterations]\n");
+	fprintf(stderr, "  test_decode -batch [-j jobs] [-d devid] "
+		"<batch|directory>...\n");
 	exit(1);
 }
 
-static void
-read_file(const char *filename, void **ptr, size_t *size)
+/* Maps the file, returning -1 with a warning if it can't. */
+static int
+map_file(const char *filename, void **ptr, size_t *size)
 {
 	int fd, ret;
 	struct stat st;
 
 	fd = open(filename, O_RDONLY);
-	if (fd < 0)
-		errx(1, "couldn't open `%s'", filename);
+	if (fd < 0) {
+		warnx("couldn't open `%s'", filename);
+		return -1;
+	}
 
 	ret = fstat(fd, &st);
-	if (ret)
-		errx(1, "couldn't stat `%s'", filename);
+	if (ret) {
+		warnx("couldn't stat `%s'", filename);
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		warnx("`%s' is empty", filename);
+		close(fd);
+		return -1;
+	}
 
 	*size = st.st_size;
 	*ptr = drm_mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
-	if (*ptr == MAP_FAILED)
-		errx(1, "couldn't map `%s'", filename);
-
 	close(fd);
+	if (*ptr == MAP_FAILED) {
+		warnx("couldn't map `%s'", filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+read_file(const char *filename, void **ptr, size_t *size)
+{
+	if (map_file(filename, ptr, size))
+		exit(1);
 }
 
 static void
@@ -82,6 +113,52 @@ dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	drm_intel_decode(ctx);
 }
 
+static void
+print_packet(void *closure, const struct drm_intel_decode_packet *packet)
+{
+	unsigned int i;
+
+	printf("0x%08x: %s (%u dwords)\n", packet->offset, packet->name,
+	       packet->count);
+
+	for (i = 0; i < packet->num_fields; i++) {
+		const struct drm_intel_decode_field *field = &packet->fields[i];
+
+		printf("    [%u] %s = ", field->index, field->name);
+		switch (field->type) {
+		case DRM_INTEL_DECODE_FIELD_INT:
+			printf("%" PRId64 "\n", field->value.i);
+			break;
+		case DRM_INTEL_DECODE_FIELD_UINT:
+			printf("0x%" PRIx64 "\n", field->value.u);
+			break;
+		case DRM_INTEL_DECODE_FIELD_FLOAT:
+			printf("%f\n", field->value.f);
+			break;
+		case DRM_INTEL_DECODE_FIELD_STRING:
+			printf("\"%s\"\n", field->value.s);
+			break;
+		}
+	}
+}
+
+/* Dumps the packet records the callback gets, with the text output off. */
+static void
+dump_fields(struct drm_intel_decode *ctx, const char *batch_filename)
+{
+	void *batch_ptr;
+	size_t batch_size;
+
+	read_file(batch_filename, &batch_ptr, &batch_size);
+
+	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+					   batch_size / 4);
+	drm_intel_decode_set_output_file(ctx, NULL);
+	drm_intel_decode_set_packet_callback(ctx, print_packet, NULL);
+
+	drm_intel_decode(ctx);
+}
+
 static void
 compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 {
@@ -131,7 +208,57 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	free(ptr);
 }
 
-static uint16_t
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Checks the batch against its reference, then times repeated decodes
+ * of it with the output discarded.
+ */
+static void
+bench_batch(struct drm_intel_decode *ctx, const char *batch_filename,
+	    int iterations)
+{
+	FILE *out;
+	void *batch_ptr;
+	size_t batch_size;
+	double start, elapsed;
+	int i;
+
+	compare_batch(ctx, batch_filename);
+
+	read_file(batch_filename, &batch_ptr, &batch_size);
+
+	out = fopen("/dev/null", "w");
+	if (!out)
+		errx(1, "couldn't open /dev/null");
+
+	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+					   batch_size / 4);
+	drm_intel_decode_set_output_file(ctx, out);
+
+	start = get_time();
+	for (i = 0; i < iterations; i++)
+		drm_intel_decode(ctx);
+	elapsed = get_time() - start;
+
+	printf("%s: %d decodes in %.3f s, %.1f us/batch, %.2f MB/s\n",
+	       batch_filename, iterations, elapsed,
+	       elapsed * 1e6 / iterations,
+	       (double)batch_size * iterations / elapsed / (1024 * 1024));
+
+	fclose(out);
+}
+
+/* Returns the device id named by the batch filename, or -1 with a
+ * warning if there isn't one.
+ */
+static int
 infer_devid(const char *batch_filename)
 {
 	struct {
@@ -162,26 +289,355 @@ infer_devid(const char *batch_filename)
 	for (i = 0; chipsets[i].name != NULL; i++) {
 		fprintf(stderr, "  %s\n", chipsets[i].name);
 	}
-	exit(1);
+	return -1;
+}
+
+/* Batch mode: decode many batches (or every *.batch file in the given
+ * directories) across a pool of worker threads.  Each batch is decoded
+ * into its own memory stream, and the results are written out in input
+ * order as the batches complete.
+ */
+struct batch_job {
+	char *filename;
+	uint16_t devid;
+	size_t size;
+
+	char *output;
+	size_t output_size;
+	unsigned long packets;
+	double elapsed;
+	int failed;
+	int done;
+};
+
+struct batch_queue {
+	struct batch_job *jobs;
+	int count;
+	int next;
+	pthread_mutex_t lock;
+	pthread_cond_t done_cond;
+};
+
+static void
+count_packet(void *closure, const struct drm_intel_decode_packet *packet)
+{
+	struct batch_job *job = closure;
+
+	job->packets++;
+}
+
+/* Decodes the job's batch, marking the job failed rather than taking
+ * the whole run down if it can't.
+ *
+ * Only the text decode is timed. The packets are counted in a separate
+ * pass, as collecting their records for the callback is work the
+ * text decode doesn't do.
+ */
+static void
+batch_decode_job(struct drm_intel_decode **ctx, int *ctx_devid,
+		 struct batch_job *job)
+{
+	FILE *out;
+	void *ptr;
+	double start;
+
+	if (job->failed)
+		return;
+
+	if (*ctx_devid != job->devid) {
+		drm_intel_decode_context_free(*ctx);
+		*ctx = drm_intel_decode_context_alloc(job->devid);
+		*ctx_devid = *ctx ? job->devid : -1;
+		if (!*ctx) {
+			warnx("unknown device id 0x%04x for `%s'",
+			      job->devid, job->filename);
+			job->failed = 1;
+			return;
+		}
+	}
+
+	if (map_file(job->filename, &ptr, &job->size)) {
+		job->failed = 1;
+		return;
+	}
+
+#if HAVE_OPEN_MEMSTREAM
+	out = open_memstream(&job->output, &job->output_size);
+#else
+	out = NULL;
+#endif
+	if (!out) {
+		warnx("couldn't open output stream for `%s'", job->filename);
+		drm_munmap(ptr, job->size);
+		job->failed = 1;
+		return;
+	}
+
+	drm_intel_decode_set_batch_pointer(*ctx, ptr, HW_OFFSET,
+					   job->size / 4);
+	drm_intel_decode_set_output_file(*ctx, out);
+	drm_intel_decode_set_packet_callback(*ctx, NULL, NULL);
+
+	start = get_time();
+	drm_intel_decode(*ctx);
+	job->elapsed = get_time() - start;
+
+	drm_intel_decode_set_output_file(*ctx, NULL);
+	drm_intel_decode_set_packet_callback(*ctx, count_packet, job);
+	drm_intel_decode(*ctx);
+	drm_intel_decode_set_packet_callback(*ctx, NULL, NULL);
+
+	drm_munmap(ptr, job->size);
+	fclose(out);
+}
+
+static void *
+batch_worker(void *arg)
+{
+	struct batch_queue *queue = arg;
+	struct drm_intel_decode *ctx = NULL;
+	int ctx_devid = -1;
+
+	for (;;) {
+		struct batch_job *job;
+
+		pthread_mutex_lock(&queue->lock);
+		if (queue->next == queue->count) {
+			pthread_mutex_unlock(&queue->lock);
+			break;
+		}
+		job = &queue->jobs[queue->next++];
+		pthread_mutex_unlock(&queue->lock);
+
+		batch_decode_job(&ctx, &ctx_devid, job);
+
+		pthread_mutex_lock(&queue->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&queue->done_cond);
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	drm_intel_decode_context_free(ctx);
+
+	return NULL;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void
+batch_add_job(struct batch_queue *queue, int *size, const char *filename,
+	      int devid)
+{
+	struct batch_job *job;
+
+	if (devid < 0)
+		devid = infer_devid(filename);
+
+	if (queue->count == *size) {
+		*size = *size ? *size * 2 : 64;
+		queue->jobs = realloc(queue->jobs,
+				      *size * sizeof(*queue->jobs));
+		if (!queue->jobs)
+			errx(1, "out of memory");
+	}
+
+	job = &queue->jobs[queue->count++];
+	memset(job, 0, sizeof(*job));
+	job->filename = strdup(filename);
+	/* Reported as failed in order with the others, without decoding */
+	if (devid < 0)
+		job->failed = 1;
+	else
+		job->devid = devid;
+}
+
+/* Adds each *.batch file in the directory, sorted by name. */
+static void
+batch_add_dir(struct batch_queue *queue, int *size, const char *dirname,
+	      int devid)
+{
+	const char *suffix = ".batch";
+	struct dirent *entry;
+	char **names = NULL;
+	int count = 0, i;
+	DIR *dir;
+
+	dir = opendir(dirname);
+	if (!dir)
+		errx(1, "couldn't open directory `%s'", dirname);
+
+	while ((entry = readdir(dir)) != NULL) {
+		size_t len = strlen(entry->d_name);
+
+		if (len <= strlen(suffix) ||
+		    strcmp(entry->d_name + len - strlen(suffix), suffix) != 0)
+			continue;
+
+		names = realloc(names, (count + 1) * sizeof(*names));
+		if (!names)
+			errx(1, "out of memory");
+		if (asprintf(&names[count++], "%s/%s", dirname,
+			     entry->d_name) < 0)
+			errx(1, "out of memory");
+	}
+	closedir(dir);
+
+	qsort(names, count, sizeof(*names), compare_names);
+	for (i = 0; i < count; i++) {
+		batch_add_job(queue, size, names[i], devid);
+		free(names[i]);
+	}
+	free(names);
+}
+
+static int
+batch_main(int argc, char **argv)
+{
+	struct batch_queue queue;
+	pthread_t *threads;
+	size_t total_size = 0;
+	unsigned long total_packets = 0;
+	double start, elapsed;
+	int size = 0, jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int devid = -1, failed = 0;
+	int i;
+
+	memset(&queue, 0, sizeof(queue));
+
+	/* Options first, so that -d applies to every batch wherever it is
+	 * on the command line.
+	 */
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+			devid = strtol(argv[++i], NULL, 0);
+	}
+
+	for (i = 0; i < argc; i++) {
+		struct stat st;
+
+		if ((strcmp(argv[i], "-j") == 0 ||
+		     strcmp(argv[i], "-d") == 0) && i + 1 < argc) {
+			i++;
+		} else if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+			batch_add_dir(&queue, &size, argv[i], devid);
+		} else {
+			batch_add_job(&queue, &size, argv[i], devid);
+		}
+	}
+
+	if (queue.count == 0)
+		usage();
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > queue.count)
+		jobs = queue.count;
+
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.done_cond, NULL);
+
+	threads = calloc(jobs, sizeof(*threads));
+	if (!threads)
+		errx(1, "out of memory");
+
+	start = get_time();
+	for (i = 0; i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, batch_worker, &queue))
+			errx(1, "couldn't create worker thread");
+	}
+
+	/* Write out the results in input order as they complete. */
+	for (i = 0; i < queue.count; i++) {
+		struct batch_job *job = &queue.jobs[i];
+
+		pthread_mutex_lock(&queue.lock);
+		while (!job->done)
+			pthread_cond_wait(&queue.done_cond, &queue.lock);
+		pthread_mutex_unlock(&queue.lock);
+
+		if (job->failed) {
+			fprintf(stderr, "%s: failed\n", job->filename);
+			failed++;
+			free(job->filename);
+			continue;
+		}
+
+		printf("=== %s ===\n", job->filename);
+		fwrite(job->output, 1, job->output_size, stdout);
+
+		fprintf(stderr, "%s: %zu bytes, %lu packets in %.3f ms, "
+			"%.2f MB/s, %.0f packets/s\n",
+			job->filename, job->size, job->packets,
+			job->elapsed * 1e3,
+			job->size / job->elapsed / (1024 * 1024),
+			job->packets / job->elapsed);
+
+		total_size += job->size;
+		total_packets += job->packets;
+		free(job->output);
+		free(job->filename);
+	}
+
+	for (i = 0; i < jobs; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = get_time() - start;
+
+	fflush(stdout);
+	fprintf(stderr, "total: %d batches (%d failed), %zu bytes, %lu "
+		"packets in %.3f s with %d jobs, %.2f MB/s, %.0f packets/s\n",
+		queue.count, failed, total_size, total_packets, elapsed, jobs,
+		total_size / elapsed / (1024 * 1024),
+		total_packets / elapsed);
+
+	free(threads);
+	free(queue.jobs);
+	pthread_cond_destroy(&queue.done_cond);
+	pthread_mutex_destroy(&queue.lock);
+
+	return failed ? 1 : 0;
 }
 
 int
 main(int argc, char **argv)
 {
-	uint16_t devid;
+	int devid;
 	struct drm_intel_decode *ctx;
 
 	if (argc < 2)
 		usage();
 
+	if (strcmp(argv[1], "-batch") == 0)
+		return batch_main(argc - 2, argv + 2);
 
 	devid = infer_devid(argv[1]);
+	if (devid < 0)
+		exit(1);
 
 	ctx = drm_intel_decode_context_alloc(devid);
+	if (!ctx)
+		errx(1, "unknown device id 0x%04x", devid);
+
+	if (argc >= 3 && strcmp(argv[2], "-bench") == 0) {
+		int iterations = BENCH_ITERATIONS;
+
+		if (argc == 4)
+			iterations = atoi(argv[3]);
+		else if (argc > 4)
+			usage();
+		if (iterations <= 0)
+			usage();
 
-	if (argc == 3) {
+		bench_batch(ctx, argv[1], iterations);
+	} else if (argc == 3) {
 		if (strcmp(argv[2], "-dump") == 0)
 			dump_batch(ctx, argv[1]);
+		else if (strcmp(argv[2], "-fields") == 0)
+			dump_fields(ctx, argv[1]);
 		else
 			usage();
 	} else {
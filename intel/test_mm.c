@@ -0,0 +1,305 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Randomised stress of the mm.c heap, in the pattern of the fake bufmgr:
+ * allocate, and on failure evict random live blocks until the allocation
+ * fits.  The same sequence is run against a plain first-fit list, as
+ * mm.c used to be, to compare speed, evictions and fragmentation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mm.h"
+
+#define HEAP_SIZE	(64 << 20)
+#define MAX_LIVE	4096
+#define DEFAULT_OPS	200000
+
+struct ff_block {
+	struct ff_block *next, *next_free;
+	int ofs, size, free;
+};
+
+struct ff_heap {
+	struct ff_block *blocks, *free_list;
+};
+
+struct stats {
+	double time;
+	unsigned int evictions;
+	unsigned int free_blocks;
+	int largest_free;
+	int total_free;
+};
+
+static uint32_t seed;
+
+static uint32_t
+rand32(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Mostly small buffers, with the odd large texture */
+static void
+random_request(int *size, int *align2)
+{
+	int order = 12 + rand32() % 11;
+
+	if (rand32() % 4)
+		order = 12 + rand32() % 5;
+	*size = (1 << order) + (rand32() % (1 << order) & ~4095);
+	*align2 = rand32() % 8 ? 12 : 12 + rand32() % 5;
+}
+
+static struct ff_block *
+ff_alloc(struct ff_heap *heap, int size, int align2)
+{
+	struct ff_block **link, *p, *rest;
+	int mask = (1 << align2) - 1;
+	int startofs = 0;
+
+	for (link = &heap->free_list; (p = *link); link = &p->next_free) {
+		startofs = (p->ofs + mask) & ~mask;
+		if (startofs + size <= p->ofs + p->size)
+			break;
+	}
+	if (p == NULL)
+		return NULL;
+	*link = p->next_free;
+
+	if (startofs > p->ofs) {
+		rest = calloc(1, sizeof(*rest));
+		rest->ofs = startofs;
+		rest->size = p->size - (startofs - p->ofs);
+		rest->next = p->next;
+		p->next = rest;
+		p->size -= rest->size;
+		p->next_free = heap->free_list;
+		heap->free_list = p;
+		p = rest;
+	}
+	if (size < p->size) {
+		rest = calloc(1, sizeof(*rest));
+		rest->ofs = startofs + size;
+		rest->size = p->size - size;
+		rest->free = 1;
+		rest->next = p->next;
+		p->next = rest;
+		p->size = size;
+		rest->next_free = heap->free_list;
+		heap->free_list = rest;
+	}
+	p->free = 0;
+	return p;
+}
+
+static void
+ff_unlink_free(struct ff_heap *heap, struct ff_block *b)
+{
+	struct ff_block **link;
+
+	for (link = &heap->free_list; *link != b; link = &(*link)->next_free)
+		;
+	*link = b->next_free;
+}
+
+static void
+ff_free(struct ff_heap *heap, struct ff_block *b)
+{
+	struct ff_block *prev = NULL, *p;
+
+	for (p = heap->blocks; p != b; p = p->next)
+		prev = p;
+
+	b->free = 1;
+	if (b->next && b->next->free) {
+		struct ff_block *q = b->next;
+
+		ff_unlink_free(heap, q);
+		b->size += q->size;
+		b->next = q->next;
+		free(q);
+	}
+	if (prev && prev->free) {
+		ff_unlink_free(heap, prev);
+		prev->size += b->size;
+		prev->next = b->next;
+		free(b);
+		b = prev;
+	}
+	b->next_free = heap->free_list;
+	heap->free_list = b;
+}
+
+static int
+run_mm(unsigned int ops, struct stats *st)
+{
+	struct mem_block *heap, *live[MAX_LIVE] = { NULL }, *p;
+	unsigned int i, nlive = 0;
+	int size, align2, end;
+	double start;
+
+	heap = mmInit(0, HEAP_SIZE);
+
+	start = get_time();
+	for (i = 0; i < ops; i++) {
+		if (nlive == MAX_LIVE || (nlive && rand32() % 3 == 0)) {
+			unsigned int j = rand32() % nlive;
+
+			mmFreeMem(live[j]);
+			live[j] = live[--nlive];
+			continue;
+		}
+
+		random_request(&size, &align2);
+		while ((p = mmAllocMem(heap, size, align2, 0)) == NULL) {
+			unsigned int j = rand32() % nlive;
+
+			mmFreeMem(live[j]);
+			live[j] = live[--nlive];
+			st->evictions++;
+		}
+		if (p->ofs & ((1 << align2) - 1))
+			return 1;
+		live[nlive++] = p;
+	}
+	st->time = get_time() - start;
+
+	end = 0;
+	for (p = heap->next; p != heap; p = p->next) {
+		if (p->ofs != end)
+			return 1;
+		end = p->ofs + p->size;
+		if (p->free) {
+			st->free_blocks++;
+			st->total_free += p->size;
+			if (p->size > st->largest_free)
+				st->largest_free = p->size;
+		}
+	}
+	if (end != HEAP_SIZE)
+		return 1;
+
+	mmDestroy(heap);
+	return 0;
+}
+
+static void
+run_first_fit(unsigned int ops, struct stats *st)
+{
+	struct ff_heap heap;
+	struct ff_block *live[MAX_LIVE] = { NULL }, *p;
+	unsigned int i, nlive = 0;
+	int size, align2;
+	double start;
+
+	heap.blocks = calloc(1, sizeof(*heap.blocks));
+	heap.blocks->size = HEAP_SIZE;
+	heap.blocks->free = 1;
+	heap.free_list = heap.blocks;
+
+	start = get_time();
+	for (i = 0; i < ops; i++) {
+		if (nlive == MAX_LIVE || (nlive && rand32() % 3 == 0)) {
+			unsigned int j = rand32() % nlive;
+
+			ff_free(&heap, live[j]);
+			live[j] = live[--nlive];
+			continue;
+		}
+
+		random_request(&size, &align2);
+		while ((p = ff_alloc(&heap, size, align2)) == NULL) {
+			unsigned int j = rand32() % nlive;
+
+			ff_free(&heap, live[j]);
+			live[j] = live[--nlive];
+			st->evictions++;
+		}
+		live[nlive++] = p;
+	}
+	st->time = get_time() - start;
+
+	for (p = heap.blocks; p; p = p->next) {
+		if (p->free) {
+			st->free_blocks++;
+			st->total_free += p->size;
+			if (p->size > st->largest_free)
+				st->largest_free = p->size;
+		}
+	}
+
+	while (heap.blocks) {
+		p = heap.blocks->next;
+		free(heap.blocks);
+		heap.blocks = p;
+	}
+}
+
+static void
+report(const char *name, unsigned int ops, const struct stats *st)
+{
+	printf("%-10s %8.1f ns/op, %6u evictions, %5u free blocks, "
+	       "largest %5.1f%% of free space\n", name,
+	       st->time * 1e9 / ops, st->evictions, st->free_blocks,
+	       st->total_free ? 100.0 * st->largest_free / st->total_free : 100.0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct stats mm = { 0 }, ff = { 0 };
+	unsigned int ops = DEFAULT_OPS;
+
+	if (argc > 1)
+		ops = strtoul(argv[1], NULL, 0);
+
+	seed = 0x9e3779b9;
+	if (run_mm(ops, &mm)) {
+		fprintf(stderr, "mm: heap inconsistent\n");
+		return 1;
+	}
+
+	seed = 0x9e3779b9;
+	run_first_fit(ops, &ff);
+
+	report("mm", ops, &mm);
+	report("first-fit", ops, &ff);
+
+	return 0;
+}
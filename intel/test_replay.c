@@ -0,0 +1,709 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Replays a bufmgr trace, as recorded by drm_intel_bufmgr_start_trace() or
+ * by running an application with INTEL_BUFMGR_TRACE=<file>, and reports
+ * the latency of each kind of operation along with the bufmgr's own
+ * statistics.
+ *
+ * The trace always runs against the fake bufmgr, whose exec and fence
+ * callbacks are stubbed out so that no GPU is needed, and also against the
+ * GEM bufmgr when there is an i915 render node.  Batches sent to real
+ * hardware are replaced by a bare MI_BATCH_BUFFER_END, as their contents
+ * were never recorded.
+ *
+ * Without a trace file, a synthetic frame loop is recorded on the fake
+ * bufmgr first and replayed from that.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "xf86drm.h"
+#include "i915_drm.h"
+#include "intel_bufmgr.h"
+
+#define MI_BATCH_BUFFER_END (0x0a << 23)
+
+#define DEFAULT_APERTURE_MB 256
+#define SYNTHETIC_FRAMES 2000
+
+enum op {
+	OP_ALLOC,
+	OP_ALLOC_RENDER,
+	OP_ALLOC_TILED,
+	OP_IMPORT,
+	OP_REF,
+	OP_UNREF,
+	OP_MAP,
+	OP_UNMAP,
+	OP_SUBDATA,
+	OP_GET_SUBDATA,
+	OP_WAIT,
+	OP_RELOC,
+	OP_RELOC_FENCE,
+	OP_EXEC,
+	OP_CHECK,
+	OP_SET_TILING,
+	OP_COUNT
+};
+
+static const char *op_names[OP_COUNT] = {
+	[OP_ALLOC] = "alloc",
+	[OP_ALLOC_RENDER] = "alloc_render",
+	[OP_ALLOC_TILED] = "alloc_tiled",
+	[OP_IMPORT] = "import",
+	[OP_REF] = "ref",
+	[OP_UNREF] = "unref",
+	[OP_MAP] = "map",
+	[OP_UNMAP] = "unmap",
+	[OP_SUBDATA] = "subdata",
+	[OP_GET_SUBDATA] = "get_subdata",
+	[OP_WAIT] = "wait",
+	[OP_RELOC] = "reloc",
+	[OP_RELOC_FENCE] = "reloc_fence",
+	[OP_EXEC] = "exec",
+	[OP_CHECK] = "check",
+	[OP_SET_TILING] = "set_tiling",
+};
+
+struct op_stats {
+	unsigned long count;
+	unsigned long failed;
+	double total;
+	double max;
+};
+
+struct replay {
+	drm_intel_bufmgr *bufmgr;
+	bool hardware;
+
+	drm_intel_bo **bos;
+	unsigned int *refs;
+	unsigned int num_bos;
+
+	char *scratch;
+	unsigned long scratch_size;
+
+	struct op_stats stats[OP_COUNT];
+	unsigned long skipped;
+};
+
+static uint32_t seed = 0x12345678;
+
+static uint32_t
+rand32(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int
+fake_fence_emit(void *priv)
+{
+	unsigned int *seqno = priv;
+
+	return ++*seqno;
+}
+
+static void
+fake_fence_wait(unsigned int fence, void *priv)
+{
+}
+
+static int
+fake_exec(drm_intel_bo *bo, unsigned int used, void *priv)
+{
+	return 0;
+}
+
+static drm_intel_bufmgr *
+fake_init(unsigned long aperture, void **virt, unsigned int *seqno)
+{
+	drm_intel_bufmgr *bufmgr;
+
+	*virt = malloc(aperture);
+	if (*virt == NULL)
+		return NULL;
+
+	bufmgr = drm_intel_bufmgr_fake_init(-1, 0, *virt, aperture, NULL);
+	if (bufmgr == NULL) {
+		free(*virt);
+		return NULL;
+	}
+
+	drm_intel_bufmgr_fake_set_fence_callback(bufmgr, fake_fence_emit,
+						 fake_fence_wait, seqno);
+	drm_intel_bufmgr_fake_set_exec_callback(bufmgr, fake_exec, NULL);
+	return bufmgr;
+}
+
+/*
+ * A frame loop in the shape of a simple 3D driver: a pool of textures
+ * that changes slowly, and per frame a batch, a vertex buffer and a
+ * state buffer pointing at some of the textures.
+ *
+ * The pool is sized to half again the aperture, so that frames keep
+ * finding their textures evicted, while each frame alone fits easily.
+ */
+static void
+synthetic_workload(drm_intel_bufmgr *bufmgr, unsigned long aperture)
+{
+	drm_intel_bo **textures, *front = NULL;
+	static char vertices[256 << 10];
+	unsigned long texture_bytes = 0;
+	unsigned int num_textures, frame, i;
+
+	/* Mean size of the textures below, with dim from 64 to 1024 */
+	for (i = 0; i < 5; i++)
+		texture_bytes += (64ul << i) * (64ul << i) * 4;
+	texture_bytes /= 5;
+
+	num_textures = aperture / texture_bytes * 3 / 2;
+	if (num_textures < 64)
+		num_textures = 64;
+
+	textures = calloc(num_textures, sizeof(*textures));
+	if (textures == NULL)
+		return;
+
+	for (frame = 0; frame < SYNTHETIC_FRAMES; frame++) {
+		drm_intel_bo *batch, *vbo, *state, *check[3];
+		unsigned int vbo_size = 16384 << (rand32() % 5);
+		uint32_t offset = 0;
+
+		/* Replace textures slowly enough that most are drawn with
+		 * a few times before they go, and so take up aperture.
+		 */
+		for (i = 0; i < num_textures; i++) {
+			uint32_t tiling = I915_TILING_X;
+			unsigned long pitch;
+			int dim;
+
+			if (textures[i] && rand32() % 256)
+				continue;
+
+			drm_intel_bo_unreference(textures[i]);
+			dim = 64 << (rand32() % 5);
+			textures[i] = drm_intel_bo_alloc_tiled(bufmgr, "texture",
+							       dim, dim, 4,
+							       &tiling, &pitch,
+							       0);
+		}
+
+		batch = drm_intel_bo_alloc_for_render(bufmgr, "batch",
+						      16384, 4096);
+		vbo = drm_intel_bo_alloc(bufmgr, "vbo", vbo_size, 4096);
+		state = drm_intel_bo_alloc(bufmgr, "state", 4096, 4096);
+
+		drm_intel_bo_map(vbo, 1);
+		drm_intel_bo_unmap(vbo);
+		drm_intel_bo_subdata(vbo, 0, vbo_size < sizeof(vertices) ?
+				     vbo_size : sizeof(vertices), vertices);
+
+		for (i = 0; i < 8; i++) {
+			drm_intel_bo_emit_reloc(state, 4 * i,
+						textures[rand32() % num_textures], 0,
+						I915_GEM_DOMAIN_SAMPLER, 0);
+		}
+
+		check[0] = batch;
+		check[1] = vbo;
+		check[2] = state;
+		drm_intel_bufmgr_check_aperture_space(check, 3);
+
+		drm_intel_bo_emit_reloc(batch, offset += 8, state, 0,
+					I915_GEM_DOMAIN_INSTRUCTION, 0);
+		drm_intel_bo_emit_reloc(batch, offset += 8, vbo, 0,
+					I915_GEM_DOMAIN_VERTEX, 0);
+		drm_intel_bo_emit_reloc(batch, offset += 8, textures[0], 0,
+					I915_GEM_DOMAIN_RENDER,
+					I915_GEM_DOMAIN_RENDER);
+		drm_intel_bo_mrb_exec(batch, 4096, NULL, 0, 0,
+				      I915_EXEC_RENDER);
+
+		/* The frame stays on screen until the next one replaces it,
+		 * even if its texture slot is reused meanwhile.
+		 */
+		drm_intel_bo_reference(textures[0]);
+		drm_intel_bo_unreference(front);
+		front = textures[0];
+
+		drm_intel_bo_unreference(state);
+		drm_intel_bo_unreference(vbo);
+		drm_intel_bo_unreference(batch);
+
+		if (frame % 100 == 99)
+			drm_intel_bo_wait_rendering(textures[0]);
+	}
+
+	for (i = 0; i < num_textures; i++)
+		drm_intel_bo_unreference(textures[i]);
+	drm_intel_bo_unreference(front);
+	free(textures);
+}
+
+static drm_intel_bo *
+lookup(struct replay *r, unsigned int id)
+{
+	if (id >= r->num_bos)
+		return NULL;
+	return r->bos[id];
+}
+
+static int
+set_bo(struct replay *r, unsigned int id, drm_intel_bo *bo)
+{
+	if (id >= r->num_bos) {
+		unsigned int num = id * 2 + 64;
+		drm_intel_bo **bos;
+		unsigned int *refs;
+
+		bos = realloc(r->bos, num * sizeof(*bos));
+		if (bos == NULL)
+			return -1;
+		r->bos = bos;
+		refs = realloc(r->refs, num * sizeof(*refs));
+		if (refs == NULL)
+			return -1;
+		r->refs = refs;
+		memset(bos + r->num_bos, 0,
+		       (num - r->num_bos) * sizeof(*bos));
+		memset(refs + r->num_bos, 0,
+		       (num - r->num_bos) * sizeof(*refs));
+		r->num_bos = num;
+	}
+
+	/* Trace ids are only reused once the application let go */
+	r->bos[id] = bo;
+	r->refs[id] = bo != NULL;
+	return 0;
+}
+
+static char *
+scratch(struct replay *r, unsigned long size)
+{
+	if (size > r->scratch_size) {
+		char *p = realloc(r->scratch, size);
+
+		if (p == NULL)
+			return NULL;
+		memset(p, 0, size);
+		r->scratch = p;
+		r->scratch_size = size;
+	}
+	return r->scratch;
+}
+
+static void
+account(struct replay *r, enum op op, double start, int failed)
+{
+	double elapsed = get_time() - start;
+	struct op_stats *s = &r->stats[op];
+
+	s->count++;
+	s->total += elapsed;
+	if (elapsed > s->max)
+		s->max = elapsed;
+	if (failed)
+		s->failed++;
+}
+
+static int
+replay_check(struct replay *r, char *args)
+{
+	drm_intel_bo **array;
+	char *tok, *save;
+	int count, n = 0, ret;
+	double start;
+
+	tok = strtok_r(args, " \n", &save);
+	if (tok == NULL)
+		return -1;
+	count = atoi(tok);
+	if (count <= 0)
+		return -1;
+
+	array = calloc(count, sizeof(*array));
+	if (array == NULL)
+		return -1;
+
+	while (n < count && (tok = strtok_r(NULL, " \n", &save)) != NULL) {
+		array[n] = tok[0] == '-' ? NULL : lookup(r, atoi(tok));
+		n++;
+	}
+
+	if (n == count && array[0] != NULL) {
+		start = get_time();
+		ret = drm_intel_bufmgr_check_aperture_space(array, count);
+		account(r, OP_CHECK, start, ret != 0);
+	} else {
+		r->skipped++;
+	}
+
+	free(array);
+	return 0;
+}
+
+static int
+replay_line(struct replay *r, char *line)
+{
+	unsigned long a, b, c, d, e, f;
+	char name[32], *args;
+	drm_intel_bo *bo, *target;
+	enum op op;
+	double start;
+	int ret = 0;
+
+	if (line[0] == '#' || line[0] == '\n')
+		return 0;
+	if (sscanf(line, "%31s", name) != 1)
+		return -1;
+	args = line + strlen(name);
+
+	for (op = 0; op < OP_COUNT; op++) {
+		if (strcmp(name, op_names[op]) == 0)
+			break;
+	}
+
+	switch (op) {
+	case OP_ALLOC:
+	case OP_ALLOC_RENDER:
+	case OP_IMPORT:
+		c = 0;
+		if (sscanf(args, "%lu %lu %lu", &a, &b, &c) < 2)
+			return -1;
+		start = get_time();
+		if (op == OP_ALLOC_RENDER)
+			bo = drm_intel_bo_alloc_for_render(r->bufmgr, "replay",
+							   b, c);
+		else
+			bo = drm_intel_bo_alloc(r->bufmgr, "replay", b, c);
+		account(r, op, start, bo == NULL);
+		return set_bo(r, a, bo);
+
+	case OP_ALLOC_TILED: {
+		uint32_t tiling;
+		unsigned long pitch;
+
+		if (sscanf(args, "%lu %lu %lu %lu %lu %lu",
+			   &a, &b, &c, &d, &e, &f) != 6)
+			return -1;
+		tiling = e;
+		start = get_time();
+		bo = drm_intel_bo_alloc_tiled(r->bufmgr, "replay", b, c, d,
+					      &tiling, &pitch, f);
+		account(r, op, start, bo == NULL);
+		return set_bo(r, a, bo);
+	}
+
+	case OP_CHECK:
+		return replay_check(r, args);
+
+	case OP_COUNT:
+		fprintf(stderr, "unknown operation: %s", line);
+		return -1;
+
+	case OP_REF:
+	case OP_UNREF:
+	case OP_MAP:
+	case OP_UNMAP:
+	case OP_SUBDATA:
+	case OP_GET_SUBDATA:
+	case OP_WAIT:
+	case OP_RELOC:
+	case OP_RELOC_FENCE:
+	case OP_EXEC:
+	case OP_SET_TILING:
+		break;
+	}
+
+	/* Everything else acts on an existing BO */
+	b = c = d = e = f = 0;
+	if (sscanf(args, "%lu %lu %lu %lu %lu %lu", &a, &b, &c, &d, &e,
+		   &f) < 1)
+		return -1;
+	bo = lookup(r, a);
+	if (bo == NULL) {
+		r->skipped++;
+		return 0;
+	}
+
+	start = get_time();
+	switch (op) {
+	case OP_REF:
+		drm_intel_bo_reference(bo);
+		r->refs[a]++;
+		break;
+	case OP_UNREF:
+		drm_intel_bo_unreference(bo);
+		break;
+	case OP_MAP:
+		ret = drm_intel_bo_map(bo, b);
+		break;
+	case OP_UNMAP:
+		ret = drm_intel_bo_unmap(bo);
+		break;
+	case OP_SUBDATA:
+	case OP_GET_SUBDATA: {
+		char *data = scratch(r, c);
+
+		if (data == NULL || b + c > bo->size) {
+			r->skipped++;
+			return 0;
+		}
+		start = get_time();
+		if (op == OP_SUBDATA)
+			ret = drm_intel_bo_subdata(bo, b, c, data);
+		else
+			ret = drm_intel_bo_get_subdata(bo, b, c, data);
+		break;
+	}
+	case OP_WAIT:
+		drm_intel_bo_wait_rendering(bo);
+		break;
+	case OP_RELOC:
+	case OP_RELOC_FENCE:
+		target = lookup(r, c);
+		/* The first two dwords of a hardware batch hold its end */
+		if (target == NULL || (r->hardware && b < 8)) {
+			r->skipped++;
+			return 0;
+		}
+		start = get_time();
+		if (op == OP_RELOC)
+			ret = drm_intel_bo_emit_reloc(bo, b, target, d, e, f);
+		else
+			ret = drm_intel_bo_emit_reloc_fence(bo, b, target,
+							    d, e, f);
+		break;
+	case OP_EXEC:
+		if (r->hardware) {
+			uint32_t end[2] = { MI_BATCH_BUFFER_END, 0 };
+
+			drm_intel_bo_subdata(bo, 0, sizeof(end), end);
+			b = sizeof(end);
+			start = get_time();
+		}
+		ret = drm_intel_bo_mrb_exec(bo, b, NULL, 0, 0, c);
+		break;
+	case OP_SET_TILING: {
+		uint32_t tiling = b;
+
+		ret = drm_intel_bo_set_tiling(bo, &tiling, c);
+		break;
+	}
+	case OP_ALLOC:
+	case OP_ALLOC_RENDER:
+	case OP_ALLOC_TILED:
+	case OP_IMPORT:
+	case OP_CHECK:
+	case OP_COUNT:
+		return -1;
+	}
+	account(r, op, start, ret != 0);
+
+	/* As in the trace, the id is only gone with its last reference */
+	if (op == OP_UNREF && --r->refs[a] == 0)
+		r->bos[a] = NULL;
+
+	return 0;
+}
+
+static int
+replay(struct replay *r, FILE *file)
+{
+	char *line = NULL;
+	size_t len = 0;
+	unsigned int lineno = 0, i;
+	int ret = 0;
+
+	rewind(file);
+	while (getline(&line, &len, file) > 0) {
+		lineno++;
+		if (replay_line(r, line) != 0) {
+			fprintf(stderr, "bad trace line %u: %s", lineno, line);
+			ret = -1;
+			break;
+		}
+	}
+	free(line);
+
+	/* Whatever the application still held when the trace ended */
+	for (i = 0; i < r->num_bos; i++) {
+		while (r->refs[i]--)
+			drm_intel_bo_unreference(r->bos[i]);
+	}
+	free(r->bos);
+	free(r->refs);
+	free(r->scratch);
+
+	return ret;
+}
+
+static void
+report(const char *name, const struct replay *r)
+{
+	double total = 0;
+	enum op op;
+
+	printf("%s:\n", name);
+	printf("  %-12s %9s %7s %12s %12s\n", "op", "count", "failed",
+	       "mean (us)", "max (us)");
+	for (op = 0; op < OP_COUNT; op++) {
+		const struct op_stats *s = &r->stats[op];
+
+		if (s->count == 0)
+			continue;
+		printf("  %-12s %9lu %7lu %12.2f %12.2f\n", op_names[op],
+		       s->count, s->failed, s->total * 1e6 / s->count,
+		       s->max * 1e6);
+		total += s->total;
+	}
+	printf("  total %.3f ms, %lu operations skipped\n", total * 1e3,
+	       r->skipped);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: test_replay [-a aperture-MiB] [-n] [trace]\n"
+		"  -a  size of the fake bufmgr's aperture (default %d)\n"
+		"  -n  don't replay on the GEM bufmgr\n",
+		DEFAULT_APERTURE_MB);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct drm_intel_bufmgr_fake_stats fake_stats;
+	struct drm_intel_bufmgr_gem_cache_stats gem_stats;
+	struct replay r;
+	unsigned long aperture = DEFAULT_APERTURE_MB << 20;
+	unsigned int seqno = 0;
+	bool use_gem = true;
+	FILE *file;
+	void *virt;
+	int fd, opt, ret;
+
+	while ((opt = getopt(argc, argv, "a:n")) != -1) {
+		switch (opt) {
+		case 'a':
+			aperture = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'n':
+			use_gem = false;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		file = fopen(argv[optind], "r");
+		if (file == NULL) {
+			perror(argv[optind]);
+			return 1;
+		}
+	} else {
+		file = tmpfile();
+		if (file == NULL) {
+			perror("tmpfile");
+			return 1;
+		}
+
+		memset(&r, 0, sizeof(r));
+		r.bufmgr = fake_init(aperture, &virt, &seqno);
+		if (r.bufmgr == NULL)
+			return 1;
+		drm_intel_bufmgr_start_trace(r.bufmgr, file);
+		synthetic_workload(r.bufmgr, aperture);
+		drm_intel_bufmgr_destroy(r.bufmgr);
+		free(virt);
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.bufmgr = fake_init(aperture, &virt, &seqno);
+	if (r.bufmgr == NULL)
+		return 1;
+	ret = replay(&r, file);
+	drm_intel_bufmgr_fake_get_stats(r.bufmgr, &fake_stats);
+	drm_intel_bufmgr_destroy(r.bufmgr);
+	free(virt);
+	if (ret)
+		return 1;
+
+	report("fake", &r);
+	printf("  %llu evictions, %llu fence waits, "
+	       "%llu of %llu KiB free in %u blocks, largest %llu KiB\n",
+	       (unsigned long long) fake_stats.evictions,
+	       (unsigned long long) fake_stats.fence_waits,
+	       (unsigned long long) fake_stats.free_bytes >> 10,
+	       (unsigned long long) fake_stats.aperture_size >> 10,
+	       fake_stats.free_blocks,
+	       (unsigned long long) fake_stats.largest_free >> 10);
+
+	fd = use_gem ? drmOpenWithType("i915", NULL, DRM_NODE_RENDER) : -1;
+	if (fd >= 0) {
+		memset(&r, 0, sizeof(r));
+		r.hardware = true;
+		r.bufmgr = drm_intel_bufmgr_gem_init(fd, 4096);
+		if (r.bufmgr) {
+			drm_intel_bufmgr_gem_enable_reuse(r.bufmgr);
+			ret = replay(&r, file);
+			drm_intel_bufmgr_gem_get_cache_stats(r.bufmgr,
+							     &gem_stats);
+			drm_intel_bufmgr_destroy(r.bufmgr);
+			if (ret)
+				return 1;
+
+			report("gem", &r);
+			printf("  BO cache: %llu hits, %llu misses, "
+			       "%llu KiB trimmed\n",
+			       (unsigned long long) gem_stats.hits,
+			       (unsigned long long) gem_stats.misses,
+			       (unsigned long long) gem_stats.trimmed_bytes >> 10);
+		}
+		close(fd);
+	}
+
+	fclose(file);
+	return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/sh
+
+TEST_FILENAME=`echo "$0" | sed 's|-fields\.sh$||'`
+REF_FILENAME="$TEST_FILENAME-fields-ref.txt"
+NEW_FILENAME="$TEST_FILENAME-fields-new.txt"
+
+./test_decode $TEST_FILENAME -fields > $NEW_FILENAME || exit 1
+
+# pretty-print a diff showing what happened, and leave the dump around
+# for possibly moving over the ref.
+if ! cmp -s $REF_FILENAME $NEW_FILENAME; then
+    echo "Differences:"
+    diff -u $REF_FILENAME $NEW_FILENAME
+    exit 1
+fi
+
+rm -f $NEW_FILENAME
+exit 0
@@ -0,0 +1,158 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Lookup of bo handles in the bo table of a submit ioctl, so building up a
+ * submit with many bo's doesn't have to search the table for every reloc.
+ *
+ * The submit's own table (an array of e.g. struct drm_msm_gem_submit_bo)
+ * stays the authority, this only maps handle to index in it.
+ */
+
+#ifndef _UTIL_BO_TABLE_H_
+#define _UTIL_BO_TABLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct util_bo_table {
+	/* maps bo handle to idx + 1 (0 for a free slot), with open
+	 * addressing and linear probing.  Size is a power of two, and kept
+	 * at least twice the number of bo's:
+	 */
+	uint32_t *slots;
+	uint32_t size;
+};
+
+#define __util_bo_handle(bos, stride, offset, idx) \
+	(*(const uint32_t *)((const char *)(bos) + (size_t)(idx) * (stride) + (offset)))
+
+/* find the slot holding handle, or the free slot it would go in: */
+static inline uint32_t *
+__util_bo_table_slot(struct util_bo_table *t, const void *bos,
+		size_t stride, size_t offset, uint32_t handle)
+{
+	uint32_t mask = t->size - 1;
+	uint32_t i = (handle * 0x9e3779b1) & mask;
+
+	for (;; i = (i + 1) & mask) {
+		uint32_t *slot = &t->slots[i];
+
+		if (!*slot || __util_bo_handle(bos, stride, offset, *slot - 1) == handle)
+			return slot;
+	}
+}
+
+static inline void
+__util_bo_table_grow(struct util_bo_table *t, const void *bos,
+		size_t stride, size_t offset, uint32_t nr_bos)
+{
+	uint32_t size = t->size ? t->size * 2 : 64;
+	uint32_t *slots = calloc(size, sizeof(*slots));
+	uint32_t i;
+
+	/* keep going with the old table, if any, while it has room: */
+	if (!slots)
+		return;
+
+	free(t->slots);
+	t->slots = slots;
+	t->size = size;
+
+	for (i = 0; i < nr_bos; i++) {
+		uint32_t handle = __util_bo_handle(bos, stride, offset, i);
+
+		*__util_bo_table_slot(t, bos, stride, offset, handle) = i + 1;
+	}
+}
+
+static inline uint32_t
+__util_bo_table_lookup(struct util_bo_table *t, const void *bos,
+		size_t stride, size_t offset, uint32_t nr_bos, uint32_t handle)
+{
+	uint32_t *slot, idx;
+
+	if (nr_bos * 2 >= t->size)
+		__util_bo_table_grow(t, bos, stride, offset, nr_bos);
+
+	if (nr_bos >= t->size) {
+		/* out of memory for the table, fall back to a search: */
+		for (idx = 0; idx < nr_bos; idx++)
+			if (__util_bo_handle(bos, stride, offset, idx) == handle)
+				return idx;
+		return nr_bos;
+	}
+
+	slot = __util_bo_table_slot(t, bos, stride, offset, handle);
+	if (!*slot)
+		*slot = nr_bos + 1;
+
+	return *slot - 1;
+}
+
+/* Returns the index of handle in bos[0..nr_bos), or nr_bos if it isn't in
+ * there yet, in which case the caller must append it as bos[nr_bos]:
+ */
+#define util_bo_table_lookup(t, bos, nr_bos, h) \
+	__util_bo_table_lookup(t, bos, sizeof(*(bos)), \
+			offsetof(__typeof__(*(bos)), handle), nr_bos, h)
+
+/* forget all handles, for when the submit's table is emptied: */
+static inline void util_bo_table_clear(struct util_bo_table *t)
+{
+	if (t->slots)
+		memset(t->slots, 0, t->size * sizeof(t->slots[0]));
+}
+
+static inline void util_bo_table_fini(struct util_bo_table *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+	t->size = 0;
+}
+
+/*
+ * Per-bo hint of its index in the last submit table it was added to, to
+ * skip even the table lookup when the same bo is added over and over.  It
+ * packs the seqno of the submit in the upper half, and the index in the
+ * lower half.
+ *
+ * The hint may be stale, or have been left by a submit built on another
+ * thread, so callers must check that bos[idx] really is their bo:
+ */
+static inline uint32_t util_bo_hint_get(uint64_t *hint, uint32_t seqno)
+{
+	uint64_t v = __atomic_load_n(hint, __ATOMIC_RELAXED);
+
+	if ((v >> 32) != seqno)
+		return UINT32_MAX;
+
+	return (uint32_t)v;
+}
+
+static inline void util_bo_hint_set(uint64_t *hint, uint32_t seqno, uint32_t idx)
+{
+	__atomic_store_n(hint, ((uint64_t)seqno << 32) | idx, __ATOMIC_RELAXED);
+}
+
+#endif /* _UTIL_BO_TABLE_H_ */